@@ -68,6 +68,14 @@ struct drm_amdgpu_capability;
  */
 #define AMDGPU_QUERY_FENCE_TIMEOUT_IS_ABSOLUTE     (1 << 0)
 
+/**
+ * Sources of amdgpu_sampler_add_device() besides the AMDGPU_INFO_SENSOR_*
+ * sensors: the usage of VRAM, CPU visible VRAM and GTT in bytes.
+ */
+#define AMDGPU_SAMPLER_VRAM_USAGE		0x100
+#define AMDGPU_SAMPLER_VIS_VRAM_USAGE		0x101
+#define AMDGPU_SAMPLER_GTT_USAGE		0x102
+
 /*--------------------------------------------------------------------------*/
 /* ----------------------------- Enums ------------------------------------ */
 /*--------------------------------------------------------------------------*/
@@ -149,6 +157,63 @@ typedef struct amdgpu_semaphore *amdgpu_semaphore_handle;
  */
 typedef uint32_t amdgpu_sem_handle;
 
+/**
+ * Define handle for a slab allocator of small buffers
+ */
+typedef struct amdgpu_bo_slab *amdgpu_bo_slab_handle;
+
+/**
+ * Define handle for a buffer sub-allocated from a slab
+ */
+typedef struct amdgpu_bo_slab_entry *amdgpu_bo_slab_entry_handle;
+
+/**
+ * Define handle for a streaming upload ring
+ */
+typedef struct amdgpu_upload_ring *amdgpu_upload_ring_handle;
+
+/**
+ * Define handle for a cache of userptr registrations
+ */
+typedef struct amdgpu_userptr_cache *amdgpu_userptr_cache_handle;
+
+/**
+ * Define handle for a registration taken from a userptr cache
+ */
+typedef struct amdgpu_userptr_entry *amdgpu_userptr_entry_handle;
+
+/**
+ * Define handle for a pool of direct GMA memory
+ */
+typedef struct amdgpu_dgma_pool *amdgpu_dgma_pool_handle;
+
+/**
+ * Define handle for a scanout capture session
+ */
+typedef struct amdgpu_scanout *amdgpu_scanout_handle;
+
+/**
+ * Define handle for a calibrated GPU clock
+ */
+typedef struct amdgpu_clock *amdgpu_clock_handle;
+
+/**
+ * Define handle for a ring of per-submission GPU timestamps
+ */
+typedef struct amdgpu_timestamp_ring *amdgpu_timestamp_ring_handle;
+
+/**
+ * Define handle for a background sampler of sensors and heap usage
+ */
+typedef struct amdgpu_sampler *amdgpu_sampler_handle;
+
+/**
+ * Called when a sampled value goes over its budget, or back under it
+ */
+typedef void (*amdgpu_sampler_budget_func)(amdgpu_device_handle dev,
+					   uint32_t source, uint64_t value,
+					   bool over, void *data);
+
 
 /*--------------------------------------------------------------------------*/
 /* -------------------------- Structures ---------------------------------- */
@@ -257,6 +322,202 @@ struct amdgpu_bo_import_result {
 	uint64_t alloc_size;
 };
 
+/**
+ * Structure describing a buffer sub-allocated from a slab
+ *
+ * \sa amdgpu_bo_slab_alloc()
+ *
+ */
+struct amdgpu_bo_slab_entry_info {
+	/** Buffer the entry lives in, to be put in BO lists */
+	amdgpu_bo_handle bo;
+
+	/** Offset of the entry in bo */
+	uint64_t offset;
+
+	/** GPU virtual address of the entry */
+	uint64_t va;
+
+	/** CPU address of the entry, NULL for AMDGPU_GEM_CREATE_NO_CPU_ACCESS */
+	void *cpu;
+
+	/** Usable size of the entry, at least the requested size */
+	uint64_t size;
+};
+
+/**
+ * Structure describing an allocation from an upload ring
+ *
+ * \sa amdgpu_upload_ring_alloc()
+ *
+ */
+struct amdgpu_upload_info {
+	/** Buffer the allocation lives in, to be put in BO lists */
+	amdgpu_bo_handle bo;
+
+	/** Offset of the allocation in bo */
+	uint64_t offset;
+
+	/** GPU virtual address of the allocation */
+	uint64_t va;
+
+	/** CPU address of the allocation */
+	void *cpu;
+};
+
+/**
+ * Structure describing user memory taken from a userptr cache
+ *
+ * \sa amdgpu_userptr_cache_get()
+ *
+ */
+struct amdgpu_userptr_info {
+	/** Buffer wrapping the memory, to be put in BO lists */
+	amdgpu_bo_handle bo;
+
+	/** Offset of the memory in bo */
+	uint64_t offset;
+
+	/** GPU virtual address of the memory */
+	uint64_t va;
+};
+
+/**
+ * Structure describing a region allocated from a direct GMA pool
+ *
+ * \sa amdgpu_dgma_pool_alloc()
+ *
+ */
+struct amdgpu_dgma_info {
+	/** Buffer of the pool's aperture, for BO lists and amdgpu_bo_va_op() */
+	amdgpu_bo_handle bo;
+
+	/** Offset of the region in bo */
+	uint64_t offset;
+
+	/** Size of the region, the requested size aligned to 4 KiB */
+	uint64_t size;
+
+	/** Physical address of the region */
+	uint64_t phys_address;
+};
+
+/**
+ * Structure describing the buffer a CRTC scans out
+ *
+ * \sa amdgpu_scanout_get_frame()
+ *
+ */
+struct amdgpu_scanout_frame {
+	/** Buffer of the frame buffer, owned by the session */
+	amdgpu_bo_handle bo;
+
+	/** Size of bo */
+	uint64_t alloc_size;
+
+	/** Frame buffer being scanned out */
+	uint32_t fb_id;
+
+	/** Whether fb_id or the buffer behind it differs from the previous
+	 *  frame */
+	bool new_fb;
+};
+
+/**
+ * Structure describing the placement state of a virtual address range
+ *
+ * \sa amdgpu_va_range_query_stats()
+ *
+ */
+struct amdgpu_va_range_stats {
+	/** Free address space in bytes */
+	uint64_t free;
+
+	/** Size of the largest free block */
+	uint64_t largest_free;
+
+	/** Free address space in whole, aligned PTE fragments */
+	uint64_t fragment_free;
+
+	/** Number of free blocks */
+	uint32_t free_blocks;
+
+	/** PTE fragment size allocations are aligned to, 0 for none */
+	uint64_t fragment_size;
+
+	/** Allocations of at least the fragment size */
+	uint64_t large_allocs;
+
+	/** Those of the large allocations placed on a fragment boundary */
+	uint64_t large_aligned;
+};
+
+/**
+ * Structure describing the calibration of a GPU clock
+ *
+ * \sa amdgpu_clock_query_info()
+ *
+ */
+struct amdgpu_clock_info {
+	/** Frequency the kernel reports for the counter, in Hz */
+	uint64_t nominal_freq;
+
+	/** Frequency fitted to the samples, in Hz */
+	uint64_t freq;
+
+	/** Deviation of freq from nominal_freq in parts per billion */
+	int64_t drift_ppb;
+
+	/** Uncertainty of the last sample, half of its read's duration */
+	uint64_t skew_ns;
+
+	/** Number of samples the fit is over */
+	uint32_t samples;
+};
+
+/**
+ * Structure describing where a submission writes its timestamps
+ *
+ * \sa amdgpu_timestamp_ring_next()
+ *
+ */
+struct amdgpu_timestamp_slot {
+	/** Sequence number to read the timestamps back with */
+	uint64_t seq;
+
+	/** GPU VA of the 64 bit timestamp taken at the start */
+	uint64_t begin_va;
+
+	/** GPU VA of the 64 bit timestamp taken at the end */
+	uint64_t end_va;
+};
+
+/**
+ * Structure describing the samples of a sensor or heap
+ *
+ * \sa amdgpu_sampler_read()
+ *
+ */
+struct amdgpu_sampler_stats {
+	/** Number of samples taken since the device was added */
+	uint64_t count;
+
+	/** CLOCK_MONOTONIC time of the last sample in nanoseconds */
+	uint64_t time_ns;
+
+	/** Value of the last sample */
+	uint64_t last;
+
+	/** Minimum of the last 64 samples */
+	uint64_t min;
+
+	/** Maximum of the last 64 samples */
+	uint64_t max;
+
+	/** Average of the last 64 samples */
+	uint64_t avg;
+};
+
 /**
  *
  * Structure to describe GDS partitioning information.
@@ -689,6 +950,100 @@ int amdgpu_get_fb_id(amdgpu_device_handle dev, unsigned int *fb_id);
 */
 int amdgpu_get_bo_from_fb_id(amdgpu_device_handle dev, unsigned int fb_id, struct amdgpu_bo_import_result *output);
 
+/**
+ * Start capturing what a CRTC scans out.
+ *
+ * The authenticated fd and the CRTC are looked up once, and the buffers of
+ * the frame buffers seen are kept across frames, so that a frame usually
+ * costs looking up the CRTC's frame buffer, or nothing with
+ * amdgpu_scanout_flipped(), and exporting its buffer instead of an import.
+ * Frame buffer ids are reused by the kernel, so a kept buffer is checked
+ * to still be the frame buffer's, and imported again if not, whenever the
+ * CRTC switches to its frame buffer or a flip to it is reported.  Frames
+ * showing the same frame buffer as the previous one aren't checked.
+ *
+ * A session must not be used from several threads at once.
+ *
+ * \param   dev     - \c [in] Device handle.
+ *                    See #amdgpu_device_initialize()
+ * \param   crtc_id - \c [in] CRTC to capture, or 0 for the first one which
+ *                    scans out a frame buffer, like amdgpu_get_fb_id()
+ * \param   scanout - \c [out] Session handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -ENOENT if no CRTC scans out
+ *
+ * \sa amdgpu_scanout_destroy(), amdgpu_scanout_get_frame()
+*/
+int amdgpu_scanout_create(amdgpu_device_handle dev,
+			  uint32_t crtc_id,
+			  amdgpu_scanout_handle *scanout);
+
+/**
+ * Stop a scanout capture and release the buffers it imported.
+ *
+ * \param   scanout - \c [in] Session handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_scanout_create()
+*/
+int amdgpu_scanout_destroy(amdgpu_scanout_handle scanout);
+
+/**
+ * Wait for the next vertical blank of the captured CRTC.
+ *
+ * \param   scanout  - \c [in] Session handle
+ * \param   sequence - \c [out] Vertical blank count, may be NULL
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_scanout_get_frame()
+*/
+int amdgpu_scanout_wait_vblank(amdgpu_scanout_handle scanout,
+			       uint32_t *sequence);
+
+/**
+ * Report a page flip of the captured CRTC.
+ *
+ * Page flip events only go to the client which flipped.  A client which
+ * captures its own output reports its flips from its page flip handler,
+ * after which amdgpu_scanout_get_frame() takes the frame buffer from the
+ * last report instead of querying the CRTC.
+ *
+ * \param   scanout - \c [in] Session handle
+ * \param   fb_id   - \c [in] Frame buffer the CRTC flipped to
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_scanout_get_frame()
+*/
+int amdgpu_scanout_flipped(amdgpu_scanout_handle scanout, uint32_t fb_id);
+
+/**
+ * Get the buffer the captured CRTC scans out.
+ *
+ * A frame buffer is only scanned out once rendering to it finished, so the
+ * buffer is ready to be copied; submissions reading it are synchronized
+ * with later rendering to it by the kernel.  The buffer stays valid until
+ * the session is destroyed, its frame buffer is found to show another
+ * buffer or eight other frame buffers were scanned out since; a reference
+ * of its own can be taken with amdgpu_bo_inc_ref().
+ *
+ * \param   scanout - \c [in] Session handle
+ * \param   frame   - \c [out] Buffer and frame buffer of the frame
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -ENOENT if the CRTC is off
+ *
+ * \sa amdgpu_scanout_wait_vblank(), amdgpu_scanout_flipped()
+*/
+int amdgpu_scanout_get_frame(amdgpu_scanout_handle scanout,
+			     struct amdgpu_scanout_frame *frame);
+
 /**
  * Request GPU access to user allocated memory e.g. via "malloc"
  *
@@ -728,6 +1083,101 @@ int amdgpu_create_bo_from_user_devmem(amdgpu_device_handle dev,
 					void *cpu, uint64_t size,
 					amdgpu_bo_handle *buf_handle);
 
+/**
+ * Create a cache of userptr registrations
+ *
+ * Wrapping user memory with amdgpu_create_bo_from_user_mem() makes the
+ * kernel pin and validate its pages every time.  The cache keeps the
+ * registrations, mapped to the GPU, and hands out the existing one for
+ * memory it contains.
+ *
+ * \param   dev        - \c [in] Device handle.
+ *                       See #amdgpu_device_initialize()
+ * \param   max_pinned - \c [in] Bytes unused registrations may pin before
+ *                       the least recently used ones are dropped, or 0 for
+ *                       the default of 256 MiB
+ * \param   cache      - \c [out] Userptr cache handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_userptr_cache_destroy(), amdgpu_userptr_cache_get()
+*/
+int amdgpu_userptr_cache_create(amdgpu_device_handle dev,
+				uint64_t max_pinned,
+				amdgpu_userptr_cache_handle *cache);
+
+/**
+ * Destroy a cache of userptr registrations
+ *
+ * Registrations which are still in use are released by the last
+ * amdgpu_userptr_cache_put(), which must not run concurrently.
+ *
+ * \param   cache - \c [in] Userptr cache handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_userptr_cache_create()
+*/
+int amdgpu_userptr_cache_destroy(amdgpu_userptr_cache_handle cache);
+
+/**
+ * Get a registration for user memory
+ *
+ * The memory needs no alignment, it is registered with the pages around
+ * it.  A registration containing the memory is reused, otherwise one is
+ * created, which also replaces registrations overlapping it.
+ *
+ * \param   cache - \c [in] Userptr cache handle
+ * \param   cpu   - \c [in] CPU address of the memory
+ * \param   size  - \c [in] Size of the memory
+ * \param   entry - \c [out] Registration handle, to pass to
+ *                  amdgpu_userptr_cache_put()
+ * \param   info  - \c [out] Buffer, offset and GPU address of the memory
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_userptr_cache_put()
+*/
+int amdgpu_userptr_cache_get(amdgpu_userptr_cache_handle cache,
+			     void *cpu, uint64_t size,
+			     amdgpu_userptr_entry_handle *entry,
+			     struct amdgpu_userptr_info *info);
+
+/**
+ * Put back a registration taken with amdgpu_userptr_cache_get()
+ *
+ * The registration stays cached, unless it was invalidated meanwhile.
+ * The kernel keeps its buffer alive for submissions still using it.
+ *
+ * \param   entry - \c [in] Registration handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_userptr_cache_get()
+*/
+int amdgpu_userptr_cache_put(amdgpu_userptr_entry_handle entry);
+
+/**
+ * Drop the registrations of user memory which is unmapped or remapped
+ *
+ * Applies to all userptr caches of the process, so it can be called from
+ * a hook of munmap() and mremap() without knowing them.  Registrations in
+ * use are released by amdgpu_userptr_cache_put().
+ *
+ * \param   cpu  - \c [in] CPU address of the memory
+ * \param   size - \c [in] Size of the memory
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_userptr_cache_get()
+*/
+int amdgpu_userptr_cache_invalidate(void *cpu, uint64_t size);
+
 /**
  * Validate if the user memory comes from BO
  *
@@ -745,129 +1195,459 @@ int amdgpu_create_bo_from_user_devmem(amdgpu_device_handle dev,
  *          <0 - Negative POSIX Error code
  *
 */
-int amdgpu_find_bo_by_cpu_mapping(amdgpu_device_handle dev,
-				  void *cpu,
-				  uint64_t size,
-				  amdgpu_bo_handle *buf_handle,
-				  uint64_t *offset_in_bo);
+int amdgpu_find_bo_by_cpu_mapping(amdgpu_device_handle dev,
+				  void *cpu,
+				  uint64_t size,
+				  amdgpu_bo_handle *buf_handle,
+				  uint64_t *offset_in_bo);
+
+/**
+ * Request GPU access to physical memory from 3rd party device.
+ *
+ * \param dev - [in] Device handle. See #amdgpu_device_initialize()
+ * \param phys_address - [in] Physical address from 3rd party device which
+ * we want to map to GPU address space (make GPU accessible)
+ * (This address must be correctly aligned).
+ * \param size - [in] Size of allocation (must be correctly aligned)
+ * \param buf_handle - [out] Buffer handle for the userptr memory
+ * resource on submission and be used in other operations.
+ *
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note
+ * This call should guarantee that such memory will be persistently
+ * "locked" / make non-pageable. The purpose of this call is to provide
+ * opportunity for GPU get access to this resource during submission.
+ *
+ *
+ * Supported (theoretical) max. size of mapping is restricted only by
+ * capability.direct_gma_size. See #amdgpu_query_capability()
+ *
+ * It is responsibility of caller to correctly specify physical_address
+*/
+int amdgpu_create_bo_from_phys_mem(amdgpu_device_handle dev,
+				uint64_t phys_address, uint64_t size,
+				amdgpu_bo_handle *buf_handle);
+
+/**
+ * Get physical address from BO
+ *
+ * \param buf_handle - [in] Buffer handle for the physical address.
+ * \param phys_address - [out] Physical address of this BO.
+ *
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_bo_get_phys_address(amdgpu_bo_handle buf_handle,
+					uint64_t *phys_address);
+
+/**
+ * Create a pool sub-allocating a range of physical memory.
+ *
+ * The range is imported once, like with amdgpu_create_bo_from_phys_mem(),
+ * and its physical address is queried once, so that allocations from the
+ * pool need no ioctl.
+ *
+ * \param   dev          - \c [in] Device handle.
+ *                         See #amdgpu_device_initialize()
+ * \param   phys_address - \c [in] Physical address of the aperture, 4 KiB
+ *                         aligned
+ * \param   size         - \c [in] Size of the aperture, a multiple of 4 KiB
+ * \param   pool         - \c [out] Pool handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -EINVAL for an empty or
+ *               unaligned aperture
+ *
+ * \sa amdgpu_dgma_pool_destroy(), amdgpu_dgma_pool_alloc()
+*/
+int amdgpu_dgma_pool_create(amdgpu_device_handle dev,
+			    uint64_t phys_address,
+			    uint64_t size,
+			    amdgpu_dgma_pool_handle *pool);
+
+/**
+ * Destroy a direct GMA pool and release its aperture.
+ *
+ * Regions still allocated from the pool become invalid.
+ *
+ * \param   pool - \c [in] Pool handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_dgma_pool_create()
+*/
+int amdgpu_dgma_pool_destroy(amdgpu_dgma_pool_handle pool);
+
+/**
+ * Allocate a region from a direct GMA pool.
+ *
+ * The region is a view of the pool's buffer: it is mapped to the GPU with
+ * amdgpu_bo_va_op() on info->bo at info->offset, and the buffer is what
+ * goes in BO lists.
+ *
+ * \param   pool      - \c [in] Pool handle
+ * \param   size      - \c [in] Size of the region
+ * \param   alignment - \c [in] Alignment of the region's physical address,
+ *                      a power of two, or 0 for 4 KiB
+ * \param   info      - \c [out] Buffer, offset, size and physical address of
+ *                      the region
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -ENOMEM if no range is free
+ *
+ * \sa amdgpu_dgma_pool_free()
+*/
+int amdgpu_dgma_pool_alloc(amdgpu_dgma_pool_handle pool,
+			   uint64_t size,
+			   uint64_t alignment,
+			   struct amdgpu_dgma_info *info);
+
+/**
+ * Return a region to a direct GMA pool.
+ *
+ * GPU mappings of the region must be gone before.
+ *
+ * \param   pool - \c [in] Pool handle
+ * \param   info - \c [in] Region as returned by amdgpu_dgma_pool_alloc()
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_dgma_pool_alloc()
+*/
+int amdgpu_dgma_pool_free(amdgpu_dgma_pool_handle pool,
+			  const struct amdgpu_dgma_info *info);
+
+/**
+ * Free previously allocated memory
+ *
+ * \param   dev	       - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   buf_handle - \c [in]  Buffer handle to free
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \note In the case of memory shared between different applications all
+ *	 resources will be “physically” freed only all such applications
+ *	 will be terminated
+ * \note If is UMD responsibility to ‘free’ buffer only when there is no
+ *	 more GPU access
+ *
+ * \sa amdgpu_bo_set_metadata(), amdgpu_bo_alloc()
+ *
+*/
+int amdgpu_bo_free(amdgpu_bo_handle buf_handle);
+
+/**
+ * Increase the reference count of a buffer object
+ *
+ * \param   bo - \c [in]  Buffer object handle to increase the reference count
+ *
+ * \sa amdgpu_bo_alloc(), amdgpu_bo_free()
+ *
+*/
+void amdgpu_bo_inc_ref(amdgpu_bo_handle bo);
+
+/**
+ * Request CPU access to GPU accessible memory
+ *
+ * \param   buf_handle - \c [in] Buffer handle
+ * \param   cpu        - \c [out] CPU address to be used for access
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_cpu_unmap()
+ *
+*/
+int amdgpu_bo_cpu_map(amdgpu_bo_handle buf_handle, void **cpu);
+
+/**
+ * Release CPU access to GPU memory
+ *
+ * \param   buf_handle  - \c [in] Buffer handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_cpu_map()
+ *
+*/
+int amdgpu_bo_cpu_unmap(amdgpu_bo_handle buf_handle);
+
+/**
+ * Copy data into a buffer through its CPU mapping
+ *
+ * Uses non-temporal stores where the CPU has them, which write whole lines
+ * of write-combined mappings, i.e. USWC system memory and visible VRAM,
+ * instead of partial ones.  Any offset and size are fine.
+ *
+ * \param   buf_handle - \c [in] Buffer handle
+ * \param   offset     - \c [in] Offset in the buffer to copy to
+ * \param   src        - \c [in] Data to copy
+ * \param   size       - \c [in] Number of bytes to copy
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_download(), amdgpu_device_set_copy_threads()
+ *
+*/
+int amdgpu_bo_upload(amdgpu_bo_handle buf_handle, uint64_t offset,
+		     const void *src, uint64_t size);
+
+/**
+ * Copy data out of a buffer through its CPU mapping
+ *
+ * Uses streaming loads where the CPU has them, which are much faster than
+ * plain loads from write-combined mappings.  Any offset and size are fine.
+ *
+ * \param   buf_handle - \c [in] Buffer handle
+ * \param   offset     - \c [in] Offset in the buffer to copy from
+ * \param   dst        - \c [out] Where to copy the data to
+ * \param   size       - \c [in] Number of bytes to copy
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_upload(), amdgpu_device_set_copy_threads()
+ *
+*/
+int amdgpu_bo_download(amdgpu_bo_handle buf_handle, uint64_t offset,
+		       void *dst, uint64_t size);
+
+/**
+ * Set the number of worker threads for large copies
+ *
+ * amdgpu_bo_upload() and amdgpu_bo_download() split copies of 4 MiB and
+ * more between the calling thread and the workers.  There are none by
+ * default.  Copies already in progress finish with the previous workers.
+ *
+ * \param   dev         - \c [in] Device handle.
+ *                        See #amdgpu_device_initialize()
+ * \param   num_threads - \c [in] Number of workers, 0 to stop them
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_upload(), amdgpu_bo_download()
+ *
+*/
+int amdgpu_device_set_copy_threads(amdgpu_device_handle dev,
+				   unsigned num_threads);
+
+/**
+ * Wait until a buffer is not used by the device.
+ *
+ * \param   dev           - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   buf_handle    - \c [in] Buffer handle.
+ * \param   timeout_ns    - Timeout in nanoseconds.
+ * \param   buffer_busy   - 0 if buffer is idle, all GPU access was completed
+ *                            and no GPU access is scheduled.
+ *                          1 GPU access is in fly or scheduled
+ *
+ * \return   0 - on success
+ *          <0 - Negative POSIX Error code
+ */
+int amdgpu_bo_wait_for_idle(amdgpu_bo_handle buf_handle,
+			    uint64_t timeout_ns,
+			    bool *buffer_busy);
+
+/**
+ * Create a slab allocator for small buffers.
+ *
+ * Allocations of up to 4 KiB are carved out of larger buffers, the slabs,
+ * which are mapped to the GPU and the CPU once.  This saves kernel handles,
+ * mappings and BO list entries when many small buffers are used.
+ *
+ * \param   dev        - \c [in] Device handle.
+ *                       See #amdgpu_device_initialize()
+ * \param   slab_size  - \c [in] Size of the slabs, a multiple of 4 KiB and at
+ *                       least 8 KiB, or 0 for the default of 64 KiB
+ * \param   slab       - \c [out] Slab allocator handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_slab_destroy(), amdgpu_bo_slab_alloc()
+*/
+int amdgpu_bo_slab_create(amdgpu_device_handle dev,
+			  uint64_t slab_size,
+			  amdgpu_bo_slab_handle *slab);
 
 /**
- * Request GPU access to physical memory from 3rd party device.
+ * Destroy a slab allocator.
  *
- * \param dev - [in] Device handle. See #amdgpu_device_initialize()
- * \param phys_address - [in] Physical address from 3rd party device which
- * we want to map to GPU address space (make GPU accessible)
- * (This address must be correctly aligned).
- * \param size - [in] Size of allocation (must be correctly aligned)
- * \param buf_handle - [out] Buffer handle for the userptr memory
- * resource on submission and be used in other operations.
+ * All of its buffers are released, including entries which are still
+ * allocated or wait for a fence.
  *
+ * \param   slab - \c [in] Slab allocator handle
  *
  * \return   0 on success\n
  *          <0 - Negative POSIX Error code
  *
- * \note
- * This call should guarantee that such memory will be persistently
- * "locked" / make non-pageable. The purpose of this call is to provide
- * opportunity for GPU get access to this resource during submission.
+ * \sa amdgpu_bo_slab_create()
+*/
+int amdgpu_bo_slab_destroy(amdgpu_bo_slab_handle slab);
+
+/**
+ * Allocate a buffer from a slab allocator.
  *
+ * Entries share a buffer with other entries of the same heap, flags and
+ * power of two size class, and are aligned to their size.  Requests which
+ * are larger than 4 KiB, or use flags which only make sense for a whole
+ * buffer, get a buffer of their own.  Entries can't be exported.
  *
- * Supported (theoretical) max. size of mapping is restricted only by
- * capability.direct_gma_size. See #amdgpu_query_capability()
+ * \param   slab         - \c [in] Slab allocator handle
+ * \param   alloc_buffer - \c [in] Allocation request, as for amdgpu_bo_alloc()
+ * \param   entry        - \c [out] Entry handle, to pass to
+ *                         amdgpu_bo_slab_free()
+ * \param   info         - \c [out] Buffer, offset, GPU and CPU address of
+ *                         the entry
  *
- * It is responsibility of caller to correctly specify physical_address
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_bo_slab_free()
 */
-int amdgpu_create_bo_from_phys_mem(amdgpu_device_handle dev,
-				uint64_t phys_address, uint64_t size,
-				amdgpu_bo_handle *buf_handle);
+int amdgpu_bo_slab_alloc(amdgpu_bo_slab_handle slab,
+			 struct amdgpu_bo_alloc_request *alloc_buffer,
+			 amdgpu_bo_slab_entry_handle *entry,
+			 struct amdgpu_bo_slab_entry_info *info);
 
 /**
- * Get physical address from BO
+ * Free a buffer allocated from a slab allocator.
  *
- * \param buf_handle - [in] Buffer handle for the physical address.
- * \param phys_address - [out] Physical address of this BO.
+ * With a fence, the entry is only reused once the fence signaled, which
+ * is checked when a size class runs out of entries, or by
+ * amdgpu_bo_slab_reclaim().  The fence's context must stay valid until
+ * then.  Entries whose fence can't be queried, e.g. after a GPU reset, are
+ * only released with the allocator.  Without a fence the entry is reused
+ * right away.
  *
+ * \param   entry - \c [in] Entry handle
+ * \param   fence - \c [in] Fence of the last submission using the entry,
+ *                  or NULL
  *
  * \return   0 on success\n
  *          <0 - Negative POSIX Error code
  *
+ * \sa amdgpu_bo_slab_alloc()
 */
-int amdgpu_bo_get_phys_address(amdgpu_bo_handle buf_handle,
-					uint64_t *phys_address);
+int amdgpu_bo_slab_free(amdgpu_bo_slab_entry_handle entry,
+			struct amdgpu_cs_fence *fence);
 
 /**
- * Free previously allocated memory
+ * Reuse entries of a slab allocator whose fences signaled.
  *
- * \param   dev	       - \c [in] Device handle. See #amdgpu_device_initialize()
- * \param   buf_handle - \c [in]  Buffer handle to free
+ * \param   slab - \c [in] Slab allocator handle
  *
  * \return   0 on success\n
  *          <0 - Negative POSIX Error code
  *
- * \note In the case of memory shared between different applications all
- *	 resources will be “physically” freed only all such applications
- *	 will be terminated
- * \note If is UMD responsibility to ‘free’ buffer only when there is no
- *	 more GPU access
- *
- * \sa amdgpu_bo_set_metadata(), amdgpu_bo_alloc()
- *
+ * \sa amdgpu_bo_slab_free()
 */
-int amdgpu_bo_free(amdgpu_bo_handle buf_handle);
+int amdgpu_bo_slab_reclaim(amdgpu_bo_slab_handle slab);
 
 /**
- * Increase the reference count of a buffer object
+ * Create a streaming upload ring.
  *
- * \param   bo - \c [in]  Buffer object handle to increase the reference count
+ * Data the GPU reads once, like vertices, constants or texture uploads, is
+ * written to allocations bumped out of a persistently mapped buffer.  Space
+ * is reused once the fences attached by amdgpu_upload_ring_fence() signaled.
+ * When the GPU still uses too much of the buffer it is replaced by one
+ * twice as large instead of waiting.
  *
- * \sa amdgpu_bo_alloc(), amdgpu_bo_free()
+ * \param   dev   - \c [in] Device handle.
+ *                  See #amdgpu_device_initialize()
+ * \param   size  - \c [in] Initial size of the ring, rounded up to a power
+ *                  of two, or 0 for the default of 1 MiB
+ * \param   heap  - \c [in] AMDGPU_GEM_DOMAIN_* the ring is allocated in
+ * \param   flags - \c [in] AMDGPU_GEM_CREATE_* flags of the ring's buffers,
+ *                  which must be CPU accessible
+ * \param   ring  - \c [out] Upload ring handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
  *
+ * \sa amdgpu_upload_ring_destroy(), amdgpu_upload_ring_alloc()
 */
-void amdgpu_bo_inc_ref(amdgpu_bo_handle bo);
+int amdgpu_upload_ring_create(amdgpu_device_handle dev,
+			      uint64_t size,
+			      uint32_t heap,
+			      uint64_t flags,
+			      amdgpu_upload_ring_handle *ring);
 
 /**
- * Request CPU access to GPU accessible memory
+ * Destroy an upload ring.
  *
- * \param   buf_handle - \c [in] Buffer handle
- * \param   cpu        - \c [out] CPU address to be used for access
+ * All of its buffers are released, including ones the GPU may still use.
+ *
+ * \param   ring - \c [in] Upload ring handle
  *
  * \return   0 on success\n
  *          <0 - Negative POSIX Error code
  *
- * \sa amdgpu_bo_cpu_unmap()
- *
+ * \sa amdgpu_upload_ring_create()
 */
-int amdgpu_bo_cpu_map(amdgpu_bo_handle buf_handle, void **cpu);
+int amdgpu_upload_ring_destroy(amdgpu_upload_ring_handle ring);
 
 /**
- * Release CPU access to GPU memory
+ * Allocate space from an upload ring.
  *
- * \param   buf_handle  - \c [in] Buffer handle
+ * Doesn't take a lock unless the ring has to wrap around or grow, so it
+ * can be called from several threads, as long as what they allocate goes
+ * to the submission fenced next, see amdgpu_upload_ring_fence().  The
+ * buffer of the allocation
+ * changes when the ring grows, and has to be put in the BO list of the
+ * submission using it.
+ *
+ * \param   ring      - \c [in] Upload ring handle
+ * \param   size      - \c [in] Size of the allocation, up to 1 GiB
+ * \param   alignment - \c [in] Alignment of the GPU address, a power of two
+ *                      up to 64 KiB, or 0 for none
+ * \param   info      - \c [out] Buffer, offset, GPU and CPU address of the
+ *                      allocation
  *
  * \return   0 on success\n
  *          <0 - Negative POSIX Error code
  *
- * \sa amdgpu_bo_cpu_map()
- *
+ * \sa amdgpu_upload_ring_fence()
 */
-int amdgpu_bo_cpu_unmap(amdgpu_bo_handle buf_handle);
+int amdgpu_upload_ring_alloc(amdgpu_upload_ring_handle ring,
+			     uint64_t size,
+			     uint32_t alignment,
+			     struct amdgpu_upload_info *info);
 
 /**
- * Wait until a buffer is not used by the device.
+ * Attach a fence to an upload ring.
  *
- * \param   dev           - \c [in] Device handle. See #amdgpu_device_initialize()
- * \param   buf_handle    - \c [in] Buffer handle.
- * \param   timeout_ns    - Timeout in nanoseconds.
- * \param   buffer_busy   - 0 if buffer is idle, all GPU access was completed
- *                            and no GPU access is scheduled.
- *                          1 GPU access is in fly or scheduled
+ * Everything allocated since the previous call is reused once the fence
+ * signaled, which is checked without waiting when the ring runs out of
+ * space.  The fence's context must stay valid until then.
  *
- * \return   0 - on success
- *          <0 - Negative POSIX Error code
- */
-int amdgpu_bo_wait_for_idle(amdgpu_bo_handle buf_handle,
-			    uint64_t timeout_ns,
-			    bool *buffer_busy);
+ * A ring has a single producer: all allocations made before the call must
+ * be used by the fenced submission or earlier ones.  Threads submitting
+ * on their own need a ring each.  Fences must come from one ring of one
+ * context, in submission order.
+ *
+ * \param   ring  - \c [in] Upload ring handle
+ * \param   fence - \c [in] Fence of the submission using the allocations
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -EINVAL for a fence from
+ *               another ring or older than the previous one
+ *
+ * \sa amdgpu_upload_ring_alloc()
+*/
+int amdgpu_upload_ring_fence(amdgpu_upload_ring_handle ring,
+			     struct amdgpu_cs_fence *fence);
 
 /**
  * Creates a BO list handle for command submission.
@@ -1330,6 +2110,287 @@ int amdgpu_query_gds_info(amdgpu_device_handle dev,
 int amdgpu_query_sensor_info(amdgpu_device_handle dev, unsigned sensor_type,
 			     unsigned size, void *value);
 
+/**
+ * Create a mapping of the GPU clock counter to CLOCK_MONOTONIC
+ *
+ * The counter behind AMDGPU_INFO_TIMESTAMP, which is also the one the GPU
+ * writes in fences and timestamp packets, is sampled together with
+ * CLOCK_MONOTONIC.  Each sample takes the read with the smallest skew out
+ * of several, and the mapping is a least squares fit over the recent
+ * samples, so it follows the drift of the counter against the host clock
+ * as long as amdgpu_clock_calibrate() is called every now and then.
+ *
+ * \param   dev   - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   clock - \c [out] Calibrated clock, with one sample taken
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_clock_destroy(), amdgpu_clock_to_host()
+ *
+*/
+int amdgpu_clock_create(amdgpu_device_handle dev, amdgpu_clock_handle *clock);
+
+/**
+ * Destroy a calibrated clock
+ *
+ * Timestamp rings converting with the clock have to be destroyed first.
+ *
+ * \param   clock - \c [in] Clock of amdgpu_clock_create()
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_clock_destroy(amdgpu_clock_handle clock);
+
+/**
+ * Take a new sample of both clocks and refit the mapping
+ *
+ * Older samples are dropped from the fit once there are enough newer
+ * ones.  Calibrating again after tens of milliseconds to seconds keeps the
+ * error of converted timestamps at a few microseconds.
+ *
+ * \param   clock - \c [in] Clock of amdgpu_clock_create()
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_clock_calibrate(amdgpu_clock_handle clock);
+
+/**
+ * Convert a GPU timestamp to CLOCK_MONOTONIC
+ *
+ * \param   clock     - \c [in] Clock of amdgpu_clock_create()
+ * \param   timestamp - \c [in] Value of the GPU clock counter
+ * \param   ns        - \c [out] CLOCK_MONOTONIC time in nanoseconds
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_clock_to_host(amdgpu_clock_handle clock, uint64_t timestamp,
+			 uint64_t *ns);
+
+/**
+ * Query the state of the calibration
+ *
+ * \param   clock - \c [in] Clock of amdgpu_clock_create()
+ * \param   info  - \c [out] Fitted frequency, drift and skew
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_clock_query_info(amdgpu_clock_handle clock,
+			    struct amdgpu_clock_info *info);
+
+/**
+ * Create a ring of per-submission timestamps
+ *
+ * Each submission gets a slot of two 64 bit timestamps, which its IBs
+ * write with the GPU clock counter, e.g. with an end of pipe event at the
+ * end.  A slot is reused once \p slots newer submissions got theirs and
+ * the fence attached with amdgpu_timestamp_ring_fence() signaled.  Slots
+ * without a fence are reused regardless, so without fences the ring must
+ * have more slots than submissions are in flight.
+ *
+ * The ring takes no reference on \p clock, which has to outlive it.
+ *
+ * \param   clock  - \c [in] Clock the timestamps are converted with
+ * \param   bo     - \c [in] Buffer holding the ring, CPU mappable
+ * \param   offset - \c [in] Offset of the ring in \p bo, 8 byte aligned
+ * \param   va     - \c [in] GPU VA \p bo is mapped at
+ * \param   slots  - \c [in] Number of slots, taking 16 bytes each
+ * \param   ring   - \c [out] Timestamp ring
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_timestamp_ring_next(), amdgpu_timestamp_ring_read()
+ *
+*/
+int amdgpu_timestamp_ring_create(amdgpu_clock_handle clock,
+				 amdgpu_bo_handle bo, uint64_t offset,
+				 uint64_t va, uint32_t slots,
+				 amdgpu_timestamp_ring_handle *ring);
+
+/**
+ * Destroy a timestamp ring
+ *
+ * \param   ring - \c [in] Ring of amdgpu_timestamp_ring_create()
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_timestamp_ring_destroy(amdgpu_timestamp_ring_handle ring);
+
+/**
+ * Get the slot of the next submission
+ *
+ * \param   ring - \c [in] Ring of amdgpu_timestamp_ring_create()
+ * \param   slot - \c [out] Sequence number and where to write the
+ *                 timestamps
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -EBUSY if the submission
+ *               which used the slot last is still running
+ *
+ * \sa amdgpu_timestamp_ring_fence()
+ *
+*/
+int amdgpu_timestamp_ring_next(amdgpu_timestamp_ring_handle ring,
+			       struct amdgpu_timestamp_slot *slot);
+
+/**
+ * Attach the fence of a submission to its slot
+ *
+ * The slot is not handed out again before the fence signaled.
+ *
+ * \param   ring  - \c [in] Ring of amdgpu_timestamp_ring_create()
+ * \param   seq   - \c [in] Sequence number of the submission's slot
+ * \param   fence - \c [in] Fence of the submission
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -ENODATA if the slot was
+ *               reused already
+ *
+ * \sa amdgpu_timestamp_ring_next()
+ *
+*/
+int amdgpu_timestamp_ring_fence(amdgpu_timestamp_ring_handle ring,
+				uint64_t seq,
+				struct amdgpu_cs_fence *fence);
+
+/**
+ * Read the timestamps of a submission as CLOCK_MONOTONIC times
+ *
+ * \param   ring     - \c [in] Ring of amdgpu_timestamp_ring_create()
+ * \param   seq      - \c [in] Sequence number of the submission's slot
+ * \param   begin_ns - \c [out] Time the submission started
+ * \param   end_ns   - \c [out] Time the submission ended
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -EAGAIN if the timestamps
+ *               weren't written yet, -ENODATA if the slot was reused
+ *
+*/
+int amdgpu_timestamp_ring_read(amdgpu_timestamp_ring_handle ring,
+			       uint64_t seq, uint64_t *begin_ns,
+			       uint64_t *end_ns);
+
+/**
+ * Create a background sampler of sensors and heap usage
+ *
+ * One thread samples the sources of all devices added to the sampler, every
+ * \p interval_ms.  The heap usages of a device take one query together,
+ * sensors one each.  The statistics of the recent samples can be read at
+ * any time without system calls.
+ *
+ * \param   interval_ms - \c [in] Time between the rounds of samples
+ * \param   sampler     - \c [out] Sampler, without devices
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_sampler_add_device(), amdgpu_sampler_read()
+ *
+*/
+int amdgpu_sampler_create(uint32_t interval_ms,
+			  amdgpu_sampler_handle *sampler);
+
+/**
+ * Stop a sampler, and destroy it with its devices
+ *
+ * \param   sampler - \c [in] Sampler of amdgpu_sampler_create()
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_sampler_destroy(amdgpu_sampler_handle sampler);
+
+/**
+ * Start sampling a device
+ *
+ * The device has to be removed from the sampler before it is
+ * deinitialized.  The first samples are taken in the next round.
+ *
+ * \param   sampler     - \c [in] Sampler of amdgpu_sampler_create()
+ * \param   dev         - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   sources     - \c [in] AMDGPU_INFO_SENSOR_* and AMDGPU_SAMPLER_*
+ * \param   num_sources - \c [in] Number of sources
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -EEXIST if the device is
+ *               sampled already
+ *
+*/
+int amdgpu_sampler_add_device(amdgpu_sampler_handle sampler,
+			      amdgpu_device_handle dev,
+			      const uint32_t *sources,
+			      uint32_t num_sources);
+
+/**
+ * Stop sampling a device
+ *
+ * Waits for a round of samples in progress.
+ *
+ * \param   sampler - \c [in] Sampler of amdgpu_sampler_create()
+ * \param   dev     - \c [in] Device added to the sampler
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_sampler_remove_device(amdgpu_sampler_handle sampler,
+				 amdgpu_device_handle dev);
+
+/**
+ * Read the statistics of a source
+ *
+ * Doesn't wait for the sampler's thread, nor make system calls.
+ *
+ * \param   sampler - \c [in] Sampler of amdgpu_sampler_create()
+ * \param   dev     - \c [in] Device added to the sampler
+ * \param   source  - \c [in] One of the device's sources
+ * \param   stats   - \c [out] Last, minimum, maximum and average value
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -EAGAIN if no sample was
+ *               taken yet
+ *
+*/
+int amdgpu_sampler_read(amdgpu_sampler_handle sampler,
+			amdgpu_device_handle dev, uint32_t source,
+			struct amdgpu_sampler_stats *stats);
+
+/**
+ * Set a budget for a source
+ *
+ * \p func is called from the sampler's thread when a sample is over
+ * \p limit while the previous one wasn't, and when a sample is back at or
+ * under it.  It must not call sampler functions other than
+ * amdgpu_sampler_read().
+ *
+ * \param   sampler - \c [in] Sampler of amdgpu_sampler_create()
+ * \param   dev     - \c [in] Device added to the sampler
+ * \param   source  - \c [in] One of the device's sources
+ * \param   limit   - \c [in] Budget, usually of a heap in bytes
+ * \param   func    - \c [in] Callback, NULL to remove the budget
+ * \param   data    - \c [in] Passed to \p func
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+*/
+int amdgpu_sampler_set_budget(amdgpu_sampler_handle sampler,
+			      amdgpu_device_handle dev, uint32_t source,
+			      uint64_t limit, amdgpu_sampler_budget_func func,
+			      void *data);
+
 /**
  * Query private aperture range
  *
@@ -1466,6 +2527,31 @@ int amdgpu_va_range_query(amdgpu_device_handle dev,
 			  uint64_t *start,
 			  uint64_t *end);
 
+/**
+ * Query how well a virtual address range is placed
+ *
+ * Allocations of at least the PTE fragment size are placed on fragment
+ * boundaries where possible, so that they can be mapped with large
+ * fragments.  This reports how many were, and how fragmented the free
+ * address space is.
+ *
+ * \param   dev   - \c [in] Device handle. See #amdgpu_device_initialize()
+ * \param   type  - \c [in] Type of virtual address range
+ * \param   flags - \c [in] AMDGPU_VA_RANGE_* flags selecting the range, as
+ *                  for amdgpu_va_range_alloc()
+ * \param   stats - \c [out] Placement state of the range
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code
+ *
+ * \sa amdgpu_va_range_alloc()
+ *
+*/
+int amdgpu_va_range_query_stats(amdgpu_device_handle dev,
+				enum amdgpu_gpu_va_range type,
+				uint64_t flags,
+				struct amdgpu_va_range_stats *stats);
+
 /**
  *  VA mapping/unmapping for the buffer object
  *
@@ -2001,6 +3087,37 @@ void amdgpu_cs_chunk_fence_to_dep(struct amdgpu_cs_fence *fence,
 void amdgpu_cs_chunk_fence_info_to_data(struct amdgpu_cs_fence_info *fence_info,
 					struct drm_amdgpu_cs_chunk_data *data);
 
+/**
+ * Start capturing command submissions to a file.
+ *
+ * Buffer allocations, GPU VA mappings, BO lists, contexts and command
+ * submissions made through \p dev are recorded, along with the contents of
+ * the IBs, until amdgpu_cs_capture_stop().  The records are written to the
+ * file by a background thread.  IB contents can only be captured for
+ * buffers mapped to the GPU after the capture was started.  The format is
+ * described in <amdgpu_capture.h>.
+ *
+ * \param   dev  - \c [in] device handle
+ * \param   path - \c [in] file to create or truncate
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, -EBUSY if already capturing
+ *
+ * \sa amdgpu_cs_capture_stop()
+ */
+int amdgpu_cs_capture_start(amdgpu_device_handle dev, const char *path);
+
+/**
+ * Stop capturing, and complete the file with an index of its records.
+ *
+ * \param   dev  - \c [in] device handle
+ *
+ * \return   0 on success\n
+ *          <0 - Negative POSIX Error code, including write errors of the
+ *               background thread
+ */
+int amdgpu_cs_capture_stop(amdgpu_device_handle dev);
+
 /**
  * Reserve VMID
  * \param   context - \c [in]  GPU Context
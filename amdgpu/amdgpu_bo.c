@@ -31,6 +31,7 @@
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include "libdrm_macros.h"
@@ -104,6 +105,8 @@ drm_public int amdgpu_bo_alloc(amdgpu_device_handle dev,
 	pthread_mutex_unlock(&dev->bo_table_mutex);
 	if (r)
 		amdgpu_bo_free(*buf_handle);
+	else if (atomic_read(&dev->capturing))
+		amdgpu_capture_bo_alloc(dev, *buf_handle, alloc_buffer);
 out:
 	return r;
 }
@@ -255,6 +258,66 @@ drm_public int amdgpu_bo_export(amdgpu_bo_handle bo,
 	return -EINVAL;
 }
 
+/* Finds the buffer a dma-buf was imported to before, which are tracked by
+ * the dma-buf's inode as every import of it comes with a new fd.  Must be
+ * called with bo_table_mutex held.
+ */
+static struct amdgpu_bo *amdgpu_bo_find_dma_buf(struct amdgpu_device *dev,
+						const struct stat *st)
+{
+	struct amdgpu_bo *bo;
+	void *value;
+
+	if (!dev->bo_dma_bufs ||
+	    drmHashLookup(dev->bo_dma_bufs, st->st_ino, &value))
+		return NULL;
+
+	bo = value;
+	if (bo->dma_buf_ino != st->st_ino || bo->dma_buf_dev != st->st_dev)
+		return NULL;
+	return bo;
+}
+
+static void amdgpu_bo_untrack_dma_buf(struct amdgpu_device *dev,
+				      struct amdgpu_bo *bo)
+{
+	void *value;
+
+	if (bo->dma_buf_ino &&
+	    !drmHashLookup(dev->bo_dma_bufs, bo->dma_buf_ino, &value) &&
+	    value == bo)
+		drmHashDelete(dev->bo_dma_bufs, bo->dma_buf_ino);
+	bo->dma_buf_ino = 0;
+}
+
+/* A buffer exported again gets a new dma-buf, only the last one is kept. */
+static void amdgpu_bo_track_dma_buf(struct amdgpu_device *dev,
+				    struct amdgpu_bo *bo,
+				    const struct stat *st)
+{
+	void *value;
+
+	if (bo->dma_buf_ino == st->st_ino && bo->dma_buf_dev == st->st_dev)
+		return;
+
+	if (!dev->bo_dma_bufs) {
+		dev->bo_dma_bufs = drmHashCreate();
+		if (!dev->bo_dma_bufs)
+			return;
+	}
+
+	amdgpu_bo_untrack_dma_buf(dev, bo);
+	if (!drmHashLookup(dev->bo_dma_bufs, st->st_ino, &value)) {
+		((struct amdgpu_bo *)value)->dma_buf_ino = 0;
+		drmHashDelete(dev->bo_dma_bufs, st->st_ino);
+	}
+	if (drmHashInsert(dev->bo_dma_bufs, st->st_ino, bo))
+		return;
+
+	bo->dma_buf_ino = st->st_ino;
+	bo->dma_buf_dev = st->st_dev;
+}
+
 drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 				enum amdgpu_bo_handle_type type,
 				uint32_t shared_handle,
@@ -268,6 +331,12 @@ drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 	int r = 0;
 	int dma_fd;
 	uint64_t dma_buf_size = 0;
+	struct stat st;
+	bool dma_buf_stat = false;
+
+	/* Buffers imported from the same dma-buf before need no ioctl. */
+	if (type == amdgpu_bo_handle_type_dma_buf_fd)
+		dma_buf_stat = fstat(shared_handle, &st) == 0;
 
 	/* We must maintain a list of pairs <handle, bo>, so that we always
 	 * return the same amdgpu_bo instance for the same handle. */
@@ -277,6 +346,18 @@ drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 	if (type == amdgpu_bo_handle_type_dma_buf_fd) {
 		off_t size;
 
+		if (dma_buf_stat) {
+			bo = amdgpu_bo_find_dma_buf(dev, &st);
+			if (bo) {
+				atomic_inc(&bo->refcount);
+				pthread_mutex_unlock(&dev->bo_table_mutex);
+
+				output->buf_handle = bo;
+				output->alloc_size = bo->alloc_size;
+				return 0;
+			}
+		}
+
 		/* Get a KMS handle. */
 		r = drmPrimeFDToHandle(dev->fd, shared_handle, &handle);
 		if (r)
@@ -318,6 +399,8 @@ drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 	if (bo) {
 		/* The buffer already exists, just bump the refcount. */
 		atomic_inc(&bo->refcount);
+		if (dma_buf_stat)
+			amdgpu_bo_track_dma_buf(dev, bo, &st);
 		pthread_mutex_unlock(&dev->bo_table_mutex);
 
 		output->buf_handle = bo;
@@ -379,6 +462,8 @@ drm_public int amdgpu_bo_import(amdgpu_device_handle dev,
 			goto remove_handle;
 
 	}
+	if (dma_buf_stat)
+		amdgpu_bo_track_dma_buf(dev, bo, &st);
 
 	output->buf_handle = bo;
 	output->alloc_size = bo->alloc_size;
@@ -410,20 +495,12 @@ drm_public int amdgpu_get_fb_id(amdgpu_device_handle dev, unsigned int *fb_id)
 	int current_id = 0;
 	int r = 0;
 	int i;
-	int flag_auth = 0;
-	int fd = dev->fd;
+	int fd;
 
-	amdgpu_get_auth(dev->fd, &flag_auth);
-	if (flag_auth) {
-		fd = dev->fd;
-	} else {
-		amdgpu_get_auth(dev->flink_fd, &flag_auth);
-		if (flag_auth) {
-			fd = dev->flink_fd;
-		} else {
-			fprintf(stderr, "amdgpu: amdgpu_get_fb_id, couldn't get the auth fd\n");
-			return EINVAL;
-		}
+	fd = amdgpu_get_auth_fd(dev);
+	if (fd < 0) {
+		fprintf(stderr, "amdgpu: amdgpu_get_fb_id, couldn't get the auth fd\n");
+		return EINVAL;
 	}
 
 	mode_res = drmModeGetResources(fd);
@@ -450,6 +527,22 @@ drm_public int amdgpu_get_fb_id(amdgpu_device_handle dev, unsigned int *fb_id)
 
 /* Get the frame buffer's gem object handle by the fb_id. */
 drm_public int amdgpu_get_bo_from_fb_id(amdgpu_device_handle dev, unsigned int fb_id, struct amdgpu_bo_import_result *output)
+{
+	int fd;
+
+	fd = amdgpu_get_auth_fd(dev);
+	if (fd < 0) {
+		fprintf(stderr, "amdgpu: amdgpu_get_bo_from_fb_id, couldn't get the auth fd\n");
+		return EINVAL;
+	}
+
+	return amdgpu_bo_import_fb(dev, fd, fb_id, output);
+}
+
+/* Import the frame buffer's gem object through the authenticated fd. */
+drm_private int amdgpu_bo_import_fb(amdgpu_device_handle dev, int fd,
+				    unsigned int fb_id,
+				    struct amdgpu_bo_import_result *output)
 {
 	drmModeFBPtr fbcur;
 	struct drm_amdgpu_gem_create_in bo_info = {};
@@ -457,21 +550,6 @@ drm_public int amdgpu_get_bo_from_fb_id(amdgpu_device_handle dev, unsigned int f
 	int r = 0;
 	struct amdgpu_bo *bo = NULL;
 	int dma_fd;
-	int flag_auth = 0;
-	int fd = dev->fd;
-
-	amdgpu_get_auth(dev->fd, &flag_auth);
-	if (flag_auth) {
-		fd = dev->fd;
-	} else {
-		amdgpu_get_auth(dev->flink_fd, &flag_auth);
-		if (flag_auth) {
-			fd = dev->flink_fd;
-		} else {
-			fprintf(stderr, "amdgpu: amdgpu_get_bo_from_fb_id, couldn't get the auth fd\n");
-			return EINVAL;
-		}
-	}
 
 	fbcur = drmModeGetFB(fd, fb_id);
 
@@ -603,12 +681,19 @@ drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 {
 	struct amdgpu_device *dev;
 	struct amdgpu_bo *bo = buf_handle;
+	bool capturing;
 
 	assert(bo != NULL);
 	dev = bo->dev;
+	capturing = atomic_read(&dev->capturing);
+	if (capturing)
+		amdgpu_capture_bo_free_prepare(dev);
 	pthread_mutex_lock(&dev->bo_table_mutex);
 
 	if (update_references(&bo->refcount, NULL)) {
+		if (capturing)
+			amdgpu_capture_bo_free(dev, bo);
+
 		/* Remove the buffer from the hash tables. */
 		handle_table_remove(&dev->bo_handles, bo->handle);
 
@@ -616,6 +701,8 @@ drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 			handle_table_remove(&dev->bo_flink_names,
 					    bo->flink_name);
 
+		amdgpu_bo_untrack_dma_buf(dev, bo);
+
 		/* Release CPU access. */
 		if (bo->cpu_map_count > 0) {
 			bo->cpu_map_count = 1;
@@ -628,6 +715,8 @@ drm_public int amdgpu_bo_free(amdgpu_bo_handle buf_handle)
 	}
 
 	pthread_mutex_unlock(&dev->bo_table_mutex);
+	if (capturing)
+		amdgpu_capture_bo_free_finish(dev);
 	return 0;
 }
 
@@ -866,8 +955,13 @@ drm_public int amdgpu_bo_list_create_raw(amdgpu_device_handle dev,
 
 	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_BO_LIST,
 				&args, sizeof(args));
-	if (!r)
+	if (!r) {
 		*result = args.out.list_handle;
+		if (atomic_read(&dev->capturing))
+			amdgpu_capture_bo_list(dev, *result,
+					       AMDGPU_BO_LIST_OP_CREATE,
+					       number_of_buffers, buffers);
+	}
 	return r;
 }
 
@@ -880,6 +974,10 @@ drm_public int amdgpu_bo_list_destroy_raw(amdgpu_device_handle dev,
 	args.in.operation = AMDGPU_BO_LIST_OP_DESTROY;
 	args.in.list_handle = bo_list;
 
+	if (atomic_read(&dev->capturing))
+		amdgpu_capture_bo_list(dev, bo_list, AMDGPU_BO_LIST_OP_DESTROY,
+				       0, NULL);
+
 	return drmCommandWriteRead(dev->fd, DRM_AMDGPU_BO_LIST,
 				   &args, sizeof(args));
 }
@@ -928,6 +1026,10 @@ drm_public int amdgpu_bo_list_create(amdgpu_device_handle dev,
 
 	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_BO_LIST,
 				&args, sizeof(args));
+	if (!r && atomic_read(&dev->capturing))
+		amdgpu_capture_bo_list(dev, args.out.list_handle,
+				       AMDGPU_BO_LIST_OP_CREATE,
+				       number_of_resources, list);
 	free(list);
 	if (r) {
 		free(*result);
@@ -948,6 +1050,10 @@ drm_public int amdgpu_bo_list_destroy(amdgpu_bo_list_handle list)
 	args.in.operation = AMDGPU_BO_LIST_OP_DESTROY;
 	args.in.list_handle = list->handle;
 
+	if (atomic_read(&list->dev->capturing))
+		amdgpu_capture_bo_list(list->dev, list->handle,
+				       AMDGPU_BO_LIST_OP_DESTROY, 0, NULL);
+
 	r = drmCommandWriteRead(list->dev->fd, DRM_AMDGPU_BO_LIST,
 				&args, sizeof(args));
 
@@ -994,6 +1100,10 @@ drm_public int amdgpu_bo_list_update(amdgpu_bo_list_handle handle,
 
 	r = drmCommandWriteRead(handle->dev->fd, DRM_AMDGPU_BO_LIST,
 				&args, sizeof(args));
+	if (!r && atomic_read(&handle->dev->capturing))
+		amdgpu_capture_bo_list(handle->dev, handle->handle,
+				       AMDGPU_BO_LIST_OP_UPDATE,
+				       number_of_resources, list);
 	free(list);
 	return r;
 }
@@ -1039,6 +1149,8 @@ drm_public int amdgpu_bo_va_op_raw(amdgpu_device_handle dev,
 	va.map_size = size;
 
 	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_GEM_VA, &va, sizeof(va));
+	if (!r && atomic_read(&dev->capturing))
+		amdgpu_capture_va_op(dev, bo, offset, size, addr, flags, ops);
 
 	return r;
 }
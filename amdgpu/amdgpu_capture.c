@@ -0,0 +1,761 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Command submission capture.
+ *
+ * While capturing, buffer allocations, GPU VA mappings, BO lists, contexts
+ * and command submissions are serialized into an in-memory ring, under the
+ * capture mutex and in call order.  A writer thread drains the ring to the
+ * file, so the submitting threads only pay for the copies.  IB contents are
+ * found through the GPU VA mappings made while capturing.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_ALLOCA_H
+# include <alloca.h>
+#endif
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "amdgpu_capture.h"
+#include "util_math.h"
+
+/* power of two */
+#define AMDGPU_CAPTURE_RING_SIZE	(4 << 20)
+
+struct amdgpu_capture_va {
+	uint64_t va;
+	uint64_t size;
+	uint64_t offset;
+	amdgpu_bo_handle bo;
+	void *cpu;		/* our own mapping of bo, if any */
+};
+
+struct amdgpu_capture {
+	/** Protects everything below, and serializes the records. */
+	pthread_mutex_t mutex;
+	pthread_cond_t data;	/* a record was queued, or stop */
+	pthread_cond_t space;	/* the writer made room in the ring */
+	pthread_t thread;
+	int fd;
+	bool active;
+	bool stop;
+	int error;
+
+	char *ring;
+	/* file offsets: head is where the next record goes, everything
+	 * before tail has been written to the file */
+	uint64_t head;
+	uint64_t tail;
+	uint64_t record_end;
+	/* the current record is bigger than the ring, and written to the
+	 * file directly */
+	bool direct;
+
+	struct amdgpu_capture_index *index;
+	uint64_t index_count;
+	uint64_t index_size;
+	bool index_failed;
+
+	/** GPU VA mappings, sorted by address */
+	struct amdgpu_capture_va *va;
+	unsigned va_count;
+	unsigned va_size;
+};
+
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t amdgpu_capture_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int amdgpu_capture_write(int fd, const void *data, size_t size)
+{
+	const char *ptr = data;
+
+	while (size) {
+		ssize_t n = write(fd, ptr, size);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		ptr += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static void *amdgpu_capture_thread(void *arg)
+{
+	struct amdgpu_capture *cap = arg;
+
+	pthread_mutex_lock(&cap->mutex);
+	for (;;) {
+		uint64_t start, size;
+		int r;
+
+		while (cap->head == cap->tail && !cap->stop)
+			pthread_cond_wait(&cap->data, &cap->mutex);
+		if (cap->head == cap->tail)
+			break;
+
+		/* the records up to head are complete and won't be touched
+		 * until tail moves past them */
+		start = cap->tail & (AMDGPU_CAPTURE_RING_SIZE - 1);
+		size = MIN2(cap->head - cap->tail,
+			    AMDGPU_CAPTURE_RING_SIZE - start);
+		pthread_mutex_unlock(&cap->mutex);
+
+		r = amdgpu_capture_write(cap->fd, cap->ring + start, size);
+
+		pthread_mutex_lock(&cap->mutex);
+		if (r && !cap->error)
+			cap->error = r;
+		cap->tail += size;
+		pthread_cond_broadcast(&cap->space);
+	}
+	pthread_mutex_unlock(&cap->mutex);
+
+	return NULL;
+}
+
+static void amdgpu_capture_put(struct amdgpu_capture *cap,
+			       const void *data, size_t size)
+{
+	uint64_t start;
+	size_t n;
+	int r;
+
+	if (!size)
+		return;
+
+	if (cap->direct) {
+		r = amdgpu_capture_write(cap->fd, data, size);
+		if (r && !cap->error)
+			cap->error = r;
+		cap->head += size;
+		cap->tail += size;
+		return;
+	}
+
+	start = cap->head & (AMDGPU_CAPTURE_RING_SIZE - 1);
+	n = MIN2(size, AMDGPU_CAPTURE_RING_SIZE - start);
+	memcpy(cap->ring + start, data, n);
+	memcpy(cap->ring, (const char *)data + n, size - n);
+	cap->head += size;
+}
+
+static void amdgpu_capture_pad(struct amdgpu_capture *cap)
+{
+	static const uint64_t zero;
+
+	amdgpu_capture_put(cap, &zero, ALIGN(cap->head, 8) - cap->head);
+}
+
+/**
+ * Start a record with \p size bytes of payload.  Must be called with the
+ * capture mutex held, which may be dropped while waiting for space.
+ *
+ * \return false if nothing should be recorded.
+ */
+static bool amdgpu_capture_begin(struct amdgpu_capture *cap, uint32_t type,
+				 uint64_t size)
+{
+	struct amdgpu_capture_record rec;
+	uint64_t total = ALIGN(sizeof(rec) + size, 8);
+
+	if (!cap->active || total > UINT32_MAX)
+		return false;
+
+	if (total > AMDGPU_CAPTURE_RING_SIZE) {
+		while (cap->active && cap->tail != cap->head)
+			pthread_cond_wait(&cap->space, &cap->mutex);
+		cap->direct = true;
+	} else {
+		while (cap->active &&
+		       cap->head + total - cap->tail > AMDGPU_CAPTURE_RING_SIZE)
+			pthread_cond_wait(&cap->space, &cap->mutex);
+	}
+	if (!cap->active) {
+		cap->direct = false;
+		return false;
+	}
+
+	if (cap->index_count == cap->index_size && !cap->index_failed) {
+		uint64_t new_size = cap->index_size ? cap->index_size * 2 : 1024;
+		struct amdgpu_capture_index *index;
+
+		index = realloc(cap->index, new_size * sizeof(*index));
+		if (index) {
+			cap->index = index;
+			cap->index_size = new_size;
+		} else {
+			cap->index_failed = true;
+			if (!cap->error)
+				cap->error = -ENOMEM;
+		}
+	}
+	if (!cap->index_failed) {
+		struct amdgpu_capture_index *entry;
+
+		entry = &cap->index[cap->index_count++];
+		entry->type = type;
+		entry->size = total;
+		entry->offset = cap->head;
+	}
+
+	cap->record_end = cap->head + total;
+	rec.type = type;
+	rec.size = total;
+	rec.time_ns = amdgpu_capture_time();
+	amdgpu_capture_put(cap, &rec, sizeof(rec));
+	return true;
+}
+
+static void amdgpu_capture_end(struct amdgpu_capture *cap)
+{
+	amdgpu_capture_pad(cap);
+	assert(cap->head == cap->record_end);
+	cap->direct = false;
+	pthread_cond_signal(&cap->data);
+}
+
+static void amdgpu_capture_record(struct amdgpu_capture *cap, uint32_t type,
+				  const void *data, size_t size)
+{
+	pthread_mutex_lock(&cap->mutex);
+	if (amdgpu_capture_begin(cap, type, size)) {
+		amdgpu_capture_put(cap, data, size);
+		amdgpu_capture_end(cap);
+	}
+	pthread_mutex_unlock(&cap->mutex);
+}
+
+/* index of the last mapping starting at or before va, or -1 */
+static int amdgpu_capture_va_find(struct amdgpu_capture *cap, uint64_t va)
+{
+	int lo = 0, hi = cap->va_count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (cap->va[mid].va <= va)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+static void amdgpu_capture_va_remove(struct amdgpu_capture *cap, unsigned i)
+{
+	if (cap->va[i].cpu)
+		amdgpu_bo_cpu_unmap(cap->va[i].bo);
+	memmove(&cap->va[i], &cap->va[i + 1],
+		(cap->va_count - i - 1) * sizeof(*cap->va));
+	cap->va_count--;
+}
+
+/* drop the mappings overlapping [va, va + size) */
+static void amdgpu_capture_va_clear(struct amdgpu_capture *cap,
+				    uint64_t va, uint64_t size)
+{
+	int i = amdgpu_capture_va_find(cap, va);
+
+	if (i < 0 || cap->va[i].va + cap->va[i].size <= va)
+		i++;
+	while (i < (int)cap->va_count && cap->va[i].va < va + size)
+		amdgpu_capture_va_remove(cap, i);
+}
+
+static void amdgpu_capture_va_insert(struct amdgpu_capture *cap,
+				     amdgpu_bo_handle bo, uint64_t offset,
+				     uint64_t va, uint64_t size)
+{
+	struct amdgpu_capture_va *entry;
+	int i;
+
+	amdgpu_capture_va_clear(cap, va, size);
+
+	if (cap->va_count == cap->va_size) {
+		unsigned new_size = cap->va_size ? cap->va_size * 2 : 64;
+
+		entry = realloc(cap->va, new_size * sizeof(*entry));
+		if (!entry)
+			return;
+		cap->va = entry;
+		cap->va_size = new_size;
+	}
+
+	i = amdgpu_capture_va_find(cap, va) + 1;
+	memmove(&cap->va[i + 1], &cap->va[i],
+		(cap->va_count - i) * sizeof(*cap->va));
+	cap->va_count++;
+
+	entry = &cap->va[i];
+	entry->va = va;
+	entry->size = size;
+	entry->offset = offset;
+	entry->bo = bo;
+	entry->cpu = NULL;
+}
+
+/* CPU address of the IB at [va, va + size), or NULL */
+static const void *amdgpu_capture_ib_ptr(struct amdgpu_capture *cap,
+					 uint64_t va, uint64_t size)
+{
+	struct amdgpu_capture_va *entry;
+	int i = amdgpu_capture_va_find(cap, va);
+
+	if (i < 0)
+		return NULL;
+
+	entry = &cap->va[i];
+	if (va + size > entry->va + entry->size ||
+	    entry->offset + (va - entry->va) + size > entry->bo->alloc_size)
+		return NULL;
+
+	if (!entry->cpu && amdgpu_bo_cpu_map(entry->bo, &entry->cpu))
+		entry->cpu = NULL;
+	if (!entry->cpu)
+		return NULL;
+
+	return (const char *)entry->cpu + entry->offset + (va - entry->va);
+}
+
+drm_private void amdgpu_capture_bo_alloc(amdgpu_device_handle dev,
+					 amdgpu_bo_handle bo,
+					 struct amdgpu_bo_alloc_request *request)
+{
+	struct amdgpu_capture_bo_alloc rec = {};
+
+	rec.handle = bo->handle;
+	rec.heap = request->preferred_heap;
+	rec.size = request->alloc_size;
+	rec.alignment = request->phys_alignment;
+	rec.flags = request->flags;
+	amdgpu_capture_record(dev->capture, AMDGPU_CAPTURE_BO_ALLOC,
+			      &rec, sizeof(rec));
+}
+
+/*
+ * amdgpu_bo_free() records a free under bo_table_mutex, so that it comes
+ * before the record of anything which reuses the handle.  The capture mutex
+ * is taken before bo_table_mutex and room for the record is made in
+ * advance, so no one waits for the writer with bo_table_mutex held:
+ *
+ *	amdgpu_capture_bo_free_prepare(dev);
+ *	pthread_mutex_lock(&dev->bo_table_mutex);
+ *	if (last reference)
+ *		amdgpu_capture_bo_free(dev, bo);
+ *	pthread_mutex_unlock(&dev->bo_table_mutex);
+ *	amdgpu_capture_bo_free_finish(dev);
+ */
+drm_private void amdgpu_capture_bo_free_prepare(amdgpu_device_handle dev)
+{
+	struct amdgpu_capture *cap = dev->capture;
+	uint64_t total = ALIGN(sizeof(struct amdgpu_capture_record) +
+			       sizeof(struct amdgpu_capture_bo_free), 8);
+
+	pthread_mutex_lock(&cap->mutex);
+	while (cap->active &&
+	       cap->head + total - cap->tail > AMDGPU_CAPTURE_RING_SIZE)
+		pthread_cond_wait(&cap->space, &cap->mutex);
+}
+
+drm_private void amdgpu_capture_bo_free(amdgpu_device_handle dev,
+					amdgpu_bo_handle bo)
+{
+	struct amdgpu_capture *cap = dev->capture;
+	struct amdgpu_capture_bo_free rec = {};
+	unsigned i;
+
+	if (cap->active) {
+		for (i = 0; i < cap->va_count;) {
+			if (cap->va[i].bo == bo)
+				amdgpu_capture_va_remove(cap, i);
+			else
+				i++;
+		}
+	}
+
+	/* doesn't wait, there is room for the record */
+	rec.handle = bo->handle;
+	if (amdgpu_capture_begin(cap, AMDGPU_CAPTURE_BO_FREE, sizeof(rec))) {
+		amdgpu_capture_put(cap, &rec, sizeof(rec));
+		amdgpu_capture_end(cap);
+	}
+}
+
+drm_private void amdgpu_capture_bo_free_finish(amdgpu_device_handle dev)
+{
+	pthread_mutex_unlock(&dev->capture->mutex);
+}
+
+drm_private void amdgpu_capture_va_op(amdgpu_device_handle dev,
+				      amdgpu_bo_handle bo, uint64_t offset,
+				      uint64_t size, uint64_t addr,
+				      uint64_t flags, uint32_t ops)
+{
+	struct amdgpu_capture *cap = dev->capture;
+	struct amdgpu_capture_va_op rec = {};
+
+	pthread_mutex_lock(&cap->mutex);
+	if (cap->active) {
+		switch (ops) {
+		case AMDGPU_VA_OP_MAP:
+		case AMDGPU_VA_OP_REPLACE:
+			amdgpu_capture_va_insert(cap, bo, offset, addr, size);
+			break;
+		case AMDGPU_VA_OP_UNMAP:
+		case AMDGPU_VA_OP_CLEAR:
+			amdgpu_capture_va_clear(cap, addr, size);
+			break;
+		}
+	}
+
+	rec.handle = bo ? bo->handle : 0;
+	rec.op = ops;
+	rec.offset = offset;
+	rec.size = size;
+	rec.va = addr;
+	rec.flags = flags;
+	rec.bo_size = bo ? bo->alloc_size : 0;
+	if (amdgpu_capture_begin(cap, AMDGPU_CAPTURE_VA_OP, sizeof(rec))) {
+		amdgpu_capture_put(cap, &rec, sizeof(rec));
+		amdgpu_capture_end(cap);
+	}
+	pthread_mutex_unlock(&cap->mutex);
+}
+
+drm_private void amdgpu_capture_bo_list(amdgpu_device_handle dev,
+					uint32_t handle, uint32_t op,
+					uint32_t count,
+					struct drm_amdgpu_bo_list_entry *entries)
+{
+	struct amdgpu_capture *cap = dev->capture;
+	struct amdgpu_capture_bo_list rec = {};
+	uint64_t size = (uint64_t)count * sizeof(*entries);
+
+	rec.handle = handle;
+	rec.op = op;
+	rec.count = count;
+
+	pthread_mutex_lock(&cap->mutex);
+	if (amdgpu_capture_begin(cap, AMDGPU_CAPTURE_BO_LIST,
+				 sizeof(rec) + size)) {
+		amdgpu_capture_put(cap, &rec, sizeof(rec));
+		amdgpu_capture_put(cap, entries, size);
+		amdgpu_capture_end(cap);
+	}
+	pthread_mutex_unlock(&cap->mutex);
+}
+
+drm_private void amdgpu_capture_ctx(amdgpu_device_handle dev, uint32_t type,
+				    uint32_t ctx_id, uint32_t priority)
+{
+	struct amdgpu_capture_ctx rec = {};
+
+	rec.ctx_id = ctx_id;
+	rec.priority = priority;
+	amdgpu_capture_record(dev->capture, type, &rec, sizeof(rec));
+}
+
+/* the list entries a BO_HANDLES chunk points to */
+static uint64_t
+amdgpu_capture_bo_handles_size(struct drm_amdgpu_cs_chunk *chunk)
+{
+	struct drm_amdgpu_bo_list_in *in;
+
+	if (chunk->length_dw * 4ull < sizeof(*in))
+		return 0;
+
+	in = (void *)(uintptr_t)chunk->chunk_data;
+	return (uint64_t)in->bo_number * in->bo_info_size;
+}
+
+drm_private void amdgpu_capture_cs(amdgpu_device_handle dev, uint32_t ctx_id,
+				   uint32_t bo_list_handle, int num_chunks,
+				   struct drm_amdgpu_cs_chunk *chunks,
+				   int result, uint64_t seq_no)
+{
+	struct amdgpu_capture *cap = dev->capture;
+	struct amdgpu_capture_cs rec = {};
+	const void **ib_ptrs;
+	uint64_t size;
+	int i, n;
+
+	/* the kernel rejected the submission, maybe for bad chunk pointers,
+	 * so don't look at them
+	 */
+	if (result)
+		num_chunks = 0;
+
+	ib_ptrs = alloca(sizeof(*ib_ptrs) * (num_chunks + 1));
+
+	rec.ctx_id = ctx_id;
+	rec.bo_list_handle = bo_list_handle;
+	rec.num_chunks = num_chunks;
+	rec.result = result;
+	rec.seq_no = seq_no;
+
+	pthread_mutex_lock(&cap->mutex);
+	if (!cap->active) {
+		pthread_mutex_unlock(&cap->mutex);
+		return;
+	}
+
+	size = sizeof(rec);
+	for (i = 0; i < num_chunks; i++) {
+		struct drm_amdgpu_cs_chunk_ib *ib;
+
+		size += sizeof(struct amdgpu_capture_chunk) +
+			ALIGN(chunks[i].length_dw * 4ull, 8);
+		if (chunks[i].chunk_id == AMDGPU_CHUNK_ID_BO_HANDLES)
+			size += ALIGN(amdgpu_capture_bo_handles_size(&chunks[i]),
+				      8);
+		if (chunks[i].chunk_id != AMDGPU_CHUNK_ID_IB)
+			continue;
+
+		ib = (void *)(uintptr_t)chunks[i].chunk_data;
+		n = rec.num_ibs++;
+		ib_ptrs[n] = amdgpu_capture_ib_ptr(cap, ib->va_start,
+						   ib->ib_bytes);
+		size += sizeof(struct amdgpu_capture_ib);
+		if (ib_ptrs[n])
+			size += ALIGN(ib->ib_bytes, 8);
+	}
+
+	if (!amdgpu_capture_begin(cap, AMDGPU_CAPTURE_CS, size)) {
+		pthread_mutex_unlock(&cap->mutex);
+		return;
+	}
+
+	amdgpu_capture_put(cap, &rec, sizeof(rec));
+	for (i = 0; i < num_chunks; i++) {
+		struct amdgpu_capture_chunk chunk;
+
+		chunk.chunk_id = chunks[i].chunk_id;
+		chunk.length_dw = chunks[i].length_dw;
+		amdgpu_capture_put(cap, &chunk, sizeof(chunk));
+		amdgpu_capture_put(cap, (void *)(uintptr_t)chunks[i].chunk_data,
+				   chunks[i].length_dw * 4);
+		amdgpu_capture_pad(cap);
+
+		if (chunks[i].chunk_id == AMDGPU_CHUNK_ID_BO_HANDLES) {
+			struct drm_amdgpu_bo_list_in *in;
+
+			in = (void *)(uintptr_t)chunks[i].chunk_data;
+			amdgpu_capture_put(cap, (void *)(uintptr_t)in->bo_info_ptr,
+					   amdgpu_capture_bo_handles_size(&chunks[i]));
+			amdgpu_capture_pad(cap);
+		}
+	}
+	for (i = 0, n = 0; i < num_chunks; i++) {
+		struct drm_amdgpu_cs_chunk_ib *ib;
+		struct amdgpu_capture_ib info = {};
+
+		if (chunks[i].chunk_id != AMDGPU_CHUNK_ID_IB)
+			continue;
+
+		ib = (void *)(uintptr_t)chunks[i].chunk_data;
+		info.va = ib->va_start;
+		if (ib_ptrs[n])
+			info.size = ib->ib_bytes;
+		else
+			info.flags = AMDGPU_CAPTURE_IB_MISSING;
+		amdgpu_capture_put(cap, &info, sizeof(info));
+		if (ib_ptrs[n]) {
+			amdgpu_capture_put(cap, ib_ptrs[n], info.size);
+			amdgpu_capture_pad(cap);
+		}
+		n++;
+	}
+	amdgpu_capture_end(cap);
+	pthread_mutex_unlock(&cap->mutex);
+}
+
+static void amdgpu_capture_release(struct amdgpu_capture *cap)
+{
+	while (cap->va_count)
+		amdgpu_capture_va_remove(cap, cap->va_count - 1);
+	free(cap->va);
+	cap->va = NULL;
+	cap->va_size = 0;
+
+	free(cap->index);
+	cap->index = NULL;
+	cap->index_count = 0;
+	cap->index_size = 0;
+	cap->index_failed = false;
+}
+
+drm_public int amdgpu_cs_capture_start(amdgpu_device_handle dev,
+				       const char *path)
+{
+	struct amdgpu_capture_header header = {};
+	struct amdgpu_capture *cap;
+	int r;
+
+	if (!dev || !path)
+		return -EINVAL;
+
+	pthread_mutex_lock(&capture_mutex);
+	if (atomic_read(&dev->capturing)) {
+		r = -EBUSY;
+		goto out;
+	}
+
+	cap = dev->capture;
+	if (!cap) {
+		cap = calloc(1, sizeof(*cap));
+		if (!cap) {
+			r = -ENOMEM;
+			goto out;
+		}
+		cap->ring = malloc(AMDGPU_CAPTURE_RING_SIZE);
+		if (!cap->ring) {
+			free(cap);
+			r = -ENOMEM;
+			goto out;
+		}
+		pthread_mutex_init(&cap->mutex, NULL);
+		pthread_cond_init(&cap->data, NULL);
+		pthread_cond_init(&cap->space, NULL);
+		dev->capture = cap;
+	}
+
+	cap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (cap->fd < 0) {
+		r = -errno;
+		goto out;
+	}
+
+	header.magic = AMDGPU_CAPTURE_MAGIC;
+	header.version = AMDGPU_CAPTURE_VERSION;
+	header.header_size = sizeof(header);
+	header.device_id = dev->info.asic_id;
+	header.family_id = dev->info.family_id;
+	header.chip_rev = dev->info.chip_rev;
+	header.chip_external_rev = dev->info.chip_external_rev;
+	r = amdgpu_capture_write(cap->fd, &header, sizeof(header));
+	if (r) {
+		close(cap->fd);
+		goto out;
+	}
+
+	cap->head = cap->tail = sizeof(header);
+	cap->error = 0;
+	cap->stop = false;
+	cap->active = true;
+
+	r = -pthread_create(&cap->thread, NULL, amdgpu_capture_thread, cap);
+	if (r) {
+		cap->active = false;
+		close(cap->fd);
+		goto out;
+	}
+
+	atomic_set(&dev->capturing, 1);
+out:
+	pthread_mutex_unlock(&capture_mutex);
+	return r;
+}
+
+drm_public int amdgpu_cs_capture_stop(amdgpu_device_handle dev)
+{
+	struct amdgpu_capture *cap;
+	struct amdgpu_capture_trailer trailer = {};
+	int r;
+
+	if (!dev)
+		return -EINVAL;
+
+	pthread_mutex_lock(&capture_mutex);
+	if (!atomic_read(&dev->capturing)) {
+		pthread_mutex_unlock(&capture_mutex);
+		return -EINVAL;
+	}
+	cap = dev->capture;
+
+	pthread_mutex_lock(&cap->mutex);
+	atomic_set(&dev->capturing, 0);
+	cap->active = false;
+	cap->stop = true;
+	pthread_cond_signal(&cap->data);
+	pthread_cond_broadcast(&cap->space);
+	pthread_mutex_unlock(&cap->mutex);
+
+	pthread_join(cap->thread, NULL);
+
+	pthread_mutex_lock(&cap->mutex);
+	r = cap->error;
+	if (!r) {
+		trailer.magic = AMDGPU_CAPTURE_INDEX_MAGIC;
+		trailer.index_offset = cap->head;
+		trailer.count = cap->index_count;
+		r = amdgpu_capture_write(cap->fd, cap->index,
+					 cap->index_count * sizeof(*cap->index));
+		if (!r)
+			r = amdgpu_capture_write(cap->fd, &trailer,
+						 sizeof(trailer));
+	}
+	if (close(cap->fd) && !r)
+		r = -errno;
+	amdgpu_capture_release(cap);
+	pthread_mutex_unlock(&cap->mutex);
+
+	pthread_mutex_unlock(&capture_mutex);
+	return r;
+}
+
+drm_private void amdgpu_capture_fini(amdgpu_device_handle dev)
+{
+	struct amdgpu_capture *cap = dev->capture;
+
+	if (!cap)
+		return;
+
+	if (atomic_read(&dev->capturing))
+		amdgpu_cs_capture_stop(dev);
+
+	pthread_cond_destroy(&cap->space);
+	pthread_cond_destroy(&cap->data);
+	pthread_mutex_destroy(&cap->mutex);
+	free(cap->ring);
+	free(cap);
+	dev->capture = NULL;
+}
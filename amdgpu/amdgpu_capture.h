@@ -0,0 +1,167 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _AMDGPU_CAPTURE_H_
+#define _AMDGPU_CAPTURE_H_
+
+#include <stdint.h>
+
+/*
+ * File format of amdgpu_cs_capture_start().
+ *
+ * A capture starts with struct amdgpu_capture_header, followed by records.
+ * Every record starts with struct amdgpu_capture_record and is padded to a
+ * multiple of 8 bytes, so all structures below are naturally aligned when
+ * the file is mapped.  Records are only ever appended, in the order the
+ * calls were made.
+ *
+ * A capture which was stopped cleanly ends with an index of all records,
+ * followed by struct amdgpu_capture_trailer as the last bytes of the file.
+ * Without a trailer, e.g. after a crash, the records can still be walked
+ * one after the other from the header on.
+ */
+
+#define AMDGPU_CAPTURE_MAGIC		0x5343555047444d41ull /* "AMDGPUCS" */
+#define AMDGPU_CAPTURE_INDEX_MAGIC	0x5849555047444d41ull /* "AMDGPUIX" */
+#define AMDGPU_CAPTURE_VERSION		1
+
+struct amdgpu_capture_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t device_id;
+	uint32_t family_id;
+	uint32_t chip_rev;
+	uint32_t chip_external_rev;
+};
+
+enum amdgpu_capture_type {
+	AMDGPU_CAPTURE_BO_ALLOC = 1,
+	AMDGPU_CAPTURE_BO_FREE,
+	AMDGPU_CAPTURE_VA_OP,
+	AMDGPU_CAPTURE_BO_LIST,
+	AMDGPU_CAPTURE_CTX_CREATE,
+	AMDGPU_CAPTURE_CTX_FREE,
+	AMDGPU_CAPTURE_CS,
+};
+
+struct amdgpu_capture_record {
+	uint32_t type;		/* enum amdgpu_capture_type */
+	uint32_t size;		/* including this header and the padding */
+	uint64_t time_ns;	/* CLOCK_MONOTONIC */
+};
+
+/* amdgpu_bo_alloc() */
+struct amdgpu_capture_bo_alloc {
+	uint32_t handle;
+	uint32_t heap;
+	uint64_t size;
+	uint64_t alignment;
+	uint64_t flags;
+};
+
+/* amdgpu_bo_free() dropping the last reference */
+struct amdgpu_capture_bo_free {
+	uint32_t handle;
+	uint32_t pad;
+};
+
+/* amdgpu_bo_va_op() and amdgpu_bo_va_op_raw().  bo_size is recorded so
+ * that buffers which were not allocated by amdgpu_bo_alloc(), e.g. imports,
+ * can be recreated on replay.
+ */
+struct amdgpu_capture_va_op {
+	uint32_t handle;	/* 0 for AMDGPU_VA_OP_CLEAR */
+	uint32_t op;		/* AMDGPU_VA_OP_* */
+	uint64_t offset;
+	uint64_t size;
+	uint64_t va;
+	uint64_t flags;
+	uint64_t bo_size;
+};
+
+/* BO list creation, update or destruction, followed by count
+ * struct drm_amdgpu_bo_list_entry.
+ */
+struct amdgpu_capture_bo_list {
+	uint32_t handle;
+	uint32_t op;		/* AMDGPU_BO_LIST_OP_* */
+	uint32_t count;
+	uint32_t pad;
+};
+
+/* amdgpu_cs_ctx_create2() and amdgpu_cs_ctx_free() */
+struct amdgpu_capture_ctx {
+	uint32_t ctx_id;
+	uint32_t priority;
+};
+
+/*
+ * A command submission, followed by num_chunks chunks, each made of a
+ * struct amdgpu_capture_chunk and the chunk data as passed to the kernel,
+ * padded to 8 bytes.  AMDGPU_CHUNK_ID_BO_HANDLES chunks are followed by the
+ * bo_number list entries they point to, bo_info_size bytes each, padded to
+ * 8 bytes as well.  Then come num_ibs struct amdgpu_capture_ib, one per
+ * IB chunk in order, each followed by the IB contents, padded to 8 bytes.
+ * Submissions the kernel rejected are recorded without chunks.  Concurrent
+ * submissions to a context may be recorded out of seq_no order.
+ */
+struct amdgpu_capture_cs {
+	uint32_t ctx_id;
+	uint32_t bo_list_handle;
+	uint32_t num_chunks;
+	uint32_t num_ibs;
+	int32_t result;		/* return value of the CS ioctl */
+	uint32_t pad;
+	uint64_t seq_no;
+};
+
+struct amdgpu_capture_chunk {
+	uint32_t chunk_id;	/* AMDGPU_CHUNK_ID_* */
+	uint32_t length_dw;
+};
+
+/* IB contents are missing if the IB isn't in a buffer that was mapped
+ * to the GPU while capturing, or it can't be mapped to the CPU.
+ */
+#define AMDGPU_CAPTURE_IB_MISSING	(1 << 0)
+
+struct amdgpu_capture_ib {
+	uint64_t va;
+	uint32_t size;		/* bytes of IB contents that follow */
+	uint32_t flags;		/* AMDGPU_CAPTURE_IB_* */
+};
+
+struct amdgpu_capture_index {
+	uint32_t type;
+	uint32_t size;
+	uint64_t offset;
+};
+
+struct amdgpu_capture_trailer {
+	uint64_t magic;
+	uint64_t index_offset;
+	uint64_t count;
+};
+
+#endif
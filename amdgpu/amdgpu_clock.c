@@ -0,0 +1,399 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * GPU clock calibration and timestamp rings.
+ *
+ * A sample pairs AMDGPU_INFO_TIMESTAMP with CLOCK_MONOTONIC read around it.
+ * The ioctl can be preempted, so the GPU counter may be taken anywhere in
+ * the window between the two host reads; of several reads the one with the
+ * shortest window is kept, with its middle as the host time.  The counter
+ * drifts against the host clock, so instead of trusting the nominal
+ * frequency the mapping is a least squares line over the last few samples,
+ * computed relative to the newest sample to keep the doubles precise.
+ *
+ * Timestamp rings keep the fence of each slot's submission, and only hand
+ * out a slot again once it signaled, so the GPU never writes the
+ * timestamps of an old submission over those of a new one.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+/* reads per sample, and samples per fit */
+#define AMDGPU_CLOCK_READS	8
+#define AMDGPU_CLOCK_SAMPLES	16
+
+struct amdgpu_clock_sample {
+	uint64_t timestamp;
+	uint64_t ns;
+	uint64_t skew;
+};
+
+struct amdgpu_clock {
+	amdgpu_device_handle dev;
+	uint64_t nominal_freq;
+
+	/** Protects everything below. */
+	pthread_mutex_t mutex;
+	struct amdgpu_clock_sample samples[AMDGPU_CLOCK_SAMPLES];
+	unsigned num_samples;
+	unsigned newest;
+	/* ns = ref_ns + offset + (timestamp - ref_timestamp) * ns_per_tick */
+	uint64_t ref_timestamp;
+	uint64_t ref_ns;
+	double offset;
+	double ns_per_tick;
+};
+
+struct amdgpu_timestamp_ring {
+	amdgpu_clock_handle clock;
+	amdgpu_bo_handle bo;
+	/* begin and end of each slot, written by the GPU */
+	volatile uint64_t *cpu;
+	uint64_t va;
+	uint32_t slots;
+
+	pthread_mutex_t mutex;
+	uint64_t next_seq;
+	/* of the submission using each slot, no context if not known */
+	struct amdgpu_cs_fence *fences;
+};
+
+static uint64_t amdgpu_clock_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int amdgpu_clock_sample(struct amdgpu_clock *clock,
+			       struct amdgpu_clock_sample *sample)
+{
+	uint64_t timestamp, before, after;
+	unsigned i;
+	int r;
+
+	sample->skew = UINT64_MAX;
+	for (i = 0; i < AMDGPU_CLOCK_READS; i++) {
+		before = amdgpu_clock_now();
+		r = amdgpu_query_info(clock->dev, AMDGPU_INFO_TIMESTAMP,
+				      sizeof(timestamp), &timestamp);
+		after = amdgpu_clock_now();
+		if (r)
+			return r;
+
+		if ((after - before) / 2 < sample->skew) {
+			sample->timestamp = timestamp;
+			sample->ns = before + (after - before) / 2;
+			sample->skew = (after - before) / 2;
+		}
+	}
+	return 0;
+}
+
+/* Refits the mapping, called with the mutex held */
+static void amdgpu_clock_fit(struct amdgpu_clock *clock)
+{
+	const struct amdgpu_clock_sample *ref = &clock->samples[clock->newest];
+	double x, y, mean_x = 0, mean_y = 0, sxx = 0, sxy = 0;
+	unsigned i;
+
+	for (i = 0; i < clock->num_samples; i++) {
+		mean_x += (int64_t)(clock->samples[i].timestamp - ref->timestamp);
+		mean_y += (int64_t)(clock->samples[i].ns - ref->ns);
+	}
+	mean_x /= clock->num_samples;
+	mean_y /= clock->num_samples;
+
+	for (i = 0; i < clock->num_samples; i++) {
+		x = (int64_t)(clock->samples[i].timestamp - ref->timestamp) -
+		    mean_x;
+		y = (int64_t)(clock->samples[i].ns - ref->ns) - mean_y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+
+	/* with a single sample, or samples too close to tell */
+	if (sxx > 0)
+		clock->ns_per_tick = sxy / sxx;
+	else
+		clock->ns_per_tick = 1e9 / clock->nominal_freq;
+
+	clock->ref_timestamp = ref->timestamp;
+	clock->ref_ns = ref->ns;
+	clock->offset = mean_y - mean_x * clock->ns_per_tick;
+}
+
+static uint64_t amdgpu_clock_convert(struct amdgpu_clock *clock,
+				     uint64_t timestamp)
+{
+	double ns;
+
+	ns = clock->offset + (int64_t)(timestamp - clock->ref_timestamp) *
+	     clock->ns_per_tick;
+	return clock->ref_ns + (int64_t)(ns < 0 ? ns - 0.5 : ns + 0.5);
+}
+
+drm_public int amdgpu_clock_create(amdgpu_device_handle dev,
+				   amdgpu_clock_handle *clock)
+{
+	struct amdgpu_clock *c;
+	int r;
+
+	if (!dev || !clock)
+		return -EINVAL;
+
+	/* the kernel reports kHz */
+	if (!dev->info.gpu_counter_freq)
+		return -ENODEV;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -ENOMEM;
+
+	c->dev = dev;
+	c->nominal_freq = dev->info.gpu_counter_freq * 1000ull;
+	pthread_mutex_init(&c->mutex, NULL);
+
+	r = amdgpu_clock_calibrate(c);
+	if (r) {
+		amdgpu_clock_destroy(c);
+		return r;
+	}
+
+	*clock = c;
+	return 0;
+}
+
+drm_public int amdgpu_clock_destroy(amdgpu_clock_handle clock)
+{
+	if (!clock)
+		return -EINVAL;
+
+	pthread_mutex_destroy(&clock->mutex);
+	free(clock);
+	return 0;
+}
+
+drm_public int amdgpu_clock_calibrate(amdgpu_clock_handle clock)
+{
+	struct amdgpu_clock_sample sample;
+	int r;
+
+	if (!clock)
+		return -EINVAL;
+
+	r = amdgpu_clock_sample(clock, &sample);
+	if (r)
+		return r;
+
+	pthread_mutex_lock(&clock->mutex);
+	if (clock->num_samples)
+		clock->newest = (clock->newest + 1) % AMDGPU_CLOCK_SAMPLES;
+	if (clock->num_samples < AMDGPU_CLOCK_SAMPLES)
+		clock->num_samples++;
+	clock->samples[clock->newest] = sample;
+	amdgpu_clock_fit(clock);
+	pthread_mutex_unlock(&clock->mutex);
+	return 0;
+}
+
+drm_public int amdgpu_clock_to_host(amdgpu_clock_handle clock,
+				    uint64_t timestamp, uint64_t *ns)
+{
+	if (!clock || !ns)
+		return -EINVAL;
+
+	pthread_mutex_lock(&clock->mutex);
+	*ns = amdgpu_clock_convert(clock, timestamp);
+	pthread_mutex_unlock(&clock->mutex);
+	return 0;
+}
+
+drm_public int amdgpu_clock_query_info(amdgpu_clock_handle clock,
+				       struct amdgpu_clock_info *info)
+{
+	double freq;
+
+	if (!clock || !info)
+		return -EINVAL;
+
+	pthread_mutex_lock(&clock->mutex);
+	freq = 1e9 / clock->ns_per_tick;
+	info->nominal_freq = clock->nominal_freq;
+	info->freq = freq + 0.5;
+	info->drift_ppb = (freq / clock->nominal_freq - 1) * 1e9;
+	info->skew_ns = clock->samples[clock->newest].skew;
+	info->samples = clock->num_samples;
+	pthread_mutex_unlock(&clock->mutex);
+	return 0;
+}
+
+drm_public int amdgpu_timestamp_ring_create(amdgpu_clock_handle clock,
+					    amdgpu_bo_handle bo,
+					    uint64_t offset, uint64_t va,
+					    uint32_t slots,
+					    amdgpu_timestamp_ring_handle *ring)
+{
+	struct amdgpu_timestamp_ring *t;
+	void *cpu;
+	int r;
+
+	if (!clock || !bo || !slots || !ring || offset % 8 ||
+	    offset > bo->alloc_size ||
+	    (bo->alloc_size - offset) / 16 < slots)
+		return -EINVAL;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	t->fences = calloc(slots, sizeof(*t->fences));
+	if (!t->fences) {
+		free(t);
+		return -ENOMEM;
+	}
+
+	r = amdgpu_bo_cpu_map(bo, &cpu);
+	if (r) {
+		free(t->fences);
+		free(t);
+		return r;
+	}
+
+	amdgpu_bo_inc_ref(bo);
+	t->clock = clock;
+	t->bo = bo;
+	t->cpu = (uint64_t *)((char *)cpu + offset);
+	t->va = va + offset;
+	t->slots = slots;
+	pthread_mutex_init(&t->mutex, NULL);
+
+	*ring = t;
+	return 0;
+}
+
+drm_public int amdgpu_timestamp_ring_destroy(amdgpu_timestamp_ring_handle ring)
+{
+	if (!ring)
+		return -EINVAL;
+
+	amdgpu_bo_cpu_unmap(ring->bo);
+	amdgpu_bo_free(ring->bo);
+	pthread_mutex_destroy(&ring->mutex);
+	free(ring->fences);
+	free(ring);
+	return 0;
+}
+
+drm_public int amdgpu_timestamp_ring_next(amdgpu_timestamp_ring_handle ring,
+					  struct amdgpu_timestamp_slot *slot)
+{
+	struct amdgpu_fence_memo memo;
+	uint32_t index;
+
+	if (!ring || !slot)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ring->mutex);
+	index = ring->next_seq % ring->slots;
+	if (ring->fences[index].context) {
+		memo.count = 0;
+		if (!amdgpu_cs_fence_signaled(&ring->fences[index], &memo)) {
+			pthread_mutex_unlock(&ring->mutex);
+			return -EBUSY;
+		}
+		ring->fences[index].context = NULL;
+	}
+	slot->seq = ring->next_seq++;
+	/* the GPU counter is never 0, so 0 is not written yet */
+	ring->cpu[index * 2] = 0;
+	ring->cpu[index * 2 + 1] = 0;
+	pthread_mutex_unlock(&ring->mutex);
+
+	slot->begin_va = ring->va + index * 16;
+	slot->end_va = slot->begin_va + 8;
+	return 0;
+}
+
+drm_public int amdgpu_timestamp_ring_fence(amdgpu_timestamp_ring_handle ring,
+					   uint64_t seq,
+					   struct amdgpu_cs_fence *fence)
+{
+	int r = 0;
+
+	if (!ring || !fence || !fence->context)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ring->mutex);
+	if (seq >= ring->next_seq)
+		r = -EINVAL;
+	else if (ring->next_seq - seq > ring->slots)
+		r = -ENODATA;
+	else
+		ring->fences[seq % ring->slots] = *fence;
+	pthread_mutex_unlock(&ring->mutex);
+	return r;
+}
+
+drm_public int amdgpu_timestamp_ring_read(amdgpu_timestamp_ring_handle ring,
+					  uint64_t seq, uint64_t *begin_ns,
+					  uint64_t *end_ns)
+{
+	uint64_t begin = 0, end = 0;
+	uint32_t index;
+	int r = 0;
+
+	if (!ring || !begin_ns || !end_ns)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ring->mutex);
+	if (seq >= ring->next_seq) {
+		r = -EINVAL;
+	} else if (ring->next_seq - seq > ring->slots) {
+		r = -ENODATA;
+	} else {
+		index = seq % ring->slots;
+		begin = ring->cpu[index * 2];
+		end = ring->cpu[index * 2 + 1];
+		if (!begin || !end)
+			r = -EAGAIN;
+	}
+	pthread_mutex_unlock(&ring->mutex);
+	if (r)
+		return r;
+
+	pthread_mutex_lock(&ring->clock->mutex);
+	*begin_ns = amdgpu_clock_convert(ring->clock, begin);
+	*end_ns = amdgpu_clock_convert(ring->clock, end);
+	pthread_mutex_unlock(&ring->clock->mutex);
+	return 0;
+}
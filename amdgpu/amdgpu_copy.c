@@ -0,0 +1,472 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Copies to and from CPU mappings of buffers.
+ *
+ * USWC system memory and visible VRAM are mapped write-combined.  Writes to
+ * them are best done with non-temporal stores of whole vectors, reads with
+ * streaming loads, which fetch whole lines instead of going uncached.  The
+ * widest variant the CPU supports up to AVX2 is picked once;
+ * AMDGPU_COPY=memcpy or sse2 in the environment caps it, e.g. for
+ * comparisons.  AVX-512 stores were slower than AVX2 in measurements, as
+ * the core clocks down for them, so AMDGPU_COPY=avx512 has to ask for them.
+ *
+ * Large copies can be split across worker threads, see
+ * amdgpu_device_set_copy_threads().  Copies hold a reference to the pool,
+ * so that it can be replaced while they run.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define AMDGPU_COPY_X86 1
+#include <immintrin.h>
+#endif
+
+/* copies below this size aren't worth waking up workers for */
+#define AMDGPU_COPY_PARALLEL_MIN	(4 * 1024 * 1024)
+#define AMDGPU_COPY_CHUNK_MIN		(1024 * 1024)
+
+typedef void (*amdgpu_copy_func)(char *dst, const char *src, size_t size);
+
+struct amdgpu_copy_job {
+	amdgpu_copy_func func;
+	char *dst;
+	const char *src;
+	uint64_t chunk_size;
+	uint64_t size;
+	unsigned num_chunks;
+	atomic_t next_chunk;
+	/* threads working on the job, protected by the pool's mutex */
+	unsigned active;
+};
+
+struct amdgpu_copy_pool {
+	/* the device's and one per copy using the pool */
+	atomic_t refcount;
+	pthread_mutex_t mutex;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	/* the job in progress, workers pick up each seqno once */
+	struct amdgpu_copy_job *job;
+	unsigned seqno;
+	bool stop;
+	unsigned num_threads;
+	pthread_t threads[];
+};
+
+static void amdgpu_copy_memcpy(char *dst, const char *src, size_t size)
+{
+	memcpy(dst, src, size);
+}
+
+static amdgpu_copy_func amdgpu_copy_to_wc = amdgpu_copy_memcpy;
+static amdgpu_copy_func amdgpu_copy_from_wc = amdgpu_copy_memcpy;
+static pthread_once_t amdgpu_copy_once = PTHREAD_ONCE_INIT;
+
+#ifdef AMDGPU_COPY_X86
+__attribute__((target("sse2")))
+static void amdgpu_copy_to_wc_sse2(char *dst, const char *src, size_t size)
+{
+	size_t head = MIN2(-(uintptr_t)dst & 15, size);
+	__m128i a, b, c, d;
+
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+
+	for (; size >= 64; size -= 64, dst += 64, src += 64) {
+		a = _mm_loadu_si128((const __m128i *)src);
+		b = _mm_loadu_si128((const __m128i *)(src + 16));
+		c = _mm_loadu_si128((const __m128i *)(src + 32));
+		d = _mm_loadu_si128((const __m128i *)(src + 48));
+		_mm_stream_si128((__m128i *)dst, a);
+		_mm_stream_si128((__m128i *)(dst + 16), b);
+		_mm_stream_si128((__m128i *)(dst + 32), c);
+		_mm_stream_si128((__m128i *)(dst + 48), d);
+	}
+	for (; size >= 16; size -= 16, dst += 16, src += 16)
+		_mm_stream_si128((__m128i *)dst,
+				 _mm_loadu_si128((const __m128i *)src));
+	_mm_sfence();
+
+	memcpy(dst, src, size);
+}
+
+__attribute__((target("avx2")))
+static void amdgpu_copy_to_wc_avx2(char *dst, const char *src, size_t size)
+{
+	size_t head = MIN2(-(uintptr_t)dst & 31, size);
+	__m256i a, b, c, d;
+
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+
+	for (; size >= 128; size -= 128, dst += 128, src += 128) {
+		a = _mm256_loadu_si256((const __m256i *)src);
+		b = _mm256_loadu_si256((const __m256i *)(src + 32));
+		c = _mm256_loadu_si256((const __m256i *)(src + 64));
+		d = _mm256_loadu_si256((const __m256i *)(src + 96));
+		_mm256_stream_si256((__m256i *)dst, a);
+		_mm256_stream_si256((__m256i *)(dst + 32), b);
+		_mm256_stream_si256((__m256i *)(dst + 64), c);
+		_mm256_stream_si256((__m256i *)(dst + 96), d);
+	}
+	for (; size >= 32; size -= 32, dst += 32, src += 32)
+		_mm256_stream_si256((__m256i *)dst,
+				    _mm256_loadu_si256((const __m256i *)src));
+	_mm_sfence();
+	_mm256_zeroupper();
+
+	memcpy(dst, src, size);
+}
+
+__attribute__((target("avx512f")))
+static void amdgpu_copy_to_wc_avx512(char *dst, const char *src, size_t size)
+{
+	size_t head = MIN2(-(uintptr_t)dst & 63, size);
+	__m512i a, b, c, d;
+
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+
+	for (; size >= 256; size -= 256, dst += 256, src += 256) {
+		a = _mm512_loadu_si512(src);
+		b = _mm512_loadu_si512(src + 64);
+		c = _mm512_loadu_si512(src + 128);
+		d = _mm512_loadu_si512(src + 192);
+		_mm512_stream_si512((__m512i *)dst, a);
+		_mm512_stream_si512((__m512i *)(dst + 64), b);
+		_mm512_stream_si512((__m512i *)(dst + 128), c);
+		_mm512_stream_si512((__m512i *)(dst + 192), d);
+	}
+	for (; size >= 64; size -= 64, dst += 64, src += 64)
+		_mm512_stream_si512((__m512i *)dst, _mm512_loadu_si512(src));
+	_mm_sfence();
+
+	memcpy(dst, src, size);
+}
+
+/* movntdqa only streams from write-combined memory, on other memory it is
+ * a plain aligned load.
+ */
+__attribute__((target("sse4.1")))
+static void amdgpu_copy_from_wc_sse41(char *dst, const char *src, size_t size)
+{
+	size_t head = MIN2(-(uintptr_t)src & 15, size);
+	__m128i a, b, c, d;
+
+	memcpy(dst, src, head);
+	dst += head;
+	src += head;
+	size -= head;
+
+	for (; size >= 64; size -= 64, dst += 64, src += 64) {
+		a = _mm_stream_load_si128((__m128i *)src);
+		b = _mm_stream_load_si128((__m128i *)(src + 16));
+		c = _mm_stream_load_si128((__m128i *)(src + 32));
+		d = _mm_stream_load_si128((__m128i *)(src + 48));
+		_mm_storeu_si128((__m128i *)dst, a);
+		_mm_storeu_si128((__m128i *)(dst + 16), b);
+		_mm_storeu_si128((__m128i *)(dst + 32), c);
+		_mm_storeu_si128((__m128i *)(dst + 48), d);
+	}
+	for (; size >= 16; size -= 16, dst += 16, src += 16)
+		_mm_storeu_si128((__m128i *)dst,
+				 _mm_stream_load_si128((__m128i *)src));
+
+	memcpy(dst, src, size);
+}
+#endif
+
+static void amdgpu_copy_init(void)
+{
+#ifdef AMDGPU_COPY_X86
+	const char *env = getenv("AMDGPU_COPY");
+	unsigned max_level = 2, level = 0;
+
+	if (env && !strcmp(env, "memcpy"))
+		max_level = 0;
+	else if (env && !strcmp(env, "sse2"))
+		max_level = 1;
+	else if (env && !strcmp(env, "avx512"))
+		max_level = 3;
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		level = 1;
+	if (__builtin_cpu_supports("avx2"))
+		level = 2;
+	if (__builtin_cpu_supports("avx512f"))
+		level = 3;
+
+	switch (MIN2(level, max_level)) {
+	case 3:
+		amdgpu_copy_to_wc = amdgpu_copy_to_wc_avx512;
+		break;
+	case 2:
+		amdgpu_copy_to_wc = amdgpu_copy_to_wc_avx2;
+		break;
+	case 1:
+		amdgpu_copy_to_wc = amdgpu_copy_to_wc_sse2;
+		break;
+	}
+	if (max_level && __builtin_cpu_supports("sse4.1"))
+		amdgpu_copy_from_wc = amdgpu_copy_from_wc_sse41;
+#endif
+}
+
+static void amdgpu_copy_run(struct amdgpu_copy_job *job)
+{
+	uint64_t offset;
+	unsigned i;
+
+	while ((i = atomic_inc_return(&job->next_chunk) - 1) < job->num_chunks) {
+		offset = i * job->chunk_size;
+		job->func(job->dst + offset, job->src + offset,
+			  MIN2(job->chunk_size, job->size - offset));
+	}
+}
+
+static void *amdgpu_copy_worker(void *data)
+{
+	struct amdgpu_copy_pool *pool = data;
+	struct amdgpu_copy_job *job;
+	unsigned seqno = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->stop && (!pool->job || pool->seqno == seqno))
+			pthread_cond_wait(&pool->work, &pool->mutex);
+		if (pool->stop)
+			break;
+
+		job = pool->job;
+		seqno = pool->seqno;
+		job->active++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		amdgpu_copy_run(job);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (!--job->active)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+static void amdgpu_copy_pool_destroy(struct amdgpu_copy_pool *pool,
+				     unsigned num_threads)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->work);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+static struct amdgpu_copy_pool *amdgpu_copy_pool_create(unsigned num_threads)
+{
+	struct amdgpu_copy_pool *pool;
+	unsigned i;
+
+	pool = calloc(1, sizeof(*pool) + num_threads * sizeof(pool->threads[0]));
+	if (!pool)
+		return NULL;
+
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	atomic_set(&pool->refcount, 1);
+	pool->num_threads = num_threads;
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&pool->threads[i], NULL,
+				   amdgpu_copy_worker, pool)) {
+			amdgpu_copy_pool_destroy(pool, i);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+static void amdgpu_copy_pool_unref(struct amdgpu_copy_pool *pool)
+{
+	if (pool && atomic_dec_and_test(&pool->refcount))
+		amdgpu_copy_pool_destroy(pool, pool->num_threads);
+}
+
+/* Splits a copy between the caller and the workers.  Fails if the workers
+ * are busy with another copy, which is then done by the caller alone.
+ */
+static bool amdgpu_copy_parallel(struct amdgpu_copy_pool *pool,
+				 amdgpu_copy_func func, char *dst,
+				 const char *src, uint64_t size)
+{
+	struct amdgpu_copy_job job;
+
+	job.func = func;
+	job.dst = dst;
+	job.src = src;
+	job.size = size;
+	/* a few chunks per thread to even out their speed, page aligned so
+	 * that all chunks are aligned like the first */
+	job.chunk_size = MAX2(size / (4 * (pool->num_threads + 1)),
+			      AMDGPU_COPY_CHUNK_MIN);
+	job.chunk_size = ALIGN(job.chunk_size, 4096);
+	job.num_chunks = (size + job.chunk_size - 1) / job.chunk_size;
+	atomic_set(&job.next_chunk, 0);
+	job.active = 1;
+
+	pthread_mutex_lock(&pool->mutex);
+	if (pool->job) {
+		pthread_mutex_unlock(&pool->mutex);
+		return false;
+	}
+	pool->job = &job;
+	pool->seqno++;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->mutex);
+
+	amdgpu_copy_run(&job);
+
+	pthread_mutex_lock(&pool->mutex);
+	job.active--;
+	while (job.active)
+		pthread_cond_wait(&pool->done, &pool->mutex);
+	pool->job = NULL;
+	pthread_mutex_unlock(&pool->mutex);
+	return true;
+}
+
+static int amdgpu_copy(amdgpu_bo_handle bo, uint64_t offset, void *data,
+		       uint64_t size, bool upload)
+{
+	struct amdgpu_copy_pool *pool;
+	amdgpu_copy_func func;
+	char *dst;
+	const char *src;
+	void *cpu;
+	int r;
+
+	if (!bo || (!data && size))
+		return -EINVAL;
+	if (offset > bo->alloc_size || size > bo->alloc_size - offset)
+		return -EINVAL;
+	if (!size)
+		return 0;
+
+	r = amdgpu_bo_cpu_map(bo, &cpu);
+	if (r)
+		return r;
+
+	pthread_once(&amdgpu_copy_once, amdgpu_copy_init);
+	if (upload) {
+		func = amdgpu_copy_to_wc;
+		dst = (char *)cpu + offset;
+		src = data;
+	} else {
+		func = amdgpu_copy_from_wc;
+		dst = data;
+		src = (char *)cpu + offset;
+	}
+
+	pool = NULL;
+	if (size >= AMDGPU_COPY_PARALLEL_MIN) {
+		pthread_mutex_lock(&bo->dev->copy_mutex);
+		pool = bo->dev->copy_pool;
+		if (pool)
+			atomic_inc(&pool->refcount);
+		pthread_mutex_unlock(&bo->dev->copy_mutex);
+	}
+
+	if (!pool || !amdgpu_copy_parallel(pool, func, dst, src, size))
+		func(dst, src, size);
+	amdgpu_copy_pool_unref(pool);
+
+	return amdgpu_bo_cpu_unmap(bo);
+}
+
+drm_private void amdgpu_copy_fini(amdgpu_device_handle dev)
+{
+	amdgpu_copy_pool_unref(dev->copy_pool);
+	dev->copy_pool = NULL;
+}
+
+drm_public int amdgpu_device_set_copy_threads(amdgpu_device_handle dev,
+					      unsigned num_threads)
+{
+	struct amdgpu_copy_pool *pool = NULL, *old;
+
+	if (!dev)
+		return -EINVAL;
+
+	if (num_threads) {
+		pool = amdgpu_copy_pool_create(num_threads);
+		if (!pool)
+			return -ENOMEM;
+	}
+
+	/* copies still using the old pool finish first */
+	pthread_mutex_lock(&dev->copy_mutex);
+	old = dev->copy_pool;
+	dev->copy_pool = pool;
+	pthread_mutex_unlock(&dev->copy_mutex);
+	amdgpu_copy_pool_unref(old);
+	return 0;
+}
+
+drm_public int amdgpu_bo_upload(amdgpu_bo_handle bo, uint64_t offset,
+				const void *src, uint64_t size)
+{
+	return amdgpu_copy(bo, offset, (void *)src, size, true);
+}
+
+drm_public int amdgpu_bo_download(amdgpu_bo_handle bo, uint64_t offset,
+				  void *dst, uint64_t size)
+{
+	return amdgpu_copy(bo, offset, dst, size, false);
+}
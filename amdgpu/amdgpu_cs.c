@@ -35,6 +35,7 @@
 #include "xf86drm.h"
 #include "amdgpu_drm.h"
 #include "amdgpu_internal.h"
+#include "amdgpu_capture.h"
 
 static int amdgpu_cs_unreference_sem(amdgpu_semaphore_handle sem);
 static int amdgpu_cs_reset_sem(amdgpu_semaphore_handle sem);
@@ -80,6 +81,9 @@ drm_public int amdgpu_cs_ctx_create2(amdgpu_device_handle dev,
 		goto error;
 
 	gpu_context->id = args.out.alloc.ctx_id;
+	if (atomic_read(&dev->capturing))
+		amdgpu_capture_ctx(dev, AMDGPU_CAPTURE_CTX_CREATE,
+				   gpu_context->id, priority);
 	for (i = 0; i < AMDGPU_HW_IP_NUM; i++)
 		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++)
 			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++)
@@ -125,6 +129,9 @@ drm_public int amdgpu_cs_ctx_free(amdgpu_context_handle context)
 	args.in.ctx_id = context->id;
 	r = drmCommandWriteRead(context->dev->fd, DRM_AMDGPU_CTX,
 				&args, sizeof(args));
+	if (atomic_read(&context->dev->capturing))
+		amdgpu_capture_ctx(context->dev, AMDGPU_CAPTURE_CTX_FREE,
+				   context->id, 0);
 	for (i = 0; i < AMDGPU_HW_IP_NUM; i++) {
 		for (j = 0; j < AMDGPU_HW_IP_INSTANCE_MAX_COUNT; j++) {
 			for (k = 0; k < AMDGPU_CS_MAX_RINGS; k++) {
@@ -210,7 +217,7 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 	struct list_head *sem_list;
 	amdgpu_semaphore_handle sem, tmp;
 	uint32_t i, size, sem_count = 0;
-	bool user_fence;
+	bool user_fence, capturing = false;
 	int r = 0;
 
 	if (ibs_request->ip_type >= AMDGPU_HW_IP_NUM)
@@ -335,8 +342,10 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 		chunks[i].chunk_data = (uint64_t)(uintptr_t)sem_dependencies;
 	}
 
+	size = cs.in.num_chunks;
 	r = drmCommandWriteRead(context->dev->fd, DRM_AMDGPU_CS,
 				&cs, sizeof(cs));
+	capturing = atomic_read(&context->dev->capturing);
 	if (r)
 		goto error_unlock;
 
@@ -344,6 +353,14 @@ static int amdgpu_cs_submit_one(amdgpu_context_handle context,
 	context->last_seq[ibs_request->ip_type][ibs_request->ip_instance][ibs_request->ring] = ibs_request->seq_no;
 error_unlock:
 	pthread_mutex_unlock(&context->sequence_mutex);
+	/* The chunks stay valid until we return.  Capturing may wait for
+	 * the writer and maps the IBs, so it is done without the lock.
+	 */
+	if (capturing)
+		amdgpu_capture_cs(context->dev, context->id,
+				  ibs_request->resources ?
+				  ibs_request->resources->handle : 0,
+				  size, chunks, r, r ? 0 : cs.out.handle);
 	free(dependencies);
 	free(sem_dependencies);
 	return r;
@@ -464,6 +481,55 @@ drm_public int amdgpu_cs_query_fence_status(struct amdgpu_cs_fence *fence,
 	return r;
 }
 
+/**
+ * Check whether a fence signaled without waiting.
+ *
+ * Fences of one ring signal in order, so \c memo saves the query for
+ * fences before one seen signaled and after one seen busy.  It must be
+ * cleared before each pass over a set of fences.  A fence which can't be
+ * queried, e.g. after a GPU reset, counts as busy.
+ */
+drm_private bool amdgpu_cs_fence_signaled(struct amdgpu_cs_fence *fence,
+					  struct amdgpu_fence_memo *memo)
+{
+	uint32_t expired = 0;
+	unsigned i;
+	int r;
+
+	for (i = 0; i < memo->count; i++) {
+		if (memo->rings[i].context == fence->context &&
+		    memo->rings[i].ip_type == fence->ip_type &&
+		    memo->rings[i].ip_instance == fence->ip_instance &&
+		    memo->rings[i].ring == fence->ring)
+			break;
+	}
+	if (i < memo->count) {
+		if (fence->fence <= memo->rings[i].signaled)
+			return true;
+		if (fence->fence >= memo->rings[i].busy)
+			return false;
+	} else if (i < AMDGPU_FENCE_MEMO_RINGS) {
+		memo->rings[i].context = fence->context;
+		memo->rings[i].ip_type = fence->ip_type;
+		memo->rings[i].ip_instance = fence->ip_instance;
+		memo->rings[i].ring = fence->ring;
+		memo->rings[i].signaled = 0;
+		memo->rings[i].busy = UINT64_MAX;
+		memo->count++;
+	}
+
+	r = amdgpu_cs_query_fence_status(fence, 0, 0, &expired);
+	if (i == AMDGPU_FENCE_MEMO_RINGS)
+		return !r && expired;
+
+	if (r || !expired) {
+		memo->rings[i].busy = fence->fence;
+		return false;
+	}
+	memo->rings[i].signaled = fence->fence;
+	return true;
+}
+
 static int amdgpu_ioctl_wait_fences(struct amdgpu_cs_fence *fences,
 				    uint32_t fence_count,
 				    bool wait_all,
@@ -856,6 +922,10 @@ drm_public int amdgpu_cs_submit_raw(amdgpu_device_handle dev,
 	cs.in.num_chunks = num_chunks;
 	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_CS,
 				&cs, sizeof(cs));
+	if (atomic_read(&dev->capturing))
+		amdgpu_capture_cs(dev, context->id,
+				  bo_list_handle ? bo_list_handle->handle : 0,
+				  num_chunks, chunks, r, r ? 0 : cs.out.handle);
 	if (r)
 		return r;
 
@@ -885,6 +955,9 @@ drm_public int amdgpu_cs_submit_raw2(amdgpu_device_handle dev,
 	cs.in.num_chunks = num_chunks;
 	r = drmCommandWriteRead(dev->fd, DRM_AMDGPU_CS,
 				&cs, sizeof(cs));
+	if (atomic_read(&dev->capturing))
+		amdgpu_capture_cs(dev, context->id, bo_list_handle,
+				  num_chunks, chunks, r, r ? 0 : cs.out.handle);
 	if (!r && seq_no)
 		*seq_no = cs.out.handle;
 	return r;
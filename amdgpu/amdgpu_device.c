@@ -93,6 +93,21 @@ int amdgpu_get_auth(int fd, int *auth)
 	return r;
 }
 
+drm_private int amdgpu_get_auth_fd(amdgpu_device_handle dev)
+{
+	int flag_auth = 0;
+
+	amdgpu_get_auth(dev->fd, &flag_auth);
+	if (flag_auth)
+		return dev->fd;
+
+	amdgpu_get_auth(dev->flink_fd, &flag_auth);
+	if (flag_auth)
+		return dev->flink_fd;
+
+	return -EINVAL;
+}
+
 static void amdgpu_device_free_internal(amdgpu_device_handle dev)
 {
 	amdgpu_device_handle *node = &fd_list;
@@ -103,6 +118,8 @@ static void amdgpu_device_free_internal(amdgpu_device_handle dev)
 	*node = (*node)->next;
 	pthread_mutex_unlock(&fd_mutex);
 
+	amdgpu_capture_fini(dev);
+	amdgpu_copy_fini(dev);
 	close(dev->fd);
 	if ((dev->flink_fd >= 0) && (dev->fd != dev->flink_fd))
 		close(dev->flink_fd);
@@ -113,7 +130,10 @@ static void amdgpu_device_free_internal(amdgpu_device_handle dev)
 	amdgpu_vamgr_deinit(&dev->vamgr_high);
 	handle_table_fini(&dev->bo_handles);
 	handle_table_fini(&dev->bo_flink_names);
+	if (dev->bo_dma_bufs)
+		drmHashDestroy(dev->bo_dma_bufs);
 	pthread_mutex_destroy(&dev->bo_table_mutex);
+	pthread_mutex_destroy(&dev->copy_mutex);
 	free(dev->marketing_name);
 	free(dev);
 }
@@ -218,6 +238,7 @@ drm_public int amdgpu_device_initialize(int fd,
 	drmFreeVersion(version);
 
 	pthread_mutex_init(&dev->bo_table_mutex, NULL);
+	pthread_mutex_init(&dev->copy_mutex, NULL);
 
 	/* Check if acceleration is working. */
 	r = amdgpu_query_info(dev, AMDGPU_INFO_ACCEL_WORKING, 4, &accel_working);
@@ -241,24 +262,28 @@ drm_public int amdgpu_device_initialize(int fd,
 	start = dev->dev_info.virtual_address_offset;
 	max = MIN2(dev->dev_info.virtual_address_max, 0x100000000ULL);
 	amdgpu_vamgr_init(&dev->vamgr_32, start, max,
-			  dev->dev_info.virtual_address_alignment);
+			  dev->dev_info.virtual_address_alignment,
+			  dev->dev_info.pte_fragment_size);
 
 	start = max;
 	max = MAX2(dev->dev_info.virtual_address_max, 0x100000000ULL);
 	amdgpu_vamgr_init(&dev->vamgr, start, max,
-			  dev->dev_info.virtual_address_alignment);
+			  dev->dev_info.virtual_address_alignment,
+			  dev->dev_info.pte_fragment_size);
 
 	start = dev->dev_info.high_va_offset;
 	max = MIN2(dev->dev_info.high_va_max, (start & ~0xffffffffULL) +
 		   0x100000000ULL);
 	amdgpu_vamgr_init(&dev->vamgr_high_32, start, max,
-			  dev->dev_info.virtual_address_alignment);
+			  dev->dev_info.virtual_address_alignment,
+			  dev->dev_info.pte_fragment_size);
 
 	start = max;
 	max = MAX2(dev->dev_info.high_va_max, (start & ~0xffffffffULL) +
 		   0x100000000ULL);
 	amdgpu_vamgr_init(&dev->vamgr_high, start, max,
-			  dev->dev_info.virtual_address_alignment);
+			  dev->dev_info.virtual_address_alignment,
+			  dev->dev_info.pte_fragment_size);
 
 	amdgpu_parse_asic_ids(dev);
 
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Direct GMA pool.
+ *
+ * The aperture is imported as one buffer, and regions of it are handed out
+ * as offsets into that buffer.  The free ranges are tracked by the same
+ * hole allocator as the GPU virtual address space, run over the physical
+ * addresses of the aperture so that alignments apply to those.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+#define AMDGPU_DGMA_ALIGNMENT	4096
+
+struct amdgpu_dgma_pool {
+	amdgpu_bo_handle bo;
+	/* physical address of the aperture */
+	uint64_t base;
+	uint64_t size;
+	/* free physical ranges */
+	struct amdgpu_bo_va_mgr mgr;
+};
+
+drm_public int amdgpu_dgma_pool_create(amdgpu_device_handle dev,
+				       uint64_t phys_address,
+				       uint64_t size,
+				       amdgpu_dgma_pool_handle *pool)
+{
+	struct amdgpu_dgma_pool *p;
+	int r;
+
+	if (!dev || !pool || !size || phys_address + size < phys_address ||
+	    phys_address % AMDGPU_DGMA_ALIGNMENT ||
+	    size % AMDGPU_DGMA_ALIGNMENT)
+		return -EINVAL;
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+
+	r = amdgpu_create_bo_from_phys_mem(dev, phys_address, size, &p->bo);
+	if (r)
+		goto error_import;
+
+	r = amdgpu_bo_get_phys_address(p->bo, &p->base);
+	if (r)
+		goto error_query;
+
+	p->size = size;
+	amdgpu_vamgr_init(&p->mgr, p->base, p->base + size,
+			  AMDGPU_DGMA_ALIGNMENT, 0);
+
+	*pool = p;
+	return 0;
+
+error_query:
+	amdgpu_bo_free(p->bo);
+error_import:
+	free(p);
+	return r;
+}
+
+drm_public int amdgpu_dgma_pool_destroy(amdgpu_dgma_pool_handle pool)
+{
+	if (!pool)
+		return -EINVAL;
+
+	amdgpu_vamgr_deinit(&pool->mgr);
+	amdgpu_bo_free(pool->bo);
+	free(pool);
+	return 0;
+}
+
+drm_public int amdgpu_dgma_pool_alloc(amdgpu_dgma_pool_handle pool,
+				      uint64_t size,
+				      uint64_t alignment,
+				      struct amdgpu_dgma_info *info)
+{
+	uint64_t phys;
+
+	if (!pool || !size || size > pool->size || !info ||
+	    (alignment & (alignment - 1)))
+		return -EINVAL;
+
+	size = ALIGN(size, AMDGPU_DGMA_ALIGNMENT);
+	phys = amdgpu_vamgr_find_va(&pool->mgr, size, alignment, 0);
+	if (phys == AMDGPU_INVALID_VA_ADDRESS)
+		return -ENOMEM;
+
+	info->bo = pool->bo;
+	info->offset = phys - pool->base;
+	info->size = size;
+	info->phys_address = phys;
+	return 0;
+}
+
+drm_public int amdgpu_dgma_pool_free(amdgpu_dgma_pool_handle pool,
+				     const struct amdgpu_dgma_info *info)
+{
+	if (!pool || !info || info->bo != pool->bo || !info->size ||
+	    info->offset >= pool->size ||
+	    info->size > pool->size - info->offset)
+		return -EINVAL;
+
+	amdgpu_vamgr_free_va(&pool->mgr, pool->base + info->offset,
+			     info->size);
+	return 0;
+}
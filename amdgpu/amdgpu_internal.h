@@ -54,6 +54,11 @@ struct amdgpu_bo_va_mgr {
 	struct list_head va_holes;
 	pthread_mutex_t bo_va_mutex;
 	uint32_t va_alignment;
+	/* PTE fragment size large allocations are aligned to, 0 for none */
+	uint64_t fragment_size;
+	/* allocations of at least the fragment size, and those aligned */
+	uint64_t large_allocs;
+	uint64_t large_aligned;
 };
 
 struct amdgpu_va {
@@ -77,6 +82,9 @@ struct amdgpu_device {
 	struct handle_table bo_handles;
 	/** List of buffer GEM flink names. Protected by bo_table_mutex. */
 	struct handle_table bo_flink_names;
+	/** Imported dma-bufs by inode number, created on first use.
+	 *  Protected by bo_table_mutex. */
+	void *bo_dma_bufs;
 	/** This protects all hash tables. */
 	pthread_mutex_t bo_table_mutex;
 	struct drm_amdgpu_info_device dev_info;
@@ -89,6 +97,12 @@ struct amdgpu_device {
 	struct amdgpu_bo_va_mgr vamgr_high;
 	/** The VA manager for the 32bit high address space */
 	struct amdgpu_bo_va_mgr vamgr_high_32;
+	/** Command submission capture, see amdgpu_cs_capture_start() */
+	struct amdgpu_capture *capture;
+	atomic_t capturing;
+	/** Workers for large copies, see amdgpu_device_set_copy_threads() */
+	struct amdgpu_copy_pool *copy_pool;
+	pthread_mutex_t copy_mutex;
 };
 
 struct amdgpu_bo {
@@ -100,6 +114,10 @@ struct amdgpu_bo {
 	uint32_t handle;
 	uint32_t flink_name;
 
+	/* inode of the dma-buf last imported, 0 if none */
+	uint64_t dma_buf_ino;
+	uint64_t dma_buf_dev;
+
 	pthread_mutex_t cpu_access_mutex;
 	void *cpu_ptr;
 	int cpu_map_count;
@@ -137,16 +155,82 @@ struct amdgpu_semaphore {
  */
 
 drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
-		       uint64_t max, uint64_t alignment);
+		       uint64_t max, uint64_t alignment,
+		       uint64_t fragment_size);
 
 drm_private void amdgpu_vamgr_deinit(struct amdgpu_bo_va_mgr *mgr);
 
+drm_private uint64_t
+amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
+		     uint64_t alignment, uint64_t base_required);
+
+drm_private void
+amdgpu_vamgr_free_va(struct amdgpu_bo_va_mgr *mgr, uint64_t va, uint64_t size);
+
 drm_private void amdgpu_parse_asic_ids(struct amdgpu_device *dev);
 
 drm_private int amdgpu_query_gpu_info_init(amdgpu_device_handle dev);
 
+drm_private void amdgpu_copy_fini(amdgpu_device_handle dev);
+
 drm_private uint64_t amdgpu_cs_calculate_timeout(uint64_t timeout);
 
+/* Fences seen during one pass over queued fences, per ring.  Only valid
+ * for that pass, as a freed context's address may be reused.
+ */
+#define AMDGPU_FENCE_MEMO_RINGS		8
+
+struct amdgpu_fence_memo {
+	unsigned count;
+	struct {
+		amdgpu_context_handle context;
+		uint32_t ip_type;
+		uint32_t ip_instance;
+		uint32_t ring;
+		/* latest fence seen signaled, earliest seen busy */
+		uint64_t signaled;
+		uint64_t busy;
+	} rings[AMDGPU_FENCE_MEMO_RINGS];
+};
+
+drm_private bool amdgpu_cs_fence_signaled(struct amdgpu_cs_fence *fence,
+					  struct amdgpu_fence_memo *memo);
+
+/* Command submission capture, only called while dev->capturing is set. */
+struct drm_amdgpu_bo_list_entry;
+struct drm_amdgpu_cs_chunk;
+
+drm_private void amdgpu_capture_fini(amdgpu_device_handle dev);
+
+drm_private void amdgpu_capture_bo_alloc(amdgpu_device_handle dev,
+					 amdgpu_bo_handle bo,
+					 struct amdgpu_bo_alloc_request *request);
+
+drm_private void amdgpu_capture_bo_free_prepare(amdgpu_device_handle dev);
+
+drm_private void amdgpu_capture_bo_free(amdgpu_device_handle dev,
+					amdgpu_bo_handle bo);
+
+drm_private void amdgpu_capture_bo_free_finish(amdgpu_device_handle dev);
+
+drm_private void amdgpu_capture_va_op(amdgpu_device_handle dev,
+				      amdgpu_bo_handle bo, uint64_t offset,
+				      uint64_t size, uint64_t addr,
+				      uint64_t flags, uint32_t ops);
+
+drm_private void amdgpu_capture_bo_list(amdgpu_device_handle dev,
+					uint32_t handle, uint32_t op,
+					uint32_t count,
+					struct drm_amdgpu_bo_list_entry *entries);
+
+drm_private void amdgpu_capture_ctx(amdgpu_device_handle dev, uint32_t type,
+				    uint32_t ctx_id, uint32_t priority);
+
+drm_private void amdgpu_capture_cs(amdgpu_device_handle dev, uint32_t ctx_id,
+				   uint32_t bo_list_handle, int num_chunks,
+				   struct drm_amdgpu_cs_chunk *chunks,
+				   int result, uint64_t seq_no);
+
 /**
 * Get the authenticated form fd,
 *
@@ -161,6 +245,27 @@ drm_private uint64_t amdgpu_cs_calculate_timeout(uint64_t timeout);
 */
 int amdgpu_get_auth(int fd, int *auth);
 
+/**
+* Get the authenticated one of the device's fds, for the KMS ioctls.
+*
+* \param   dev - \c [in] Device handle
+*
+* \return   The fd on success\n
+*          -EINVAL if neither fd is authenticated
+*/
+drm_private int amdgpu_get_auth_fd(amdgpu_device_handle dev);
+
+/**
+* Import the buffer of a frame buffer.
+*
+* Same as amdgpu_get_bo_from_fb_id(), with the authenticated fd already
+* looked up, see amdgpu_get_auth_fd().  Returns EFAULT if the frame buffer
+* can't be found, like that function.
+*/
+drm_private int amdgpu_bo_import_fb(amdgpu_device_handle dev, int fd,
+				    unsigned int fb_id,
+				    struct amdgpu_bo_import_result *output);
+
 /**
  * Inline functions.
  */
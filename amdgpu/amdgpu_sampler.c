@@ -0,0 +1,454 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Background sampler of sensors and heap usage.
+ *
+ * One thread samples every device of the sampler in rounds.  The heap
+ * usages of a device come from a single AMDGPU_INFO_MEMORY query, where the
+ * kernel has it, instead of two queries per heap.  The samples of each
+ * source go into a window, and the thread publishes the statistics of the
+ * window under a sequence count, so readers copy them without locking out
+ * the thread; they only take a mutex for finding the device, which the
+ * thread never holds while sampling.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+#define AMDGPU_SAMPLER_WINDOW	64
+
+struct amdgpu_sampler_channel {
+	uint32_t source;
+	/* the last samples, only used by the thread */
+	uint64_t values[AMDGPU_SAMPLER_WINDOW];
+	/* odd while the thread updates stats */
+	volatile unsigned seq;
+	struct amdgpu_sampler_stats stats;
+
+	/* budget, under the sampler's mutex */
+	uint64_t limit;
+	amdgpu_sampler_budget_func func;
+	void *data;
+	bool over;
+};
+
+struct amdgpu_sampler_device {
+	struct amdgpu_sampler_device *next;
+	amdgpu_device_handle dev;
+	/* any of the heap usages is sampled */
+	bool heaps;
+	/* AMDGPU_INFO_MEMORY failed once, so use the older queries */
+	bool no_memory_info;
+	uint32_t num_channels;
+	struct amdgpu_sampler_channel *channels;
+};
+
+struct amdgpu_sampler {
+	pthread_t thread;
+	uint64_t interval_ns;
+
+	/** Held by the thread while sampling, protects the budgets, stop and
+	 * changes of the device list. */
+	pthread_mutex_t mutex;
+	pthread_cond_t stop_cond;
+	bool stop;
+
+	/** Protects the device list for readers. */
+	pthread_mutex_t list_mutex;
+	struct amdgpu_sampler_device *devices;
+};
+
+static uint64_t amdgpu_sampler_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static bool amdgpu_sampler_is_heap(uint32_t source)
+{
+	return source == AMDGPU_SAMPLER_VRAM_USAGE ||
+	       source == AMDGPU_SAMPLER_VIS_VRAM_USAGE ||
+	       source == AMDGPU_SAMPLER_GTT_USAGE;
+}
+
+static void amdgpu_sampler_publish(struct amdgpu_sampler_channel *ch,
+				   uint64_t value, uint64_t time)
+{
+	struct amdgpu_sampler_stats stats = ch->stats;
+	uint64_t sum = 0;
+	unsigned i, n;
+
+	ch->values[stats.count % AMDGPU_SAMPLER_WINDOW] = value;
+	stats.count++;
+	stats.time_ns = time;
+	stats.last = value;
+	stats.min = stats.max = value;
+
+	n = MIN2(stats.count, AMDGPU_SAMPLER_WINDOW);
+	for (i = 0; i < n; i++) {
+		stats.min = MIN2(stats.min, ch->values[i]);
+		stats.max = MAX2(stats.max, ch->values[i]);
+		sum += ch->values[i];
+	}
+	stats.avg = sum / n;
+
+	ch->seq++;
+	__sync_synchronize();
+	ch->stats = stats;
+	__sync_synchronize();
+	ch->seq++;
+}
+
+static int amdgpu_sampler_query_heap(struct amdgpu_sampler_device *d,
+				     const struct drm_amdgpu_memory_info *memory,
+				     uint32_t source, uint64_t *value)
+{
+	unsigned query;
+
+	if (!d->no_memory_info) {
+		switch (source) {
+		case AMDGPU_SAMPLER_VRAM_USAGE:
+			*value = memory->vram.heap_usage;
+			break;
+		case AMDGPU_SAMPLER_VIS_VRAM_USAGE:
+			*value = memory->cpu_accessible_vram.heap_usage;
+			break;
+		default:
+			*value = memory->gtt.heap_usage;
+			break;
+		}
+		return 0;
+	}
+
+	if (source == AMDGPU_SAMPLER_VRAM_USAGE)
+		query = AMDGPU_INFO_VRAM_USAGE;
+	else if (source == AMDGPU_SAMPLER_VIS_VRAM_USAGE)
+		query = AMDGPU_INFO_VIS_VRAM_USAGE;
+	else
+		query = AMDGPU_INFO_GTT_USAGE;
+	return amdgpu_query_info(d->dev, query, sizeof(*value), value);
+}
+
+/* Samples the sources of a device, called with the mutex held */
+static void amdgpu_sampler_poll(struct amdgpu_sampler_device *d)
+{
+	struct drm_amdgpu_memory_info memory = {};
+	struct amdgpu_sampler_channel *ch;
+	uint64_t value;
+	uint32_t sensor;
+	unsigned i;
+	int r;
+
+	if (d->heaps && !d->no_memory_info &&
+	    amdgpu_query_info(d->dev, AMDGPU_INFO_MEMORY, sizeof(memory),
+			      &memory))
+		d->no_memory_info = true;
+
+	for (i = 0; i < d->num_channels; i++) {
+		ch = &d->channels[i];
+		if (amdgpu_sampler_is_heap(ch->source)) {
+			r = amdgpu_sampler_query_heap(d, &memory, ch->source,
+						      &value);
+		} else {
+			r = amdgpu_query_sensor_info(d->dev, ch->source,
+						     sizeof(sensor), &sensor);
+			value = sensor;
+		}
+		if (r)
+			continue;
+
+		amdgpu_sampler_publish(ch, value, amdgpu_sampler_now());
+
+		if (ch->func && (value > ch->limit) != ch->over) {
+			ch->over = !ch->over;
+			ch->func(d->dev, ch->source, value, ch->over, ch->data);
+		}
+	}
+}
+
+static void *amdgpu_sampler_thread(void *param)
+{
+	struct amdgpu_sampler *sampler = param;
+	struct amdgpu_sampler_device *d;
+	uint64_t deadline, now;
+	struct timespec ts;
+
+	pthread_mutex_lock(&sampler->mutex);
+	deadline = amdgpu_sampler_now();
+	while (!sampler->stop) {
+		for (d = sampler->devices; d; d = d->next)
+			amdgpu_sampler_poll(d);
+
+		/* skip the rounds which a slow one ran into */
+		now = amdgpu_sampler_now();
+		do
+			deadline += sampler->interval_ns;
+		while (deadline <= now);
+
+		ts.tv_sec = deadline / 1000000000ull;
+		ts.tv_nsec = deadline % 1000000000ull;
+		while (!sampler->stop &&
+		       pthread_cond_timedwait(&sampler->stop_cond,
+					      &sampler->mutex, &ts) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&sampler->mutex);
+	return NULL;
+}
+
+/* Called with list_mutex held */
+static struct amdgpu_sampler_channel *
+amdgpu_sampler_find(struct amdgpu_sampler *sampler, amdgpu_device_handle dev,
+		    uint32_t source)
+{
+	struct amdgpu_sampler_device *d;
+	unsigned i;
+
+	for (d = sampler->devices; d; d = d->next) {
+		if (d->dev != dev)
+			continue;
+		for (i = 0; i < d->num_channels; i++) {
+			if (d->channels[i].source == source)
+				return &d->channels[i];
+		}
+		break;
+	}
+	return NULL;
+}
+
+static void amdgpu_sampler_free_device(struct amdgpu_sampler_device *d)
+{
+	free(d->channels);
+	free(d);
+}
+
+drm_public int amdgpu_sampler_create(uint32_t interval_ms,
+				     amdgpu_sampler_handle *sampler)
+{
+	struct amdgpu_sampler *s;
+	pthread_condattr_t attr;
+	int r;
+
+	if (!interval_ms || !sampler)
+		return -EINVAL;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+
+	s->interval_ns = interval_ms * 1000000ull;
+	pthread_mutex_init(&s->mutex, NULL);
+	pthread_mutex_init(&s->list_mutex, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&s->stop_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	r = -pthread_create(&s->thread, NULL, amdgpu_sampler_thread, s);
+	if (r) {
+		pthread_cond_destroy(&s->stop_cond);
+		pthread_mutex_destroy(&s->list_mutex);
+		pthread_mutex_destroy(&s->mutex);
+		free(s);
+		return r;
+	}
+
+	*sampler = s;
+	return 0;
+}
+
+drm_public int amdgpu_sampler_destroy(amdgpu_sampler_handle sampler)
+{
+	struct amdgpu_sampler_device *d;
+
+	if (!sampler)
+		return -EINVAL;
+
+	pthread_mutex_lock(&sampler->mutex);
+	sampler->stop = true;
+	pthread_cond_signal(&sampler->stop_cond);
+	pthread_mutex_unlock(&sampler->mutex);
+	pthread_join(sampler->thread, NULL);
+
+	while ((d = sampler->devices)) {
+		sampler->devices = d->next;
+		amdgpu_sampler_free_device(d);
+	}
+	pthread_cond_destroy(&sampler->stop_cond);
+	pthread_mutex_destroy(&sampler->list_mutex);
+	pthread_mutex_destroy(&sampler->mutex);
+	free(sampler);
+	return 0;
+}
+
+drm_public int amdgpu_sampler_add_device(amdgpu_sampler_handle sampler,
+					 amdgpu_device_handle dev,
+					 const uint32_t *sources,
+					 uint32_t num_sources)
+{
+	struct amdgpu_sampler_device *d, *other;
+	unsigned i, j;
+	int r = 0;
+
+	if (!sampler || !dev || !sources || !num_sources)
+		return -EINVAL;
+
+	for (i = 0; i < num_sources; i++) {
+		if (!sources[i] || (sources[i] >= AMDGPU_SAMPLER_VRAM_USAGE &&
+				    !amdgpu_sampler_is_heap(sources[i])))
+			return -EINVAL;
+		for (j = 0; j < i; j++) {
+			if (sources[j] == sources[i])
+				return -EINVAL;
+		}
+	}
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return -ENOMEM;
+	d->channels = calloc(num_sources, sizeof(*d->channels));
+	if (!d->channels) {
+		free(d);
+		return -ENOMEM;
+	}
+
+	d->dev = dev;
+	d->num_channels = num_sources;
+	for (i = 0; i < num_sources; i++) {
+		d->channels[i].source = sources[i];
+		if (amdgpu_sampler_is_heap(sources[i]))
+			d->heaps = true;
+	}
+
+	pthread_mutex_lock(&sampler->mutex);
+	pthread_mutex_lock(&sampler->list_mutex);
+	for (other = sampler->devices; other; other = other->next) {
+		if (other->dev == dev)
+			r = -EEXIST;
+	}
+	if (!r) {
+		d->next = sampler->devices;
+		sampler->devices = d;
+	}
+	pthread_mutex_unlock(&sampler->list_mutex);
+	pthread_mutex_unlock(&sampler->mutex);
+
+	if (r)
+		amdgpu_sampler_free_device(d);
+	return r;
+}
+
+drm_public int amdgpu_sampler_remove_device(amdgpu_sampler_handle sampler,
+					    amdgpu_device_handle dev)
+{
+	struct amdgpu_sampler_device **d, *found = NULL;
+
+	if (!sampler || !dev)
+		return -EINVAL;
+
+	pthread_mutex_lock(&sampler->mutex);
+	pthread_mutex_lock(&sampler->list_mutex);
+	for (d = &sampler->devices; *d; d = &(*d)->next) {
+		if ((*d)->dev == dev) {
+			found = *d;
+			*d = found->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&sampler->list_mutex);
+	pthread_mutex_unlock(&sampler->mutex);
+
+	if (!found)
+		return -EINVAL;
+
+	amdgpu_sampler_free_device(found);
+	return 0;
+}
+
+drm_public int amdgpu_sampler_read(amdgpu_sampler_handle sampler,
+				   amdgpu_device_handle dev, uint32_t source,
+				   struct amdgpu_sampler_stats *stats)
+{
+	struct amdgpu_sampler_channel *ch;
+	unsigned seq;
+	int r = 0;
+
+	if (!sampler || !dev || !stats)
+		return -EINVAL;
+
+	pthread_mutex_lock(&sampler->list_mutex);
+	ch = amdgpu_sampler_find(sampler, dev, source);
+	if (ch) {
+		do {
+			seq = ch->seq;
+			__sync_synchronize();
+			*stats = ch->stats;
+			__sync_synchronize();
+		} while ((seq & 1) || seq != ch->seq);
+
+		if (!stats->count)
+			r = -EAGAIN;
+	} else {
+		r = -EINVAL;
+	}
+	pthread_mutex_unlock(&sampler->list_mutex);
+	return r;
+}
+
+drm_public int amdgpu_sampler_set_budget(amdgpu_sampler_handle sampler,
+					 amdgpu_device_handle dev,
+					 uint32_t source, uint64_t limit,
+					 amdgpu_sampler_budget_func func,
+					 void *data)
+{
+	struct amdgpu_sampler_channel *ch;
+	int r = 0;
+
+	if (!sampler || !dev)
+		return -EINVAL;
+
+	pthread_mutex_lock(&sampler->mutex);
+	pthread_mutex_lock(&sampler->list_mutex);
+	ch = amdgpu_sampler_find(sampler, dev, source);
+	if (ch) {
+		ch->limit = limit;
+		ch->func = func;
+		ch->data = data;
+		ch->over = false;
+	} else {
+		r = -EINVAL;
+	}
+	pthread_mutex_unlock(&sampler->list_mutex);
+	pthread_mutex_unlock(&sampler->mutex);
+	return r;
+}
@@ -0,0 +1,351 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Scanout capture sessions.
+ *
+ * amdgpu_get_fb_id() and amdgpu_get_bo_from_fb_id() look up the
+ * authenticated fd, every CRTC and the frame buffer's buffer on each call.
+ * A session does the first two once and keeps the buffers of the last few
+ * frame buffers it saw, as compositors flip between a handful of them.
+ *
+ * Frame buffer ids are reused by the kernel once a frame buffer is
+ * removed, so a kept buffer is checked against the frame buffer's dma-buf
+ * when the CRTC switches to the frame buffer or a flip to it is reported.
+ * The kernel keeps one dma-buf per buffer while it is exported, and the
+ * session holds on to one for every buffer it keeps, so the dma-buf's inode
+ * tells whether the frame buffer still shows it.  As that takes GETFB, an
+ * export and an fstat(), frames which show the same frame buffer as the
+ * previous one, without a flip in between, skip the check: removing the
+ * frame buffer a CRTC scans out turns the CRTC off.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+
+#define AMDGPU_SCANOUT_FBS	8
+
+struct amdgpu_scanout_fb {
+	uint32_t fb_id;
+	/* NULL for unused entries */
+	amdgpu_bo_handle bo;
+	uint64_t alloc_size;
+	/* dma-buf of the buffer, which keeps its inode */
+	int dma_buf_fd;
+	dev_t dma_buf_dev;
+	ino_t dma_buf_ino;
+	/* import count when the buffer was imported, tells buffers apart */
+	uint64_t serial;
+	/* frame count of the last use, for replacing the oldest */
+	uint64_t last_use;
+};
+
+struct amdgpu_scanout {
+	amdgpu_device_handle dev;
+	/* authenticated fd for the KMS ioctls */
+	int fd;
+	uint32_t crtc_id;
+	/* selects the CRTC in vblank requests */
+	uint32_t vblank_type;
+	/* frame buffer of the last amdgpu_scanout_flipped(), if called */
+	bool flips;
+	uint32_t flipped_fb;
+	/* a flip was reported since the last frame */
+	bool flip_pending;
+	/* kept buffer of the last frame */
+	struct amdgpu_scanout_fb *current;
+	uint64_t last_serial;
+	uint64_t imports;
+	uint64_t frames;
+	struct amdgpu_scanout_fb fbs[AMDGPU_SCANOUT_FBS];
+};
+
+static void amdgpu_scanout_release(struct amdgpu_scanout_fb *fb)
+{
+	if (fb->bo) {
+		amdgpu_bo_free(fb->bo);
+		close(fb->dma_buf_fd);
+	}
+	memset(fb, 0, sizeof(*fb));
+}
+
+/* Closes a handle GETFB returned, unless importing its buffer on the same
+ * fd gave it to a buffer of the device.
+ */
+static void amdgpu_scanout_close_handle(struct amdgpu_scanout *scanout,
+					uint32_t handle)
+{
+	struct amdgpu_device *dev = scanout->dev;
+	struct drm_gem_close args = {};
+	bool owned = false;
+
+	if (scanout->fd == dev->fd) {
+		pthread_mutex_lock(&dev->bo_table_mutex);
+		owned = handle_table_lookup(&dev->bo_handles, handle) != NULL;
+		pthread_mutex_unlock(&dev->bo_table_mutex);
+	}
+	if (owned)
+		return;
+
+	args.handle = handle;
+	drmIoctl(scanout->fd, DRM_IOCTL_GEM_CLOSE, &args);
+}
+
+/* Exports the buffer a frame buffer shows to a dma-buf.  The handle GETFB
+ * returned must be closed after the buffer is imported, as it may be the
+ * one the import gives back.
+ */
+static int amdgpu_scanout_dma_buf(struct amdgpu_scanout *scanout,
+				  uint32_t fb_id, uint32_t *handle,
+				  int *dma_buf_fd, struct stat *st)
+{
+	drmModeFBPtr fb;
+	int r = 0;
+
+	fb = drmModeGetFB(scanout->fd, fb_id);
+	if (!fb)
+		return -errno;
+	*handle = fb->handle;
+	drmModeFreeFB(fb);
+
+	if (drmPrimeHandleToFD(scanout->fd, *handle, DRM_CLOEXEC, dma_buf_fd))
+		r = -errno;
+	else if (fstat(*dma_buf_fd, st)) {
+		r = -errno;
+		close(*dma_buf_fd);
+	}
+	if (r)
+		amdgpu_scanout_close_handle(scanout, *handle);
+	return r;
+}
+
+/* Returns the kept buffer of a frame buffer, importing it if the frame
+ * buffer wasn't seen before or shows another buffer by now.
+ */
+static int amdgpu_scanout_lookup(struct amdgpu_scanout *scanout,
+				 uint32_t fb_id,
+				 struct amdgpu_scanout_fb **out)
+{
+	struct amdgpu_scanout_fb *fb = &scanout->fbs[0];
+	struct amdgpu_bo_import_result result;
+	struct stat st;
+	uint32_t handle = 0;
+	unsigned i;
+	int dma_buf_fd, r;
+
+	for (i = 0; i < AMDGPU_SCANOUT_FBS; i++) {
+		if (scanout->fbs[i].bo && scanout->fbs[i].fb_id == fb_id) {
+			fb = &scanout->fbs[i];
+			break;
+		}
+		if (scanout->fbs[i].last_use < fb->last_use)
+			fb = &scanout->fbs[i];
+	}
+
+	r = amdgpu_scanout_dma_buf(scanout, fb_id, &handle, &dma_buf_fd, &st);
+	if (r) {
+		if (i < AMDGPU_SCANOUT_FBS)
+			amdgpu_scanout_release(fb);
+		return r;
+	}
+
+	if (i < AMDGPU_SCANOUT_FBS && fb->dma_buf_ino == st.st_ino &&
+	    fb->dma_buf_dev == st.st_dev) {
+		close(dma_buf_fd);
+		amdgpu_scanout_close_handle(scanout, handle);
+		*out = fb;
+		return 0;
+	}
+
+	/* import the very buffer checked, the frame buffer may change */
+	r = amdgpu_bo_import(scanout->dev, amdgpu_bo_handle_type_dma_buf_fd,
+			     dma_buf_fd, &result);
+	amdgpu_scanout_close_handle(scanout, handle);
+	if (r) {
+		close(dma_buf_fd);
+		return r;
+	}
+
+	amdgpu_scanout_release(fb);
+	fb->fb_id = fb_id;
+	fb->bo = result.buf_handle;
+	fb->alloc_size = result.alloc_size;
+	fb->dma_buf_fd = dma_buf_fd;
+	fb->dma_buf_dev = st.st_dev;
+	fb->dma_buf_ino = st.st_ino;
+	fb->serial = ++scanout->imports;
+	*out = fb;
+	return 0;
+}
+
+drm_public int amdgpu_scanout_create(amdgpu_device_handle dev,
+				     uint32_t crtc_id,
+				     amdgpu_scanout_handle *scanout)
+{
+	struct amdgpu_scanout *s;
+	drmModeCrtcPtr crtc;
+	drmModeResPtr res;
+	int fd, i, r = -ENOENT;
+
+	if (!dev || !scanout)
+		return -EINVAL;
+
+	fd = amdgpu_get_auth_fd(dev);
+	if (fd < 0)
+		return fd;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+
+	res = drmModeGetResources(fd);
+	if (!res) {
+		free(s);
+		return -errno;
+	}
+
+	for (i = 0; i < res->count_crtcs; i++) {
+		crtc = drmModeGetCrtc(fd, res->crtcs[i]);
+		if (!crtc)
+			continue;
+
+		if (crtc_id ? crtc->crtc_id == crtc_id : crtc->buffer_id != 0) {
+			s->crtc_id = crtc->crtc_id;
+			if (i > 1)
+				s->vblank_type = (i << DRM_VBLANK_HIGH_CRTC_SHIFT) &
+						 DRM_VBLANK_HIGH_CRTC_MASK;
+			else if (i == 1)
+				s->vblank_type = DRM_VBLANK_SECONDARY;
+			r = 0;
+		}
+		drmModeFreeCrtc(crtc);
+		if (!r)
+			break;
+	}
+	drmModeFreeResources(res);
+
+	if (r) {
+		free(s);
+		return crtc_id ? -EINVAL : r;
+	}
+
+	s->dev = dev;
+	s->fd = fd;
+	*scanout = s;
+	return 0;
+}
+
+drm_public int amdgpu_scanout_destroy(amdgpu_scanout_handle scanout)
+{
+	unsigned i;
+
+	if (!scanout)
+		return -EINVAL;
+
+	for (i = 0; i < AMDGPU_SCANOUT_FBS; i++)
+		amdgpu_scanout_release(&scanout->fbs[i]);
+	free(scanout);
+	return 0;
+}
+
+drm_public int amdgpu_scanout_wait_vblank(amdgpu_scanout_handle scanout,
+					  uint32_t *sequence)
+{
+	drmVBlank vbl = {};
+
+	if (!scanout)
+		return -EINVAL;
+
+	vbl.request.type = DRM_VBLANK_RELATIVE | scanout->vblank_type;
+	vbl.request.sequence = 1;
+	if (drmWaitVBlank(scanout->fd, &vbl))
+		return -errno;
+
+	if (sequence)
+		*sequence = vbl.reply.sequence;
+	return 0;
+}
+
+drm_public int amdgpu_scanout_flipped(amdgpu_scanout_handle scanout,
+				      uint32_t fb_id)
+{
+	if (!scanout || !fb_id)
+		return -EINVAL;
+
+	scanout->flips = true;
+	scanout->flipped_fb = fb_id;
+	scanout->flip_pending = true;
+	return 0;
+}
+
+drm_public int amdgpu_scanout_get_frame(amdgpu_scanout_handle scanout,
+					struct amdgpu_scanout_frame *frame)
+{
+	struct amdgpu_scanout_fb *fb;
+	drmModeCrtcPtr crtc;
+	uint32_t fb_id;
+	int r;
+
+	if (!scanout || !frame)
+		return -EINVAL;
+
+	if (scanout->flips) {
+		fb_id = scanout->flipped_fb;
+	} else {
+		crtc = drmModeGetCrtc(scanout->fd, scanout->crtc_id);
+		if (!crtc)
+			return -errno;
+
+		fb_id = crtc->buffer_id;
+		drmModeFreeCrtc(crtc);
+	}
+
+	if (!fb_id)
+		return -ENOENT;
+
+	fb = scanout->current;
+	if (scanout->flip_pending || !fb || !fb->bo || fb->fb_id != fb_id) {
+		r = amdgpu_scanout_lookup(scanout, fb_id, &fb);
+		if (r)
+			return r;
+		scanout->current = fb;
+		scanout->flip_pending = false;
+	}
+
+	fb->last_use = ++scanout->frames;
+	frame->bo = fb->bo;
+	frame->alloc_size = fb->alloc_size;
+	frame->fb_id = fb_id;
+	frame->new_fb = fb->serial != scanout->last_serial;
+	scanout->last_serial = fb->serial;
+	return 0;
+}
@@ -0,0 +1,560 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Slab sub-allocator for small buffers.
+ *
+ * Small allocations are carved out of slabs, buffers of slab_size bytes
+ * which are mapped to the GPU and the CPU once when they are created.  A
+ * slab only holds entries of one power of two size class, for one heap and
+ * set of creation flags.  Entries which are freed with a fence are queued
+ * and only reused once the fence signaled.  The whole queue is checked
+ * when a size class runs out of free entries, so that entries of a busy
+ * ring don't hold up those of others.  Slabs are released when all of
+ * their entries are free again, except for one spare per size class.
+ *
+ * Allocations which don't fit in a slab get a buffer of their own, so
+ * that callers don't need a second allocation path.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+#define AMDGPU_SLAB_MIN_ORDER		6	/* 64 bytes */
+#define AMDGPU_SLAB_MAX_ORDER		12	/* 4 KiB */
+#define AMDGPU_SLAB_NUM_ORDERS		(AMDGPU_SLAB_MAX_ORDER - \
+					 AMDGPU_SLAB_MIN_ORDER + 1)
+#define AMDGPU_SLAB_DEFAULT_SIZE	(64 * 1024)
+/* rings with a reclaim queue of their own, the others share the last one */
+#define AMDGPU_SLAB_RECLAIM_RINGS	8
+
+/* creation flags that can't be shared between entries */
+#define AMDGPU_SLAB_DEDICATED_FLAGS	(AMDGPU_GEM_CREATE_VRAM_CLEARED | \
+					 AMDGPU_GEM_CREATE_VM_ALWAYS_VALID | \
+					 AMDGPU_GEM_CREATE_EXPLICIT_SYNC)
+
+struct amdgpu_bo_slab_entry {
+	/* next entry on the slab's free list or the reclaim queue */
+	struct amdgpu_bo_slab_entry *next;
+	/* NULL for dedicated buffers */
+	struct amdgpu_slab *slab;
+	struct amdgpu_cs_fence fence;
+};
+
+/* an allocation which didn't fit in a slab */
+struct amdgpu_slab_dedicated {
+	struct amdgpu_bo_slab_entry base;
+	struct list_head list;
+	struct amdgpu_bo_slab *owner;
+	amdgpu_bo_handle bo;
+	amdgpu_va_handle va_handle;
+	uint64_t va;
+	void *cpu;
+	uint64_t size;
+};
+
+/* slabs of one heap and set of creation flags */
+struct amdgpu_slab_group {
+	struct list_head list;
+	struct amdgpu_bo_slab *owner;
+	uint32_t heap;
+	uint64_t flags;
+	/* slabs with free entries, by size class */
+	struct list_head partial[AMDGPU_SLAB_NUM_ORDERS];
+	/* slabs with only free entries, by size class */
+	unsigned num_empty[AMDGPU_SLAB_NUM_ORDERS];
+};
+
+struct amdgpu_slab {
+	/* in group->partial while there are free entries */
+	struct list_head list;
+	/* in amdgpu_bo_slab::slabs */
+	struct list_head link;
+	struct amdgpu_slab_group *group;
+	amdgpu_bo_handle bo;
+	amdgpu_va_handle va_handle;
+	uint64_t va;
+	void *cpu;
+	unsigned order;
+	unsigned num_entries;
+	unsigned num_free;
+	struct amdgpu_bo_slab_entry *free;
+	struct amdgpu_bo_slab_entry entries[];
+};
+
+/* entries freed with fences of one ring which didn't signal yet, oldest
+ * first, so that the first busy fence ends the scan
+ */
+struct amdgpu_slab_reclaim {
+	/* NULL while the queue is empty */
+	amdgpu_context_handle context;
+	uint32_t ip_type;
+	uint32_t ip_instance;
+	uint32_t ring;
+	struct amdgpu_bo_slab_entry *head;
+	struct amdgpu_bo_slab_entry *tail;
+};
+
+struct amdgpu_bo_slab {
+	amdgpu_device_handle dev;
+	uint64_t slab_size;
+	pthread_mutex_t mutex;
+	struct list_head groups;
+	struct list_head slabs;
+	struct list_head dedicated;
+	struct amdgpu_slab_reclaim reclaim[AMDGPU_SLAB_RECLAIM_RINGS];
+};
+
+static unsigned amdgpu_slab_order(uint64_t size)
+{
+	unsigned order = AMDGPU_SLAB_MIN_ORDER;
+
+	while ((1ull << order) < size)
+		order++;
+	return order;
+}
+
+static void amdgpu_slab_unmap(amdgpu_bo_handle bo, amdgpu_va_handle va_handle,
+			      uint64_t va, uint64_t size, bool cpu)
+{
+	if (cpu)
+		amdgpu_bo_cpu_unmap(bo);
+	amdgpu_bo_va_op(bo, 0, size, va, 0, AMDGPU_VA_OP_UNMAP);
+	amdgpu_va_range_free(va_handle);
+	amdgpu_bo_free(bo);
+}
+
+/* Allocates a buffer and maps it to the GPU and, unless the heap isn't CPU
+ * accessible, to the CPU.
+ */
+static int amdgpu_slab_map(amdgpu_device_handle dev,
+			   struct amdgpu_bo_alloc_request *request,
+			   amdgpu_bo_handle *bo, amdgpu_va_handle *va_handle,
+			   uint64_t *va, void **cpu)
+{
+	int r;
+
+	r = amdgpu_bo_alloc(dev, request, bo);
+	if (r)
+		return r;
+
+	r = amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general,
+				  request->alloc_size, request->phys_alignment,
+				  0, va, va_handle, 0);
+	if (r)
+		goto error_va_alloc;
+
+	r = amdgpu_bo_va_op(*bo, 0, request->alloc_size, *va, 0,
+			    AMDGPU_VA_OP_MAP);
+	if (r)
+		goto error_va_map;
+
+	*cpu = NULL;
+	if (!(request->flags & AMDGPU_GEM_CREATE_NO_CPU_ACCESS)) {
+		r = amdgpu_bo_cpu_map(*bo, cpu);
+		if (r) {
+			amdgpu_slab_unmap(*bo, *va_handle, *va,
+					  request->alloc_size, false);
+			return r;
+		}
+	}
+	return 0;
+
+error_va_map:
+	amdgpu_va_range_free(*va_handle);
+error_va_alloc:
+	amdgpu_bo_free(*bo);
+	return r;
+}
+
+static struct amdgpu_slab *amdgpu_slab_create(struct amdgpu_slab_group *group,
+					      unsigned order)
+{
+	struct amdgpu_bo_slab *owner = group->owner;
+	struct amdgpu_bo_alloc_request request = {};
+	struct amdgpu_slab *slab;
+	unsigned i, num_entries = owner->slab_size >> order;
+
+	slab = calloc(1, sizeof(*slab) + num_entries * sizeof(slab->entries[0]));
+	if (!slab)
+		return NULL;
+
+	request.alloc_size = owner->slab_size;
+	request.phys_alignment = 1 << AMDGPU_SLAB_MAX_ORDER;
+	request.preferred_heap = group->heap;
+	request.flags = group->flags;
+	if (amdgpu_slab_map(owner->dev, &request, &slab->bo, &slab->va_handle,
+			    &slab->va, &slab->cpu)) {
+		free(slab);
+		return NULL;
+	}
+
+	slab->group = group;
+	slab->order = order;
+	slab->num_entries = num_entries;
+	slab->num_free = num_entries;
+	for (i = num_entries; i-- > 0;) {
+		slab->entries[i].slab = slab;
+		slab->entries[i].next = slab->free;
+		slab->free = &slab->entries[i];
+	}
+	return slab;
+}
+
+static void amdgpu_slab_destroy(struct amdgpu_slab *slab)
+{
+	list_del(&slab->link);
+	amdgpu_slab_unmap(slab->bo, slab->va_handle, slab->va,
+			  slab->group->owner->slab_size, slab->cpu != NULL);
+	free(slab);
+}
+
+static void amdgpu_slab_dedicated_free(struct amdgpu_slab_dedicated *ded)
+{
+	list_del(&ded->list);
+	amdgpu_slab_unmap(ded->bo, ded->va_handle, ded->va, ded->size,
+			  ded->cpu != NULL);
+	free(ded);
+}
+
+/* Returns an entry to its slab.  Called with the owner's mutex held. */
+static void amdgpu_slab_release(struct amdgpu_bo_slab_entry *entry)
+{
+	struct amdgpu_slab *slab = entry->slab;
+	struct amdgpu_slab_group *group;
+	unsigned index;
+
+	if (!slab) {
+		amdgpu_slab_dedicated_free((struct amdgpu_slab_dedicated *)entry);
+		return;
+	}
+
+	group = slab->group;
+	index = slab->order - AMDGPU_SLAB_MIN_ORDER;
+	entry->next = slab->free;
+	slab->free = entry;
+	if (slab->num_free++ == 0)
+		list_add(&slab->list, &group->partial[index]);
+
+	if (slab->num_free == slab->num_entries) {
+		if (group->num_empty[index]) {
+			list_del(&slab->list);
+			amdgpu_slab_destroy(slab);
+		} else {
+			group->num_empty[index]++;
+		}
+	}
+}
+
+/* Reuses the entries in the reclaim queues whose fences signaled, up to the
+ * first busy one of each queue.  Fences of a ring signal in order, so this
+ * only looks at the entries it reuses.  Called with the owner's mutex held.
+ */
+static void amdgpu_slab_reclaim_locked(struct amdgpu_bo_slab *owner)
+{
+	struct amdgpu_bo_slab_entry *entry;
+	struct amdgpu_fence_memo memo;
+	unsigned i;
+
+	memo.count = 0;
+	for (i = 0; i < AMDGPU_SLAB_RECLAIM_RINGS; i++) {
+		struct amdgpu_slab_reclaim *queue = &owner->reclaim[i];
+
+		if (!queue->head)
+			continue;
+
+		while ((entry = queue->head) &&
+		       amdgpu_cs_fence_signaled(&entry->fence, &memo)) {
+			queue->head = entry->next;
+			amdgpu_slab_release(entry);
+		}
+		if (!queue->head) {
+			queue->tail = NULL;
+			queue->context = NULL;
+		}
+	}
+}
+
+/* The reclaim queue for fences of the ring of @fence. */
+static struct amdgpu_slab_reclaim *
+amdgpu_slab_reclaim_queue(struct amdgpu_bo_slab *owner,
+			  struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_slab_reclaim *queue, *unused = NULL;
+	unsigned i;
+
+	for (i = 0; i < AMDGPU_SLAB_RECLAIM_RINGS; i++) {
+		queue = &owner->reclaim[i];
+		if (!queue->context) {
+			if (!unused)
+				unused = queue;
+			continue;
+		}
+		if (queue->context == fence->context &&
+		    queue->ip_type == fence->ip_type &&
+		    queue->ip_instance == fence->ip_instance &&
+		    queue->ring == fence->ring)
+			return queue;
+	}
+
+	/* with more rings in use, entries of the last queue can wait for
+	 * the ones of other rings ahead of them
+	 */
+	if (!unused)
+		return &owner->reclaim[AMDGPU_SLAB_RECLAIM_RINGS - 1];
+
+	unused->context = fence->context;
+	unused->ip_type = fence->ip_type;
+	unused->ip_instance = fence->ip_instance;
+	unused->ring = fence->ring;
+	return unused;
+}
+
+static struct amdgpu_slab_group *
+amdgpu_slab_group_get(struct amdgpu_bo_slab *owner, uint32_t heap,
+		      uint64_t flags)
+{
+	struct amdgpu_slab_group *group;
+	unsigned i;
+
+	LIST_FOR_EACH_ENTRY(group, &owner->groups, list) {
+		if (group->heap == heap && group->flags == flags)
+			return group;
+	}
+
+	group = calloc(1, sizeof(*group));
+	if (!group)
+		return NULL;
+	group->owner = owner;
+	group->heap = heap;
+	group->flags = flags;
+	for (i = 0; i < AMDGPU_SLAB_NUM_ORDERS; i++)
+		list_inithead(&group->partial[i]);
+	list_add(&group->list, &owner->groups);
+	return group;
+}
+
+static int amdgpu_slab_alloc_dedicated(struct amdgpu_bo_slab *owner,
+				       struct amdgpu_bo_alloc_request *request,
+				       amdgpu_bo_slab_entry_handle *entry,
+				       struct amdgpu_bo_slab_entry_info *info)
+{
+	struct amdgpu_slab_dedicated *ded;
+	int r;
+
+	ded = calloc(1, sizeof(*ded));
+	if (!ded)
+		return -ENOMEM;
+
+	r = amdgpu_slab_map(owner->dev, request, &ded->bo, &ded->va_handle,
+			    &ded->va, &ded->cpu);
+	if (r) {
+		free(ded);
+		return r;
+	}
+	ded->owner = owner;
+	ded->size = request->alloc_size;
+
+	pthread_mutex_lock(&owner->mutex);
+	list_add(&ded->list, &owner->dedicated);
+	pthread_mutex_unlock(&owner->mutex);
+
+	info->bo = ded->bo;
+	info->offset = 0;
+	info->va = ded->va;
+	info->cpu = ded->cpu;
+	info->size = ded->size;
+	*entry = &ded->base;
+	return 0;
+}
+
+drm_public int amdgpu_bo_slab_create(amdgpu_device_handle dev,
+				     uint64_t slab_size,
+				     amdgpu_bo_slab_handle *slab)
+{
+	struct amdgpu_bo_slab *owner;
+
+	if (!dev || !slab)
+		return -EINVAL;
+
+	if (!slab_size)
+		slab_size = AMDGPU_SLAB_DEFAULT_SIZE;
+	/* at least two entries of the largest size class */
+	if (slab_size < 2 << AMDGPU_SLAB_MAX_ORDER ||
+	    slab_size % (1 << AMDGPU_SLAB_MAX_ORDER))
+		return -EINVAL;
+
+	owner = calloc(1, sizeof(*owner));
+	if (!owner)
+		return -ENOMEM;
+
+	owner->dev = dev;
+	owner->slab_size = slab_size;
+	pthread_mutex_init(&owner->mutex, NULL);
+	list_inithead(&owner->groups);
+	list_inithead(&owner->slabs);
+	list_inithead(&owner->dedicated);
+
+	*slab = owner;
+	return 0;
+}
+
+drm_public int amdgpu_bo_slab_destroy(amdgpu_bo_slab_handle owner)
+{
+	struct amdgpu_slab_group *group, *next_group;
+	struct amdgpu_slab_dedicated *ded, *next_ded;
+	struct amdgpu_slab *slab, *next_slab;
+
+	if (!owner)
+		return -EINVAL;
+
+	/* the kernel keeps buffers alive until the GPU is done with them */
+	LIST_FOR_EACH_ENTRY_SAFE(slab, next_slab, &owner->slabs, link)
+		amdgpu_slab_destroy(slab);
+	LIST_FOR_EACH_ENTRY_SAFE(ded, next_ded, &owner->dedicated, list)
+		amdgpu_slab_dedicated_free(ded);
+	LIST_FOR_EACH_ENTRY_SAFE(group, next_group, &owner->groups, list)
+		free(group);
+
+	pthread_mutex_destroy(&owner->mutex);
+	free(owner);
+	return 0;
+}
+
+drm_public int amdgpu_bo_slab_alloc(amdgpu_bo_slab_handle owner,
+				    struct amdgpu_bo_alloc_request *alloc_buffer,
+				    amdgpu_bo_slab_entry_handle *entry,
+				    struct amdgpu_bo_slab_entry_info *info)
+{
+	struct amdgpu_bo_slab_entry *e;
+	struct amdgpu_slab_group *group;
+	struct amdgpu_slab *slab;
+	uint64_t size;
+	unsigned order, index;
+
+	if (!owner || !alloc_buffer || !entry || !info)
+		return -EINVAL;
+
+	/* entries are aligned to their size */
+	size = MAX3(alloc_buffer->alloc_size, alloc_buffer->phys_alignment, 1);
+	if (size > 1 << AMDGPU_SLAB_MAX_ORDER ||
+	    alloc_buffer->flags & AMDGPU_SLAB_DEDICATED_FLAGS ||
+	    alloc_buffer->preferred_heap & ~(AMDGPU_GEM_DOMAIN_CPU |
+					     AMDGPU_GEM_DOMAIN_GTT |
+					     AMDGPU_GEM_DOMAIN_VRAM))
+		return amdgpu_slab_alloc_dedicated(owner, alloc_buffer, entry,
+						   info);
+
+	order = amdgpu_slab_order(size);
+	index = order - AMDGPU_SLAB_MIN_ORDER;
+
+	pthread_mutex_lock(&owner->mutex);
+	group = amdgpu_slab_group_get(owner, alloc_buffer->preferred_heap,
+				      alloc_buffer->flags);
+	if (!group) {
+		pthread_mutex_unlock(&owner->mutex);
+		return -ENOMEM;
+	}
+
+	if (LIST_IS_EMPTY(&group->partial[index]))
+		amdgpu_slab_reclaim_locked(owner);
+
+	if (LIST_IS_EMPTY(&group->partial[index])) {
+		/* don't hold up other threads while the kernel allocates */
+		pthread_mutex_unlock(&owner->mutex);
+		slab = amdgpu_slab_create(group, order);
+		if (!slab)
+			return -ENOMEM;
+		pthread_mutex_lock(&owner->mutex);
+		list_add(&slab->link, &owner->slabs);
+		list_add(&slab->list, &group->partial[index]);
+		group->num_empty[index]++;
+	}
+
+	slab = LIST_FIRST_ENTRY(&group->partial[index], struct amdgpu_slab,
+				list);
+	if (slab->num_free == slab->num_entries)
+		group->num_empty[index]--;
+	e = slab->free;
+	slab->free = e->next;
+	if (--slab->num_free == 0)
+		list_del(&slab->list);
+	pthread_mutex_unlock(&owner->mutex);
+
+	e->next = NULL;
+	info->bo = slab->bo;
+	info->offset = (uint64_t)(e - slab->entries) << order;
+	info->va = slab->va + info->offset;
+	info->cpu = slab->cpu ? (char *)slab->cpu + info->offset : NULL;
+	info->size = 1ull << order;
+	*entry = e;
+	return 0;
+}
+
+drm_public int amdgpu_bo_slab_free(amdgpu_bo_slab_entry_handle entry,
+				   struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_bo_slab *owner;
+
+	if (!entry)
+		return -EINVAL;
+
+	if (entry->slab)
+		owner = entry->slab->group->owner;
+	else
+		owner = ((struct amdgpu_slab_dedicated *)entry)->owner;
+
+	pthread_mutex_lock(&owner->mutex);
+	if (fence && fence->context && fence->fence != AMDGPU_NULL_SUBMIT_SEQ) {
+		struct amdgpu_slab_reclaim *queue;
+
+		queue = amdgpu_slab_reclaim_queue(owner, fence);
+		entry->fence = *fence;
+		entry->next = NULL;
+		if (queue->tail)
+			queue->tail->next = entry;
+		else
+			queue->head = entry;
+		queue->tail = entry;
+	} else {
+		amdgpu_slab_release(entry);
+	}
+	pthread_mutex_unlock(&owner->mutex);
+	return 0;
+}
+
+drm_public int amdgpu_bo_slab_reclaim(amdgpu_bo_slab_handle owner)
+{
+	if (!owner)
+		return -EINVAL;
+
+	pthread_mutex_lock(&owner->mutex);
+	amdgpu_slab_reclaim_locked(owner);
+	pthread_mutex_unlock(&owner->mutex);
+	return 0;
+}
@@ -0,0 +1,465 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Streaming upload ring.
+ *
+ * Uploads are bumped out of a buffer which is mapped to the GPU and the CPU
+ * once.  Positions in the buffer are counted as if it repeated forever, so
+ * that the space in use is simply [tail, head).  Fences attached by
+ * amdgpu_upload_ring_fence() end a region at the head, and the tail moves
+ * past a region once its fence signaled.  That is only right with a single
+ * producer, whose fences come from one ring and in order.
+ *
+ * The head and the end of the space it may move into share a 64 bit word,
+ * which allocations bump with a compare and swap.  Only when that space
+ * runs out the mutex is taken, to move the tail past signaled regions,
+ * wrap around, or replace the buffer by one twice as large if the GPU
+ * still uses too much of it.  Replaced buffers are released once their
+ * last fence signaled.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+#define AMDGPU_UPLOAD_DEFAULT_SIZE	(1024 * 1024)
+#define AMDGPU_UPLOAD_MIN_SIZE		4096
+#define AMDGPU_UPLOAD_MAX_SIZE		(1u << 31)
+#define AMDGPU_UPLOAD_MAX_ALIGNMENT	(64 * 1024)
+
+/* atomic_t only holds an int, but head and limit have to change together */
+#define amdgpu_upload_cmpxchg(ptr, old, new) \
+	__sync_val_compare_and_swap(ptr, old, new)
+
+#define AMDGPU_UPLOAD_STATE(head, limit) \
+	(((uint64_t)(limit) << 32) | (uint32_t)(head))
+#define AMDGPU_UPLOAD_HEAD(state)	((uint32_t)(state))
+#define AMDGPU_UPLOAD_LIMIT(state)	((uint32_t)((state) >> 32))
+
+struct amdgpu_upload_region {
+	/* position the region ends at */
+	uint64_t end;
+	struct amdgpu_cs_fence fence;
+};
+
+struct amdgpu_upload_buffer {
+	/* in amdgpu_upload_ring::retired once replaced */
+	struct list_head list;
+	amdgpu_bo_handle bo;
+	amdgpu_va_handle va_handle;
+	uint64_t va;
+	void *cpu;
+	uint32_t size;
+	/* offset of the next allocation and the offset it may grow up to */
+	uint64_t state;
+	/* position of offset 0 in the current lap */
+	uint64_t lap;
+	/* positions up to which the buffer is reusable and fenced */
+	uint64_t tail;
+	uint64_t fenced;
+	/* fenced regions, oldest first, in a circular array */
+	struct amdgpu_upload_region *regions;
+	unsigned first_region;
+	unsigned num_regions;
+	unsigned max_regions;
+};
+
+struct amdgpu_upload_ring {
+	amdgpu_device_handle dev;
+	uint32_t heap;
+	uint64_t flags;
+	pthread_mutex_t mutex;
+	/* the buffer allocations are bumped in, only replaced under the
+	 * mutex */
+	struct amdgpu_upload_buffer *current;
+	/* replaced buffers.  They are kept until the ring is destroyed, as
+	 * allocations may still look at them, but their memory is released
+	 * once the GPU is done with it. */
+	struct list_head retired;
+	/* the fence attached last, later ones must follow it */
+	struct amdgpu_cs_fence last_fence;
+};
+
+static void amdgpu_upload_buffer_release(struct amdgpu_upload_buffer *buf)
+{
+	if (!buf->bo)
+		return;
+
+	amdgpu_bo_cpu_unmap(buf->bo);
+	amdgpu_bo_va_op(buf->bo, 0, buf->size, buf->va, 0, AMDGPU_VA_OP_UNMAP);
+	amdgpu_va_range_free(buf->va_handle);
+	amdgpu_bo_free(buf->bo);
+	buf->bo = NULL;
+	free(buf->regions);
+	buf->regions = NULL;
+	buf->num_regions = buf->max_regions = 0;
+}
+
+static struct amdgpu_upload_buffer *
+amdgpu_upload_buffer_create(struct amdgpu_upload_ring *ring, uint32_t size)
+{
+	struct amdgpu_bo_alloc_request request = {};
+	struct amdgpu_upload_buffer *buf;
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf)
+		return NULL;
+
+	request.alloc_size = size;
+	request.phys_alignment = AMDGPU_UPLOAD_MAX_ALIGNMENT;
+	request.preferred_heap = ring->heap;
+	request.flags = ring->flags;
+	if (amdgpu_bo_alloc(ring->dev, &request, &buf->bo))
+		goto error_bo_alloc;
+
+	if (amdgpu_va_range_alloc(ring->dev, amdgpu_gpu_va_range_general,
+				  size, AMDGPU_UPLOAD_MAX_ALIGNMENT, 0,
+				  &buf->va, &buf->va_handle, 0))
+		goto error_va_alloc;
+
+	if (amdgpu_bo_va_op(buf->bo, 0, size, buf->va, 0, AMDGPU_VA_OP_MAP))
+		goto error_va_map;
+
+	if (amdgpu_bo_cpu_map(buf->bo, &buf->cpu))
+		goto error_cpu_map;
+
+	buf->size = size;
+	buf->state = AMDGPU_UPLOAD_STATE(0, size);
+	list_inithead(&buf->list);
+	return buf;
+
+error_cpu_map:
+	amdgpu_bo_va_op(buf->bo, 0, size, buf->va, 0, AMDGPU_VA_OP_UNMAP);
+error_va_map:
+	amdgpu_va_range_free(buf->va_handle);
+error_va_alloc:
+	amdgpu_bo_free(buf->bo);
+error_bo_alloc:
+	free(buf);
+	return NULL;
+}
+
+/* Bumps the head without taking the mutex.  Fails once the space up to the
+ * limit is used up, which is right away for replaced buffers.
+ */
+static bool amdgpu_upload_bump(struct amdgpu_upload_buffer *buf,
+			       uint32_t size, uint32_t alignment,
+			       uint32_t *offset)
+{
+	uint64_t old = buf->state, prev;
+	uint32_t start, limit;
+
+	for (;;) {
+		start = ALIGN(AMDGPU_UPLOAD_HEAD(old), alignment);
+		limit = AMDGPU_UPLOAD_LIMIT(old);
+		if (start > limit || size > limit - start)
+			return false;
+
+		prev = amdgpu_upload_cmpxchg(&buf->state, old,
+					     AMDGPU_UPLOAD_STATE(start + size,
+								 limit));
+		if (prev == old)
+			break;
+		old = prev;
+	}
+	*offset = start;
+	return true;
+}
+
+static uint64_t amdgpu_upload_head(struct amdgpu_upload_buffer *buf)
+{
+	return buf->lap + AMDGPU_UPLOAD_HEAD(buf->state);
+}
+
+/* Moves the tail past the regions whose fences signaled. */
+static void amdgpu_upload_reclaim(struct amdgpu_upload_buffer *buf,
+				  struct amdgpu_fence_memo *memo)
+{
+	struct amdgpu_upload_region *region;
+
+	while (buf->num_regions) {
+		region = &buf->regions[buf->first_region];
+		if (!amdgpu_cs_fence_signaled(&region->fence, memo))
+			break;
+		buf->tail = region->end;
+		buf->first_region = (buf->first_region + 1) &
+				    (buf->max_regions - 1);
+		buf->num_regions--;
+	}
+}
+
+static int amdgpu_upload_add_region(struct amdgpu_upload_buffer *buf,
+				    uint64_t end,
+				    struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_upload_region *regions;
+	unsigned i, max;
+
+	if (buf->num_regions == buf->max_regions) {
+		max = MAX2(buf->max_regions * 2, 16);
+		regions = malloc(max * sizeof(*regions));
+		if (!regions)
+			return -ENOMEM;
+		for (i = 0; i < buf->num_regions; i++)
+			regions[i] = buf->regions[(buf->first_region + i) &
+						  (buf->max_regions - 1)];
+		free(buf->regions);
+		buf->regions = regions;
+		buf->first_region = 0;
+		buf->max_regions = max;
+	}
+
+	i = (buf->first_region + buf->num_regions) & (buf->max_regions - 1);
+	buf->regions[i].end = end;
+	buf->regions[i].fence = *fence;
+	buf->num_regions++;
+	buf->fenced = end;
+	return 0;
+}
+
+/* Stops allocations from a buffer for good and queues it for release. */
+static void amdgpu_upload_retire(struct amdgpu_upload_ring *ring,
+				 struct amdgpu_upload_buffer *buf)
+{
+	uint64_t old = buf->state, prev;
+
+	for (;;) {
+		prev = amdgpu_upload_cmpxchg(&buf->state, old,
+				AMDGPU_UPLOAD_STATE(AMDGPU_UPLOAD_HEAD(old),
+						    AMDGPU_UPLOAD_HEAD(old)));
+		if (prev == old)
+			break;
+		old = prev;
+	}
+	list_add(&buf->list, &ring->retired);
+}
+
+/* Releases replaced buffers whose regions all signaled.  Allocations made
+ * since the last fence keep a buffer alive.
+ */
+static void amdgpu_upload_reclaim_retired(struct amdgpu_upload_ring *ring,
+					  struct amdgpu_fence_memo *memo)
+{
+	struct amdgpu_upload_buffer *buf;
+
+	LIST_FOR_EACH_ENTRY(buf, &ring->retired, list) {
+		if (!buf->bo)
+			continue;
+		amdgpu_upload_reclaim(buf, memo);
+		if (!buf->num_regions && buf->fenced == amdgpu_upload_head(buf))
+			amdgpu_upload_buffer_release(buf);
+	}
+}
+
+/* Allocates once the space up to the limit ran out.  Called with the
+ * ring's mutex held.
+ */
+static int amdgpu_upload_alloc_locked(struct amdgpu_upload_ring *ring,
+				      uint32_t size, uint32_t alignment,
+				      struct amdgpu_upload_buffer **out,
+				      uint32_t *offset)
+{
+	struct amdgpu_upload_buffer *buf = ring->current;
+	struct amdgpu_fence_memo memo;
+	uint64_t old, start, end, lap, new_size;
+
+	memo.count = 0;
+	amdgpu_upload_reclaim(buf, &memo);
+	amdgpu_upload_reclaim_retired(ring, &memo);
+
+	for (;;) {
+		old = buf->state;
+		start = buf->lap + ALIGN(AMDGPU_UPLOAD_HEAD(old), alignment);
+		/* skip the rest of the lap if the allocation doesn't fit */
+		if (start + size > buf->lap + buf->size)
+			start = buf->lap + buf->size;
+		end = buf->tail + buf->size;
+
+		if (start + size > end) {
+			/* the GPU still uses too much of the buffer */
+			new_size = buf->size * 2;
+			while (new_size < size + alignment)
+				new_size *= 2;
+			if (new_size > AMDGPU_UPLOAD_MAX_SIZE)
+				return -ENOMEM;
+
+			buf = amdgpu_upload_buffer_create(ring, new_size);
+			if (!buf)
+				return -ENOMEM;
+			amdgpu_upload_retire(ring, ring->current);
+			/* publish the buffer only once it is set up */
+			__sync_synchronize();
+			ring->current = buf;
+			continue;
+		}
+
+		lap = start & ~(uint64_t)(buf->size - 1);
+		if (amdgpu_upload_cmpxchg(&buf->state, old,
+				AMDGPU_UPLOAD_STATE(start + size - lap,
+						    MIN2(lap + buf->size, end) - lap)) == old)
+			break;
+	}
+	buf->lap = lap;
+	*out = buf;
+	*offset = start - lap;
+	return 0;
+}
+
+drm_public int amdgpu_upload_ring_create(amdgpu_device_handle dev,
+					 uint64_t size,
+					 uint32_t heap,
+					 uint64_t flags,
+					 amdgpu_upload_ring_handle *ring)
+{
+	struct amdgpu_upload_ring *r;
+	uint32_t buf_size = AMDGPU_UPLOAD_MIN_SIZE;
+
+	if (!dev || !ring || size > AMDGPU_UPLOAD_MAX_SIZE)
+		return -EINVAL;
+	if (flags & AMDGPU_GEM_CREATE_NO_CPU_ACCESS)
+		return -EINVAL;
+
+	if (!size)
+		size = AMDGPU_UPLOAD_DEFAULT_SIZE;
+	while (buf_size < size)
+		buf_size *= 2;
+
+	r = calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+
+	r->dev = dev;
+	r->heap = heap;
+	r->flags = flags;
+	pthread_mutex_init(&r->mutex, NULL);
+	list_inithead(&r->retired);
+
+	r->current = amdgpu_upload_buffer_create(r, buf_size);
+	if (!r->current) {
+		pthread_mutex_destroy(&r->mutex);
+		free(r);
+		return -ENOMEM;
+	}
+
+	*ring = r;
+	return 0;
+}
+
+drm_public int amdgpu_upload_ring_destroy(amdgpu_upload_ring_handle ring)
+{
+	struct amdgpu_upload_buffer *buf, *next;
+
+	if (!ring)
+		return -EINVAL;
+
+	/* the kernel keeps buffers alive until the GPU is done with them */
+	LIST_FOR_EACH_ENTRY_SAFE(buf, next, &ring->retired, list) {
+		amdgpu_upload_buffer_release(buf);
+		free(buf);
+	}
+	amdgpu_upload_buffer_release(ring->current);
+	free(ring->current);
+
+	pthread_mutex_destroy(&ring->mutex);
+	free(ring);
+	return 0;
+}
+
+drm_public int amdgpu_upload_ring_alloc(amdgpu_upload_ring_handle ring,
+					uint64_t size,
+					uint32_t alignment,
+					struct amdgpu_upload_info *info)
+{
+	struct amdgpu_upload_buffer *buf;
+	uint32_t offset;
+	int r;
+
+	if (!ring || !info || !size || size > AMDGPU_UPLOAD_MAX_SIZE / 2)
+		return -EINVAL;
+	if (!alignment)
+		alignment = 1;
+	if (alignment & (alignment - 1) ||
+	    alignment > AMDGPU_UPLOAD_MAX_ALIGNMENT)
+		return -EINVAL;
+
+	buf = ring->current;
+	if (!amdgpu_upload_bump(buf, size, alignment, &offset)) {
+		pthread_mutex_lock(&ring->mutex);
+		r = amdgpu_upload_alloc_locked(ring, size, alignment, &buf,
+					       &offset);
+		pthread_mutex_unlock(&ring->mutex);
+		if (r)
+			return r;
+	}
+
+	info->bo = buf->bo;
+	info->offset = offset;
+	info->va = buf->va + offset;
+	info->cpu = (char *)buf->cpu + offset;
+	return 0;
+}
+
+drm_public int amdgpu_upload_ring_fence(amdgpu_upload_ring_handle ring,
+					struct amdgpu_cs_fence *fence)
+{
+	struct amdgpu_cs_fence *last;
+	struct amdgpu_upload_buffer *buf;
+	uint64_t head;
+	int r = 0;
+
+	if (!ring || !fence || !fence->context)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ring->mutex);
+	last = &ring->last_fence;
+	if (last->context &&
+	    (fence->context != last->context ||
+	     fence->ip_type != last->ip_type ||
+	     fence->ip_instance != last->ip_instance ||
+	     fence->ring != last->ring || fence->fence < last->fence)) {
+		r = -EINVAL;
+		goto out;
+	}
+	*last = *fence;
+
+	LIST_FOR_EACH_ENTRY(buf, &ring->retired, list) {
+		head = amdgpu_upload_head(buf);
+		if (buf->bo && head != buf->fenced) {
+			r = amdgpu_upload_add_region(buf, head, fence);
+			if (r)
+				goto out;
+		}
+	}
+	buf = ring->current;
+	head = amdgpu_upload_head(buf);
+	if (head != buf->fenced)
+		r = amdgpu_upload_add_region(buf, head, fence);
+out:
+	pthread_mutex_unlock(&ring->mutex);
+	return r;
+}
@@ -0,0 +1,373 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Userptr registration cache.
+ *
+ * Registering user memory makes the kernel pin and validate its pages,
+ * which is wasted work when a client wraps the same memory again.  The
+ * cache keeps registrations, page aligned and mapped to the GPU, in a skip
+ * list keyed by their start address.  They never overlap, so the one with
+ * the greatest start at or below an address is the only one which can
+ * contain it.  A request overlapping registrations without being contained
+ * in one replaces them by a registration of the union.
+ *
+ * Unused registrations are dropped in least recently used order once the
+ * cached ones pin more than the cache's limit.  Unmapping or remapping user
+ * memory has to be reported with amdgpu_userptr_cache_invalidate(), which
+ * applies to all caches of the process so that a munmap()/mremap() hook
+ * doesn't need to know about them.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_internal.h"
+#include "util_math.h"
+
+#define AMDGPU_USERPTR_DEFAULT_MAX_PINNED	(256ull * 1024 * 1024)
+
+struct amdgpu_userptr_entry {
+	/* in amdgpu_userptr_cache::lru while cached, then in ::retired until
+	 * it is unused
+	 */
+	struct list_head lru;
+	struct amdgpu_userptr_cache *cache;
+	uintptr_t start;
+	uintptr_t end;
+	amdgpu_bo_handle bo;
+	amdgpu_va_handle va_handle;
+	uint64_t va;
+	/* users since amdgpu_userptr_cache_get(), protected by the mutex */
+	unsigned use;
+	/* still found by lookups */
+	bool cached;
+};
+
+struct amdgpu_userptr_cache {
+	/* in amdgpu_userptr_caches */
+	struct list_head link;
+	amdgpu_device_handle dev;
+	pthread_mutex_t mutex;
+	/* cached entries by start address */
+	void *index;
+	/* cached entries, most recently used first */
+	struct list_head lru;
+	/* entries dropped from the cache while in use */
+	struct list_head retired;
+	uint64_t pinned;
+	uint64_t max_pinned;
+};
+
+static pthread_mutex_t amdgpu_userptr_caches_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head amdgpu_userptr_caches = {
+	&amdgpu_userptr_caches, &amdgpu_userptr_caches
+};
+
+static void amdgpu_userptr_release(struct amdgpu_userptr_entry *entry)
+{
+	amdgpu_bo_va_op(entry->bo, 0, entry->end - entry->start, entry->va, 0,
+			AMDGPU_VA_OP_UNMAP);
+	amdgpu_va_range_free(entry->va_handle);
+	amdgpu_bo_free(entry->bo);
+	free(entry);
+}
+
+/* Removes an entry from the cache, it is released once unused. */
+static void amdgpu_userptr_uncache(struct amdgpu_userptr_entry *entry)
+{
+	struct amdgpu_userptr_cache *cache = entry->cache;
+
+	drmSLDelete(cache->index, entry->start);
+	list_del(&entry->lru);
+	cache->pinned -= entry->end - entry->start;
+	entry->cached = false;
+	if (entry->use)
+		list_add(&entry->lru, &cache->retired);
+	else
+		amdgpu_userptr_release(entry);
+}
+
+/* Returns the entry with the greatest start at or below addr. */
+static struct amdgpu_userptr_entry *
+amdgpu_userptr_lookup(struct amdgpu_userptr_cache *cache, uintptr_t addr,
+		      unsigned long *next_key,
+		      struct amdgpu_userptr_entry **next)
+{
+	unsigned long prev_key;
+	void *prev_value, *next_value;
+
+	*next = NULL;
+	if (drmSLLookupNeighbors(cache->index, addr + 1, &prev_key,
+				 &prev_value, next_key, &next_value) == 2)
+		*next = next_value;
+	/* the list's head has no value */
+	return prev_value;
+}
+
+/* Drops the cached entries overlapping [start, end), or only grows the
+ * range to cover them if invalidate is false.
+ */
+static void amdgpu_userptr_overlap(struct amdgpu_userptr_cache *cache,
+				   uintptr_t *start, uintptr_t *end,
+				   bool invalidate)
+{
+	struct amdgpu_userptr_entry *entry, *next;
+	unsigned long next_key;
+
+	entry = amdgpu_userptr_lookup(cache, *start, &next_key, &next);
+	if (!entry || entry->end <= *start)
+		entry = next;
+
+	while (entry && entry->start < *end) {
+		/* look up the next one before the entry goes away */
+		amdgpu_userptr_lookup(cache, entry->start, &next_key, &next);
+		if (!invalidate) {
+			*start = MIN2(*start, entry->start);
+			*end = MAX2(*end, entry->end);
+		}
+		amdgpu_userptr_uncache(entry);
+		entry = next;
+	}
+}
+
+/* Drops unused entries, least recently used first, until the limit is
+ * met again.
+ */
+static void amdgpu_userptr_evict(struct amdgpu_userptr_cache *cache)
+{
+	struct amdgpu_userptr_entry *entry, *prev;
+
+	LIST_FOR_EACH_ENTRY_SAFE_REV(entry, prev, &cache->lru, lru) {
+		if (cache->pinned <= cache->max_pinned)
+			break;
+		if (!entry->use)
+			amdgpu_userptr_uncache(entry);
+	}
+}
+
+static int amdgpu_userptr_register(struct amdgpu_userptr_cache *cache,
+				   uintptr_t start, uintptr_t end,
+				   struct amdgpu_userptr_entry **out)
+{
+	struct amdgpu_userptr_entry *entry;
+	uint64_t size = end - start;
+	int r;
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return -ENOMEM;
+
+	r = amdgpu_create_bo_from_user_mem(cache->dev, (void *)start, size,
+					   &entry->bo);
+	if (r)
+		goto error_bo;
+
+	r = amdgpu_va_range_alloc(cache->dev, amdgpu_gpu_va_range_general,
+				  size, 0, 0, &entry->va, &entry->va_handle, 0);
+	if (r)
+		goto error_va_alloc;
+
+	r = amdgpu_bo_va_op(entry->bo, 0, size, entry->va, 0,
+			    AMDGPU_VA_OP_MAP);
+	if (r)
+		goto error_va_map;
+
+	if (drmSLInsert(cache->index, start, entry)) {
+		r = -ENOMEM;
+		goto error_insert;
+	}
+
+	entry->cache = cache;
+	entry->start = start;
+	entry->end = end;
+	entry->cached = true;
+	list_add(&entry->lru, &cache->lru);
+	cache->pinned += size;
+	*out = entry;
+	return 0;
+
+error_insert:
+	amdgpu_bo_va_op(entry->bo, 0, size, entry->va, 0, AMDGPU_VA_OP_UNMAP);
+error_va_map:
+	amdgpu_va_range_free(entry->va_handle);
+error_va_alloc:
+	amdgpu_bo_free(entry->bo);
+error_bo:
+	free(entry);
+	return r;
+}
+
+drm_public int amdgpu_userptr_cache_create(amdgpu_device_handle dev,
+					   uint64_t max_pinned,
+					   amdgpu_userptr_cache_handle *cache)
+{
+	struct amdgpu_userptr_cache *c;
+
+	if (!dev || !cache)
+		return -EINVAL;
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return -ENOMEM;
+
+	c->index = drmSLCreate();
+	if (!c->index) {
+		free(c);
+		return -ENOMEM;
+	}
+
+	c->dev = dev;
+	c->max_pinned = max_pinned ? max_pinned :
+			AMDGPU_USERPTR_DEFAULT_MAX_PINNED;
+	pthread_mutex_init(&c->mutex, NULL);
+	list_inithead(&c->lru);
+	list_inithead(&c->retired);
+
+	pthread_mutex_lock(&amdgpu_userptr_caches_mutex);
+	list_add(&c->link, &amdgpu_userptr_caches);
+	pthread_mutex_unlock(&amdgpu_userptr_caches_mutex);
+
+	*cache = c;
+	return 0;
+}
+
+drm_public int amdgpu_userptr_cache_destroy(amdgpu_userptr_cache_handle cache)
+{
+	struct amdgpu_userptr_entry *entry, *next;
+
+	if (!cache)
+		return -EINVAL;
+
+	pthread_mutex_lock(&amdgpu_userptr_caches_mutex);
+	list_del(&cache->link);
+	pthread_mutex_unlock(&amdgpu_userptr_caches_mutex);
+
+	/* entries still in use are released by amdgpu_userptr_cache_put() */
+	pthread_mutex_lock(&cache->mutex);
+	LIST_FOR_EACH_ENTRY_SAFE(entry, next, &cache->lru, lru) {
+		if (entry->use) {
+			list_del(&entry->lru);
+			entry->cached = false;
+			entry->cache = NULL;
+		} else {
+			amdgpu_userptr_release(entry);
+		}
+	}
+	LIST_FOR_EACH_ENTRY_SAFE(entry, next, &cache->retired, lru) {
+		list_del(&entry->lru);
+		entry->cache = NULL;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	drmSLDestroy(cache->index);
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache);
+	return 0;
+}
+
+drm_public int amdgpu_userptr_cache_get(amdgpu_userptr_cache_handle cache,
+					void *cpu, uint64_t size,
+					amdgpu_userptr_entry_handle *entry,
+					struct amdgpu_userptr_info *info)
+{
+	uintptr_t addr = (uintptr_t)cpu, page_mask = getpagesize() - 1;
+	uintptr_t start, end;
+	struct amdgpu_userptr_entry *e, *next;
+	unsigned long next_key;
+	int r = 0;
+
+	if (!cache || !cpu || !size || !entry || !info ||
+	    addr + size < addr)
+		return -EINVAL;
+
+	pthread_mutex_lock(&cache->mutex);
+	e = amdgpu_userptr_lookup(cache, addr, &next_key, &next);
+	if (e && addr + size <= e->end) {
+		list_del(&e->lru);
+		list_add(&e->lru, &cache->lru);
+	} else {
+		start = addr & ~page_mask;
+		end = (addr + size + page_mask) & ~page_mask;
+		amdgpu_userptr_overlap(cache, &start, &end, false);
+		r = amdgpu_userptr_register(cache, start, end, &e);
+		if (r)
+			goto out;
+	}
+
+	e->use++;
+	amdgpu_userptr_evict(cache);
+
+	*entry = e;
+	info->bo = e->bo;
+	info->offset = addr - e->start;
+	info->va = e->va + info->offset;
+out:
+	pthread_mutex_unlock(&cache->mutex);
+	return r;
+}
+
+drm_public int amdgpu_userptr_cache_put(amdgpu_userptr_entry_handle entry)
+{
+	struct amdgpu_userptr_cache *cache;
+
+	if (!entry)
+		return -EINVAL;
+
+	/* the cache is gone if it was destroyed while the entry was used */
+	cache = entry->cache;
+	if (cache)
+		pthread_mutex_lock(&cache->mutex);
+	if (!--entry->use && !entry->cached) {
+		if (cache)
+			list_del(&entry->lru);
+		amdgpu_userptr_release(entry);
+	} else if (cache)
+		amdgpu_userptr_evict(cache);
+	if (cache)
+		pthread_mutex_unlock(&cache->mutex);
+	return 0;
+}
+
+drm_public int amdgpu_userptr_cache_invalidate(void *cpu, uint64_t size)
+{
+	struct amdgpu_userptr_cache *cache;
+	uintptr_t start = (uintptr_t)cpu, end = start + size;
+
+	if (!size)
+		return 0;
+	if (end < start)
+		return -EINVAL;
+
+	pthread_mutex_lock(&amdgpu_userptr_caches_mutex);
+	LIST_FOR_EACH_ENTRY(cache, &amdgpu_userptr_caches, link) {
+		pthread_mutex_lock(&cache->mutex);
+		amdgpu_userptr_overlap(cache, &start, &end, true);
+		pthread_mutex_unlock(&cache->mutex);
+	}
+	pthread_mutex_unlock(&amdgpu_userptr_caches_mutex);
+	return 0;
+}
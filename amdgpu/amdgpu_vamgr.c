@@ -42,12 +42,16 @@ drm_public int amdgpu_va_range_query(amdgpu_device_handle dev,
 }
 
 drm_private void amdgpu_vamgr_init(struct amdgpu_bo_va_mgr *mgr, uint64_t start,
-				   uint64_t max, uint64_t alignment)
+				   uint64_t max, uint64_t alignment,
+				   uint64_t fragment_size)
 {
 	struct amdgpu_bo_va_hole *n;
 
 	mgr->va_max = max;
 	mgr->va_alignment = alignment;
+	mgr->fragment_size = fragment_size;
+	mgr->large_allocs = 0;
+	mgr->large_aligned = 0;
 
 	list_inithead(&mgr->va_holes);
 	pthread_mutex_init(&mgr->bo_va_mutex, NULL);
@@ -69,21 +73,23 @@ drm_private void amdgpu_vamgr_deinit(struct amdgpu_bo_va_mgr *mgr)
 	pthread_mutex_destroy(&mgr->bo_va_mutex);
 }
 
-static drm_private uint64_t
-amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
-		     uint64_t alignment, uint64_t base_required)
+/*
+ * Large allocations are placed on PTE fragment boundaries, so that the
+ * kernel can map them with large fragments, which take fewer TLB entries.
+ * Small allocations are taken from the bottom of the range and large ones
+ * from the top, so the two grow towards each other instead of small
+ * allocations ending up in the gaps between large ones and breaking up the
+ * aligned space.
+ */
+
+/* Bottom up first fit, called with the mutex held */
+static uint64_t
+amdgpu_vamgr_find_hole(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
+		       uint64_t alignment, uint64_t base_required)
 {
 	struct amdgpu_bo_va_hole *hole, *n;
 	uint64_t offset = 0, waste = 0;
 
-
-	alignment = MAX2(alignment, mgr->va_alignment);
-	size = ALIGN(size, mgr->va_alignment);
-
-	if (base_required % alignment)
-		return AMDGPU_INVALID_VA_ADDRESS;
-
-	pthread_mutex_lock(&mgr->bo_va_mutex);
 	LIST_FOR_EACH_ENTRY_SAFE_REV(hole, n, &mgr->va_holes, list) {
 		if (base_required) {
 			if (hole->offset > base_required ||
@@ -104,7 +110,6 @@ amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 			offset = hole->offset;
 			list_del(&hole->list);
 			free(hole);
-			pthread_mutex_unlock(&mgr->bo_va_mutex);
 			return offset;
 		}
 		if ((hole->size - waste) > size) {
@@ -116,21 +121,90 @@ amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
 			}
 			hole->size -= (size + waste);
 			hole->offset += size + waste;
-			pthread_mutex_unlock(&mgr->bo_va_mutex);
 			return offset;
 		}
 		if ((hole->size - waste) == size) {
 			hole->size = waste;
-			pthread_mutex_unlock(&mgr->bo_va_mutex);
 			return offset;
 		}
 	}
 
-	pthread_mutex_unlock(&mgr->bo_va_mutex);
 	return AMDGPU_INVALID_VA_ADDRESS;
 }
 
-static drm_private void
+/* Top down first fit, called with the mutex held */
+static uint64_t
+amdgpu_vamgr_find_hole_top(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
+			   uint64_t alignment)
+{
+	struct amdgpu_bo_va_hole *hole, *n;
+	uint64_t offset, end;
+
+	/* the holes are sorted by descending offset */
+	LIST_FOR_EACH_ENTRY(hole, &mgr->va_holes, list) {
+		if (hole->size < size)
+			continue;
+
+		end = hole->offset + hole->size;
+		offset = end - size;
+		offset -= offset % alignment;
+		if (offset < hole->offset)
+			continue;
+
+		if (offset + size != end) {
+			n = calloc(1, sizeof(struct amdgpu_bo_va_hole));
+			if (!n)
+				return AMDGPU_INVALID_VA_ADDRESS;
+			n->offset = offset + size;
+			n->size = end - n->offset;
+			list_addtail(&n->list, &hole->list);
+		}
+
+		hole->size = offset - hole->offset;
+		if (!hole->size) {
+			list_del(&hole->list);
+			free(hole);
+		}
+		return offset;
+	}
+
+	return AMDGPU_INVALID_VA_ADDRESS;
+}
+
+drm_private uint64_t
+amdgpu_vamgr_find_va(struct amdgpu_bo_va_mgr *mgr, uint64_t size,
+		     uint64_t alignment, uint64_t base_required)
+{
+	uint64_t offset = AMDGPU_INVALID_VA_ADDRESS;
+	bool large;
+
+	alignment = MAX2(alignment, mgr->va_alignment);
+	size = ALIGN(size, mgr->va_alignment);
+
+	if (base_required % alignment)
+		return AMDGPU_INVALID_VA_ADDRESS;
+
+	large = mgr->fragment_size && size >= mgr->fragment_size;
+
+	pthread_mutex_lock(&mgr->bo_va_mutex);
+	if (large && !base_required)
+		offset = amdgpu_vamgr_find_hole_top(mgr, size,
+					MAX2(alignment, mgr->fragment_size));
+	/* without aligned space left, any placement is better than none */
+	if (offset == AMDGPU_INVALID_VA_ADDRESS)
+		offset = amdgpu_vamgr_find_hole(mgr, size, alignment,
+						base_required);
+
+	if (large && offset != AMDGPU_INVALID_VA_ADDRESS) {
+		mgr->large_allocs++;
+		if (offset % mgr->fragment_size == 0)
+			mgr->large_aligned++;
+	}
+	pthread_mutex_unlock(&mgr->bo_va_mutex);
+	return offset;
+}
+
+drm_private void
 amdgpu_vamgr_free_va(struct amdgpu_bo_va_mgr *mgr, uint64_t va, uint64_t size)
 {
 	struct amdgpu_bo_va_hole *hole, *next;
@@ -186,6 +260,22 @@ out:
 	pthread_mutex_unlock(&mgr->bo_va_mutex);
 }
 
+static struct amdgpu_bo_va_mgr *
+amdgpu_vamgr_select(amdgpu_device_handle dev, uint64_t flags)
+{
+	if (flags & AMDGPU_VA_RANGE_HIGH) {
+		if (flags & AMDGPU_VA_RANGE_32_BIT)
+			return &dev->vamgr_high_32;
+		else
+			return &dev->vamgr_high;
+	} else {
+		if (flags & AMDGPU_VA_RANGE_32_BIT)
+			return &dev->vamgr_32;
+		else
+			return &dev->vamgr;
+	}
+}
+
 drm_public int amdgpu_va_range_alloc(amdgpu_device_handle dev,
 				     enum amdgpu_gpu_va_range va_range_type,
 				     uint64_t size,
@@ -201,17 +291,7 @@ drm_public int amdgpu_va_range_alloc(amdgpu_device_handle dev,
 	if (flags & AMDGPU_VA_RANGE_HIGH && !dev->vamgr_high_32.va_max)
 		flags &= ~AMDGPU_VA_RANGE_HIGH;
 
-	if (flags & AMDGPU_VA_RANGE_HIGH) {
-		if (flags & AMDGPU_VA_RANGE_32_BIT)
-			vamgr = &dev->vamgr_high_32;
-		else
-			vamgr = &dev->vamgr_high;
-	} else {
-		if (flags & AMDGPU_VA_RANGE_32_BIT)
-			vamgr = &dev->vamgr_32;
-		else
-			vamgr = &dev->vamgr;
-	}
+	vamgr = amdgpu_vamgr_select(dev, flags);
 
 	va_base_alignment = MAX2(va_base_alignment, vamgr->va_alignment);
 	size = ALIGN(size, vamgr->va_alignment);
@@ -261,3 +341,40 @@ drm_public int amdgpu_va_range_free(amdgpu_va_handle va_range_handle)
 	free(va_range_handle);
 	return 0;
 }
+
+drm_public int amdgpu_va_range_query_stats(amdgpu_device_handle dev,
+					   enum amdgpu_gpu_va_range type,
+					   uint64_t flags,
+					   struct amdgpu_va_range_stats *stats)
+{
+	struct amdgpu_bo_va_hole *hole;
+	struct amdgpu_bo_va_mgr *mgr;
+	uint64_t start, end;
+
+	if (!dev || type != amdgpu_gpu_va_range_general || !stats)
+		return -EINVAL;
+
+	if (flags & AMDGPU_VA_RANGE_HIGH && !dev->vamgr_high_32.va_max)
+		flags &= ~AMDGPU_VA_RANGE_HIGH;
+	mgr = amdgpu_vamgr_select(dev, flags);
+
+	memset(stats, 0, sizeof(*stats));
+	pthread_mutex_lock(&mgr->bo_va_mutex);
+	stats->fragment_size = mgr->fragment_size;
+	stats->large_allocs = mgr->large_allocs;
+	stats->large_aligned = mgr->large_aligned;
+	LIST_FOR_EACH_ENTRY(hole, &mgr->va_holes, list) {
+		stats->free += hole->size;
+		stats->largest_free = MAX2(stats->largest_free, hole->size);
+		stats->free_blocks++;
+		if (!mgr->fragment_size)
+			continue;
+
+		start = ALIGN(hole->offset, mgr->fragment_size);
+		end = (hole->offset + hole->size) & ~(mgr->fragment_size - 1);
+		if (end > start)
+			stats->fragment_free += end - start;
+	}
+	pthread_mutex_unlock(&mgr->bo_va_mutex);
+	return 0;
+}
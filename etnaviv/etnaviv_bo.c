@@ -29,6 +29,8 @@
 
 drm_private pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
 drm_private void bo_del(struct etna_bo *bo);
+drm_private void bo_close(struct etna_bo *bo);
+drm_private void bo_free(struct etna_bo *bo);
 
 /* set buffer name, and add to table, call w/ table_lock held: */
 static void set_name(struct etna_bo *bo, uint32_t name)
@@ -38,12 +40,11 @@ static void set_name(struct etna_bo *bo, uint32_t name)
 	drmHashInsert(bo->dev->name_table, name, bo);
 }
 
-/* Called under table_lock */
-drm_private void bo_del(struct etna_bo *bo)
+/* Closes the GEM handle.  Called under table_lock, so that the handle
+ * cannot be reused by a racing import before it is out of the tables.
+ */
+drm_private void bo_close(struct etna_bo *bo)
 {
-	if (bo->map)
-		drm_munmap(bo->map, bo->size);
-
 	if (bo->name)
 		drmHashDelete(bo->dev->name_table, bo->name);
 
@@ -55,10 +56,24 @@ drm_private void bo_del(struct etna_bo *bo)
 		drmHashDelete(bo->dev->handle_table, bo->handle);
 		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
 	}
+}
+
+/* Frees a closed bo, does not need table_lock */
+drm_private void bo_free(struct etna_bo *bo)
+{
+	if (bo->map)
+		drm_munmap(bo->map, bo->size);
 
 	free(bo);
 }
 
+/* Called under table_lock */
+drm_private void bo_del(struct etna_bo *bo)
+{
+	bo_close(bo);
+	bo_free(bo);
+}
+
 /* lookup a buffer from it's handle, call w/ table_lock held: */
 static struct etna_bo *lookup_bo(void *tbl, uint32_t handle)
 {
@@ -69,7 +84,8 @@ static struct etna_bo *lookup_bo(void *tbl, uint32_t handle)
 		bo = etna_bo_ref(bo);
 
 		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
+		if (!LIST_IS_EMPTY(&bo->list))
+			etna_bo_cache_remove(&bo->dev->bo_cache, bo);
 	}
 
 	return bo;
@@ -26,15 +26,23 @@
 
 #include "etnaviv_priv.h"
 #include "etnaviv_drmif.h"
+#include "util_bucket.h"
 
 drm_private void bo_del(struct etna_bo *bo);
+drm_private void bo_close(struct etna_bo *bo);
+drm_private void bo_free(struct etna_bo *bo);
 drm_private extern pthread_mutex_t table_lock;
 
+/* max number of bo's the reaper closes per table_lock hold */
+#define REAP_BATCH 32
+
 static void add_bucket(struct etna_bo_cache *cache, int size)
 {
 	unsigned i = cache->num_buckets;
 
 	assert(i < ARRAY_SIZE(cache->cache_bucket));
+	/* get_bucket() computes the index from the size: */
+	assert(util_bucket_index(size) == i);
 
 	list_inithead(&cache->cache_bucket[i].list);
 	cache->cache_bucket[i].size = size;
@@ -85,7 +93,8 @@ drm_private void etna_bo_cache_cleanup(struct etna_bo_cache *cache, time_t time)
 			if (time && ((time - bo->free_time) <= 1))
 				break;
 
-			list_del(&bo->list);
+			etna_bo_cache_remove(cache, bo);
+			cache->evictions++;
 			bo_del(bo);
 		}
 	}
@@ -93,21 +102,94 @@ drm_private void etna_bo_cache_cleanup(struct etna_bo_cache *cache, time_t time)
 	cache->time = time;
 }
 
-static struct etna_bo_bucket *get_bucket(struct etna_bo_cache *cache, uint32_t size)
+/* Unlinks a bo from its bucket.  Called under table_lock */
+drm_private void etna_bo_cache_remove(struct etna_bo_cache *cache, struct etna_bo *bo)
 {
-	unsigned i;
+	list_delinit(&bo->list);
+	cache->size -= bo->size;
+	cache->count--;
+}
 
-	/* hmm, this is what intel does, but I suppose we could calculate our
-	 * way to the correct bucket size rather than looping..
-	 */
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct etna_bo_bucket *bucket = &cache->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
+/* Moves up to @max of the oldest bo's which are either expired or over
+ * the cache's budget to @victims.  Called under table_lock
+ */
+static unsigned etna_bo_cache_evict(struct etna_bo_cache *cache, time_t time,
+		struct list_head *victims, unsigned max)
+{
+	unsigned i, n = 0;
+
+	while (n < max) {
+		struct etna_bo *bo, *oldest = NULL;
+
+		/* buckets are in free_time order, so the oldest bo is at
+		 * the head of one of them:
+		 */
+		for (i = 0; i < cache->num_buckets; i++) {
+			struct etna_bo_bucket *bucket = &cache->cache_bucket[i];
+
+			if (LIST_IS_EMPTY(&bucket->list))
+				continue;
+			bo = LIST_ENTRY(struct etna_bo, bucket->list.next, list);
+			if (!oldest || bo->free_time < oldest->free_time)
+				oldest = bo;
 		}
+
+		if (!oldest)
+			break;
+		if ((time - oldest->free_time) <= cache->max_age &&
+				(!cache->max_size || cache->size <= cache->max_size))
+			break;
+
+		etna_bo_cache_remove(cache, oldest);
+		cache->evictions++;
+		list_addtail(&oldest->list, victims);
+		n++;
 	}
 
-	return NULL;
+	return n;
+}
+
+/* Reaper callback, the background counterpart of etna_bo_cache_cleanup().
+ * The GEM handles are closed in batches under table_lock, the unmapping
+ * and freeing is done after dropping it.  Never waits for table_lock, as
+ * etna_device_del() holds it while unregistering from the reaper; whatever
+ * is left over is picked up on the next run.
+ */
+drm_private void etna_bo_cache_reap(void *data)
+{
+	struct etna_device *dev = data;
+	struct timespec time;
+	unsigned n;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	do {
+		struct list_head victims;
+		struct etna_bo *bo, *tmp;
+
+		list_inithead(&victims);
+
+		if (pthread_mutex_trylock(&table_lock))
+			return;
+		n = etna_bo_cache_evict(&dev->bo_cache, time.tv_sec,
+				&victims, REAP_BATCH);
+		LIST_FOR_EACH_ENTRY(bo, &victims, list)
+			bo_close(bo);
+		pthread_mutex_unlock(&table_lock);
+
+		LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &victims, list)
+			bo_free(bo);
+	} while (n == REAP_BATCH);
+}
+
+static struct etna_bo_bucket *get_bucket(struct etna_bo_cache *cache, uint32_t size)
+{
+	unsigned i = util_bucket_index(size);
+
+	if (i >= cache->num_buckets)
+		return NULL;
+
+	return &cache->cache_bucket[i];
 }
 
 static int is_idle(struct etna_bo *bo)
@@ -118,14 +200,17 @@ static int is_idle(struct etna_bo *bo)
 			DRM_ETNA_PREP_NOSYNC) == 0;
 }
 
-static struct etna_bo *find_in_bucket(struct etna_bo_bucket *bucket, uint32_t flags)
+static struct etna_bo *find_in_bucket(struct etna_bo_cache *cache,
+		struct etna_bo_bucket *bucket, uint32_t flags)
 {
 	struct etna_bo *bo = NULL, *tmp;
 
 	pthread_mutex_lock(&table_lock);
 
-	if (LIST_IS_EMPTY(&bucket->list))
+	if (LIST_IS_EMPTY(&bucket->list)) {
+		cache->misses++;
 		goto out_unlock;
+	}
 
 	LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &bucket->list, list) {
 		/* skip BOs with different flags */
@@ -134,7 +219,8 @@ static struct etna_bo *find_in_bucket(struct etna_bo_bucket *bucket, uint32_t fl
 
 		/* check if the first BO with matching flags is idle */
 		if (is_idle(bo)) {
-			list_delinit(&bo->list);
+			etna_bo_cache_remove(cache, bo);
+			cache->hits++;
 			goto out_unlock;
 		}
 
@@ -144,6 +230,7 @@ static struct etna_bo *find_in_bucket(struct etna_bo_bucket *bucket, uint32_t fl
 
 	/* There was no matching buffer found */
 	bo = NULL;
+	cache->misses++;
 
 out_unlock:
 	pthread_mutex_unlock(&table_lock);
@@ -167,7 +254,7 @@ drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache, uin
 	/* see if we can be green and recycle: */
 	if (bucket) {
 		*size = bucket->size;
-		bo = find_in_bucket(bucket, flags);
+		bo = find_in_bucket(cache, bucket, flags);
 		if (bo) {
 			atomic_set(&bo->refcnt, 1);
 			etna_device_ref(bo->dev);
@@ -190,7 +277,13 @@ drm_private int etna_bo_cache_free(struct etna_bo_cache *cache, struct etna_bo *
 
 		bo->free_time = time.tv_sec;
 		list_addtail(&bo->list, &bucket->list);
-		etna_bo_cache_cleanup(cache, time.tv_sec);
+		cache->size += bo->size;
+		cache->count++;
+
+		if (!bo->dev->reaper)
+			etna_bo_cache_cleanup(cache, time.tv_sec);
+		else if (cache->max_size && cache->size > cache->max_size)
+			drmReaperKick(bo->dev->reaper);
 
 		/* bo's in the bucket cache don't have a ref and
 		 * don't hold a ref to the dev:
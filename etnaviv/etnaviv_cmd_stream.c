@@ -29,7 +29,7 @@
 #include "etnaviv_drmif.h"
 #include "etnaviv_priv.h"
 
-static pthread_mutex_t idx_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_t stream_id;
 
 static void *grow(void *ptr, uint32_t nr, uint32_t *max, uint32_t sz)
 {
@@ -84,6 +84,9 @@ drm_public struct etna_cmd_stream *etna_cmd_stream_new(struct etna_pipe *pipe,
 
 	stream->base.size = size;
 	stream->pipe = pipe;
+	do {
+		stream->id = atomic_inc_return(&stream_id);
+	} while (!stream->id);
 	stream->reset_notify = reset_notify;
 	stream->reset_notify_priv = priv;
 
@@ -100,6 +103,8 @@ drm_public void etna_cmd_stream_del(struct etna_cmd_stream *stream)
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
 
+	if (priv->bo_table)
+		drmHashDestroy(priv->bo_table);
 	free(stream->buffer);
 	free(priv->submit.relocs);
 	free(priv->submit.pmrs);
@@ -116,6 +121,11 @@ static void reset_buffer(struct etna_cmd_stream *stream)
 	priv->submit.nr_pmrs = 0;
 	priv->nr_bos = 0;
 
+	if (priv->bo_table) {
+		drmHashDestroy(priv->bo_table);
+		priv->bo_table = NULL;
+	}
+
 	if (priv->reset_notify)
 		priv->reset_notify(stream, priv->reset_notify_priv);
 }
@@ -147,26 +157,25 @@ static uint32_t bo2idx(struct etna_cmd_stream *stream, struct etna_bo *bo,
 {
 	struct etna_cmd_stream_priv *priv = etna_cmd_stream_priv(stream);
 	uint32_t idx;
+	void *val;
 
-	pthread_mutex_lock(&idx_lock);
-
-	if (!bo->current_stream) {
+	if (atomic_read(&bo->current_stream) == priv->id) {
+		idx = bo->idx;
+	} else if (priv->bo_table &&
+		   !drmHashLookup(priv->bo_table, bo->handle, &val)) {
+		/* referenced before, while claimed by another stream */
+		idx = (uint32_t)(uintptr_t)val;
+	} else if (atomic_cmpxchg(&bo->current_stream, 0, priv->id) == 0) {
 		idx = append_bo(stream, bo);
-		bo->current_stream = stream;
 		bo->idx = idx;
-	} else if (bo->current_stream == stream) {
-		idx = bo->idx;
 	} else {
 		/* slow-path: */
-		for (idx = 0; idx < priv->nr_bos; idx++)
-			if (priv->bos[idx] == bo)
-				break;
-		if (idx == priv->nr_bos) {
-			/* not found */
-			idx = append_bo(stream, bo);
-		}
+		if (!priv->bo_table)
+			priv->bo_table = drmHashCreate();
+
+		idx = append_bo(stream, bo);
+		drmHashInsert(priv->bo_table, bo->handle, (void *)(uintptr_t)idx);
 	}
-	pthread_mutex_unlock(&idx_lock);
 
 	if (flags & ETNA_RELOC_READ)
 		priv->submit.bos[idx].flags |= ETNA_SUBMIT_BO_READ;
@@ -215,7 +224,7 @@ static void flush(struct etna_cmd_stream *stream, int in_fence_fd,
 	for (uint32_t i = 0; i < priv->nr_bos; i++) {
 		struct etna_bo *bo = priv->bos[i];
 
-		bo->current_stream = NULL;
+		atomic_cmpxchg(&bo->current_stream, priv->id, 0);
 		etna_bo_del(bo);
 	}
 
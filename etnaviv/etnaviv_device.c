@@ -39,7 +39,8 @@
 #include "etnaviv_priv.h"
 #include "etnaviv_drmif.h"
 
-static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+/* shared with the bo's, which the cache cleanup in etna_device_del() frees */
+drm_private extern pthread_mutex_t table_lock;
 
 drm_public struct etna_device *etna_device_new(int fd)
 {
@@ -81,6 +82,7 @@ drm_public struct etna_device *etna_device_ref(struct etna_device *dev)
 
 static void etna_device_del_impl(struct etna_device *dev)
 {
+	drmReaperUnregister(dev->reaper);
 	etna_bo_cache_cleanup(&dev->bo_cache, 0);
 	drmHashDestroy(dev->handle_table);
 	drmHashDestroy(dev->name_table);
@@ -113,3 +115,37 @@ drm_public int etna_device_fd(struct etna_device *dev)
 {
    return dev->fd;
 }
+
+drm_public int etna_device_enable_cache_reaper(struct etna_device *dev,
+		uint64_t max_size, uint32_t max_age)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&table_lock);
+	dev->bo_cache.max_size = max_size;
+	dev->bo_cache.max_age = max_age ? max_age : 1;
+	if (!dev->reaper) {
+		dev->reaper = drmReaperRegister(etna_bo_cache_reap, dev, 500);
+		if (!dev->reaper)
+			ret = -ENOMEM;
+	} else {
+		drmReaperKick(dev->reaper);
+	}
+	pthread_mutex_unlock(&table_lock);
+
+	return ret;
+}
+
+drm_public void etna_device_get_cache_stats(struct etna_device *dev,
+		struct etna_bo_cache_stats *stats)
+{
+	struct etna_bo_cache *cache = &dev->bo_cache;
+
+	pthread_mutex_lock(&table_lock);
+	stats->hits = cache->hits;
+	stats->misses = cache->misses;
+	stats->evictions = cache->evictions;
+	stats->size = cache->size;
+	stats->count = cache->count;
+	pthread_mutex_unlock(&table_lock);
+}
@@ -92,6 +92,24 @@ struct etna_device *etna_device_ref(struct etna_device *dev);
 void etna_device_del(struct etna_device *dev);
 int etna_device_fd(struct etna_device *dev);
 
+/* bo cache occupancy and hit-rate: */
+struct etna_bo_cache_stats {
+	uint64_t hits;          /* allocations served from the cache */
+	uint64_t misses;        /* cacheable allocations which were not */
+	uint64_t evictions;     /* cached bo's freed */
+	uint64_t size;          /* bytes currently cached */
+	uint32_t count;         /* bo's currently cached */
+};
+
+/* Free cached bo's from the shared background reaper thread rather than
+ * from etna_bo_del(), once they are older than max_age seconds or when
+ * the cache holds more than max_size bytes (0 for no limit):
+ */
+int etna_device_enable_cache_reaper(struct etna_device *dev,
+		uint64_t max_size, uint32_t max_age);
+void etna_device_get_cache_stats(struct etna_device *dev,
+		struct etna_bo_cache_stats *stats);
+
 /* gpu functions:
  */
 
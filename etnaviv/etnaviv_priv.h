@@ -56,6 +56,14 @@ struct etna_bo_cache {
 	struct etna_bo_bucket cache_bucket[14 * 4];
 	unsigned num_buckets;
 	time_t time;
+
+	/* limits enforced by the background reaper, if enabled: */
+	uint64_t max_size;
+	time_t max_age;
+
+	uint64_t size;
+	uint32_t count;
+	uint64_t hits, misses, evictions;
 };
 
 struct etna_device {
@@ -74,12 +82,15 @@ struct etna_device {
 	void *handle_table, *name_table;
 
 	struct etna_bo_cache bo_cache;
+	void *reaper;       /* drmReaperRegister() handle, if enabled */
 
 	int closefd;        /* call close(fd) upon destruction */
 };
 
 drm_private void etna_bo_cache_init(struct etna_bo_cache *cache);
 drm_private void etna_bo_cache_cleanup(struct etna_bo_cache *cache, time_t time);
+drm_private void etna_bo_cache_reap(void *data);
+drm_private void etna_bo_cache_remove(struct etna_bo_cache *cache, struct etna_bo *bo);
 drm_private struct etna_bo *etna_bo_cache_alloc(struct etna_bo_cache *cache,
 		uint32_t *size, uint32_t flags);
 drm_private int etna_bo_cache_free(struct etna_bo_cache *cache, struct etna_bo *bo);
@@ -99,13 +110,13 @@ struct etna_bo {
 	atomic_t        refcnt;
 
 	/* in the common case, a bo won't be referenced by more than a single
-	 * command stream.  So to avoid looping over all the bo's in the
-	 * reloc table to find the idx of a bo that might already be in the
-	 * table, we cache the idx in the bo.  But in order to detect the
-	 * slow-path where bo is ref'd in multiple streams, we also must track
-	 * the current_stream for which the idx is valid.  See bo2idx().
+	 * command stream.  So the first stream to reference the bo claims it
+	 * by atomically setting current_stream to its id, and caches the idx
+	 * in the bo until it flushes.  Only the owning stream writes idx, so
+	 * it can be read without locking.  Other streams referencing the bo
+	 * meanwhile fall back to their bo_table.  See bo2idx().
 	 */
-	struct etna_cmd_stream *current_stream;
+	atomic_t current_stream;
 	uint32_t idx;
 
 	int reuse;
@@ -150,6 +161,12 @@ struct etna_cmd_stream_priv {
 	struct etna_bo **bos;
 	uint32_t nr_bos, max_bos;
 
+	/* unique id, for etna_bo::current_stream: */
+	int id;
+
+	/* maps handle to idx for bo's claimed by other streams: */
+	void *bo_table;
+
 	/* notify callback if buffer reset happened */
 	void (*reset_notify)(struct etna_cmd_stream *stream, void *priv);
 	void *reset_notify_priv;
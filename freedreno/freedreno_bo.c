@@ -31,6 +31,8 @@
 
 drm_private pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
 drm_private void bo_del(struct fd_bo *bo);
+drm_private void bo_close(struct fd_bo *bo);
+drm_private void bo_free(struct fd_bo *bo);
 
 /* set buffer name, and add to table, call w/ table_lock held: */
 static void set_name(struct fd_bo *bo, uint32_t name)
@@ -49,7 +51,11 @@ static struct fd_bo * lookup_bo(void *tbl, uint32_t key)
 		bo = fd_bo_ref(bo);
 
 		/* don't break the bucket if this bo was found in one */
-		list_delinit(&bo->list);
+		if (!LIST_IS_EMPTY(&bo->list)) {
+			struct fd_device *dev = bo->dev;
+			fd_bo_cache_remove((bo->bo_reuse == RING_CACHE) ?
+					&dev->ring_cache : &dev->bo_cache, bo);
+		}
 	}
 	return bo;
 }
@@ -250,14 +256,11 @@ out:
 	pthread_mutex_unlock(&table_lock);
 }
 
-/* Called under table_lock */
-drm_private void bo_del(struct fd_bo *bo)
+/* Closes the GEM handle.  Called under table_lock, so that the handle
+ * cannot be reused by a racing import before it is out of the tables.
+ */
+drm_private void bo_close(struct fd_bo *bo)
 {
-	VG_BO_FREE(bo);
-
-	if (bo->map)
-		drm_munmap(bo->map, bo->size);
-
 	/* TODO probably bo's in bucket list get removed from
 	 * handle table??
 	 */
@@ -271,10 +274,26 @@ drm_private void bo_del(struct fd_bo *bo)
 			drmHashDelete(bo->dev->name_table, bo->name);
 		drmIoctl(bo->dev->fd, DRM_IOCTL_GEM_CLOSE, &req);
 	}
+}
+
+/* Frees a closed bo, does not need table_lock */
+drm_private void bo_free(struct fd_bo *bo)
+{
+	VG_BO_FREE(bo);
+
+	if (bo->map)
+		drm_munmap(bo->map, bo->size);
 
 	bo->funcs->destroy(bo);
 }
 
+/* Called under table_lock */
+drm_private void bo_del(struct fd_bo *bo)
+{
+	bo_close(bo);
+	bo_free(bo);
+}
+
 drm_public int fd_bo_get_name(struct fd_bo *bo, uint32_t *name)
 {
 	if (!bo->name) {
@@ -28,16 +28,25 @@
 
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
+#include "util_bucket.h"
 
 drm_private void bo_del(struct fd_bo *bo);
+drm_private void bo_close(struct fd_bo *bo);
+drm_private void bo_free(struct fd_bo *bo);
 drm_private extern pthread_mutex_t table_lock;
 
+/* max number of bo's the reaper closes per table_lock hold */
+#define REAP_BATCH 32
+
 static void
 add_bucket(struct fd_bo_cache *cache, int size)
 {
 	unsigned int i = cache->num_buckets;
 
 	assert(i < ARRAY_SIZE(cache->cache_bucket));
+	/* get_bucket() computes the index from the size: */
+	assert((cache->coarse ? util_bucket_index_coarse(size) :
+			util_bucket_index(size)) == i);
 
 	list_inithead(&cache->cache_bucket[i].list);
 	cache->cache_bucket[i].size = size;
@@ -61,6 +70,8 @@ fd_bo_cache_init(struct fd_bo_cache *cache, int coarse)
 	 * width/height alignment and rounding of sizes to pages will
 	 * get us useful cache hit rates anyway)
 	 */
+	cache->coarse = coarse;
+
 	add_bucket(cache, 4096);
 	add_bucket(cache, 4096 * 2);
 	if (!coarse)
@@ -98,7 +109,8 @@ fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time)
 				break;
 
 			VG_BO_OBTAIN(bo);
-			list_del(&bo->list);
+			fd_bo_cache_remove(cache, bo);
+			cache->evictions++;
 			bo_del(bo);
 		}
 	}
@@ -106,21 +118,101 @@ fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time)
 	cache->time = time;
 }
 
-static struct fd_bo_bucket * get_bucket(struct fd_bo_cache *cache, uint32_t size)
+/* Unlinks a bo from its bucket.  Called under table_lock */
+drm_private void
+fd_bo_cache_remove(struct fd_bo_cache *cache, struct fd_bo *bo)
 {
-	int i;
+	list_delinit(&bo->list);
+	cache->size -= bo->size;
+	cache->count--;
+}
 
-	/* hmm, this is what intel does, but I suppose we could calculate our
-	 * way to the correct bucket size rather than looping..
-	 */
-	for (i = 0; i < cache->num_buckets; i++) {
-		struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
+/* Moves up to @max of the oldest bo's which are either expired or over
+ * the cache's budget to @victims.  Called under table_lock
+ */
+static int
+fd_bo_cache_evict(struct fd_bo_cache *cache, time_t time,
+		struct list_head *victims, int max)
+{
+	int i, n = 0;
+
+	while (n < max) {
+		struct fd_bo *bo, *oldest = NULL;
+
+		/* buckets are in free_time order, so the oldest bo is at
+		 * the head of one of them:
+		 */
+		for (i = 0; i < cache->num_buckets; i++) {
+			struct fd_bo_bucket *bucket = &cache->cache_bucket[i];
+
+			if (LIST_IS_EMPTY(&bucket->list))
+				continue;
+			bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
+			if (!oldest || bo->free_time < oldest->free_time)
+				oldest = bo;
 		}
+
+		if (!oldest)
+			break;
+		if ((time - oldest->free_time) <= cache->max_age &&
+				(!cache->max_size || cache->size <= cache->max_size))
+			break;
+
+		VG_BO_OBTAIN(oldest);
+		fd_bo_cache_remove(cache, oldest);
+		cache->evictions++;
+		list_addtail(&oldest->list, victims);
+		n++;
 	}
 
-	return NULL;
+	return n;
+}
+
+/* Reaper callback, the background counterpart of fd_bo_cache_cleanup().
+ * The GEM handles are closed in batches under table_lock, the unmapping
+ * and freeing is done after dropping it.  Never waits for table_lock, as
+ * fd_device_del() holds it while unregistering from the reaper; whatever
+ * is left over is picked up on the next run.
+ */
+drm_private void
+fd_bo_cache_reap(void *data)
+{
+	struct fd_device *dev = data;
+	struct timespec time;
+	int n;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	do {
+		struct list_head victims;
+		struct fd_bo *bo, *tmp;
+
+		list_inithead(&victims);
+
+		if (pthread_mutex_trylock(&table_lock))
+			return;
+		n = fd_bo_cache_evict(&dev->bo_cache, time.tv_sec,
+				&victims, REAP_BATCH);
+		n += fd_bo_cache_evict(&dev->ring_cache, time.tv_sec,
+				&victims, REAP_BATCH - n);
+		LIST_FOR_EACH_ENTRY(bo, &victims, list)
+			bo_close(bo);
+		pthread_mutex_unlock(&table_lock);
+
+		LIST_FOR_EACH_ENTRY_SAFE(bo, tmp, &victims, list)
+			bo_free(bo);
+	} while (n == REAP_BATCH);
+}
+
+static struct fd_bo_bucket * get_bucket(struct fd_bo_cache *cache, uint32_t size)
+{
+	unsigned i = cache->coarse ? util_bucket_index_coarse(size) :
+			util_bucket_index(size);
+
+	if (i >= (unsigned)cache->num_buckets)
+		return NULL;
+
+	return &cache->cache_bucket[i];
 }
 
 static int is_idle(struct fd_bo *bo)
@@ -131,7 +223,8 @@ static int is_idle(struct fd_bo *bo)
 			DRM_FREEDRENO_PREP_NOSYNC) == 0;
 }
 
-static struct fd_bo *find_in_bucket(struct fd_bo_bucket *bucket, uint32_t flags)
+static struct fd_bo *find_in_bucket(struct fd_bo_cache *cache,
+		struct fd_bo_bucket *bucket, uint32_t flags)
 {
 	struct fd_bo *bo = NULL;
 
@@ -147,11 +240,15 @@ static struct fd_bo *find_in_bucket(struct fd_bo_bucket *bucket, uint32_t flags)
 		bo = LIST_ENTRY(struct fd_bo, bucket->list.next, list);
 		/* TODO check for compatible flags? */
 		if (is_idle(bo)) {
-			list_del(&bo->list);
+			fd_bo_cache_remove(cache, bo);
 		} else {
 			bo = NULL;
 		}
 	}
+	if (bo)
+		cache->hits++;
+	else
+		cache->misses++;
 	pthread_mutex_unlock(&table_lock);
 
 	return bo;
@@ -171,7 +268,7 @@ fd_bo_cache_alloc(struct fd_bo_cache *cache, uint32_t *size, uint32_t flags)
 retry:
 	if (bucket) {
 		*size = bucket->size;
-		bo = find_in_bucket(bucket, flags);
+		bo = find_in_bucket(cache, bucket, flags);
 		if (bo) {
 			VG_BO_OBTAIN(bo);
 			if (bo->funcs->madvise(bo, TRUE) <= 0) {
@@ -206,7 +303,13 @@ fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo)
 		bo->free_time = time.tv_sec;
 		VG_BO_RELEASE(bo);
 		list_addtail(&bo->list, &bucket->list);
-		fd_bo_cache_cleanup(cache, time.tv_sec);
+		cache->size += bo->size;
+		cache->count++;
+
+		if (!bo->dev->reaper)
+			fd_bo_cache_cleanup(cache, time.tv_sec);
+		else if (cache->max_size && cache->size > cache->max_size)
+			drmReaperKick(bo->dev->reaper);
 
 		/* bo's in the bucket cache don't have a ref and
 		 * don't hold a ref to the dev:
@@ -33,7 +33,8 @@
 #include "freedreno_drmif.h"
 #include "freedreno_priv.h"
 
-static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+/* shared with the bo's, which the cache cleanup in fd_device_del() frees */
+drm_private extern pthread_mutex_t table_lock;
 
 struct fd_device * kgsl_device_new(int fd);
 struct fd_device * msm_device_new(int fd);
@@ -110,7 +111,9 @@ drm_public struct fd_device * fd_device_ref(struct fd_device *dev)
 static void fd_device_del_impl(struct fd_device *dev)
 {
 	int close_fd = dev->closefd ? dev->fd : -1;
+	drmReaperUnregister(dev->reaper);
 	fd_bo_cache_cleanup(&dev->bo_cache, 0);
+	fd_bo_cache_cleanup(&dev->ring_cache, 0);
 	drmHashDestroy(dev->handle_table);
 	drmHashDestroy(dev->name_table);
 	dev->funcs->destroy(dev);
@@ -143,3 +146,42 @@ drm_public enum fd_version fd_device_version(struct fd_device *dev)
 {
 	return dev->version;
 }
+
+drm_public int fd_device_enable_cache_reaper(struct fd_device *dev,
+		uint64_t max_size, uint32_t max_age)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&table_lock);
+	dev->bo_cache.max_size = dev->ring_cache.max_size = max_size;
+	dev->bo_cache.max_age = dev->ring_cache.max_age = max_age ? max_age : 1;
+	if (!dev->reaper) {
+		dev->reaper = drmReaperRegister(fd_bo_cache_reap, dev, 500);
+		if (!dev->reaper)
+			ret = -ENOMEM;
+	} else {
+		drmReaperKick(dev->reaper);
+	}
+	pthread_mutex_unlock(&table_lock);
+
+	return ret;
+}
+
+drm_public void fd_device_get_cache_stats(struct fd_device *dev,
+		struct fd_bo_cache_stats *stats)
+{
+	struct fd_bo_cache *caches[] = { &dev->bo_cache, &dev->ring_cache };
+	unsigned i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&table_lock);
+	for (i = 0; i < ARRAY_SIZE(caches); i++) {
+		stats->hits += caches[i]->hits;
+		stats->misses += caches[i]->misses;
+		stats->evictions += caches[i]->evictions;
+		stats->size += caches[i]->size;
+		stats->count += caches[i]->count;
+	}
+	pthread_mutex_unlock(&table_lock);
+}
@@ -99,6 +99,24 @@ enum fd_version {
 };
 enum fd_version fd_device_version(struct fd_device *dev);
 
+/* bo cache occupancy and hit-rate, summed over the device's caches: */
+struct fd_bo_cache_stats {
+	uint64_t hits;          /* allocations served from the cache */
+	uint64_t misses;        /* cacheable allocations which were not */
+	uint64_t evictions;     /* cached bo's freed */
+	uint64_t size;          /* bytes currently cached */
+	uint32_t count;         /* bo's currently cached */
+};
+
+/* Free cached bo's from the shared background reaper thread rather than
+ * from fd_bo_del(), once they are older than max_age seconds or when a
+ * cache holds more than max_size bytes (0 for no limit):
+ */
+int fd_device_enable_cache_reaper(struct fd_device *dev,
+		uint64_t max_size, uint32_t max_age);
+void fd_device_get_cache_stats(struct fd_device *dev,
+		struct fd_bo_cache_stats *stats);
+
 /* pipe functions:
  */
 
@@ -76,7 +76,16 @@ struct fd_bo_bucket {
 struct fd_bo_cache {
 	struct fd_bo_bucket cache_bucket[14 * 4];
 	int num_buckets;
+	int coarse;
 	time_t time;
+
+	/* limits enforced by the background reaper, if enabled: */
+	uint64_t max_size;
+	time_t max_age;
+
+	uint64_t size;
+	uint32_t count;
+	uint64_t hits, misses, evictions;
 };
 
 struct fd_device {
@@ -99,6 +108,7 @@ struct fd_device {
 
 	struct fd_bo_cache bo_cache;
 	struct fd_bo_cache ring_cache;
+	void *reaper;       /* drmReaperRegister() handle, if enabled */
 
 	int closefd;        /* call close(fd) upon destruction */
 
@@ -108,6 +118,8 @@ struct fd_device {
 
 drm_private void fd_bo_cache_init(struct fd_bo_cache *cache, int coarse);
 drm_private void fd_bo_cache_cleanup(struct fd_bo_cache *cache, time_t time);
+drm_private void fd_bo_cache_reap(void *data);
+drm_private void fd_bo_cache_remove(struct fd_bo_cache *cache, struct fd_bo *bo);
 drm_private struct fd_bo * fd_bo_cache_alloc(struct fd_bo_cache *cache,
 		uint32_t *size, uint32_t flags);
 drm_private int fd_bo_cache_free(struct fd_bo_cache *cache, struct fd_bo *bo);
@@ -40,7 +40,7 @@
 struct msm_device {
 	struct fd_device base;
 	struct fd_bo_cache ring_cache;
-	unsigned ring_cnt;
+	atomic_t ring_cnt;
 };
 
 static inline struct msm_device * to_msm_device(struct fd_device *x)
@@ -85,11 +85,12 @@ struct msm_bo {
 	struct fd_bo base;
 	uint64_t offset;
 	uint64_t presumed;
-	/* to avoid excess hashtable lookups, cache the ring this bo was
-	 * last emitted on (since that will probably also be the next ring
-	 * it is emitted on)
+	/* to avoid excess hashtable lookups, the first ring this bo is
+	 * emitted on claims it by atomically setting its seqno, and caches
+	 * the idx until it is flushed.  Only the owning ring writes idx, so
+	 * it can be read without locking.  See bo2idx().
 	 */
-	unsigned current_ring_seqno;
+	atomic_t current_ring_seqno;
 	uint32_t idx;
 };
 
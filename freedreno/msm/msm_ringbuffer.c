@@ -90,7 +90,7 @@ struct msm_ringbuffer {
 
 	unsigned offset;    /* for sub-allocated stateobj rb's */
 
-	unsigned seqno;
+	int seqno;
 
 	/* maps fd_bo to idx: */
 	void *bo_table;
@@ -115,8 +115,6 @@ static inline struct msm_ringbuffer * to_msm_ringbuffer(struct fd_ringbuffer *x)
 
 #define INIT_SIZE 0x1000
 
-static pthread_mutex_t idx_lock = PTHREAD_MUTEX_INITIALIZER;
-
 static struct msm_cmd *current_cmd(struct fd_ringbuffer *ring)
 {
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
@@ -221,27 +219,27 @@ static uint32_t bo2idx(struct fd_ringbuffer *ring, struct fd_bo *bo, uint32_t fl
 	struct msm_ringbuffer *msm_ring = to_msm_ringbuffer(ring);
 	struct msm_bo *msm_bo = to_msm_bo(bo);
 	uint32_t idx;
-	pthread_mutex_lock(&idx_lock);
-	if (msm_bo->current_ring_seqno == msm_ring->seqno) {
+	void *val;
+
+	if (atomic_read(&msm_bo->current_ring_seqno) == msm_ring->seqno) {
 		idx = msm_bo->idx;
+	} else if (msm_ring->bo_table &&
+			!drmHashLookup(msm_ring->bo_table, bo->handle, &val)) {
+		/* found */
+		idx = (uint32_t)(uintptr_t)val;
+	} else if (atomic_cmpxchg(&msm_bo->current_ring_seqno, 0,
+			msm_ring->seqno) == 0) {
+		idx = append_bo(ring, bo);
+		msm_bo->idx = idx;
 	} else {
-		void *val;
-
+		/* claimed by another ring: */
 		if (!msm_ring->bo_table)
 			msm_ring->bo_table = drmHashCreate();
 
-		if (!drmHashLookup(msm_ring->bo_table, bo->handle, &val)) {
-			/* found */
-			idx = (uint32_t)(uintptr_t)val;
-		} else {
-			idx = append_bo(ring, bo);
-			val = (void *)(uintptr_t)idx;
-			drmHashInsert(msm_ring->bo_table, bo->handle, val);
-		}
-		msm_bo->current_ring_seqno = msm_ring->seqno;
-		msm_bo->idx = idx;
+		idx = append_bo(ring, bo);
+		val = (void *)(uintptr_t)idx;
+		drmHashInsert(msm_ring->bo_table, bo->handle, val);
 	}
-	pthread_mutex_unlock(&idx_lock);
 	if (flags & FD_RELOC_READ)
 		msm_ring->submit.bos[idx].flags |= MSM_SUBMIT_BO_READ;
 	if (flags & FD_RELOC_WRITE)
@@ -336,7 +334,7 @@ static void flush_reset(struct fd_ringbuffer *ring)
 		struct msm_bo *msm_bo = to_msm_bo(msm_ring->bos[i]);
 		if (!msm_bo)
 			continue;
-		msm_bo->current_ring_seqno = 0;
+		atomic_cmpxchg(&msm_bo->current_ring_seqno, msm_ring->seqno, 0);
 		fd_bo_del(&msm_bo->base);
 	}
 
@@ -708,7 +706,9 @@ drm_private struct fd_ringbuffer * msm_ringbuffer_new(struct fd_pipe *pipe,
 	}
 
 	list_inithead(&msm_ring->cmd_list);
-	msm_ring->seqno = ++to_msm_device(pipe->dev)->ring_cnt;
+	do {
+		msm_ring->seqno = atomic_inc_return(&to_msm_device(pipe->dev)->ring_cnt);
+	} while (!msm_ring->seqno);
 
 	ring = &msm_ring->base;
 	atomic_set(&ring->refcnt, 1);
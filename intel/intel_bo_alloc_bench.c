@@ -0,0 +1,422 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Buffer object cache benchmark for the GEM buffer manager.
+ *
+ * Allocates and releases buffers of random sizes from one or more threads,
+ * so that they are recycled through the bo cache, and reports how long the
+ * buffer manager lock is held per allocation and release.  Lock hold times
+ * are measured by wrapping pthread_mutex_lock/unlock.
+ *
+ * Before that, buffers are mapped and unmapped at random under a VMA cache
+ * byte budget, checking that the budget holds, that the largest of the
+ * least recently used mappings goes first, and that the statistics add up,
+ * and that the reaper drains the bos an idle thread keeps to itself.
+ *
+ * The kernel is stubbed out by overriding ioctl(), so this runs without
+ * intel hardware.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#undef NDEBUG
+#include <assert.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include "xf86drm.h"
+#include "i915_drm.h"
+#include "intel_bufmgr.h"
+
+static uint32_t next_handle = 1;
+
+/* Tests are built with hidden visibility, export the stubs to libdrm. */
+__attribute__((visibility("default")))
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct drm_i915_gem_create *create;
+	struct drm_i915_gem_madvise *madvise;
+	struct drm_i915_gem_get_aperture *aperture;
+	struct drm_i915_gem_mmap *mmap_arg;
+	void *ptr;
+	drm_i915_getparam_t *gp;
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	switch (request) {
+	case DRM_IOCTL_I915_GETPARAM:
+		gp = arg;
+		/* an Ivybridge GT2 without any of the optional features */
+		if (gp->param != I915_PARAM_CHIPSET_ID)
+			break;
+		*gp->value = 0x0162;
+		return 0;
+	case DRM_IOCTL_I915_GEM_GET_APERTURE:
+		aperture = arg;
+		aperture->aper_size = 1ull << 31;
+		aperture->aper_available_size = 1ull << 31;
+		return 0;
+	case DRM_IOCTL_I915_GEM_CREATE:
+		create = arg;
+		create->handle = __sync_fetch_and_add(&next_handle, 1);
+		return 0;
+	case DRM_IOCTL_I915_GEM_MADVISE:
+		madvise = arg;
+		madvise->retained = 1;
+		return 0;
+	case DRM_IOCTL_I915_GEM_MMAP:
+		mmap_arg = arg;
+		ptr = mmap(NULL, mmap_arg->size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED)
+			return -1;
+		mmap_arg->addr_ptr = (uintptr_t)ptr;
+		return 0;
+	case DRM_IOCTL_I915_GEM_BUSY:
+	case DRM_IOCTL_I915_GEM_SET_TILING:
+	case DRM_IOCTL_I915_GEM_SET_DOMAIN:
+	case DRM_IOCTL_I915_GEM_SW_FINISH:
+	case DRM_IOCTL_GEM_CLOSE:
+		return 0;
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int (*real_lock)(pthread_mutex_t *mutex);
+static int (*real_unlock)(pthread_mutex_t *mutex);
+static __thread int measuring;
+static __thread uint64_t lock_start, hold_ns;
+
+__attribute__((visibility("default")))
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	int ret = real_lock(mutex);
+
+	if (measuring)
+		lock_start = get_time_ns();
+	return ret;
+}
+
+__attribute__((visibility("default")))
+int pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+	if (measuring)
+		hold_ns += get_time_ns() - lock_start;
+	return real_unlock(mutex);
+}
+
+
+static drm_intel_bufmgr *bufmgr;
+static unsigned nbos = 64, iterations = 1000000;
+static unsigned long max_size = 8 << 20;
+
+struct worker {
+	pthread_t thread;
+	unsigned seed;
+	uint64_t alloc_ns, free_ns;
+	unsigned nfrees;
+};
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	drm_intel_bo **bos;
+	unsigned i;
+
+	bos = calloc(nbos, sizeof(*bos));
+	assert(bos);
+
+	for (i = 0; i < iterations; i++) {
+		unsigned slot = rand_r(&w->seed) % nbos;
+		unsigned long size = 1 + rand_r(&w->seed) % max_size;
+
+		if (bos[slot]) {
+			hold_ns = 0;
+			measuring = 1;
+			drm_intel_bo_unreference(bos[slot]);
+			measuring = 0;
+			w->free_ns += hold_ns;
+			w->nfrees++;
+		}
+
+		hold_ns = 0;
+		measuring = 1;
+		bos[slot] = drm_intel_bo_alloc(bufmgr, "bench", size, 0);
+		measuring = 0;
+		w->alloc_ns += hold_ns;
+		assert(bos[slot] && bos[slot]->size >= size);
+	}
+
+	for (i = 0; i < nbos; i++)
+		drm_intel_bo_unreference(bos[i]);
+	free(bos);
+
+	return NULL;
+}
+
+#define VMA_BOS		64
+#define VMA_BUDGET	(16 << 20)
+
+static void map_bo(drm_intel_bo *bo)
+{
+	assert(drm_intel_bo_map(bo, 1) == 0);
+	memset(bo->virtual, 0xa5, 64);
+}
+
+/* Mapped bytes of the bos in use, the rest of the mappings are idle. */
+static void check_vma_stats(drm_intel_bufmgr *vma_bufmgr, uint64_t open_size,
+			    uint64_t maps)
+{
+	struct drm_intel_vma_cache_stats stats;
+
+	drm_intel_bufmgr_gem_get_vma_cache_stats(vma_bufmgr, &stats);
+	assert(stats.reuses + stats.remaps == maps);
+	assert(stats.cpu_size == stats.cached_size + open_size);
+	assert(stats.wc_size == 0 && stats.gtt_size == 0);
+	/* only mappings in use may take the address space over budget */
+	assert(stats.cpu_size <= VMA_BUDGET || stats.cached_size == 0);
+}
+
+static void check_vma_cache(void)
+{
+	static const unsigned long sizes[] = {
+		1 << 20, 4 << 20, 1 << 20, 1 << 20, 2 << 20,
+	};
+	struct drm_intel_vma_cache_stats stats;
+	drm_intel_bufmgr *vma_bufmgr;
+	drm_intel_bo *bos[VMA_BOS];
+	bool mapped[VMA_BOS] = {};
+	uint64_t open_size = 0, maps = 0;
+	unsigned seed = 1, i, j;
+
+	vma_bufmgr = drm_intel_bufmgr_gem_init(-1, 4096);
+	assert(vma_bufmgr);
+	drm_intel_bufmgr_gem_set_vma_cache_bytes(vma_bufmgr, 8 << 20);
+
+	/* 7 MiB of idle mappings, the 2 MiB one needs one of them gone */
+	for (i = 0; i < 5; i++) {
+		bos[i] = drm_intel_bo_alloc(vma_bufmgr, "vma", sizes[i], 0);
+		assert(bos[i] && bos[i]->size == sizes[i]);
+		map_bo(bos[i]);
+		if (i < 4)
+			drm_intel_bo_unmap(bos[i]);
+	}
+	drm_intel_bufmgr_gem_get_vma_cache_stats(vma_bufmgr, &stats);
+	assert(stats.evictions == 1 && stats.remaps == 5);
+	assert(stats.cached_count == 3 && stats.cached_size == 3 << 20);
+	assert(stats.cpu_size == 5 << 20);
+
+	/* the 4 MiB one went, not the older 1 MiB one */
+	map_bo(bos[0]);
+	map_bo(bos[1]);
+	drm_intel_bufmgr_gem_get_vma_cache_stats(vma_bufmgr, &stats);
+	assert(stats.reuses == 1 && stats.remaps == 6);
+	for (i = 0; i < 5; i++) {
+		drm_intel_bo_unmap(bos[i]);
+		drm_intel_bo_unreference(bos[i]);
+	}
+
+	/* random sizes and maps, up to a quarter of the bos mapped at once */
+	drm_intel_bufmgr_gem_set_vma_cache_bytes(vma_bufmgr, VMA_BUDGET);
+	drm_intel_bufmgr_gem_get_vma_cache_stats(vma_bufmgr, &stats);
+	maps = stats.reuses + stats.remaps;
+	for (i = 0; i < VMA_BOS; i++) {
+		bos[i] = drm_intel_bo_alloc(vma_bufmgr, "vma",
+					    4096 << rand_r(&seed) % 10, 0);
+		assert(bos[i]);
+	}
+	for (i = 0; i < 20000; i++) {
+		j = rand_r(&seed) % VMA_BOS;
+		if (mapped[j]) {
+			drm_intel_bo_unmap(bos[j]);
+			open_size -= bos[j]->size;
+		} else if (open_size < VMA_BUDGET / 4) {
+			map_bo(bos[j]);
+			open_size += bos[j]->size;
+			maps++;
+		} else {
+			continue;
+		}
+		mapped[j] = !mapped[j];
+		check_vma_stats(vma_bufmgr, open_size, maps);
+	}
+
+	drm_intel_bufmgr_gem_get_vma_cache_stats(vma_bufmgr, &stats);
+	printf("vma cache: %llu maps, %.1f%% reused, %llu evictions, "
+	       "%llu KiB mapped\n", (unsigned long long)maps,
+	       100.0 * stats.reuses / maps, (unsigned long long)stats.evictions,
+	       (unsigned long long)stats.cpu_size >> 10);
+
+	for (i = 0; i < VMA_BOS; i++) {
+		if (mapped[i])
+			drm_intel_bo_unmap(bos[i]);
+		drm_intel_bo_unreference(bos[i]);
+	}
+	drm_intel_bufmgr_destroy(vma_bufmgr);
+}
+
+/* The bos this thread released stay in its magazines until reaped. */
+static void check_magazine_drain(void)
+{
+	struct drm_intel_bo_cache_stats stats;
+	drm_intel_bufmgr *mag_bufmgr;
+	drm_intel_bo *bos[4];
+	unsigned i;
+
+	mag_bufmgr = drm_intel_bufmgr_gem_init(-1, 4096);
+	assert(mag_bufmgr);
+	drm_intel_bufmgr_gem_enable_reuse(mag_bufmgr);
+
+	for (i = 0; i < 4; i++) {
+		bos[i] = drm_intel_bo_alloc(mag_bufmgr, "mag", 4096, 0);
+		assert(bos[i]);
+	}
+	for (i = 0; i < 4; i++)
+		drm_intel_bo_unreference(bos[i]);
+	drm_intel_bufmgr_gem_get_cache_stats(mag_bufmgr, &stats);
+	assert(stats.count == 4 && stats.size == 4 * 4096);
+
+	/* over budget, the magazines count too */
+	assert(drm_intel_bufmgr_gem_enable_cache_reaper(mag_bufmgr,
+							2 * 4096, 3600) == 0);
+	for (i = 0; i < 200; i++) {
+		drm_intel_bufmgr_gem_get_cache_stats(mag_bufmgr, &stats);
+		if (stats.size <= 2 * 4096)
+			break;
+		usleep(10000);
+	}
+	assert(stats.count == 2 && stats.size == 2 * 4096);
+	assert(stats.evictions == 2);
+
+	drm_intel_bufmgr_destroy(mag_bufmgr);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-b live bos] [-n iterations] "
+		"[-m max size] [-t threads]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct drm_intel_bo_cache_stats stats;
+	struct worker *workers;
+	unsigned i, nthreads = 1, nfrees = 0;
+	uint64_t alloc_ns = 0, free_ns = 0, start;
+	int c;
+
+	while ((c = getopt(argc, argv, "b:n:m:t:")) != -1) {
+		switch (c) {
+		case 'b':
+			nbos = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!nbos || !iterations || !max_size || !nthreads)
+		usage(argv[0]);
+
+	real_lock = (int (*)(pthread_mutex_t *))
+		dlsym(RTLD_NEXT, "pthread_mutex_lock");
+	real_unlock = (int (*)(pthread_mutex_t *))
+		dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+	assert(real_lock && real_unlock);
+
+	check_vma_cache();
+	check_magazine_drain();
+
+	bufmgr = drm_intel_bufmgr_gem_init(-1, 4096);
+	assert(bufmgr);
+	drm_intel_bufmgr_gem_enable_reuse(bufmgr);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	assert(workers);
+
+	start = get_time_ns();
+	for (i = 0; i < nthreads; i++) {
+		workers[i].seed = i + 1;
+		assert(pthread_create(&workers[i].thread, NULL,
+				      run_worker, &workers[i]) == 0);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		alloc_ns += workers[i].alloc_ns;
+		free_ns += workers[i].free_ns;
+		nfrees += workers[i].nfrees;
+	}
+
+	printf("%u allocations of up to %lu bytes, %u live, %u threads\n",
+	       iterations, max_size, nbos, nthreads);
+	printf("lock held %.1f ns per allocation, %.1f ns per release\n",
+	       (double)alloc_ns / ((uint64_t)iterations * nthreads),
+	       (double)free_ns / nfrees);
+	printf("%.1f ns per allocate/release cycle\n",
+	       (double)(get_time_ns() - start) / iterations);
+
+	/* every allocation is either a cache hit or a miss */
+	drm_intel_bufmgr_gem_get_cache_stats(bufmgr, &stats);
+	assert(stats.hits + stats.misses == (uint64_t)iterations * nthreads);
+
+	free(workers);
+	drm_intel_bufmgr_destroy(bufmgr);
+
+	return 0;
+}
@@ -177,9 +177,39 @@ drm_intel_bo *drm_intel_bo_gem_create_from_name(drm_intel_bufmgr *bufmgr,
 						const char *name,
 						unsigned int handle);
 void drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr);
+
+struct drm_intel_bo_cache_stats {
+	uint64_t hits;		/* allocations served from the cache */
+	uint64_t misses;	/* cacheable allocations which were not */
+	uint64_t evictions;	/* cached bos freed */
+	uint64_t size;		/* bytes currently cached */
+	uint32_t count;		/* bos currently cached */
+};
+
+int drm_intel_bufmgr_gem_enable_cache_reaper(drm_intel_bufmgr *bufmgr,
+					     uint64_t max_size,
+					     uint32_t max_age);
+void drm_intel_bufmgr_gem_get_cache_stats(drm_intel_bufmgr *bufmgr,
+					  struct drm_intel_bo_cache_stats *stats);
 void drm_intel_bufmgr_gem_enable_fenced_relocs(drm_intel_bufmgr *bufmgr);
 void drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr,
 					     int limit);
+
+struct drm_intel_vma_cache_stats {
+	uint64_t reuses;	/* maps served by an existing mapping */
+	uint64_t remaps;	/* maps which had to create a mapping */
+	uint64_t evictions;	/* idle bos whose mappings were dropped */
+	uint64_t cpu_size;	/* bytes of CPU mappings */
+	uint64_t wc_size;	/* bytes of WC mappings */
+	uint64_t gtt_size;	/* bytes of GTT mappings */
+	uint64_t cached_size;	/* bytes of mappings of idle bos */
+	uint32_t cached_count;	/* mappings of idle bos */
+};
+
+void drm_intel_bufmgr_gem_set_vma_cache_bytes(drm_intel_bufmgr *bufmgr,
+					      uint64_t limit);
+void drm_intel_bufmgr_gem_get_vma_cache_stats(drm_intel_bufmgr *bufmgr,
+					      struct drm_intel_vma_cache_stats *stats);
 int drm_intel_gem_bo_map_unsynchronized(drm_intel_bo *bo);
 int drm_intel_gem_bo_map_gtt(drm_intel_bo *bo);
 int drm_intel_gem_bo_unmap_gtt(drm_intel_bo *bo);
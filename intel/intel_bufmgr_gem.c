@@ -54,6 +54,7 @@
 #endif
 #include "libdrm_macros.h"
 #include "libdrm_lists.h"
+#include "util_bucket.h"
 #include "intel_bufmgr.h"
 #include "intel_bufmgr_priv.h"
 #include "intel_chipset.h"
@@ -103,6 +104,53 @@ struct drm_intel_gem_bo_bucket {
 	unsigned long size;
 };
 
+/** Kinds of CPU mappings of a bo, for the VMA cache accounting */
+enum drm_intel_vma_type {
+	VMA_CPU,
+	VMA_WC,
+	VMA_GTT,
+	VMA_NUM_TYPES
+};
+
+/* number of least recently used mappings the byte budget picks from */
+#define VMA_EVICT_SCAN 4
+
+/*
+ * Per-thread bo magazines.  Each thread that releases buffers keeps a few
+ * idle bos of each of the small bucket sizes to itself, so that the common
+ * allocate/release cycle doesn't need bufmgr_gem->lock.  Magazines spill
+ * to and refill from the shared buckets in batches.
+ */
+#define MAGAZINE_ROUNDS 4
+#define MAGAZINE_BATCH (MAGAZINE_ROUNDS / 2)
+#define MAGAZINE_BUCKETS 20	/* buckets of up to 256 KiB */
+
+struct drm_intel_gem_bo_magazine {
+	/** Cached bos, oldest first */
+	drm_intel_bo_gem *rounds[MAGAZINE_ROUNDS];
+	int count;
+};
+
+struct drm_intel_gem_bo_magazines {
+	/** Link in bufmgr_gem->magazines, protected by bufmgr_gem->lock */
+	drmMMListHead link;
+	struct _drm_intel_bufmgr_gem *bufmgr_gem;
+
+	struct drm_intel_gem_bo_magazine bucket[MAGAZINE_BUCKETS];
+
+	/**
+	 * Claimed by the owning thread while it uses the magazines, and by
+	 * the cache cleanup while it drains them.  Neither waits for the
+	 * other, see drm_intel_gem_bo_magazines_claim().
+	 */
+	atomic_t busy;
+
+	/** Statistics, only written by the owning thread */
+	uint64_t size;
+	unsigned int count;
+	uint64_t hits;
+};
+
 typedef struct _drm_intel_bufmgr_gem {
 	drm_intel_bufmgr bufmgr;
 
@@ -125,6 +173,24 @@ typedef struct _drm_intel_bufmgr_gem {
 	int num_buckets;
 	time_t time;
 
+	/**
+	 * Background reaper handle and the limits it enforces, see
+	 * drm_intel_bufmgr_gem_enable_cache_reaper()
+	 */
+	void *reaper;
+	uint64_t cache_max_size;
+	time_t cache_max_age;
+
+	/** Occupancy and hit-rate of the bo cache */
+	uint64_t cache_size;
+	unsigned int cache_count;
+	uint64_t cache_hits, cache_misses, cache_evictions;
+
+	/** Thread-local bo magazines, see drm_intel_gem_bo_magazine_put() */
+	pthread_key_t magazine_key;
+	drmMMListHead magazines;
+	bool has_magazines;
+
 	drmMMListHead managers;
 
 	drm_intel_bo_gem *name_table;
@@ -133,6 +199,16 @@ typedef struct _drm_intel_bufmgr_gem {
 	drmMMListHead vma_cache;
 	int vma_count, vma_open, vma_max;
 
+	/**
+	 * Address space taken by mappings of each type, by the idle ones in
+	 * vma_cache, and the budget for the former, see
+	 * drm_intel_bufmgr_gem_set_vma_cache_bytes()
+	 */
+	uint64_t vma_mapped[VMA_NUM_TYPES];
+	uint64_t vma_size, vma_max_size;
+	uint64_t vma_remaps, vma_evictions;
+	atomic_t vma_reuses;
+
 	uint64_t gtt_size;
 	int available_fences;
 	int pci_device;
@@ -305,11 +381,27 @@ static void drm_intel_gem_bo_unreference(drm_intel_bo *bo);
 
 static void drm_intel_gem_bo_free(drm_intel_bo *bo);
 
+static void drm_intel_gem_bo_close(drm_intel_bo *bo);
+
+static void drm_intel_gem_bo_release(drm_intel_bo *bo);
+
+static void drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem,
+					   time_t time);
+
 static inline drm_intel_bo_gem *to_bo_gem(drm_intel_bo *bo)
 {
         return (drm_intel_bo_gem *)bo;
 }
 
+/** Address space taken by the bo's CPU, WC and GTT mappings */
+static uint64_t
+drm_intel_gem_bo_vma_size(drm_intel_bo_gem *bo_gem)
+{
+	return (uint64_t)bo_gem->bo.size * (!!bo_gem->mem_virtual +
+					    !!bo_gem->wc_virtual +
+					    !!bo_gem->gtt_virtual);
+}
+
 static unsigned long
 drm_intel_gem_bo_tile_size(drm_intel_bufmgr_gem *bufmgr_gem, unsigned long size,
 			   uint32_t *tiling_mode)
@@ -396,17 +488,12 @@ static struct drm_intel_gem_bo_bucket *
 drm_intel_gem_bo_bucket_for_size(drm_intel_bufmgr_gem *bufmgr_gem,
 				 unsigned long size)
 {
-	int i;
+	unsigned i = util_bucket_index(size);
 
-	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
-		struct drm_intel_gem_bo_bucket *bucket =
-		    &bufmgr_gem->cache_bucket[i];
-		if (bucket->size >= size) {
-			return bucket;
-		}
-	}
+	if (i >= (unsigned)bufmgr_gem->num_buckets)
+		return NULL;
 
-	return NULL;
+	return &bufmgr_gem->cache_bucket[i];
 }
 
 static void
@@ -681,6 +768,16 @@ drm_intel_gem_bo_madvise(drm_intel_bo *bo, int madv)
 		 madv);
 }
 
+/** Unlinks a bo from its cache bucket.  Called with bufmgr_gem->lock held. */
+static void
+drm_intel_gem_bo_cache_remove(drm_intel_bufmgr_gem *bufmgr_gem,
+			      drm_intel_bo_gem *bo_gem)
+{
+	DRMLISTDEL(&bo_gem->head);
+	bufmgr_gem->cache_size -= bo_gem->bo.size;
+	bufmgr_gem->cache_count--;
+}
+
 /* drop the oldest entries that have been purged by the kernel */
 static void
 drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
@@ -695,11 +792,349 @@ drm_intel_gem_bo_cache_purge_bucket(drm_intel_bufmgr_gem *bufmgr_gem,
 		    (bufmgr_gem, bo_gem, I915_MADV_DONTNEED))
 			break;
 
-		DRMLISTDEL(&bo_gem->head);
+		drm_intel_gem_bo_cache_remove(bufmgr_gem, bo_gem);
+		bufmgr_gem->cache_evictions++;
 		drm_intel_gem_bo_free(&bo_gem->bo);
 	}
 }
 
+/**
+ * Returns the calling thread's magazines, creating them if @create is set.
+ */
+static struct drm_intel_gem_bo_magazines *
+drm_intel_gem_bo_magazines_get(drm_intel_bufmgr_gem *bufmgr_gem, bool create)
+{
+	struct drm_intel_gem_bo_magazines *mags;
+
+	if (!bufmgr_gem->has_magazines)
+		return NULL;
+
+	mags = pthread_getspecific(bufmgr_gem->magazine_key);
+	if (mags || !create)
+		return mags;
+
+	mags = calloc(1, sizeof(*mags));
+	if (!mags)
+		return NULL;
+	mags->bufmgr_gem = bufmgr_gem;
+	if (pthread_setspecific(bufmgr_gem->magazine_key, mags)) {
+		free(mags);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	DRMLISTADDTAIL(&mags->link, &bufmgr_gem->magazines);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return mags;
+}
+
+/**
+ * Moves the @n oldest bos of a magazine to the shared bucket.  Called with
+ * bufmgr_gem->lock held.
+ */
+static void
+drm_intel_gem_bo_magazine_spill(drm_intel_bufmgr_gem *bufmgr_gem,
+				struct drm_intel_gem_bo_magazines *mags,
+				int i, int n)
+{
+	struct drm_intel_gem_bo_magazine *mag = &mags->bucket[i];
+	struct drm_intel_gem_bo_bucket *bucket = &bufmgr_gem->cache_bucket[i];
+	int j;
+
+	for (j = 0; j < n; j++) {
+		drm_intel_bo_gem *bo_gem = mag->rounds[j];
+		drmMMListHead *pos = bucket->head.prev;
+
+		/* Keep the bucket in free_time order for the cleanup.  Other
+		 * threads may have spilled newer bos in the meantime.
+		 */
+		while (pos != &bucket->head &&
+		       DRMLISTENTRY(drm_intel_bo_gem, pos, head)->free_time >
+		       bo_gem->free_time)
+			pos = pos->prev;
+		DRMLISTADD(&bo_gem->head, pos);
+
+		bufmgr_gem->cache_size += bo_gem->bo.size;
+		bufmgr_gem->cache_count++;
+		mags->size -= bo_gem->bo.size;
+		mags->count--;
+	}
+
+	mag->count -= n;
+	memmove(mag->rounds, mag->rounds + n, mag->count * sizeof(mag->rounds[0]));
+}
+
+/**
+ * Claims the magazines for the caller.  The owning thread falls back to the
+ * shared buckets and the cleanup skips the magazines if this fails, so no
+ * one ever waits on a claim.
+ */
+static bool
+drm_intel_gem_bo_magazines_claim(struct drm_intel_gem_bo_magazines *mags)
+{
+	return atomic_cmpxchg(&mags->busy, 0, 1) == 0;
+}
+
+static void
+drm_intel_gem_bo_magazines_release(struct drm_intel_gem_bo_magazines *mags)
+{
+	atomic_dec(&mags->busy, 1);
+}
+
+/**
+ * Moves the bos that have been idle for longer than the cache's max age, or
+ * all of them if @all is set, to the shared buckets.  Called with
+ * bufmgr_gem->lock held and the magazines claimed.
+ */
+static void
+drm_intel_gem_bo_magazines_expire(drm_intel_bufmgr_gem *bufmgr_gem,
+				  struct drm_intel_gem_bo_magazines *mags,
+				  time_t time, bool all)
+{
+	int i, n;
+
+	for (i = 0; i < MAGAZINE_BUCKETS; i++) {
+		struct drm_intel_gem_bo_magazine *mag = &mags->bucket[i];
+
+		for (n = 0; n < mag->count && !all; n++)
+			if (time - mag->rounds[n]->free_time <=
+			    bufmgr_gem->cache_max_age)
+				break;
+		if (all)
+			n = mag->count;
+		if (n)
+			drm_intel_gem_bo_magazine_spill(bufmgr_gem, mags, i, n);
+	}
+}
+
+/**
+ * Hands the expired bos of all threads' magazines to the shared buckets,
+ * where the cleanup or the reaper frees them, so that the bos of idle
+ * threads don't stay around forever.  If the cache is over its size budget
+ * with the magazines counted in, the magazines are emptied completely.
+ * Magazines which are in use are skipped, their owner ages them on the next
+ * release.  Called with bufmgr_gem->lock held.
+ */
+static void
+drm_intel_gem_bo_magazines_drain(drm_intel_bufmgr_gem *bufmgr_gem,
+				 time_t time)
+{
+	struct drm_intel_gem_bo_magazines *mags;
+	uint64_t size = bufmgr_gem->cache_size;
+	bool over;
+
+	/* A snapshot, as for the statistics */
+	DRMLISTFOREACHENTRY(mags, &bufmgr_gem->magazines, link)
+		size += mags->size;
+	over = bufmgr_gem->cache_max_size &&
+	       size > bufmgr_gem->cache_max_size;
+
+	DRMLISTFOREACHENTRY(mags, &bufmgr_gem->magazines, link) {
+		if (!drm_intel_gem_bo_magazines_claim(mags))
+			continue;
+		drm_intel_gem_bo_magazines_expire(bufmgr_gem, mags, time, over);
+		drm_intel_gem_bo_magazines_release(mags);
+	}
+}
+
+/**
+ * Refills an empty magazine with a batch of bos from the end of the shared
+ * bucket that the allocation would have used, i.e. the most recently used
+ * ones for render targets and the least recently used ones otherwise.
+ * Called with bufmgr_gem->lock held.
+ */
+static void
+drm_intel_gem_bo_magazine_refill(drm_intel_bufmgr_gem *bufmgr_gem,
+				 struct drm_intel_gem_bo_magazines *mags,
+				 int i, bool for_render)
+{
+	struct drm_intel_gem_bo_magazine *mag = &mags->bucket[i];
+	struct drm_intel_gem_bo_bucket *bucket = &bufmgr_gem->cache_bucket[i];
+	drm_intel_bo_gem *bo_gem;
+
+	assert(mag->count == 0);
+	while (mag->count < MAGAZINE_BATCH && !DRMLISTEMPTY(&bucket->head)) {
+		if (for_render)
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+					      bucket->head.prev, head);
+		else
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+					      bucket->head.next, head);
+		drm_intel_gem_bo_cache_remove(bufmgr_gem, bo_gem);
+
+		/* Taken newest first from the tail, keep oldest first. */
+		if (for_render) {
+			memmove(mag->rounds + 1, mag->rounds,
+				mag->count * sizeof(mag->rounds[0]));
+			mag->rounds[0] = bo_gem;
+		} else {
+			mag->rounds[mag->count] = bo_gem;
+		}
+		mag->count++;
+		mags->size += bo_gem->bo.size;
+		mags->count++;
+	}
+}
+
+/**
+ * Lock-free counterpart of the cache lookup in
+ * drm_intel_gem_bo_alloc_internal(), with the same MRU and idle policies.
+ */
+static drm_intel_bo_gem *
+drm_intel_gem_bo_magazine_alloc(drm_intel_bufmgr_gem *bufmgr_gem,
+				struct drm_intel_gem_bo_magazines *mags,
+				int i, bool for_render,
+				uint32_t tiling_mode, unsigned long stride)
+{
+	struct drm_intel_gem_bo_magazine *mag = &mags->bucket[i];
+	drm_intel_bo_gem *bo_gem;
+
+	while (mag->count) {
+		if (for_render) {
+			bo_gem = mag->rounds[mag->count - 1];
+		} else {
+			bo_gem = mag->rounds[0];
+			if (drm_intel_gem_bo_busy(&bo_gem->bo))
+				return NULL;
+			memmove(mag->rounds, mag->rounds + 1,
+				(mag->count - 1) * sizeof(mag->rounds[0]));
+		}
+		mag->count--;
+		mags->size -= bo_gem->bo.size;
+		mags->count--;
+
+		if (drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
+						      I915_MADV_WILLNEED) &&
+		    drm_intel_gem_bo_set_tiling_internal(&bo_gem->bo,
+							 tiling_mode,
+							 stride) == 0) {
+			mags->hits++;
+			return bo_gem;
+		}
+
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_close(&bo_gem->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_release(&bo_gem->bo);
+	}
+
+	return NULL;
+}
+
+/**
+ * Lock-free counterpart of the caching in
+ * drm_intel_gem_bo_unreference_final(), for small reusable bos without
+ * relocations or open mappings.  Reusable bos have never been shared, so
+ * nothing can look them up and take a new reference once the last one is
+ * gone.
+ *
+ * Returns false if the bo has to take the locked path instead.
+ */
+static bool
+drm_intel_gem_bo_magazine_put(drm_intel_bo_gem *bo_gem, time_t time)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem =
+	    (drm_intel_bufmgr_gem *) bo_gem->bo.bufmgr;
+	struct drm_intel_gem_bo_magazines *mags;
+	struct drm_intel_gem_bo_magazine *mag;
+	struct drm_intel_gem_bo_bucket *bucket;
+	int i, n;
+
+	if (!bufmgr_gem->bo_reuse || !bo_gem->reusable ||
+	    bo_gem->reloc_count || bo_gem->softpin_target_count ||
+	    bo_gem->map_count)
+		return false;
+
+	bucket = drm_intel_gem_bo_bucket_for_size(bufmgr_gem, bo_gem->bo.size);
+	if (bucket == NULL)
+		return false;
+	i = bucket - bufmgr_gem->cache_bucket;
+	if (i >= MAGAZINE_BUCKETS)
+		return false;
+
+	mags = drm_intel_gem_bo_magazines_get(bufmgr_gem, true);
+	if (!mags || !drm_intel_gem_bo_magazines_claim(mags))
+		return false;
+
+	atomic_set(&bo_gem->refcount, 0);
+
+	DBG("bo_unreference final: %d (%s)\n",
+	    bo_gem->gem_handle, bo_gem->name);
+
+	bo_gem->kflags = 0;
+	bo_gem->used_as_reloc_target = false;
+	free(bo_gem->reloc_target_info);
+	bo_gem->reloc_target_info = NULL;
+	free(bo_gem->relocs);
+	bo_gem->relocs = NULL;
+	free(bo_gem->softpin_target);
+	bo_gem->softpin_target = NULL;
+	bo_gem->softpin_target_size = 0;
+
+	if (!drm_intel_gem_bo_madvise_internal(bufmgr_gem, bo_gem,
+					       I915_MADV_DONTNEED)) {
+		drm_intel_gem_bo_magazines_release(mags);
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_close(&bo_gem->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_release(&bo_gem->bo);
+		return true;
+	}
+
+	bo_gem->free_time = time;
+	bo_gem->name = NULL;
+	bo_gem->validate_index = -1;
+
+	/* Hand the expired bos of all sizes, and half of a full magazine, to
+	 * the shared buckets, where the usual cleanup takes care of them.
+	 */
+	mag = &mags->bucket[i];
+	n = mag->count &&
+	    time - mag->rounds[0]->free_time > bufmgr_gem->cache_max_age;
+	if (n || mag->count == MAGAZINE_ROUNDS) {
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_magazines_expire(bufmgr_gem, mags, time,
+						  false);
+		if (mag->count == MAGAZINE_ROUNDS)
+			drm_intel_gem_bo_magazine_spill(bufmgr_gem, mags, i,
+							MAGAZINE_BATCH);
+		if (!bufmgr_gem->reaper)
+			drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time);
+		else if (bufmgr_gem->cache_max_size &&
+			 bufmgr_gem->cache_size + mags->size >
+			 bufmgr_gem->cache_max_size)
+			drmReaperKick(bufmgr_gem->reaper);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+	}
+
+	mag->rounds[mag->count++] = bo_gem;
+	mags->size += bo_gem->bo.size;
+	mags->count++;
+	drm_intel_gem_bo_magazines_release(mags);
+
+	return true;
+}
+
+/** pthread key destructor, returns an exiting thread's bos to the buckets. */
+static void
+drm_intel_gem_bo_magazines_destroy(void *data)
+{
+	struct drm_intel_gem_bo_magazines *mags = data;
+	drm_intel_bufmgr_gem *bufmgr_gem = mags->bufmgr_gem;
+	int i;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	for (i = 0; i < MAGAZINE_BUCKETS; i++)
+		drm_intel_gem_bo_magazine_spill(bufmgr_gem, mags, i,
+						mags->bucket[i].count);
+	bufmgr_gem->cache_hits += mags->hits;
+	DRMLISTDEL(&mags->link);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	free(mags);
+}
+
 static drm_intel_bo *
 drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 				const char *name,
@@ -714,6 +1149,8 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 	unsigned int page_size = getpagesize();
 	int ret;
 	struct drm_intel_gem_bo_bucket *bucket;
+	struct drm_intel_gem_bo_magazines *mags = NULL;
+	int mag_index = -1;
 	bool alloc_from_cache;
 	unsigned long bo_size;
 	bool for_render = false;
@@ -735,6 +1172,25 @@ drm_intel_gem_bo_alloc_internal(drm_intel_bufmgr *bufmgr,
 		bo_size = bucket->size;
 	}
 
+	/* Try the thread's own magazine first, without taking the lock */
+	if (bucket != NULL)
+		mag_index = bucket - bufmgr_gem->cache_bucket;
+	if (mag_index >= 0 && mag_index < MAGAZINE_BUCKETS)
+		mags = drm_intel_gem_bo_magazines_get(bufmgr_gem, false);
+	if (mags && drm_intel_gem_bo_magazines_claim(mags)) {
+		bo_gem = drm_intel_gem_bo_magazine_alloc(bufmgr_gem, mags,
+							 mag_index, for_render,
+							 tiling_mode, stride);
+		drm_intel_gem_bo_magazines_release(mags);
+		if (bo_gem) {
+			if (for_render)
+				bo_gem->bo.align = alignment;
+			else
+				assert(alignment == 0);
+			goto init;
+		}
+	}
+
 	pthread_mutex_lock(&bufmgr_gem->lock);
 	/* Get a buffer out of the cache if available */
 retry:
@@ -747,7 +1203,7 @@ retry:
 			 */
 			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
 					      bucket->head.prev, head);
-			DRMLISTDEL(&bo_gem->head);
+			drm_intel_gem_bo_cache_remove(bufmgr_gem, bo_gem);
 			alloc_from_cache = true;
 			bo_gem->bo.align = alignment;
 		} else {
@@ -763,7 +1219,8 @@ retry:
 					      bucket->head.next, head);
 			if (!drm_intel_gem_bo_busy(&bo_gem->bo)) {
 				alloc_from_cache = true;
-				DRMLISTDEL(&bo_gem->head);
+				drm_intel_gem_bo_cache_remove(bufmgr_gem,
+							      bo_gem);
 			}
 		}
 
@@ -782,9 +1239,28 @@ retry:
 				drm_intel_gem_bo_free(&bo_gem->bo);
 				goto retry;
 			}
+
+			/* Take a batch of this size for the thread too.  The
+			 * cleanup only claims the magazines under the lock,
+			 * so this doesn't fail.
+			 */
+			if (mags && mags->bucket[mag_index].count == 0 &&
+			    drm_intel_gem_bo_magazines_claim(mags)) {
+				drm_intel_gem_bo_magazine_refill(bufmgr_gem, mags,
+								 mag_index,
+								 for_render);
+				drm_intel_gem_bo_magazines_release(mags);
+			}
 		}
 	}
 
+	if (bucket != NULL) {
+		if (alloc_from_cache)
+			bufmgr_gem->cache_hits++;
+		else
+			bufmgr_gem->cache_misses++;
+	}
+
 	if (!alloc_from_cache) {
 		struct drm_i915_gem_create create;
 
@@ -827,7 +1303,9 @@ retry:
 							 stride))
 			goto err_free;
 	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 
+init:
 	bo_gem->name = name;
 	atomic_set(&bo_gem->refcount, 1);
 	bo_gem->validate_index = -1;
@@ -837,7 +1315,6 @@ retry:
 	bo_gem->reusable = true;
 
 	drm_intel_bo_gem_set_in_aperture_size(bufmgr_gem, bo_gem, alignment);
-	pthread_mutex_unlock(&bufmgr_gem->lock);
 
 	DBG("bo_create: buf %d (%s) %ldb\n",
 	    bo_gem->gem_handle, bo_gem->name, size);
@@ -1170,8 +1647,12 @@ err_unref:
 	return NULL;
 }
 
+/**
+ * Drops the bo from the bufmgr's tables and VMA cache and closes the GEM
+ * handle.  Called with bufmgr_gem->lock held.
+ */
 static void
-drm_intel_gem_bo_free(drm_intel_bo *bo)
+drm_intel_gem_bo_close(drm_intel_bo *bo)
 {
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
@@ -1180,19 +1661,18 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 
 	DRMLISTDEL(&bo_gem->vma_list);
 	if (bo_gem->mem_virtual) {
-		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->mem_virtual, 0));
-		drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_mapped[VMA_CPU] -= bo->size;
 	}
 	if (bo_gem->wc_virtual) {
-		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->wc_virtual, 0));
-		drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_mapped[VMA_WC] -= bo->size;
 	}
 	if (bo_gem->gtt_virtual) {
-		drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
 		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_mapped[VMA_GTT] -= bo->size;
 	}
+	bufmgr_gem->vma_size -= drm_intel_gem_bo_vma_size(bo_gem);
 
 	if (bo_gem->global_name)
 		HASH_DELETE(name_hh, bufmgr_gem->name_table, bo_gem);
@@ -1206,9 +1686,35 @@ drm_intel_gem_bo_free(drm_intel_bo *bo)
 		DBG("DRM_IOCTL_GEM_CLOSE %d failed (%s): %s\n",
 		    bo_gem->gem_handle, bo_gem->name, strerror(errno));
 	}
+}
+
+/** Unmaps and frees a closed bo, does not need bufmgr_gem->lock. */
+static void
+drm_intel_gem_bo_release(drm_intel_bo *bo)
+{
+	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
+
+	if (bo_gem->mem_virtual) {
+		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->mem_virtual, 0));
+		drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
+	}
+	if (bo_gem->wc_virtual) {
+		VG(VALGRIND_FREELIKE_BLOCK(bo_gem->wc_virtual, 0));
+		drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
+	}
+	if (bo_gem->gtt_virtual)
+		drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
+
 	free(bo);
 }
 
+static void
+drm_intel_gem_bo_free(drm_intel_bo *bo)
+{
+	drm_intel_gem_bo_close(bo);
+	drm_intel_gem_bo_release(bo);
+}
+
 static void
 drm_intel_gem_bo_mark_mmaps_incoherent(drm_intel_bo *bo)
 {
@@ -1235,6 +1741,8 @@ drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
 	if (bufmgr_gem->time == time)
 		return;
 
+	drm_intel_gem_bo_magazines_drain(bufmgr_gem, time);
+
 	for (i = 0; i < bufmgr_gem->num_buckets; i++) {
 		struct drm_intel_gem_bo_bucket *bucket =
 		    &bufmgr_gem->cache_bucket[i];
@@ -1247,7 +1755,8 @@ drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
 			if (time - bo_gem->free_time <= 1)
 				break;
 
-			DRMLISTDEL(&bo_gem->head);
+			drm_intel_gem_bo_cache_remove(bufmgr_gem, bo_gem);
+			bufmgr_gem->cache_evictions++;
 
 			drm_intel_gem_bo_free(&bo_gem->bo);
 		}
@@ -1256,45 +1765,170 @@ drm_intel_gem_cleanup_bo_cache(drm_intel_bufmgr_gem *bufmgr_gem, time_t time)
 	bufmgr_gem->time = time;
 }
 
-static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem)
+/* max number of bos the reaper closes per lock hold */
+#define REAP_BATCH 32
+
+/**
+ * Moves up to @max of the oldest cached bos which are either expired or
+ * over the cache budget to @victims.  Called with bufmgr_gem->lock held.
+ */
+static int
+drm_intel_gem_bo_cache_evict(drm_intel_bufmgr_gem *bufmgr_gem, time_t time,
+			     drmMMListHead *victims, int max)
+{
+	int i, n = 0;
+
+	while (n < max) {
+		drm_intel_bo_gem *bo_gem, *oldest = NULL;
+
+		/* Buckets are in free_time order, so the oldest bo is at
+		 * the head of one of them.
+		 */
+		for (i = 0; i < bufmgr_gem->num_buckets; i++) {
+			struct drm_intel_gem_bo_bucket *bucket =
+			    &bufmgr_gem->cache_bucket[i];
+
+			if (DRMLISTEMPTY(&bucket->head))
+				continue;
+			bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+					      bucket->head.next, head);
+			if (!oldest || bo_gem->free_time < oldest->free_time)
+				oldest = bo_gem;
+		}
+
+		if (!oldest)
+			break;
+		if (time - oldest->free_time <= bufmgr_gem->cache_max_age &&
+		    (!bufmgr_gem->cache_max_size ||
+		     bufmgr_gem->cache_size <= bufmgr_gem->cache_max_size))
+			break;
+
+		drm_intel_gem_bo_cache_remove(bufmgr_gem, oldest);
+		bufmgr_gem->cache_evictions++;
+		DRMLISTADDTAIL(&oldest->head, victims);
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Reaper callback, the background counterpart of
+ * drm_intel_gem_cleanup_bo_cache().  The GEM handles are closed in batches
+ * under the bufmgr lock, the unmapping and freeing is done after dropping it.
+ */
+static void
+drm_intel_gem_bo_cache_reap(void *data)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = data;
+	struct timespec time;
+	int n;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	do {
+		drmMMListHead victims, *pos, *next;
+
+		DRMINITLISTHEAD(&victims);
+
+		pthread_mutex_lock(&bufmgr_gem->lock);
+		drm_intel_gem_bo_magazines_drain(bufmgr_gem, time.tv_sec);
+		n = drm_intel_gem_bo_cache_evict(bufmgr_gem, time.tv_sec,
+						 &victims, REAP_BATCH);
+		for (pos = victims.next; pos != &victims; pos = pos->next)
+			drm_intel_gem_bo_close(&DRMLISTENTRY(drm_intel_bo_gem,
+							     pos, head)->bo);
+		pthread_mutex_unlock(&bufmgr_gem->lock);
+
+		for (pos = victims.next; pos != &victims; pos = next) {
+			next = pos->next;
+			drm_intel_gem_bo_release(&DRMLISTENTRY(drm_intel_bo_gem,
+							       pos, head)->bo);
+		}
+	} while (n == REAP_BATCH);
+}
+
+/** Unmaps an idle bo's cached mappings.  Called with bufmgr_gem->lock held. */
+static void drm_intel_gem_bo_evict_vma(drm_intel_bufmgr_gem *bufmgr_gem,
+				       drm_intel_bo_gem *bo_gem)
 {
-	int limit;
+	assert(bo_gem->map_count == 0);
+	DRMLISTDELINIT(&bo_gem->vma_list);
+	bufmgr_gem->vma_size -= drm_intel_gem_bo_vma_size(bo_gem);
+	bufmgr_gem->vma_evictions++;
+
+	if (bo_gem->mem_virtual) {
+		drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
+		bo_gem->mem_virtual = NULL;
+		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_mapped[VMA_CPU] -= bo_gem->bo.size;
+	}
+	if (bo_gem->wc_virtual) {
+		drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
+		bo_gem->wc_virtual = NULL;
+		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_mapped[VMA_WC] -= bo_gem->bo.size;
+	}
+	if (bo_gem->gtt_virtual) {
+		drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
+		bo_gem->gtt_virtual = NULL;
+		bufmgr_gem->vma_count--;
+		bufmgr_gem->vma_mapped[VMA_GTT] -= bo_gem->bo.size;
+	}
+}
+
+/**
+ * Trims the VMA cache to the count and byte limits, leaving room for
+ * @reserve more bytes of mappings.
+ *
+ * The count limit evicts in LRU order.  The byte limit evicts the largest
+ * of the few least recently used mappings instead, so that a single big
+ * mapping goes before a handful of small ones which are about as old.
+ */
+static void drm_intel_gem_bo_purge_vma_cache(drm_intel_bufmgr_gem *bufmgr_gem,
+					     uint64_t reserve)
+{
+	uint64_t mapped;
+	int i, limit;
 
 	DBG("%s: cached=%d, open=%d, limit=%d\n", __FUNCTION__,
 	    bufmgr_gem->vma_count, bufmgr_gem->vma_open, bufmgr_gem->vma_max);
 
-	if (bufmgr_gem->vma_max < 0)
-		return;
-
 	/* We may need to evict a few entries in order to create new mmaps */
 	limit = bufmgr_gem->vma_max - 2*bufmgr_gem->vma_open;
 	if (limit < 0)
 		limit = 0;
 
-	while (bufmgr_gem->vma_count > limit) {
-		drm_intel_bo_gem *bo_gem;
+	while (!DRMLISTEMPTY(&bufmgr_gem->vma_cache)) {
+		drm_intel_bo_gem *bo_gem, *victim;
+		drmMMListHead *pos;
 
-		bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+		victim = DRMLISTENTRY(drm_intel_bo_gem,
 				      bufmgr_gem->vma_cache.next,
 				      vma_list);
-		assert(bo_gem->map_count == 0);
-		DRMLISTDELINIT(&bo_gem->vma_list);
 
-		if (bo_gem->mem_virtual) {
-			drm_munmap(bo_gem->mem_virtual, bo_gem->bo.size);
-			bo_gem->mem_virtual = NULL;
-			bufmgr_gem->vma_count--;
-		}
-		if (bo_gem->wc_virtual) {
-			drm_munmap(bo_gem->wc_virtual, bo_gem->bo.size);
-			bo_gem->wc_virtual = NULL;
-			bufmgr_gem->vma_count--;
-		}
-		if (bo_gem->gtt_virtual) {
-			drm_munmap(bo_gem->gtt_virtual, bo_gem->bo.size);
-			bo_gem->gtt_virtual = NULL;
-			bufmgr_gem->vma_count--;
+		mapped = reserve;
+		for (i = 0; i < VMA_NUM_TYPES; i++)
+			mapped += bufmgr_gem->vma_mapped[i];
+
+		if (bufmgr_gem->vma_max_size &&
+		    mapped > bufmgr_gem->vma_max_size) {
+			for (i = 0, pos = victim->vma_list.next;
+			     i < VMA_EVICT_SCAN - 1 &&
+			     pos != &bufmgr_gem->vma_cache;
+			     i++, pos = pos->next) {
+				bo_gem = DRMLISTENTRY(drm_intel_bo_gem,
+						      pos, vma_list);
+				if (drm_intel_gem_bo_vma_size(bo_gem) >
+				    drm_intel_gem_bo_vma_size(victim))
+					victim = bo_gem;
+			}
+		} else if (bufmgr_gem->vma_max < 0 ||
+			   bufmgr_gem->vma_count <= limit) {
+			break;
 		}
+
+		drm_intel_gem_bo_evict_vma(bufmgr_gem, victim);
 	}
 }
 
@@ -1309,7 +1943,8 @@ static void drm_intel_gem_bo_close_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 		bufmgr_gem->vma_count++;
 	if (bo_gem->gtt_virtual)
 		bufmgr_gem->vma_count++;
-	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	bufmgr_gem->vma_size += drm_intel_gem_bo_vma_size(bo_gem);
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem, 0);
 }
 
 static void drm_intel_gem_bo_open_vma(drm_intel_bufmgr_gem *bufmgr_gem,
@@ -1323,7 +1958,9 @@ static void drm_intel_gem_bo_open_vma(drm_intel_bufmgr_gem *bufmgr_gem,
 		bufmgr_gem->vma_count--;
 	if (bo_gem->gtt_virtual)
 		bufmgr_gem->vma_count--;
-	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	bufmgr_gem->vma_size -= drm_intel_gem_bo_vma_size(bo_gem);
+	/* leave room for a mapping of the bo */
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem, bo_gem->bo.size);
 }
 
 static void
@@ -1387,6 +2024,12 @@ drm_intel_gem_bo_unreference_final(drm_intel_bo *bo, time_t time)
 		bo_gem->validate_index = -1;
 
 		DRMLISTADDTAIL(&bo_gem->head, &bucket->head);
+		bufmgr_gem->cache_size += bo->size;
+		bufmgr_gem->cache_count++;
+
+		if (bufmgr_gem->reaper && bufmgr_gem->cache_max_size &&
+		    bufmgr_gem->cache_size > bufmgr_gem->cache_max_size)
+			drmReaperKick(bufmgr_gem->reaper);
 	} else {
 		drm_intel_gem_bo_free(bo);
 	}
@@ -1415,11 +2058,16 @@ static void drm_intel_gem_bo_unreference(drm_intel_bo *bo)
 
 		clock_gettime(CLOCK_MONOTONIC, &time);
 
+		if (drm_intel_gem_bo_magazine_put(bo_gem, time.tv_sec))
+			return;
+
 		pthread_mutex_lock(&bufmgr_gem->lock);
 
 		if (atomic_dec_and_test(&bo_gem->refcount)) {
 			drm_intel_gem_bo_unreference_final(bo, time.tv_sec);
-			drm_intel_gem_cleanup_bo_cache(bufmgr_gem, time.tv_sec);
+			if (!bufmgr_gem->reaper)
+				drm_intel_gem_cleanup_bo_cache(bufmgr_gem,
+							       time.tv_sec);
 		}
 
 		pthread_mutex_unlock(&bufmgr_gem->lock);
@@ -1468,6 +2116,10 @@ static int drm_intel_gem_bo_map(drm_intel_bo *bo, int write_enable)
 		}
 		VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
 		bo_gem->mem_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+		bufmgr_gem->vma_mapped[VMA_CPU] += bo->size;
+		bufmgr_gem->vma_remaps++;
+	} else {
+		atomic_inc(&bufmgr_gem->vma_reuses);
 	}
 	DBG("bo_map: %d (%s) -> %p\n", bo_gem->gem_handle, bo_gem->name,
 	    bo_gem->mem_virtual);
@@ -1552,6 +2204,10 @@ map_gtt(drm_intel_bo *bo)
 				drm_intel_gem_bo_close_vma(bufmgr_gem, bo_gem);
 			return ret;
 		}
+		bufmgr_gem->vma_mapped[VMA_GTT] += bo->size;
+		bufmgr_gem->vma_remaps++;
+	} else {
+		atomic_inc(&bufmgr_gem->vma_reuses);
 	}
 
 	bo->virtual = bo_gem->gtt_virtual;
@@ -1901,6 +2557,27 @@ drm_intel_bufmgr_gem_destroy(drm_intel_bufmgr *bufmgr)
 	struct drm_gem_close close_bo;
 	int i, ret;
 
+	drmReaperUnregister(bufmgr_gem->reaper);
+
+	/* Free the bos of all threads' magazines.  Deleting the key keeps the
+	 * destructor from running for threads that exit later on.
+	 */
+	if (bufmgr_gem->has_magazines) {
+		pthread_key_delete(bufmgr_gem->magazine_key);
+		while (!DRMLISTEMPTY(&bufmgr_gem->magazines)) {
+			struct drm_intel_gem_bo_magazines *mags =
+			    DRMLISTENTRY(struct drm_intel_gem_bo_magazines,
+					 bufmgr_gem->magazines.next, link);
+			int j;
+
+			for (i = 0; i < MAGAZINE_BUCKETS; i++)
+				for (j = 0; j < mags->bucket[i].count; j++)
+					drm_intel_gem_bo_free(&mags->bucket[i].rounds[j]->bo);
+			DRMLISTDEL(&mags->link);
+			free(mags);
+		}
+	}
+
 	free(bufmgr_gem->exec2_objects);
 	free(bufmgr_gem->exec_objects);
 	free(bufmgr_gem->exec_bos);
@@ -2770,6 +3447,67 @@ drm_intel_bufmgr_gem_enable_reuse(drm_intel_bufmgr *bufmgr)
 	bufmgr_gem->bo_reuse = true;
 }
 
+/**
+ * Frees cached buffer objects from the shared background reaper thread
+ * instead of from drm_intel_bo_unreference().
+ *
+ * Cached buffers are freed once they are older than \p max_age seconds
+ * (0 for the default of 1 second), and oldest first whenever the cache
+ * holds more than \p max_size bytes (0 for no limit).  Only has an effect
+ * once reuse is enabled with drm_intel_bufmgr_gem_enable_reuse().
+ */
+drm_public int
+drm_intel_bufmgr_gem_enable_cache_reaper(drm_intel_bufmgr *bufmgr,
+					 uint64_t max_size, uint32_t max_age)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+	int ret = 0;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->cache_max_size = max_size;
+	bufmgr_gem->cache_max_age = max_age ? max_age : 1;
+	if (!bufmgr_gem->reaper) {
+		bufmgr_gem->reaper =
+			drmReaperRegister(drm_intel_gem_bo_cache_reap,
+					  bufmgr_gem, 500);
+		if (!bufmgr_gem->reaper)
+			ret = -ENOMEM;
+	} else {
+		drmReaperKick(bufmgr_gem->reaper);
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+
+	return ret;
+}
+
+/**
+ * Returns the occupancy and hit-rate counters of the buffer object cache.
+ */
+drm_public void
+drm_intel_bufmgr_gem_get_cache_stats(drm_intel_bufmgr *bufmgr,
+				     struct drm_intel_bo_cache_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bufmgr;
+	struct drm_intel_gem_bo_magazines *mags;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	stats->hits = bufmgr_gem->cache_hits;
+	stats->misses = bufmgr_gem->cache_misses;
+	stats->evictions = bufmgr_gem->cache_evictions;
+	stats->size = bufmgr_gem->cache_size;
+	stats->count = bufmgr_gem->cache_count;
+
+	/* The magazines of other threads may change under us, these are
+	 * only a snapshot anyway.
+	 */
+	DRMLISTFOREACHENTRY(mags, &bufmgr_gem->magazines, link) {
+		stats->hits += mags->hits;
+		stats->size += mags->size;
+		stats->count += mags->count;
+	}
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
 /**
  * Disables implicit synchronisation before executing the bo
  *
@@ -3076,6 +3814,8 @@ add_bucket(drm_intel_bufmgr_gem *bufmgr_gem, int size)
 	unsigned int i = bufmgr_gem->num_buckets;
 
 	assert(i < ARRAY_SIZE(bufmgr_gem->cache_bucket));
+	/* drm_intel_gem_bo_bucket_for_size() computes the index from the size */
+	assert(util_bucket_index(size) == i);
 
 	DRMINITLISTHEAD(&bufmgr_gem->cache_bucket[i].head);
 	bufmgr_gem->cache_bucket[i].size = size;
@@ -3116,7 +3856,49 @@ drm_intel_bufmgr_gem_set_vma_cache_size(drm_intel_bufmgr *bufmgr, int limit)
 
 	bufmgr_gem->vma_max = limit;
 
-	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem);
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem, 0);
+}
+
+/**
+ * Limits the address space taken by CPU, WC and GTT mappings of the bufmgr's
+ * buffers to \p limit bytes (0 for no limit), by unmapping the cached
+ * mappings of buffers which are not currently mapped.
+ *
+ * This is useful for 32-bit processes, where a few large mappings exhaust
+ * the address space long before the count set with
+ * drm_intel_bufmgr_gem_set_vma_cache_size() is reached.
+ */
+drm_public void
+drm_intel_bufmgr_gem_set_vma_cache_bytes(drm_intel_bufmgr *bufmgr,
+					 uint64_t limit)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	bufmgr_gem->vma_max_size = limit;
+	drm_intel_gem_bo_purge_vma_cache(bufmgr_gem, 0);
+	pthread_mutex_unlock(&bufmgr_gem->lock);
+}
+
+/**
+ * Returns the occupancy and reuse counters of the VMA cache.
+ */
+drm_public void
+drm_intel_bufmgr_gem_get_vma_cache_stats(drm_intel_bufmgr *bufmgr,
+					 struct drm_intel_vma_cache_stats *stats)
+{
+	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *)bufmgr;
+
+	pthread_mutex_lock(&bufmgr_gem->lock);
+	stats->reuses = atomic_read(&bufmgr_gem->vma_reuses);
+	stats->remaps = bufmgr_gem->vma_remaps;
+	stats->evictions = bufmgr_gem->vma_evictions;
+	stats->cpu_size = bufmgr_gem->vma_mapped[VMA_CPU];
+	stats->wc_size = bufmgr_gem->vma_mapped[VMA_WC];
+	stats->gtt_size = bufmgr_gem->vma_mapped[VMA_GTT];
+	stats->cached_size = bufmgr_gem->vma_size;
+	stats->cached_count = bufmgr_gem->vma_count;
+	pthread_mutex_unlock(&bufmgr_gem->lock);
 }
 
 static int
@@ -3506,8 +4288,10 @@ drm_public void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
-	if (bo_gem->mem_virtual)
+	if (bo_gem->mem_virtual) {
+		atomic_inc(&bufmgr_gem->vma_reuses);
 		return bo_gem->mem_virtual;
+	}
 
 	if (bo_gem->is_userptr) {
 		/* Return the same user ptr */
@@ -3538,7 +4322,11 @@ drm_public void *drm_intel_gem_bo_map__cpu(drm_intel_bo *bo)
 		} else {
 			VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
 			bo_gem->mem_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+			bufmgr_gem->vma_mapped[VMA_CPU] += bo->size;
+			bufmgr_gem->vma_remaps++;
 		}
+	} else {
+		atomic_inc(&bufmgr_gem->vma_reuses);
 	}
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
@@ -3550,8 +4338,10 @@ drm_public void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo)
 	drm_intel_bufmgr_gem *bufmgr_gem = (drm_intel_bufmgr_gem *) bo->bufmgr;
 	drm_intel_bo_gem *bo_gem = (drm_intel_bo_gem *) bo;
 
-	if (bo_gem->wc_virtual)
+	if (bo_gem->wc_virtual) {
+		atomic_inc(&bufmgr_gem->vma_reuses);
 		return bo_gem->wc_virtual;
+	}
 
 	if (bo_gem->is_userptr)
 		return NULL;
@@ -3581,7 +4371,11 @@ drm_public void *drm_intel_gem_bo_map__wc(drm_intel_bo *bo)
 		} else {
 			VG(VALGRIND_MALLOCLIKE_BLOCK(mmap_arg.addr_ptr, mmap_arg.size, 0, 1));
 			bo_gem->wc_virtual = (void *)(uintptr_t) mmap_arg.addr_ptr;
+			bufmgr_gem->vma_mapped[VMA_WC] += bo->size;
+			bufmgr_gem->vma_remaps++;
 		}
+	} else {
+		atomic_inc(&bufmgr_gem->vma_reuses);
 	}
 	pthread_mutex_unlock(&bufmgr_gem->lock);
 
@@ -3802,6 +4596,12 @@ drm_intel_bufmgr_gem_init(int fd, int batch_size)
 	DRMINITLISTHEAD(&bufmgr_gem->vma_cache);
 	bufmgr_gem->vma_max = -1; /* unlimited by default */
 
+	DRMINITLISTHEAD(&bufmgr_gem->magazines);
+	bufmgr_gem->cache_max_age = 1;
+	bufmgr_gem->has_magazines =
+		pthread_key_create(&bufmgr_gem->magazine_key,
+				   drm_intel_gem_bo_magazines_destroy) == 0;
+
 	DRMLISTADD(&bufmgr_gem->managers, &bufmgr_list);
 
 exit:
@@ -63,6 +63,8 @@ struct nouveau_pushbuf_priv {
 	uint32_t *bgn;
 	int bo_next;
 	int bo_nr;
+	struct nouveau_pushbuf_refn *batch;
+	int batch_size;
 	struct nouveau_bo *bos[];
 };
 
@@ -143,25 +145,108 @@ pushbuf_kref_fits(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 	return false;
 }
 
-static struct drm_nouveau_gem_pushbuf_bo *
-pushbuf_kref(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
-	     uint32_t flags)
+static inline uint32_t
+pushbuf_domains(uint32_t flags)
+{
+	uint32_t domains = 0;
+
+	if (flags & NOUVEAU_BO_VRAM)
+		domains |= NOUVEAU_GEM_DOMAIN_VRAM;
+	if (flags & NOUVEAU_BO_GART)
+		domains |= NOUVEAU_GEM_DOMAIN_GART;
+	return domains;
+}
+
+/* Merges the access flags of a buffer into its existing reference. */
+static inline bool
+pushbuf_kref_merge(struct nouveau_pushbuf *push,
+		   struct drm_nouveau_gem_pushbuf_bo *kref,
+		   struct nouveau_bo *bo, uint32_t flags)
 {
 	struct nouveau_device *dev = push->client->device;
+	struct nouveau_pushbuf_krec *krec = nouveau_pushbuf(push)->krec;
+	uint32_t domains = pushbuf_domains(flags);
+
+	/* possible conflict in memory types - flush and retry */
+	if (!(kref->valid_domains & domains))
+		return false;
+
+	/* VRAM|GART buffer turning into a VRAM buffer.  Make sure
+	 * it'll fit in VRAM and force a flush if not.
+	 */
+	if ((kref->valid_domains  & NOUVEAU_GEM_DOMAIN_GART) &&
+	    (            domains == NOUVEAU_GEM_DOMAIN_VRAM)) {
+		if (krec->vram_used + bo->size > dev->vram_limit)
+			return false;
+		krec->vram_used += bo->size;
+		krec->gart_used -= bo->size;
+	}
+
+	kref->valid_domains &= domains;
+	if (flags & NOUVEAU_BO_WR)
+		kref->write_domains |= domains;
+	if (flags & NOUVEAU_BO_RD)
+		kref->read_domains |= domains;
+	return true;
+}
+
+/* Adds a reference to a buffer to the current krec, or merges the access
+ * flags into an existing one.  If "fits" is set, the caller has already
+ * made sure that there's room for the buffer in the krec and that it's
+ * not referenced by another pushbuf.
+ */
+static struct drm_nouveau_gem_pushbuf_bo *
+pushbuf_kref_add(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
+		 uint32_t flags, bool fits)
+{
 	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
 	struct nouveau_pushbuf_krec *krec = nvpb->krec;
-	struct nouveau_pushbuf *fpush;
 	struct drm_nouveau_gem_pushbuf_bo *kref;
 	uint32_t domains, domains_wr, domains_rd;
 
-	domains = 0;
-	if (flags & NOUVEAU_BO_VRAM)
-		domains |= NOUVEAU_GEM_DOMAIN_VRAM;
-	if (flags & NOUVEAU_BO_GART)
-		domains |= NOUVEAU_GEM_DOMAIN_GART;
+	kref = cli_kref_get(push->client, bo);
+	if (kref)
+		return pushbuf_kref_merge(push, kref, bo, flags) ? kref : NULL;
+
+	domains = pushbuf_domains(flags);
 	domains_wr = domains * !!(flags & NOUVEAU_BO_WR);
 	domains_rd = domains * !!(flags & NOUVEAU_BO_RD);
 
+	if (fits) {
+		if (domains == NOUVEAU_GEM_DOMAIN_VRAM)
+			krec->vram_used += bo->size;
+		else
+			krec->gart_used += bo->size;
+	} else
+	if (krec->nr_buffer == NOUVEAU_GEM_MAX_BUFFERS ||
+	    !pushbuf_kref_fits(push, bo, &domains)) {
+		return NULL;
+	}
+
+	kref = &krec->buffer[krec->nr_buffer++];
+	kref->user_priv = (unsigned long)bo;
+	kref->handle = bo->handle;
+	kref->valid_domains = domains;
+	kref->write_domains = domains_wr;
+	kref->read_domains = domains_rd;
+	kref->presumed.valid = 1;
+	kref->presumed.offset = bo->offset;
+	if (bo->flags & NOUVEAU_BO_VRAM)
+		kref->presumed.domain = NOUVEAU_GEM_DOMAIN_VRAM;
+	else
+		kref->presumed.domain = NOUVEAU_GEM_DOMAIN_GART;
+
+	cli_kref_set(push->client, bo, kref, push);
+	atomic_inc(&nouveau_bo(bo)->refcnt);
+	return kref;
+}
+
+static struct drm_nouveau_gem_pushbuf_bo *
+pushbuf_kref(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
+	     uint32_t flags)
+{
+	struct nouveau_pushbuf *fpush;
+
 	/* if buffer is referenced on another pushbuf that is owned by the
 	 * same client, we need to flush the other pushbuf first to ensure
 	 * the correct ordering of commands
@@ -170,49 +255,131 @@ pushbuf_kref(struct nouveau_pushbuf *push, struct nouveau_bo *bo,
 	if (fpush && fpush != push)
 		pushbuf_flush(fpush);
 
-	kref = cli_kref_get(push->client, bo);
-	if (kref) {
-		/* possible conflict in memory types - flush and retry */
-		if (!(kref->valid_domains & domains))
-			return NULL;
-
-		/* VRAM|GART buffer turning into a VRAM buffer.  Make sure
-		 * it'll fit in VRAM and force a flush if not.
-		 */
-		if ((kref->valid_domains  & NOUVEAU_GEM_DOMAIN_GART) &&
-		    (            domains == NOUVEAU_GEM_DOMAIN_VRAM)) {
-			if (krec->vram_used + bo->size > dev->vram_limit)
-				return NULL;
-			krec->vram_used += bo->size;
-			krec->gart_used -= bo->size;
+	return pushbuf_kref_add(push, bo, flags, false);
+}
+
+/* Bulk validation of a set of buffers.  Buffers which are already on the
+ * krec are merged right away.  The others are set aside, along with the
+ * space they need and the other pushbufs that reference them, which are
+ * then flushed at a single point, in order.  If everything fits, the new
+ * buffers are added without pushbuf_kref_fits() having to place each of
+ * them; otherwise they go through pushbuf_kref() one at a time.
+ */
+#define PUSHBUF_BATCH_FLUSH 4
+
+struct pushbuf_kref_batch {
+	struct nouveau_pushbuf *flush[PUSHBUF_BATCH_FLUSH];
+	int nr_flush;
+	int nr_buffer;
+	uint64_t vram;
+	uint64_t gart;
+};
+
+static void
+pushbuf_kref_batch_flush(struct pushbuf_kref_batch *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->nr_flush; i++)
+		pushbuf_flush(batch->flush[i]);
+	batch->nr_flush = 0;
+}
+
+static int
+pushbuf_kref_batch_defer(struct nouveau_pushbuf *push,
+			 struct pushbuf_kref_batch *batch,
+			 struct nouveau_pushbuf *fpush,
+			 struct nouveau_bo *bo, uint32_t flags)
+{
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_pushbuf_refn *refs;
+	int i;
+
+	if (batch->nr_buffer == nvpb->batch_size) {
+		int size = nvpb->batch_size ? nvpb->batch_size * 2 : 64;
+
+		refs = realloc(nvpb->batch, size * sizeof(*refs));
+		if (!refs) {
+			pushbuf_kref_batch_flush(batch);
+			return pushbuf_kref(push, bo, flags) ? 0 : -ENOSPC;
 		}
+		nvpb->batch = refs;
+		nvpb->batch_size = size;
+	}
 
-		kref->valid_domains &= domains;
-		kref->write_domains |= domains_wr;
-		kref->read_domains  |= domains_rd;
-	} else {
-		if (krec->nr_buffer == NOUVEAU_GEM_MAX_BUFFERS ||
-		    !pushbuf_kref_fits(push, bo, &domains))
-			return NULL;
-
-		kref = &krec->buffer[krec->nr_buffer++];
-		kref->user_priv = (unsigned long)bo;
-		kref->handle = bo->handle;
-		kref->valid_domains = domains;
-		kref->write_domains = domains_wr;
-		kref->read_domains = domains_rd;
-		kref->presumed.valid = 1;
-		kref->presumed.offset = bo->offset;
-		if (bo->flags & NOUVEAU_BO_VRAM)
-			kref->presumed.domain = NOUVEAU_GEM_DOMAIN_VRAM;
-		else
-			kref->presumed.domain = NOUVEAU_GEM_DOMAIN_GART;
+	if (fpush) {
+		for (i = 0; i < batch->nr_flush; i++) {
+			if (batch->flush[i] == fpush)
+				break;
+		}
+		/* keep the flushes in order once the set is full */
+		if (i == PUSHBUF_BATCH_FLUSH) {
+			pushbuf_kref_batch_flush(batch);
+			i = 0;
+		}
+		if (i == batch->nr_flush)
+			batch->flush[batch->nr_flush++] = fpush;
+	}
+
+	/* buffers listed more than once are counted more than once, which
+	 * at worst sends the batch down the slow path
+	 */
+	refs = &nvpb->batch[batch->nr_buffer++];
+	refs->bo = bo;
+	refs->flags = flags;
+	if (pushbuf_domains(flags) == NOUVEAU_GEM_DOMAIN_VRAM)
+		batch->vram += bo->size;
+	else
+		batch->gart += bo->size;
+	return 0;
+}
+
+static inline int
+pushbuf_kref_batch_add(struct nouveau_pushbuf *push,
+		       struct pushbuf_kref_batch *batch,
+		       struct nouveau_bo *bo, uint32_t flags)
+{
+	struct nouveau_pushbuf *fpush = cli_push_get(push->client, bo);
 
-		cli_kref_set(push->client, bo, kref, push);
-		atomic_inc(&nouveau_bo(bo)->refcnt);
+	/* a buffer on this pushbuf always has a kref */
+	if (fpush != push)
+		return pushbuf_kref_batch_defer(push, batch, fpush, bo, flags);
+
+	if (!pushbuf_kref_merge(push, cli_kref_get(push->client, bo), bo,
+				flags))
+		return -ENOSPC;
+	return 0;
+}
+
+static int
+pushbuf_kref_batch_commit(struct nouveau_pushbuf *push,
+			  struct pushbuf_kref_batch *batch)
+{
+	struct nouveau_device *dev = push->client->device;
+	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
+	struct nouveau_pushbuf_krec *krec = nvpb->krec;
+	struct nouveau_pushbuf_refn *refs = nvpb->batch;
+	bool fits;
+	int i;
+
+	pushbuf_kref_batch_flush(batch);
+
+	fits = krec->nr_buffer + batch->nr_buffer <= NOUVEAU_GEM_MAX_BUFFERS &&
+	       krec->vram_used + batch->vram <= dev->vram_limit &&
+	       krec->gart_used + batch->gart <= dev->gart_limit;
+
+	for (i = 0; i < batch->nr_buffer; i++) {
+		if (fits) {
+			if (!pushbuf_kref_add(push, refs[i].bo, refs[i].flags,
+					      true))
+				return -ENOSPC;
+		} else {
+			if (!pushbuf_kref(push, refs[i].bo, refs[i].flags))
+				return -ENOSPC;
+		}
 	}
 
-	return kref;
+	return 0;
 }
 
 static uint32_t
@@ -453,17 +620,15 @@ pushbuf_refn(struct nouveau_pushbuf *push, bool retry,
 {
 	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
 	struct nouveau_pushbuf_krec *krec = nvpb->krec;
-	struct drm_nouveau_gem_pushbuf_bo *kref;
+	struct pushbuf_kref_batch batch = {};
 	int sref = krec->nr_buffer;
 	int ret = 0, i;
 
-	for (i = 0; i < nr; i++) {
-		kref = pushbuf_kref(push, refs[i].bo, refs[i].flags);
-		if (!kref) {
-			ret = -ENOSPC;
-			break;
-		}
-	}
+	for (i = 0; i < nr && !ret; i++)
+		ret = pushbuf_kref_batch_add(push, &batch, refs[i].bo,
+					     refs[i].flags);
+	if (!ret)
+		ret = pushbuf_kref_batch_commit(push, &batch);
 
 	if (ret) {
 		pushbuf_refn_fail(push, sref, krec->nr_reloc);
@@ -482,9 +647,9 @@ pushbuf_validate(struct nouveau_pushbuf *push, bool retry)
 {
 	struct nouveau_pushbuf_priv *nvpb = nouveau_pushbuf(push);
 	struct nouveau_pushbuf_krec *krec = nvpb->krec;
-	struct drm_nouveau_gem_pushbuf_bo *kref;
 	struct nouveau_bufctx *bctx = push->bufctx;
 	struct nouveau_bufref *bref;
+	struct pushbuf_kref_batch batch = {};
 	int relocs = bctx ? bctx->relocs * 2: 0;
 	int sref, srel, ret;
 
@@ -499,13 +664,19 @@ pushbuf_validate(struct nouveau_pushbuf *push, bool retry)
 	DRMLISTADD(&bctx->head, &nvpb->bctx_list);
 
 	DRMLISTFOREACHENTRY(bref, &bctx->pending, thead) {
-		kref = pushbuf_kref(push, bref->bo, bref->flags);
-		if (!kref) {
-			ret = -ENOSPC;
+		ret = pushbuf_kref_batch_add(push, &batch, bref->bo,
+					     bref->flags);
+		if (ret)
 			break;
-		}
+	}
+	if (!ret)
+		ret = pushbuf_kref_batch_commit(push, &batch);
+
+	if (!ret && bctx->relocs) {
+		DRMLISTFOREACHENTRY(bref, &bctx->pending, thead) {
+			if (!bref->packet)
+				continue;
 
-		if (bref->packet) {
 			pushbuf_krel(push, bref->bo, bref->packet, 0, 0, 0);
 			*push->cur++ = 0;
 			pushbuf_krel(push, bref->bo, bref->data, bref->flags,
@@ -620,6 +791,7 @@ nouveau_pushbuf_del(struct nouveau_pushbuf **ppush)
 		while (nvpb->bo_nr--)
 			nouveau_bo_ref(NULL, &nvpb->bos[nvpb->bo_nr]);
 		nouveau_bo_ref(NULL, &nvpb->bo);
+		free(nvpb->batch);
 		free(nvpb);
 	}
 	*ppush = NULL;
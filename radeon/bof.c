@@ -24,10 +24,26 @@
  *      Jerome Glisse
  */
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "bof.h"
 
+/*
+ * A file loaded by bof_load_file(), mapped copy-on-write so that values can
+ * be handed out in place and still be written to.  Every node read from it
+ * holds a reference.
+ */
+struct bof_map {
+	char		*ptr;
+	size_t		size;
+	unsigned	refcount;
+};
+
 /*
  * helpers
  */
@@ -45,6 +61,8 @@ static int bof_entry_grow(bof_t *bof)
 	return 0;
 }
 
+static int bof_expand(bof_t *bof);
+
 /*
  * object 
  */
@@ -65,6 +83,8 @@ bof_t *bof_object_get(bof_t *object, const char *keyname)
 {
 	unsigned i;
 
+	if (bof_expand(object))
+		return NULL;
 	for (i = 0; i < object->array_size; i += 2) {
 		if (!strcmp(object->array[i]->value, keyname)) {
 			return object->array[i + 1];
@@ -80,6 +100,9 @@ int bof_object_set(bof_t *object, const char *keyname, bof_t *value)
 
 	if (object->type != BOF_TYPE_OBJECT)
 		return -EINVAL;
+	r = bof_expand(object);
+	if (r)
+		return r;
 	r = bof_entry_grow(object);
 	if (r)
 		return r;
@@ -113,6 +136,9 @@ int bof_array_append(bof_t *array, bof_t *value)
 	int r;
 	if (array->type != BOF_TYPE_ARRAY)
 		return -EINVAL;
+	r = bof_expand(array);
+	if (r)
+		return r;
 	r = bof_entry_grow(array);
 	if (r)
 		return r;
@@ -124,14 +150,14 @@ int bof_array_append(bof_t *array, bof_t *value)
 
 bof_t *bof_array_get(bof_t *bof, unsigned i)
 {
-	if (!bof_is_array(bof) || i >= bof->array_size)
+	if (!bof_is_array(bof) || bof_expand(bof) || i >= bof->array_size)
 		return NULL;
 	return bof->array[i];
 }
 
 unsigned bof_array_size(bof_t *bof)
 {
-	if (!bof_is_array(bof))
+	if (!bof_is_array(bof) || bof_expand(bof))
 		return 0;
 	return bof->array_size;
 }
@@ -215,7 +241,11 @@ bof_t *bof_int32(int32_t value)
 
 int32_t bof_int32_value(bof_t *bof)
 {
-	return *((uint32_t*)bof->value);
+	int32_t value;
+
+	/* loaded values aren't necessarily aligned */
+	memcpy(&value, bof->value, 4);
+	return value;
 }
 
 /*
@@ -241,7 +271,7 @@ static void bof_print_bof(bof_t *bof, int level, int entry)
 		fprintf(stderr, "%p string [%s %d]\n", bof, (char*)bof->value, bof->size);
 		break;
 	case BOF_TYPE_INT32:
-		fprintf(stderr, "%p int32 [%d %d]\n", bof, *(int*)bof->value, bof->size);
+		fprintf(stderr, "%p int32 [%d %d]\n", bof, bof_int32_value(bof), bof->size);
 		break;
 	case BOF_TYPE_BLOB:
 		fprintf(stderr, "%p blob [%d]\n", bof, bof->size);
@@ -265,6 +295,11 @@ static void bof_print_rec(bof_t *bof, int level, int entry)
 {
 	unsigned i;
 
+	if (bof == NULL) {
+		bof_print_bof(bof, level, entry);
+		return;
+	}
+	bof_expand(bof);
 	bof_print_bof(bof, level, entry);
 	for (i = 0; i < bof->array_size; i++) {
 		bof_print_rec(bof->array[i], level + 2, i);
@@ -276,97 +311,158 @@ void bof_print(bof_t *bof)
 	bof_print_rec(bof, 0, 0);
 }
 
-static int bof_read(bof_t *root, FILE *file, long end, int level)
+static void bof_map_put(struct bof_map *map)
 {
-	bof_t *bof = NULL;
-	int r;
+	if (--map->refcount > 0)
+		return;
+	munmap(map->ptr, map->size);
+	free(map);
+}
 
-	if (ftell(file) >= end) {
-		return 0;
+/* Reads the node at offset from its header, it must end before end.
+ * Values are used in place and children are only read by bof_expand().
+ */
+static bof_t *bof_map_node(struct bof_map *map, size_t offset, size_t end)
+{
+	bof_t *bof;
+
+	if (end - offset < 12) {
+		fprintf(stderr, "truncated node at %zu\n", offset);
+		return NULL;
 	}
-	r = bof_entry_grow(root);
-	if (r)
-		return r;
 	bof = bof_object();
 	if (bof == NULL)
-		return -ENOMEM;
-	bof->offset = ftell(file);
-	r = fread(&bof->type, 4, 1, file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&bof->size, 4, 1, file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&bof->array_size, 4, 1, file);
-	if (r != 1)
-		goto out_err;
+		return NULL;
+	bof->map = map;
+	map->refcount++;
+	bof->offset = offset;
+	memcpy(&bof->type, map->ptr + offset, 4);
+	memcpy(&bof->size, map->ptr + offset + 4, 4);
+	/* the number of children, only used to size the array up front */
+	memcpy(&bof->centry, map->ptr + offset + 8, 4);
 	switch (bof->type) {
+	case BOF_TYPE_NULL:
+		/* written with a size of 0 but a full header */
+		return bof;
 	case BOF_TYPE_STRING:
+		if (bof->size <= 12 || bof->size > end - offset ||
+		    map->ptr[offset + bof->size - 1] != '\0')
+			goto out_err;
+		break;
 	case BOF_TYPE_INT32:
-	case BOF_TYPE_BLOB:
-		bof->value = calloc(1, bof->size - 12);
-		if (bof->value == NULL) {
+		if (bof->size != 16 || bof->size > end - offset)
 			goto out_err;
-		}
-		r = fread(bof->value, bof->size - 12, 1, file);
-		if (r != 1) {
-			fprintf(stderr, "error reading %d\n", bof->size - 12);
+		break;
+	case BOF_TYPE_BLOB:
+		if (bof->size < 12 || bof->size > end - offset)
 			goto out_err;
-		}
 		break;
-	case BOF_TYPE_NULL:
-		return 0;
 	case BOF_TYPE_OBJECT:
 	case BOF_TYPE_ARRAY:
-		r = bof_read(bof, file, bof->offset + bof->size, level + 2);
-		if (r)
+		if (bof->size < 12 || bof->size > end - offset)
 			goto out_err;
-		break;
+		bof->lazy = 1;
+		return bof;
 	default:
 		fprintf(stderr, "invalid type %d\n", bof->type);
-		goto out_err;
+		bof_decref(bof);
+		return NULL;
 	}
-	root->array[root->centry++] = bof;
-	return bof_read(root, file, end, level);
+	bof->value = map->ptr + offset + 12;
+	return bof;
 out_err:
+	fprintf(stderr, "invalid size %d at %zu\n", bof->size, offset);
 	bof_decref(bof);
-	return -EINVAL;
+	return NULL;
 }
 
-bof_t *bof_load_file(const char *filename)
+/* Reads the children of a loaded object or array on first use. */
+static int bof_expand(bof_t *bof)
 {
-	bof_t *root = bof_object();
+	size_t offset, end;
+	bof_t *child;
+	unsigned i;
 	int r;
 
-	if (root == NULL) {
-		fprintf(stderr, "%s failed to create root object\n", __func__);
-		return NULL;
+	if (!bof->lazy)
+		return 0;
+	offset = bof->offset + 12;
+	end = bof->offset + bof->size;
+	/* every child takes at least 12 bytes */
+	if (bof->centry && bof->centry <= (end - offset) / 12 && !bof->array) {
+		bof->array = malloc(bof->centry * sizeof(void*));
+		if (bof->array)
+			bof->nentry = bof->centry;
 	}
-	root->file = fopen(filename, "r");
-	if (root->file == NULL)
-		goto out_err;
-	r = fseek(root->file, 0L, SEEK_SET);
-	if (r) {
-		fprintf(stderr, "%s failed to seek into file %s\n", __func__, filename);
-		goto out_err;
+	while (offset < end) {
+		r = bof_entry_grow(bof);
+		if (r)
+			goto out_err;
+		r = -EINVAL;
+		child = bof_map_node(bof->map, offset, end);
+		if (child == NULL)
+			goto out_err;
+		bof->array[bof->array_size++] = child;
+		/* object keys are strings */
+		if (bof->type == BOF_TYPE_OBJECT && (bof->array_size & 1) &&
+		    child->type != BOF_TYPE_STRING)
+			goto out_err;
+		offset += child->type == BOF_TYPE_NULL ? 12 : child->size;
 	}
-	root->offset = ftell(root->file);
-	r = fread(&root->type, 4, 1, root->file);
-	if (r != 1)
-		goto out_err;
-	r = fread(&root->size, 4, 1, root->file);
-	if (r != 1)
+	r = -EINVAL;
+	if (bof->type == BOF_TYPE_OBJECT && (bof->array_size & 1))
 		goto out_err;
-	r = fread(&root->array_size, 4, 1, root->file);
-	if (r != 1)
-		goto out_err;
-	r = bof_read(root, root->file, root->offset + root->size, 2);
-	if (r)
-		goto out_err;
-	return root;
+	bof->lazy = 0;
+	return 0;
 out_err:
-	bof_decref(root);
-	return NULL;
+	for (i = 0; i < bof->array_size; i++)
+		bof_decref(bof->array[i]);
+	bof->array_size = 0;
+	return r;
+}
+
+bof_t *bof_load_file(const char *filename)
+{
+	struct bof_map *map;
+	struct stat st;
+	bof_t *root;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "%s failed to open file %s\n", __func__, filename);
+		return NULL;
+	}
+	if (fstat(fd, &st) || st.st_size < 12 ||
+	    (unsigned long long)st.st_size > SIZE_MAX) {
+		fprintf(stderr, "%s invalid file %s\n", __func__, filename);
+		close(fd);
+		return NULL;
+	}
+	map = calloc(1, sizeof(*map));
+	if (map == NULL) {
+		close(fd);
+		return NULL;
+	}
+	map->size = st.st_size;
+	map->ptr = mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			fd, 0);
+	close(fd);
+	if (map->ptr == MAP_FAILED) {
+		fprintf(stderr, "%s failed to map file %s\n", __func__, filename);
+		free(map);
+		return NULL;
+	}
+	/* the root holds the only reference from here on */
+	map->refcount = 1;
+	root = bof_map_node(map, 0, map->size);
+	bof_map_put(map);
+	if (root && !bof_is_object(root) && !bof_is_array(root)) {
+		fprintf(stderr, "%s root of %s isn't an object\n", __func__, filename);
+		bof_decref(root);
+		root = NULL;
+	}
+	return root;
 }
 
 void bof_incref(bof_t *bof)
@@ -392,7 +488,10 @@ void bof_decref(bof_t *bof)
 		bof->file = NULL;
 	}
 	free(bof->array);
-	free(bof->value);
+	if (bof->map)
+		bof_map_put(bof->map);
+	else
+		free(bof->value);
 	free(bof);
 }
 
@@ -401,6 +500,9 @@ static int bof_file_write(bof_t *bof, FILE *file)
 	unsigned i;
 	int r;
 
+	r = bof_expand(bof);
+	if (r)
+		return r;
 	r = fwrite(&bof->type, 4, 1, file);
 	if (r != 1)
 		return -EINVAL;
@@ -439,8 +541,11 @@ static int bof_file_write(bof_t *bof, FILE *file)
 int bof_dump_file(bof_t *bof, const char *filename)
 {
 	unsigned i;
-	int r = 0;
+	int r;
 
+	r = bof_expand(bof);
+	if (r)
+		return r;
 	if (bof->file) {
 		fclose(bof->file);
 		bof->file = NULL;
@@ -37,6 +37,7 @@
 #define BOF_TYPE_INT32		5
 
 struct bof;
+struct bof_map;
 
 typedef struct bof {
 	struct bof	**array;
@@ -49,6 +50,10 @@ typedef struct bof {
 	uint32_t	array_size;
 	void		*value;
 	long		offset;
+	/* set for nodes loaded by bof_load_file(), values point into it */
+	struct bof_map	*map;
+	/* children of a loaded object or array which weren't read yet */
+	unsigned	lazy;
 } bof_t;
 
 extern int bof_file_flush(bof_t *root);
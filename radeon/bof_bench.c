@@ -0,0 +1,251 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * on the rights to use, copy, modify, merge, publish, distribute, sub
+ * license, and/or sell copies of the Software, and to permit persons to whom
+ * the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHOR(S) AND/OR THEIR SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Load benchmark for BOF command stream dumps.
+ *
+ * Writes a synthetic dump laid out like the ones of the GEM command stream
+ * (device_id, reloc, pm4 and an array of bos with size, handle and data),
+ * then reports time and resident memory for loading it, looking up every
+ * bo's data and reading all of it.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bof.h"
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* anonymous and file backed resident set in KiB */
+static void get_rss(unsigned long *anon, unsigned long *file)
+{
+	char line[256];
+	FILE *status;
+
+	*anon = *file = 0;
+	status = fopen("/proc/self/status", "r");
+	if (status == NULL)
+		return;
+	while (fgets(line, sizeof(line), status)) {
+		sscanf(line, "RssAnon: %lu", anon);
+		sscanf(line, "RssFile: %lu", file);
+	}
+	fclose(status);
+}
+
+static void report(const char *name, uint64_t start)
+{
+	static unsigned long base_anon, base_file;
+	unsigned long anon, file;
+
+	get_rss(&anon, &file);
+	if (name == NULL) {
+		base_anon = anon;
+		base_file = file;
+		return;
+	}
+	printf("%-7s %8.3f ms, %8lu KiB anon, %8lu KiB file resident\n",
+	       name, (gettime_ns() - start) / 1e6, anon - base_anon,
+	       file - base_file);
+}
+
+static void set_int32(bof_t *object, const char *key, int32_t value)
+{
+	bof_t *bof = bof_int32(value);
+
+	assert(bof && !bof_object_set(object, key, bof));
+	bof_decref(bof);
+}
+
+static void set_blob(bof_t *object, const char *key, unsigned size, void *data)
+{
+	bof_t *bof = bof_blob(size, data);
+
+	assert(bof && !bof_object_set(object, key, bof));
+	bof_decref(bof);
+}
+
+static void write_dump(const char *filename, unsigned nbos, unsigned bo_size)
+{
+	uint32_t *data = malloc(bo_size);
+	bof_t *root, *array, *bo;
+	unsigned i, j;
+
+	assert(data);
+	root = bof_object();
+	array = bof_array();
+	assert(root && array);
+	set_int32(root, "device_id", 0x9710);
+	for (j = 0; j < bo_size / 4; j++)
+		data[j] = j;
+	set_blob(root, "reloc", bo_size, data);
+	set_blob(root, "pm4", bo_size, data);
+	for (i = 0; i < nbos; i++) {
+		bo = bof_object();
+		assert(bo);
+		set_int32(bo, "size", bo_size);
+		set_int32(bo, "handle", i + 1);
+		data[0] = i;
+		set_blob(bo, "data", bo_size, data);
+		assert(!bof_array_append(array, bo));
+		bof_decref(bo);
+	}
+	assert(!bof_object_set(root, "bo", array));
+	bof_decref(array);
+	assert(!bof_dump_file(root, filename));
+	bof_decref(root);
+	free(data);
+}
+
+static int compare_files(const char *a, const char *b)
+{
+	FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+	int ca, cb;
+
+	assert(fa && fb);
+	do {
+		ca = getc(fa);
+		cb = getc(fb);
+	} while (ca == cb && ca != EOF);
+	fclose(fa);
+	fclose(fb);
+	return ca == cb ? 0 : -1;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n bos] [-s bo size in KiB] [-c]\n"
+		"  -c  check that a loaded dump is written back unchanged\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	char filename[] = "/tmp/bof_bench_XXXXXX";
+	char copy[sizeof(filename) + 5];
+	unsigned nbos = 4096, bo_size = 64 * 1024;
+	uint64_t start, sum = 0;
+	bof_t *root, *array, *bo, *blob;
+	int c, check = 0, fd, status;
+	pid_t pid;
+	unsigned i, j, n;
+
+	while ((c = getopt(argc, argv, "n:s:c")) != -1) {
+		switch (c) {
+		case 'n':
+			nbos = atoi(optarg);
+			break;
+		case 's':
+			bo_size = atoi(optarg) * 1024;
+			break;
+		case 'c':
+			check = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !bo_size)
+		usage(argv[0]);
+
+	fd = mkstemp(filename);
+	assert(fd >= 0);
+	close(fd);
+	/* in a child, so that its memory doesn't show up below */
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		write_dump(filename, nbos, bo_size);
+		exit(0);
+	}
+	assert(waitpid(pid, &status, 0) == pid && status == 0);
+	printf("%u bos of %u KiB, %.1f MiB dump\n", nbos, bo_size / 1024,
+	       (double)nbos * bo_size / (1024 * 1024));
+
+	report(NULL, 0);
+	start = gettime_ns();
+	root = bof_load_file(filename);
+	assert(root);
+	report("load:", start);
+
+	start = gettime_ns();
+	array = bof_object_get(root, "bo");
+	assert(array);
+	n = bof_array_size(array);
+	assert(n == nbos);
+	for (i = 0; i < n; i++) {
+		bo = bof_array_get(array, i);
+		assert(bof_int32_value(bof_object_get(bo, "handle")) == (int)i + 1);
+		blob = bof_object_get(bo, "data");
+		assert(bof_blob_size(blob) == bo_size);
+		assert(bof_blob_value(blob));
+	}
+	report("lookup:", start);
+
+	start = gettime_ns();
+	for (i = 0; i < n; i++) {
+		const char *data;
+		uint32_t word;
+
+		blob = bof_object_get(bof_array_get(array, i), "data");
+		data = bof_blob_value(blob);
+		/* blobs are only byte aligned within the file */
+		memcpy(&word, data, sizeof(word));
+		assert(word == i);
+		for (j = 0; j < bo_size / 4; j++) {
+			memcpy(&word, data + j * 4, sizeof(word));
+			sum += word;
+		}
+	}
+	report("read:", start);
+	/* every bo holds 0, 1, 2, ... with the first word replaced by its index */
+	j = bo_size / 4;
+	assert(sum == (uint64_t)n * j * (j - 1) / 2 + (uint64_t)n * (n - 1) / 2);
+
+	if (check) {
+		snprintf(copy, sizeof(copy), "%s.copy", filename);
+		assert(!bof_dump_file(root, copy));
+		assert(!compare_files(filename, copy));
+		unlink(copy);
+	}
+
+	bof_decref(root);
+	unlink(filename);
+
+	return 0;
+}
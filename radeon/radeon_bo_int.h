@@ -18,6 +18,10 @@ struct radeon_bo_int {
     struct radeon_bo_manager    *bom;
     uint32_t                    space_accounted;
     uint32_t                    referenced_in_cs;
+    /* number of persistent space check entries referencing this bo, and
+     * the CS they belong to, NULL if several CSes hold some */
+    unsigned                    space_persistent;
+    struct radeon_cs_int        *space_cs;
 };
 
 /* bo functions */
@@ -49,6 +49,7 @@ drm_public int radeon_cs_emit(struct radeon_cs *cs)
 drm_public int radeon_cs_destroy(struct radeon_cs *cs)
 {
     struct radeon_cs_int *csi = (struct radeon_cs_int *)cs;
+    radeon_cs_space_detach(csi);
     return csi->csm->funcs->cs_destroy(csi);
 }
 
@@ -76,6 +76,8 @@ struct cs_gem {
     unsigned                    nrelocs;
     uint32_t                    *relocs;
     struct radeon_bo_int        **relocs_bo;
+    /* open addressing handle -> reloc index + 1, twice nrelocs in size */
+    uint32_t                    *reloc_hash;
 };
 
 static pthread_mutex_t id_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -122,6 +124,79 @@ static void free_id(uint32_t id)
     pthread_mutex_unlock( &id_mutex );
 }
 
+static inline uint32_t cs_gem_reloc_hash(uint32_t handle)
+{
+    uint32_t h = handle * 0x9e3779b1;
+
+    return h ^ (h >> 16);
+}
+
+static void cs_gem_reloc_hash_insert(struct cs_gem *csg, uint32_t handle,
+                                     unsigned i)
+{
+    uint32_t mask = 2 * csg->nrelocs - 1;
+    uint32_t slot = cs_gem_reloc_hash(handle) & mask;
+
+    while (csg->reloc_hash[slot])
+        slot = (slot + 1) & mask;
+    csg->reloc_hash[slot] = i + 1;
+}
+
+/**
+ * Returns the reloc referencing handle, or NULL if there is none.
+ */
+static struct cs_reloc_gem *cs_gem_reloc_lookup(struct cs_gem *csg,
+                                                uint32_t handle)
+{
+    uint32_t mask = 2 * csg->nrelocs - 1;
+    uint32_t slot = cs_gem_reloc_hash(handle) & mask;
+    struct cs_reloc_gem *reloc;
+
+    while (csg->reloc_hash[slot]) {
+        reloc = (struct cs_reloc_gem*)
+            &csg->relocs[(csg->reloc_hash[slot] - 1) * RELOC_SIZE];
+        if (reloc->handle == handle)
+            return reloc;
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+/**
+ * Doubles the reloc storage, it is kept across cs_gem_erase() so a CS
+ * only grows until it fits the largest command stream of the client.
+ */
+static int cs_gem_grow_relocs(struct cs_gem *csg)
+{
+    unsigned nrelocs = csg->nrelocs * 2, i;
+    struct radeon_bo_int **relocs_bo;
+    uint32_t *relocs, *reloc_hash;
+
+    relocs_bo = realloc(csg->relocs_bo, nrelocs * sizeof(void*));
+    if (relocs_bo == NULL) {
+        return -ENOMEM;
+    }
+    csg->relocs_bo = relocs_bo;
+    relocs = realloc(csg->relocs, nrelocs * RELOC_SIZE * 4);
+    if (relocs == NULL) {
+        return -ENOMEM;
+    }
+    csg->base.relocs = csg->relocs = relocs;
+    csg->chunks[1].chunk_data = (uint64_t)(uintptr_t)csg->relocs;
+    reloc_hash = calloc(2 * nrelocs, sizeof(uint32_t));
+    if (reloc_hash == NULL) {
+        return -ENOMEM;
+    }
+    free(csg->reloc_hash);
+    csg->reloc_hash = reloc_hash;
+    csg->nrelocs = nrelocs;
+
+    for (i = 0; i < csg->base.crelocs; i++) {
+        cs_gem_reloc_hash_insert(csg, csg->relocs[i * RELOC_SIZE], i);
+    }
+    return 0;
+}
+
 static struct radeon_cs_int *cs_gem_create(struct radeon_cs_manager *csm,
                                        uint32_t ndw)
 {
@@ -160,6 +235,14 @@ static struct radeon_cs_int *cs_gem_create(struct radeon_cs_manager *csm,
         free(csg);
         return NULL;
     }
+    csg->reloc_hash = (uint32_t*)calloc(2 * csg->nrelocs, sizeof(uint32_t));
+    if (csg->reloc_hash == NULL) {
+        free(csg->relocs);
+        free(csg->relocs_bo);
+        free(csg->base.packets);
+        free(csg);
+        return NULL;
+    }
     csg->chunks[0].chunk_id = RADEON_CHUNK_ID_IB;
     csg->chunks[0].length_dw = 0;
     csg->chunks[0].chunk_data = (uint64_t)(uintptr_t)csg->base.packets;
@@ -179,7 +262,7 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     struct cs_gem *csg = (struct cs_gem*)cs;
     struct cs_reloc_gem *reloc;
     uint32_t idx;
-    unsigned i;
+    int r;
 
     assert(boi->space_accounted);
 
@@ -199,63 +282,47 @@ static int cs_gem_write_reloc(struct radeon_cs_int *cs,
     /* use bit field hash function to determine
        if this bo is for sure not in this cs.*/
     if ((atomic_read((atomic_t *)radeon_gem_get_reloc_in_cs(bo)) & cs->id)) {
-        /* check if bo is already referenced.
-         * Scanning from end to begin reduces cycles with mesa because
-         * it often relocates same shared dma bo again. */
-        for(i = cs->crelocs; i != 0;) {
-            --i;
-            idx = i * RELOC_SIZE;
-            reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
-            if (reloc->handle == bo->handle) {
-                /* Check domains must be in read or write. As we check already
-                 * checked that in argument one of the read or write domain was
-                 * set we only need to check that if previous reloc as the read
-                 * domain set then the read_domain should also be set for this
-                 * new relocation.
-                 */
-                /* the DDX expects to read and write from same pixmap */
-                if (write_domain && (reloc->read_domain & write_domain)) {
-                    reloc->read_domain = 0;
-                    reloc->write_domain = write_domain;
-                } else if (read_domain & reloc->write_domain) {
-                    reloc->read_domain = 0;
-                } else {
-                    if (write_domain != reloc->write_domain)
-                        return -EINVAL;
-                    if (read_domain != reloc->read_domain)
-                        return -EINVAL;
-                }
-
-                reloc->read_domain |= read_domain;
-                reloc->write_domain |= write_domain;
-                /* update flags */
-                reloc->flags |= (flags & reloc->flags);
-                /* write relocation packet */
-                radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
-                radeon_cs_write_dword((struct radeon_cs *)cs, idx);
-                return 0;
+        /* check if bo is already referenced */
+        reloc = cs_gem_reloc_lookup(csg, bo->handle);
+        if (reloc) {
+            idx = (uint32_t*)reloc - csg->relocs;
+            /* Check domains must be in read or write. As we check already
+             * checked that in argument one of the read or write domain was
+             * set we only need to check that if previous reloc as the read
+             * domain set then the read_domain should also be set for this
+             * new relocation.
+             */
+            /* the DDX expects to read and write from same pixmap */
+            if (write_domain && (reloc->read_domain & write_domain)) {
+                reloc->read_domain = 0;
+                reloc->write_domain = write_domain;
+            } else if (read_domain & reloc->write_domain) {
+                reloc->read_domain = 0;
+            } else {
+                if (write_domain != reloc->write_domain)
+                    return -EINVAL;
+                if (read_domain != reloc->read_domain)
+                    return -EINVAL;
             }
+
+            reloc->read_domain |= read_domain;
+            reloc->write_domain |= write_domain;
+            /* update flags */
+            reloc->flags |= (flags & reloc->flags);
+            /* write relocation packet */
+            radeon_cs_write_dword((struct radeon_cs *)cs, 0xc0001000);
+            radeon_cs_write_dword((struct radeon_cs *)cs, idx);
+            return 0;
         }
     }
     /* new relocation */
     if (csg->base.crelocs >= csg->nrelocs) {
-        /* allocate more memory (TODO: should use a slab allocator maybe) */
-        uint32_t *tmp, size;
-        size = ((csg->nrelocs + 1) * sizeof(struct radeon_bo*));
-        tmp = (uint32_t*)realloc(csg->relocs_bo, size);
-        if (tmp == NULL) {
-            return -ENOMEM;
+        r = cs_gem_grow_relocs(csg);
+        if (r) {
+            return r;
         }
-        csg->relocs_bo = (struct radeon_bo_int **)tmp;
-        size = ((csg->nrelocs + 1) * RELOC_SIZE * 4);
-        tmp = (uint32_t*)realloc(csg->relocs, size);
-        if (tmp == NULL) {
-            return -ENOMEM;
-        }
-        cs->relocs = csg->relocs = tmp;
-        csg->nrelocs += 1;
-        csg->chunks[1].chunk_data = (uint64_t)(uintptr_t)csg->relocs;
     }
+    cs_gem_reloc_hash_insert(csg, bo->handle, csg->base.crelocs);
     csg->relocs_bo[csg->base.crelocs] = boi;
     idx = (csg->base.crelocs++) * RELOC_SIZE;
     reloc = (struct cs_reloc_gem*)&csg->relocs[idx];
@@ -355,7 +422,7 @@ static void cs_gem_dump_bof(struct radeon_cs_int *cs)
     bof_decref(device_id);
     device_id = NULL;
     /* dump relocs */
-    blob = bof_blob(csg->nrelocs * 16, csg->relocs);
+    blob = bof_blob(csg->base.crelocs * 16, csg->relocs);
     if (blob == NULL)
         goto out_err;
     if (bof_object_set(root, "reloc", blob))
@@ -445,7 +512,7 @@ static int cs_gem_emit(struct radeon_cs_int *cs)
     r = drmCommandWriteRead(cs->csm->fd, DRM_RADEON_CS,
                             &csg->cs, sizeof(struct drm_radeon_cs));
     for (i = 0; i < csg->base.crelocs; i++) {
-        csg->relocs_bo[i]->space_accounted = 0;
+        radeon_cs_space_set_accounted(csg->relocs_bo[i], 0, 0);
         /* bo might be referenced from another context so have to use atomic operations */
         atomic_dec((atomic_t *)radeon_gem_get_reloc_in_cs((struct radeon_bo*)csg->relocs_bo[i]), cs->id);
         radeon_bo_unref((struct radeon_bo *)csg->relocs_bo[i]);
@@ -463,6 +530,7 @@ static int cs_gem_destroy(struct radeon_cs_int *cs)
     struct cs_gem *csg = (struct cs_gem*)cs;
 
     free_id(cs->id);
+    free(csg->reloc_hash);
     free(csg->relocs_bo);
     free(cs->relocs);
     free(cs->packets);
@@ -485,6 +553,9 @@ static int cs_gem_erase(struct radeon_cs_int *cs)
             }
         }
     }
+    if (cs->crelocs) {
+        memset(csg->reloc_hash, 0, 2 * csg->nrelocs * sizeof(uint32_t));
+    }
     cs->relocs_total_size = 0;
     cs->cdw = 0;
     cs->section_ndw = 0;
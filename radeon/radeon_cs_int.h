@@ -2,6 +2,8 @@
 #ifndef _RADEON_CS_INT_H_
 #define _RADEON_CS_INT_H_
 
+#include "libdrm_macros.h"
+
 struct radeon_cs_space_check {
     struct radeon_bo_int *bo;
     uint32_t read_domains;
@@ -26,6 +28,14 @@ struct radeon_cs_int {
     int                         section_line;
     struct radeon_cs_space_check bos[MAX_SPACE_BOS];
     int                         bo_count;
+    /* bos[0..bo_checked) are accounted for as of space_checked_gen */
+    int                         bo_checked;
+    /* bumped when the domains of a persistent bo change, see
+     * radeon_cs_space_set_accounted() */
+    uint32_t                    space_gen;
+    uint32_t                    space_checked_gen;
+    /* a persistent bo is shared with another CS, nothing is kept */
+    int                         space_shared;
     void                        (*space_flush_fn)(void *);
     void                        *space_flush_data;
     uint32_t                    id;
@@ -64,4 +74,9 @@ struct radeon_cs_manager {
     int32_t vram_write_used, gart_write_used;
     int32_t read_used;
 };
+drm_private void radeon_cs_space_set_accounted(struct radeon_bo_int *bo,
+                                              uint32_t accounted,
+                                              unsigned owners);
+drm_private void radeon_cs_space_detach(struct radeon_cs_int *cs);
+
 #endif
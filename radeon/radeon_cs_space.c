@@ -39,7 +39,24 @@ struct rad_sizes {
     int32_t op_vram_write;
 };
 
-static inline int radeon_cs_setup_bo(struct radeon_cs_space_check *sc, struct rad_sizes *sizes)
+/*
+ * A CS's generation is bumped whenever the accounted domains of one of its
+ * persistent bos change behind the back of its space check entries, which
+ * then need to be accounted for again. A bo knows the CS holding it as
+ * persistent; CSes sharing persistent bos with another CS can't be told,
+ * so they account for all of them on every check.
+ */
+drm_private void radeon_cs_space_set_accounted(struct radeon_bo_int *bo,
+                                              uint32_t accounted,
+                                              unsigned owners)
+{
+    if (bo->space_persistent > owners && bo->space_accounted != accounted &&
+        bo->space_cs)
+        bo->space_cs->space_gen++;
+    bo->space_accounted = accounted;
+}
+
+static int radeon_cs_setup_bo(struct radeon_cs_space_check *sc, struct rad_sizes *sizes)
 {
     uint32_t read_domains, write_domain;
     struct radeon_bo_int *bo;
@@ -51,7 +68,8 @@ static inline int radeon_cs_setup_bo(struct radeon_cs_space_check *sc, struct ra
 
     /* legacy needs a static check */
     if (radeon_bo_is_static((struct radeon_bo *)sc->bo)) {
-        bo->space_accounted = sc->new_accounted = (read_domains << 16) | write_domain;
+        sc->new_accounted = (read_domains << 16) | write_domain;
+        radeon_cs_space_set_accounted(bo, sc->new_accounted, 0);
         return 0;
     }
 
@@ -106,12 +124,19 @@ static inline int radeon_cs_setup_bo(struct radeon_cs_space_check *sc, struct ra
     return 0;
 }
 
+/*
+ * Persistent bos accounted for by a previous check contribute nothing to
+ * the totals unless the domains of one of them changed since, so only the
+ * bos added in between and the new one are set up, unless the generation
+ * tells otherwise.
+ */
 static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_space_check *new_tmp)
 {
     struct radeon_cs_manager *csm = cs->csm;
     int i;
     struct radeon_bo_int *bo;
     struct rad_sizes sizes;
+    uint32_t gen;
     int ret;
 
     /* check the totals for this operation */
@@ -119,10 +144,13 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
     if (cs->bo_count == 0 && !new_tmp)
         return 0;
 
+    if (cs->space_gen != cs->space_checked_gen || cs->space_shared)
+        cs->bo_checked = 0;
+
     memset(&sizes, 0, sizeof(struct rad_sizes));
 
     /* prepare */
-    for (i = 0; i < cs->bo_count; i++) {
+    for (i = cs->bo_checked; i < cs->bo_count; i++) {
         ret = radeon_cs_setup_bo(&cs->bos[i], &sizes);
         if (ret)
             return ret;
@@ -152,12 +180,17 @@ static int radeon_cs_do_space_check(struct radeon_cs_int *cs, struct radeon_cs_s
     csm->vram_write_used += sizes.op_vram_write;
     csm->read_used += sizes.op_read;
     /* commit */
-    for (i = 0; i < cs->bo_count; i++) {
+    gen = cs->space_gen;
+    for (i = cs->bo_checked; i < cs->bo_count; i++) {
         bo = cs->bos[i].bo;
-        bo->space_accounted = cs->bos[i].new_accounted;
+        radeon_cs_space_set_accounted(bo, cs->bos[i].new_accounted, 1);
     }
     if (new_tmp)
-        new_tmp->bo->space_accounted = new_tmp->new_accounted;
+        radeon_cs_space_set_accounted(new_tmp->bo, new_tmp->new_accounted, 0);
+
+    /* our own commit may have invalidated the entries checked before */
+    cs->bo_checked = gen == cs->space_gen ? cs->bo_count : 0;
+    cs->space_checked_gen = cs->space_gen;
 
     return RADEON_CS_SPACE_OK;
 }
@@ -176,6 +209,16 @@ radeon_cs_space_add_persistent_bo(struct radeon_cs *cs, struct radeon_bo *bo,
             return;
     }
     radeon_bo_ref(bo);
+    if (!boi->space_persistent) {
+        boi->space_cs = csi;
+    } else if (boi->space_cs != csi) {
+        /* the other CS may not know yet */
+        if (boi->space_cs)
+            boi->space_cs->space_shared = 1;
+        boi->space_cs = NULL;
+        csi->space_shared = 1;
+    }
+    boi->space_persistent++;
     i = csi->bo_count;
     csi->bos[i].bo = boi;
     csi->bos[i].read_domains = read_domains;
@@ -233,11 +276,25 @@ drm_public int radeon_cs_space_check(struct radeon_cs *cs)
     return radeon_cs_check_space_internal(csi, NULL);
 }
 
+/* The persistent bos of a destroyed CS stay referenced, as they always
+ * did, but must not point at it. */
+drm_private void radeon_cs_space_detach(struct radeon_cs_int *cs)
+{
+    int i;
+
+    for (i = 0; i < cs->bo_count; i++) {
+        if (cs->bos[i].bo->space_cs == cs)
+            cs->bos[i].bo->space_cs = NULL;
+    }
+}
+
 drm_public void radeon_cs_space_reset_bos(struct radeon_cs *cs)
 {
     struct radeon_cs_int *csi = (struct radeon_cs_int *)cs;
     int i;
     for (i = 0; i < csi->bo_count; i++) {
+        if (!--csi->bos[i].bo->space_persistent)
+            csi->bos[i].bo->space_cs = NULL;
         radeon_bo_unref((struct radeon_bo *)csi->bos[i].bo);
         csi->bos[i].bo = NULL;
         csi->bos[i].read_domains = 0;
@@ -245,4 +302,6 @@ drm_public void radeon_cs_space_reset_bos(struct radeon_cs *cs)
         csi->bos[i].new_accounted = 0;
     }
     csi->bo_count = 0;
+    csi->bo_checked = 0;
+    csi->space_shared = 0;
 }
@@ -0,0 +1,350 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Captures a few command submissions against the fake amdgpu driver, and
+ * checks that the stream holds them, with their IB contents, dependencies
+ * and BO lists, and that its index matches the records.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_capture.h"
+#include "amdgpu_fake.h"
+
+#define NR_SUBMITS	64
+#define IB_DWORDS	16
+#define IB_BO_SIZE	(NR_SUBMITS * IB_DWORDS * 4)
+/* bigger than the capture ring */
+#define BIG_IB_SIZE	(5 << 20)
+
+struct test_bo {
+	amdgpu_bo_handle bo;
+	amdgpu_va_handle va_handle;
+	uint64_t va;
+	uint32_t *cpu;
+};
+
+static void test_bo_alloc(amdgpu_device_handle dev, uint64_t size,
+			  struct test_bo *tbo)
+{
+	struct amdgpu_bo_alloc_request req = {};
+	void *cpu;
+
+	req.alloc_size = size;
+	req.phys_alignment = 4096;
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	assert(amdgpu_bo_alloc(dev, &req, &tbo->bo) == 0);
+	assert(amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general, size,
+				     4096, 0, &tbo->va, &tbo->va_handle,
+				     0) == 0);
+	assert(amdgpu_bo_va_op(tbo->bo, 0, size, tbo->va, 0,
+			       AMDGPU_VA_OP_MAP) == 0);
+	assert(amdgpu_bo_cpu_map(tbo->bo, &cpu) == 0);
+	tbo->cpu = cpu;
+}
+
+static void test_bo_free(struct test_bo *tbo, uint64_t size)
+{
+	assert(amdgpu_bo_cpu_unmap(tbo->bo) == 0);
+	assert(amdgpu_bo_va_op(tbo->bo, 0, size, tbo->va, 0,
+			       AMDGPU_VA_OP_UNMAP) == 0);
+	assert(amdgpu_va_range_free(tbo->va_handle) == 0);
+	assert(amdgpu_bo_free(tbo->bo) == 0);
+}
+
+static void capture(amdgpu_device_handle dev, const char *path,
+		    uint64_t *ib_va)
+{
+	struct test_bo ib, big, data;
+	struct amdgpu_cs_request request;
+	struct amdgpu_cs_ib_info ib_info;
+	struct amdgpu_cs_fence fence = {};
+	struct drm_amdgpu_cs_chunk chunks[2];
+	struct drm_amdgpu_cs_chunk_data chunk_data;
+	struct drm_amdgpu_bo_list_entry entries[2];
+	struct drm_amdgpu_bo_list_in bo_handles = {};
+	amdgpu_bo_handle resources[3];
+	amdgpu_bo_list_handle list;
+	amdgpu_context_handle ctx;
+	uint64_t seq_no;
+	unsigned i;
+
+	assert(amdgpu_cs_capture_start(dev, path) == 0);
+	assert(amdgpu_cs_capture_start(dev, path) == -EBUSY);
+
+	test_bo_alloc(dev, IB_BO_SIZE, &ib);
+	test_bo_alloc(dev, BIG_IB_SIZE, &big);
+	test_bo_alloc(dev, 4096, &data);
+	for (i = 0; i < IB_BO_SIZE / 4; i++)
+		ib.cpu[i] = 0xc0de0000 + i;
+	for (i = 0; i < BIG_IB_SIZE / 4; i++)
+		big.cpu[i] = i;
+	*ib_va = ib.va;
+
+	resources[0] = ib.bo;
+	resources[1] = big.bo;
+	resources[2] = data.bo;
+	assert(amdgpu_bo_list_create(dev, 3, resources, NULL, &list) == 0);
+	assert(amdgpu_cs_ctx_create(dev, &ctx) == 0);
+
+	for (i = 0; i < NR_SUBMITS; i++) {
+		memset(&ib_info, 0, sizeof(ib_info));
+		ib_info.ib_mc_address = ib.va + i * IB_DWORDS * 4;
+		ib_info.size = IB_DWORDS;
+
+		memset(&request, 0, sizeof(request));
+		request.ip_type = AMDGPU_HW_IP_GFX;
+		request.resources = list;
+		request.number_of_ibs = 1;
+		request.ibs = &ib_info;
+		if (i) {
+			request.number_of_dependencies = 1;
+			request.dependencies = &fence;
+		}
+		assert(amdgpu_cs_submit(ctx, 0, &request, 1) == 0);
+
+		fence.context = ctx;
+		fence.ip_type = AMDGPU_HW_IP_GFX;
+		fence.fence = request.seq_no;
+	}
+
+	/* an IB bigger than the capture ring */
+	memset(&chunk_data, 0, sizeof(chunk_data));
+	chunk_data.ib_data.va_start = big.va;
+	chunk_data.ib_data.ib_bytes = BIG_IB_SIZE;
+	chunk_data.ib_data.ip_type = AMDGPU_HW_IP_GFX;
+	chunks[0].chunk_id = AMDGPU_CHUNK_ID_IB;
+	chunks[0].length_dw = sizeof(struct drm_amdgpu_cs_chunk_ib) / 4;
+	chunks[0].chunk_data = (uint64_t)(uintptr_t)&chunk_data;
+	assert(amdgpu_cs_submit_raw(dev, ctx, list, 1, chunks, &seq_no) == 0);
+
+	/* an IB outside of any mapping, with an inline BO list */
+	entries[0].bo_handle = 1;
+	entries[0].bo_priority = 0;
+	entries[1].bo_handle = 3;
+	entries[1].bo_priority = 7;
+	bo_handles.bo_number = 2;
+	bo_handles.bo_info_size = sizeof(entries[0]);
+	bo_handles.bo_info_ptr = (uint64_t)(uintptr_t)entries;
+	chunk_data.ib_data.va_start = 0x100000;
+	chunk_data.ib_data.ib_bytes = IB_DWORDS * 4;
+	chunks[1].chunk_id = AMDGPU_CHUNK_ID_BO_HANDLES;
+	chunks[1].length_dw = sizeof(bo_handles) / 4;
+	chunks[1].chunk_data = (uint64_t)(uintptr_t)&bo_handles;
+	assert(amdgpu_cs_submit_raw2(dev, ctx, 0, 2, chunks, &seq_no) == 0);
+
+	/* a rejected submission, its chunk data must not be looked at */
+	chunks[0].chunk_data = 0;
+	amdgpu_fake_cs_errno = EFAULT;
+	assert(amdgpu_cs_submit_raw2(dev, ctx, 0, 1, chunks, &seq_no) ==
+	       -EFAULT);
+	amdgpu_fake_cs_errno = 0;
+
+	assert(amdgpu_cs_ctx_free(ctx) == 0);
+	assert(amdgpu_bo_list_destroy(list) == 0);
+	test_bo_free(&data, 4096);
+	test_bo_free(&big, BIG_IB_SIZE);
+	test_bo_free(&ib, IB_BO_SIZE);
+
+	assert(amdgpu_cs_capture_stop(dev) == 0);
+	assert(amdgpu_cs_capture_stop(dev) == -EINVAL);
+}
+
+static unsigned check_cs(const struct amdgpu_capture_record *rec,
+			 uint64_t ib_va, unsigned nr_cs)
+{
+	const struct amdgpu_capture_cs *cs = (const void *)(rec + 1);
+	const char *ptr = (const char *)(cs + 1);
+	const struct amdgpu_capture_ib *ib;
+	const uint32_t *words;
+	unsigned i, deps = 0;
+
+	if (nr_cs == NR_SUBMITS + 2) {
+		assert(cs->result == -EFAULT);
+		assert(cs->num_chunks == 0 && cs->num_ibs == 0);
+		assert(ptr == (const char *)rec + rec->size);
+		return 0;
+	}
+
+	assert(cs->result == 0 && cs->seq_no == nr_cs + 1);
+	assert(cs->num_ibs == 1);
+
+	for (i = 0; i < cs->num_chunks; i++) {
+		const struct amdgpu_capture_chunk *chunk = (const void *)ptr;
+		const struct drm_amdgpu_bo_list_entry *entries;
+
+		ptr += sizeof(*chunk) + (chunk->length_dw * 4 + 7) / 8 * 8;
+		if (chunk->chunk_id == AMDGPU_CHUNK_ID_DEPENDENCIES) {
+			const struct drm_amdgpu_cs_chunk_dep *dep =
+				(const void *)(chunk + 1);
+
+			assert(dep->handle == nr_cs);
+			deps++;
+		}
+		if (chunk->chunk_id == AMDGPU_CHUNK_ID_BO_HANDLES) {
+			entries = (const void *)ptr;
+			assert(entries[0].bo_handle == 1);
+			assert(entries[1].bo_priority == 7);
+			ptr += 2 * sizeof(*entries);
+		}
+	}
+
+	ib = (const void *)ptr;
+	words = (const uint32_t *)(ib + 1);
+	if (nr_cs < NR_SUBMITS) {
+		assert(cs->bo_list_handle == 1);
+		assert(ib->va == ib_va + nr_cs * IB_DWORDS * 4);
+		assert(ib->size == IB_DWORDS * 4 && !ib->flags);
+		for (i = 0; i < IB_DWORDS; i++)
+			assert(words[i] == 0xc0de0000 + nr_cs * IB_DWORDS + i);
+		assert(deps == (nr_cs ? 1 : 0));
+	} else if (nr_cs == NR_SUBMITS) {
+		assert(ib->size == BIG_IB_SIZE && !ib->flags);
+		for (i = 0; i < BIG_IB_SIZE / 4; i++)
+			assert(words[i] == i);
+	} else {
+		assert(ib->va == 0x100000);
+		assert(ib->size == 0 && ib->flags == AMDGPU_CAPTURE_IB_MISSING);
+	}
+	ptr = (const char *)(words) + (ib->size + 7) / 8 * 8;
+	assert(ptr == (const char *)rec + rec->size);
+
+	return deps;
+}
+
+static void check(const char *path, uint64_t ib_va)
+{
+	const struct amdgpu_capture_header *header;
+	const struct amdgpu_capture_trailer *trailer;
+	const struct amdgpu_capture_index *index;
+	unsigned counts[AMDGPU_CAPTURE_CS + 1] = {};
+	unsigned nr_records = 0, deps = 0;
+	uint64_t offset, last_time = 0;
+	struct stat st;
+	char *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	assert(fstat(fd, &st) == 0);
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	assert(map != MAP_FAILED);
+	close(fd);
+
+	header = (const void *)map;
+	assert(header->magic == AMDGPU_CAPTURE_MAGIC);
+	assert(header->version == AMDGPU_CAPTURE_VERSION);
+	assert(header->device_id == 0x687f);
+
+	trailer = (const void *)(map + st.st_size - sizeof(*trailer));
+	assert(trailer->magic == AMDGPU_CAPTURE_INDEX_MAGIC);
+	assert(trailer->index_offset + trailer->count * sizeof(*index) +
+	       sizeof(*trailer) == (uint64_t)st.st_size);
+	index = (const void *)(map + trailer->index_offset);
+
+	/* walk the records, and compare them with the index */
+	for (offset = header->header_size; offset < trailer->index_offset;) {
+		const struct amdgpu_capture_record *rec = (const void *)(map + offset);
+
+		assert(nr_records < trailer->count);
+		assert(index[nr_records].offset == offset);
+		assert(index[nr_records].type == rec->type);
+		assert(index[nr_records].size == rec->size);
+		assert(rec->size % 8 == 0);
+		assert(rec->time_ns >= last_time);
+		assert(rec->type >= AMDGPU_CAPTURE_BO_ALLOC &&
+		       rec->type <= AMDGPU_CAPTURE_CS);
+
+		if (rec->type == AMDGPU_CAPTURE_CS)
+			deps += check_cs(rec, ib_va, counts[AMDGPU_CAPTURE_CS]);
+
+		last_time = rec->time_ns;
+		counts[rec->type]++;
+		nr_records++;
+		offset += rec->size;
+	}
+	assert(offset == trailer->index_offset);
+	assert(nr_records == trailer->count);
+
+	assert(counts[AMDGPU_CAPTURE_BO_ALLOC] == 3);
+	assert(counts[AMDGPU_CAPTURE_BO_FREE] == 3);
+	assert(counts[AMDGPU_CAPTURE_VA_OP] == 6);
+	assert(counts[AMDGPU_CAPTURE_BO_LIST] == 2);
+	assert(counts[AMDGPU_CAPTURE_CTX_CREATE] == 1);
+	assert(counts[AMDGPU_CAPTURE_CTX_FREE] == 1);
+	assert(counts[AMDGPU_CAPTURE_CS] == NR_SUBMITS + 3);
+	assert(deps == NR_SUBMITS - 1);
+
+	munmap(map, st.st_size);
+}
+
+int main(int argc, char *argv[])
+{
+	char tmp[] = "/tmp/amdgpu_capture_test_XXXXXX";
+	const char *path = tmp;
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	uint64_t ib_va;
+	int fd;
+
+	/* the capture is kept if a path is given, e.g. for amdgpu_replay */
+	if (argc > 1) {
+		path = argv[1];
+	} else {
+		fd = mkstemp(tmp);
+		assert(fd >= 0);
+		close(fd);
+	}
+
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+
+	printf("testing capture ... ");
+	capture(dev, path, &ib_va);
+	assert(amdgpu_fake_stats.submits == NR_SUBMITS + 2);
+	printf("ok\n");
+
+	printf("testing stream ... ");
+	check(path, ib_va);
+	printf("ok\n");
+
+	assert(amdgpu_device_deinitialize(dev) == 0);
+	if (argc == 1)
+		unlink(path);
+
+	return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * GPU clock calibration benchmark.
+ *
+ * The fake kernel driver's GPU counter drifts against CLOCK_MONOTONIC, and
+ * some of its reads are delayed like preempted ioctls.  GPU timestamps of
+ * known host times are converted with a calibrated clock, and the usual ad
+ * hoc mapping of a single read and the nominal frequency, and the errors
+ * of both are reported.  The timestamp ring is checked with timestamps
+ * written through its CPU mapping in place of the GPU.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+#define SLOTS	64
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t error_ns(uint64_t a, uint64_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+static void check_ring(amdgpu_device_handle dev, amdgpu_clock_handle clock)
+{
+	struct amdgpu_bo_alloc_request req = {};
+	struct amdgpu_timestamp_slot slot, first;
+	struct amdgpu_cs_fence fence = {};
+	amdgpu_timestamp_ring_handle ring;
+	amdgpu_context_handle ctx;
+	uint64_t begin, end, now, va;
+	amdgpu_va_handle va_handle;
+	amdgpu_bo_handle bo;
+	uint64_t *cpu;
+	unsigned i;
+	void *ptr;
+
+	req.alloc_size = 4096;
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	assert(amdgpu_bo_alloc(dev, &req, &bo) == 0);
+	assert(amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general, 4096,
+				     0, 0, &va, &va_handle, 0) == 0);
+	assert(amdgpu_bo_va_op(bo, 0, 4096, va, 0, AMDGPU_VA_OP_MAP) == 0);
+	assert(amdgpu_bo_cpu_map(bo, &ptr) == 0);
+	cpu = ptr;
+
+	assert(amdgpu_timestamp_ring_create(clock, bo, 4096 - SLOTS * 16 + 8,
+					    va, SLOTS, &ring) == -EINVAL);
+	assert(amdgpu_timestamp_ring_create(clock, bo, 256, va, SLOTS,
+					    &ring) == 0);
+
+	assert(amdgpu_timestamp_ring_next(ring, &first) == 0);
+	assert(first.begin_va == va + 256 && first.end_va == va + 264);
+	assert(amdgpu_timestamp_ring_read(ring, first.seq, &begin,
+					  &end) == -EAGAIN);
+	assert(amdgpu_timestamp_ring_read(ring, first.seq + 1, &begin,
+					  &end) == -EINVAL);
+
+	/* written by the submission's IBs */
+	now = gettime_ns();
+	cpu[(first.begin_va - va) / 8] = amdgpu_fake_gpu_clock(now);
+	cpu[(first.end_va - va) / 8] = amdgpu_fake_gpu_clock(now + 1000000);
+	assert(amdgpu_timestamp_ring_read(ring, first.seq, &begin, &end) == 0);
+	assert(error_ns(begin, now) < 50000);
+	assert(error_ns(end - begin, 1000000) < 1000);
+
+	/* the first slot isn't reused while its submission runs */
+	assert(amdgpu_cs_ctx_create(dev, &ctx) == 0);
+	fence.context = ctx;
+	fence.ip_type = AMDGPU_HW_IP_GFX;
+	fence.ring = 1;
+	fence.fence = 1;
+	assert(amdgpu_timestamp_ring_fence(ring, first.seq + 1,
+					   &fence) == -EINVAL);
+	assert(amdgpu_timestamp_ring_fence(ring, first.seq, &fence) == 0);
+	amdgpu_fake_signaled = 1;
+	amdgpu_fake_stalled_rings = 1 << 1;
+	for (i = 1; i < SLOTS; i++)
+		assert(amdgpu_timestamp_ring_next(ring, &slot) == 0);
+	assert(amdgpu_timestamp_ring_next(ring, &slot) == -EBUSY);
+	assert(amdgpu_timestamp_ring_read(ring, first.seq, &begin, &end) == 0);
+
+	/* the last one wraps around to the first slot */
+	amdgpu_fake_stalled_rings = 0;
+	assert(amdgpu_timestamp_ring_next(ring, &slot) == 0);
+	assert(slot.begin_va == first.begin_va);
+	assert(amdgpu_timestamp_ring_read(ring, first.seq, &begin,
+					  &end) == -ENODATA);
+	assert(amdgpu_timestamp_ring_fence(ring, first.seq,
+					   &fence) == -ENODATA);
+	assert(amdgpu_cs_ctx_free(ctx) == 0);
+
+	assert(amdgpu_bo_va_op(bo, 0, 4096, va, 0, AMDGPU_VA_OP_UNMAP) == 0);
+	assert(amdgpu_va_range_free(va_handle) == 0);
+	assert(amdgpu_bo_cpu_unmap(bo) == 0);
+	assert(amdgpu_bo_free(bo) == 0);
+
+	/* the ring holds its own reference and mapping */
+	assert(amdgpu_timestamp_ring_read(ring, slot.seq, &begin,
+					  &end) == -EAGAIN);
+	assert(amdgpu_timestamp_ring_destroy(ring) == 0);
+}
+
+static void bench_accuracy(amdgpu_device_handle dev, unsigned duration_ms,
+			   unsigned interval_ms)
+{
+	uint64_t adhoc_ns, adhoc_timestamp, nominal_freq, start, now, ns;
+	uint64_t adhoc_max = 0, adhoc_sum = 0, max = 0, sum = 0;
+	uint64_t calibrated = 0, cost = 0, converted = 0, elapsed = 0;
+	struct amdgpu_clock_info info;
+	struct amdgpu_gpu_info gpu_info;
+	amdgpu_clock_handle clock;
+	uint64_t timestamp, last;
+	unsigned n = 0;
+
+	assert(amdgpu_query_gpu_info(dev, &gpu_info) == 0);
+	nominal_freq = gpu_info.gpu_counter_freq * 1000ull;
+
+	/* one read, mapped with the nominal frequency */
+	adhoc_ns = gettime_ns();
+	assert(amdgpu_query_info(dev, AMDGPU_INFO_TIMESTAMP,
+				 sizeof(adhoc_timestamp),
+				 &adhoc_timestamp) == 0);
+
+	assert(amdgpu_clock_create(dev, &clock) == 0);
+	start = last = gettime_ns();
+	do {
+		now = gettime_ns();
+		if (now - last >= interval_ms * 1000000ull) {
+			assert(amdgpu_clock_calibrate(clock) == 0);
+			cost += gettime_ns() - now;
+			calibrated++;
+			last = now;
+		}
+
+		/* a timestamp written by the GPU at a known time */
+		now = gettime_ns();
+		timestamp = amdgpu_fake_gpu_clock(now);
+
+		ns = adhoc_ns + (int64_t)(timestamp - adhoc_timestamp) *
+		     (1e9 / nominal_freq);
+		adhoc_max = error_ns(ns, now) > adhoc_max ?
+			    error_ns(ns, now) : adhoc_max;
+		adhoc_sum += error_ns(ns, now);
+
+		converted = gettime_ns();
+		assert(amdgpu_clock_to_host(clock, timestamp, &ns) == 0);
+		elapsed += gettime_ns() - converted;
+		max = error_ns(ns, now) > max ? error_ns(ns, now) : max;
+		sum += error_ns(ns, now);
+		n++;
+		usleep(200);
+	} while (now - start < duration_ms * 1000000ull);
+
+	assert(amdgpu_clock_query_info(clock, &info) == 0);
+	assert(info.nominal_freq == nominal_freq);
+	printf("ad hoc:      mean error %7.2f us, max %7.2f us\n",
+	       adhoc_sum / 1e3 / n, adhoc_max / 1e3);
+	printf("calibrated:  mean error %7.2f us, max %7.2f us, "
+	       "%.1f us per calibration, %.0f ns per conversion\n",
+	       sum / 1e3 / n, max / 1e3, cost / 1e3 / calibrated,
+	       (double)elapsed / n);
+	printf("             drift %lld ppb fitted, %d ppb actual, "
+	       "%u samples, %llu ns skew\n", (long long)info.drift_ppb,
+	       amdgpu_fake_clock_drift_ppb, info.samples,
+	       (unsigned long long)info.skew_ns);
+	assert(amdgpu_clock_destroy(clock) == 0);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d duration ms] [-i calibration interval ms] "
+		"[-p drift ppb]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned duration_ms = 1000, interval_ms = 50;
+	amdgpu_device_handle dev;
+	amdgpu_clock_handle clock;
+	uint32_t major, minor;
+	int c, fd;
+
+	amdgpu_fake_clock_drift_ppb = 300000;
+	while ((c = getopt(argc, argv, "d:i:p:")) != -1) {
+		switch (c) {
+		case 'd':
+			duration_ms = atoi(optarg);
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 'p':
+			amdgpu_fake_clock_drift_ppb = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !duration_ms || !interval_ms)
+		usage(argv[0]);
+
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+
+	srand(1);
+	assert(amdgpu_clock_create(dev, &clock) == 0);
+	check_ring(dev, clock);
+	assert(amdgpu_clock_destroy(clock) == 0);
+
+	bench_accuracy(dev, duration_ms, interval_ms);
+
+	assert(amdgpu_device_deinitialize(dev) == 0);
+	return 0;
+}
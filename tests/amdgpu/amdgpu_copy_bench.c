@@ -0,0 +1,243 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Bandwidth benchmark for amdgpu_bo_upload() and amdgpu_bo_download().
+ *
+ * Buffers of the fake kernel driver are shared memfd mappings, which stand
+ * in for write-combined ones; the streaming instructions take the same
+ * paths on them, but only real WC memory shows the full difference.  Every
+ * copy variant the CPU supports runs in a child of its own, as the variant
+ * is picked once per process, and is checked against unaligned offsets and
+ * sizes first.  With workers, they are also replaced while another thread
+ * copies.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* uploads and downloads every offset and size around a few vectors */
+static void check_edges(amdgpu_bo_handle bo)
+{
+	uint8_t src[512], dst[512], *cpu;
+	unsigned offset, size, i;
+	void *ptr;
+
+	assert(amdgpu_bo_cpu_map(bo, &ptr) == 0);
+	cpu = ptr;
+	for (i = 0; i < sizeof(src); i++)
+		src[i] = i * 7 + 1;
+
+	for (offset = 0; offset < 80; offset++) {
+		for (size = 0; size < 300; size++) {
+			memset(cpu, 0, 512);
+			assert(amdgpu_bo_upload(bo, offset, src, size) == 0);
+			for (i = 0; i < 512; i++)
+				assert(cpu[i] == (i >= offset && i < offset + size ?
+						  src[i - offset] : 0));
+
+			memset(dst, 0xff, sizeof(dst));
+			assert(amdgpu_bo_download(bo, offset, dst + 1, size) == 0);
+			assert(dst[0] == 0xff && dst[size + 1] == 0xff);
+			assert(!memcmp(dst + 1, src, size));
+		}
+	}
+	assert(amdgpu_bo_cpu_unmap(bo) == 0);
+}
+
+static double bandwidth(amdgpu_bo_handle bo, void *data, uint64_t offset,
+			uint64_t size, unsigned loops, int upload)
+{
+	uint64_t start = gettime_ns();
+	unsigned i;
+
+	for (i = 0; i < loops; i++) {
+		if (upload)
+			assert(amdgpu_bo_upload(bo, offset, data, size) == 0);
+		else
+			assert(amdgpu_bo_download(bo, offset, data, size) == 0);
+	}
+	return (double)size * loops / (gettime_ns() - start);
+}
+
+struct copier {
+	amdgpu_bo_handle bo;
+	void *data;
+	uint64_t size;
+	unsigned loops;
+};
+
+static void *copy_loop(void *arg)
+{
+	struct copier *c = arg;
+	unsigned i;
+
+	for (i = 0; i < c->loops; i++)
+		assert(amdgpu_bo_upload(c->bo, 0, c->data, c->size) == 0);
+	return NULL;
+}
+
+/* replaces the workers while copies use them */
+static void check_set_threads(amdgpu_device_handle dev, amdgpu_bo_handle bo,
+			      void *data, uint64_t size, unsigned num_threads)
+{
+	struct copier c = { bo, data, size, 50 };
+	pthread_t tid;
+	unsigned i;
+
+	assert(pthread_create(&tid, NULL, copy_loop, &c) == 0);
+	for (i = 0; i < 50; i++)
+		assert(amdgpu_device_set_copy_threads(dev, i % 3 ?
+						      num_threads : 0) == 0);
+	assert(pthread_join(tid, NULL) == 0);
+}
+
+static void bench(const char *name, uint64_t size, unsigned loops,
+		  unsigned num_threads)
+{
+	struct amdgpu_bo_alloc_request req = {};
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	amdgpu_bo_handle bo;
+	uint8_t *data;
+	uint64_t i;
+	int fd;
+
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+
+	req.alloc_size = size + 4096;
+	req.phys_alignment = 4096;
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	req.flags = AMDGPU_GEM_CREATE_CPU_GTT_USWC;
+	assert(amdgpu_bo_alloc(dev, &req, &bo) == 0);
+	check_edges(bo);
+
+	data = malloc(size + 64);
+	assert(data);
+	for (i = 0; i < size + 64; i++)
+		data[i] = i;
+	/* fault everything in */
+	assert(amdgpu_bo_upload(bo, 0, data, size) == 0);
+
+	printf("%-7s upload %6.2f GB/s, unaligned %6.2f GB/s, "
+	       "download %6.2f GB/s, unaligned %6.2f GB/s\n", name,
+	       bandwidth(bo, data, 0, size, loops, 1),
+	       bandwidth(bo, data + 3, 61, size - 7, loops, 1),
+	       bandwidth(bo, data, 0, size, loops, 0),
+	       bandwidth(bo, data + 3, 61, size - 7, loops, 0));
+
+	if (num_threads) {
+		assert(amdgpu_device_set_copy_threads(dev, num_threads) == 0);
+		printf("%-7s upload %6.2f GB/s, download %6.2f GB/s with %u "
+		       "threads\n", name, bandwidth(bo, data, 0, size, loops, 1),
+		       bandwidth(bo, data, 0, size, loops, 0), num_threads);
+		memset(data, 0, size);
+		assert(amdgpu_bo_download(bo, 0, data, size) == 0);
+		for (i = 0; i < size; i++)
+			assert(data[i] == (uint8_t)i);
+
+		check_set_threads(dev, bo, data, size, num_threads);
+	}
+
+	assert(amdgpu_bo_free(bo) == 0);
+	assert(amdgpu_device_deinitialize(dev) == 0);
+	free(data);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-s size in MiB] [-l loops] [-t threads]\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *variants[] = { "memcpy", "sse2", "avx2", "avx512" };
+	int supported[] = { 1, 0, 0, 0 };
+	unsigned loops = 10, num_threads = 0, i;
+	uint64_t size = 64 << 20;
+	int c, status;
+	pid_t pid;
+
+	while ((c = getopt(argc, argv, "s:l:t:")) != -1) {
+		switch (c) {
+		case 's':
+			size = (uint64_t)atoi(optarg) << 20;
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !size || !loops)
+		usage(argv[0]);
+
+#if defined(__i386__) || defined(__x86_64__)
+	supported[1] = __builtin_cpu_supports("sse2");
+	supported[2] = __builtin_cpu_supports("avx2");
+	supported[3] = __builtin_cpu_supports("avx512f");
+#endif
+
+	for (i = 0; i < sizeof(variants) / sizeof(variants[0]); i++) {
+		if (!supported[i])
+			continue;
+		pid = fork();
+		assert(pid >= 0);
+		if (pid == 0) {
+			setenv("AMDGPU_COPY", variants[i], 1);
+			bench(variants[i], size, loops, num_threads);
+			exit(0);
+		}
+		assert(waitpid(pid, &status, 0) == pid && status == 0);
+	}
+	return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Benchmark for direct GMA pools, comparing an import per DMA target with
+ * regions of a pool.
+ *
+ * A set of small targets is kept alive and one of them is replaced per
+ * step, each target being mapped to the GPU and its physical address
+ * looked up.  The pool is checked for aligned, non-overlapping regions and
+ * for merging the free ranges again first.
+ *
+ * Runs against the fake kernel driver, so kernel costs are left out; the
+ * ioctl counts show what a real import would add.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+#define APERTURE_BASE	0x100000000ull
+#define APERTURE_SIZE	(256ull << 20)
+#define MAX_LIVE	1024
+
+struct target {
+	struct amdgpu_dgma_info info;
+	amdgpu_va_handle va_handle;
+	uint64_t va;
+};
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* 4 KiB to 256 KiB, in pages */
+static uint64_t random_size(void)
+{
+	return (1 + rand() % 64) * 4096;
+}
+
+static void map_target(amdgpu_device_handle dev, struct target *t)
+{
+	assert(amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general,
+				     t->info.size, 0, 0, &t->va,
+				     &t->va_handle, 0) == 0);
+	assert(amdgpu_bo_va_op(t->info.bo, t->info.offset, t->info.size,
+			       t->va, 0, AMDGPU_VA_OP_MAP) == 0);
+}
+
+static void unmap_target(struct target *t)
+{
+	assert(amdgpu_bo_va_op(t->info.bo, t->info.offset, t->info.size,
+			       t->va, 0, AMDGPU_VA_OP_UNMAP) == 0);
+	assert(amdgpu_va_range_free(t->va_handle) == 0);
+}
+
+static void check_pool(amdgpu_device_handle dev)
+{
+	static uint8_t used[APERTURE_SIZE / 4096];
+	struct amdgpu_dgma_info info[512];
+	uint64_t alignment, page;
+	amdgpu_dgma_pool_handle pool;
+	unsigned i, n;
+
+	assert(amdgpu_dgma_pool_create(dev, APERTURE_BASE, 0, &pool) ==
+	       -EINVAL);
+	assert(amdgpu_dgma_pool_create(dev, APERTURE_BASE + 512,
+				       APERTURE_SIZE - 4096, &pool) == -EINVAL);
+	assert(amdgpu_dgma_pool_create(dev, APERTURE_BASE,
+				       APERTURE_SIZE - 512, &pool) == -EINVAL);
+
+	assert(amdgpu_dgma_pool_create(dev, APERTURE_BASE, APERTURE_SIZE,
+				       &pool) == 0);
+
+	for (n = 0; n < 512; n++) {
+		alignment = 4096ull << (rand() % 6);
+		assert(amdgpu_dgma_pool_alloc(pool, 1 + rand() % 300000,
+					      alignment, &info[n]) == 0);
+		assert(info[n].phys_address % alignment == 0);
+		assert(info[n].phys_address == APERTURE_BASE + info[n].offset);
+		assert(info[n].offset + info[n].size <= APERTURE_SIZE);
+		for (page = 0; page < info[n].size / 4096; page++) {
+			assert(!used[info[n].offset / 4096 + page]);
+			used[info[n].offset / 4096 + page] = 1;
+		}
+	}
+
+	/* free in a different order than allocated */
+	for (i = 0; i < n; i += 2)
+		assert(amdgpu_dgma_pool_free(pool, &info[i]) == 0);
+	for (i = 1; i < n; i += 2)
+		assert(amdgpu_dgma_pool_free(pool, &info[i]) == 0);
+
+	/* all the ranges are merged again */
+	assert(amdgpu_dgma_pool_alloc(pool, APERTURE_SIZE, 0, &info[0]) == 0);
+	assert(info[0].offset == 0);
+	assert(amdgpu_dgma_pool_alloc(pool, 4096, 0, &info[1]) == -ENOMEM);
+	assert(amdgpu_dgma_pool_free(pool, &info[0]) == 0);
+
+	assert(amdgpu_dgma_pool_destroy(pool) == 0);
+}
+
+static void bench_import(amdgpu_device_handle dev, unsigned steps,
+			 unsigned live)
+{
+	unsigned ioctls = amdgpu_fake_stats.dgma_imports +
+			  amdgpu_fake_stats.dgma_queries;
+	amdgpu_bo_handle bos[MAX_LIVE] = {};
+	struct target targets[MAX_LIVE];
+	uint64_t begin, elapsed, phys;
+	unsigned i, slot;
+
+	begin = gettime_ns();
+	for (i = 0; i < steps; i++) {
+		slot = i % live;
+		if (bos[slot]) {
+			unmap_target(&targets[slot]);
+			assert(amdgpu_bo_free(bos[slot]) == 0);
+		}
+
+		/* the caller has to find free space on its own */
+		targets[slot].info.offset = slot * (APERTURE_SIZE / live);
+		targets[slot].info.size = random_size();
+		assert(amdgpu_create_bo_from_phys_mem(dev, APERTURE_BASE +
+						      targets[slot].info.offset,
+						      targets[slot].info.size,
+						      &bos[slot]) == 0);
+		assert(amdgpu_bo_get_phys_address(bos[slot], &phys) == 0);
+		targets[slot].info.bo = bos[slot];
+		targets[slot].info.offset = 0;
+		targets[slot].info.phys_address = phys;
+		map_target(dev, &targets[slot]);
+	}
+	elapsed = gettime_ns() - begin;
+
+	for (slot = 0; slot < live && slot < steps; slot++) {
+		unmap_target(&targets[slot]);
+		assert(amdgpu_bo_free(bos[slot]) == 0);
+	}
+
+	printf("import per target: %9.0f targets/s, %u DGMA ioctls\n",
+	       steps / (elapsed / 1e9),
+	       amdgpu_fake_stats.dgma_imports + amdgpu_fake_stats.dgma_queries -
+	       ioctls);
+}
+
+static void bench_pool(amdgpu_device_handle dev, unsigned steps,
+		       unsigned live)
+{
+	unsigned ioctls = amdgpu_fake_stats.dgma_imports +
+			  amdgpu_fake_stats.dgma_queries;
+	struct target targets[MAX_LIVE];
+	amdgpu_dgma_pool_handle pool;
+	uint64_t begin, elapsed;
+	unsigned i, slot;
+
+	begin = gettime_ns();
+	assert(amdgpu_dgma_pool_create(dev, APERTURE_BASE, APERTURE_SIZE,
+				       &pool) == 0);
+	for (i = 0; i < steps; i++) {
+		slot = i % live;
+		if (i >= live) {
+			unmap_target(&targets[slot]);
+			assert(amdgpu_dgma_pool_free(pool,
+						     &targets[slot].info) == 0);
+		}
+
+		assert(amdgpu_dgma_pool_alloc(pool, random_size(), 0,
+					      &targets[slot].info) == 0);
+		map_target(dev, &targets[slot]);
+	}
+	elapsed = gettime_ns() - begin;
+
+	for (slot = 0; slot < live && slot < steps; slot++) {
+		unmap_target(&targets[slot]);
+		assert(amdgpu_dgma_pool_free(pool, &targets[slot].info) == 0);
+	}
+	assert(amdgpu_dgma_pool_destroy(pool) == 0);
+
+	printf("pool:              %9.0f targets/s, %u DGMA ioctls\n",
+	       steps / (elapsed / 1e9),
+	       amdgpu_fake_stats.dgma_imports + amdgpu_fake_stats.dgma_queries -
+	       ioctls);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n steps] [-l live targets]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned steps = 100000, live = 256;
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "n:l:")) != -1) {
+		switch (c) {
+		case 'n':
+			steps = atoi(optarg);
+			break;
+		case 'l':
+			live = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !steps || !live || live > MAX_LIVE)
+		usage(argv[0]);
+
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+
+	srand(1);
+	check_pool(dev);
+
+	srand(1);
+	bench_import(dev, steps, live);
+	srand(1);
+	bench_pool(dev, steps, live);
+	assert(amdgpu_fake_stats.bo_creates == amdgpu_fake_stats.bo_closes);
+
+	assert(amdgpu_device_deinitialize(dev) == 0);
+	return 0;
+}
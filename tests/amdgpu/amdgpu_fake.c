@@ -0,0 +1,540 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "xf86drm.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+struct amdgpu_fake_stats amdgpu_fake_stats;
+uint64_t amdgpu_fake_signaled;
+uint32_t amdgpu_fake_stalled_rings;
+int amdgpu_fake_cs_errno;
+uint32_t amdgpu_fake_crtc_fb;
+uint32_t amdgpu_fake_fb_handle;
+uint16_t amdgpu_fake_mode_width = 1920;
+uint32_t amdgpu_fake_pte_fragment_size = 2 << 20;
+int32_t amdgpu_fake_clock_drift_ppb;
+uint64_t amdgpu_fake_vram_usage;
+uint64_t amdgpu_fake_gtt_usage;
+
+/* buffers live at handle << FAKE_BO_SHIFT in the memfd */
+#define FAKE_BO_SHIFT	32
+
+static int fake_enabled, fake_fd = -1;
+static uint32_t next_handle, next_list, next_ctx;
+static uint64_t next_seq;
+
+/* the second of the two CRTCs is the one which can be on */
+#define FAKE_CRTC_ID	40
+/* size of buffers from other clients */
+#define FAKE_SHARED_SIZE	(8 << 20)
+
+static uint32_t vblank_seq;
+
+/* dma-bufs are memfds, known by inode with the handle of their buffer.
+ * Like in the kernel, a handle which exported or imported a dma-buf keeps
+ * it until it is closed, so exporting it again returns the same one.
+ */
+#define FAKE_DMA_BUFS	4096
+static struct {
+	uint64_t ino;
+	uint32_t handle;
+	/* reference of the handle which exported or imported it */
+	bool held;
+	int fd;
+} dma_bufs[FAKE_DMA_BUFS];
+static unsigned next_dma_buf;
+static unsigned held_dma_bufs;
+
+/* Handles are shared by all clients, so the handles GETFB creates in the
+ * kernel are references of the frame buffer's handle, which closing them
+ * drops, by handle.
+ */
+#define FAKE_FB_HANDLES	4096
+static unsigned fb_handle_refs[FAKE_FB_HANDLES];
+
+/* physical addresses of imported apertures, by handle */
+#define FAKE_DGMA_SLOTS	4096
+static uint64_t dgma_addrs[FAKE_DGMA_SLOTS];
+
+/* kHz, as reported by the kernel */
+#define FAKE_CLOCK_FREQ	100000
+/* the counter doesn't start with the system */
+#define FAKE_CLOCK_BASE	(1ull << 40)
+
+uint64_t amdgpu_fake_gpu_clock(uint64_t ns)
+{
+	uint64_t ticks = ns / (1000000 / FAKE_CLOCK_FREQ);
+
+	return FAKE_CLOCK_BASE + ticks +
+	       (int64_t)((double)ticks * amdgpu_fake_clock_drift_ppb / 1e9);
+}
+
+static uint64_t fake_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void fake_delay(uint64_t ns)
+{
+	uint64_t end = fake_now() + ns;
+
+	while (fake_now() < end)
+		;
+}
+
+static uint64_t fake_timestamp(void)
+{
+	unsigned delay = rand() % 8;
+	uint64_t ticks;
+
+	if (delay == 0)
+		fake_delay(rand() % 20000);
+	ticks = amdgpu_fake_gpu_clock(fake_now());
+	if (delay == 1)
+		fake_delay(rand() % 20000);
+	return ticks;
+}
+
+#define FAKE_VRAM_SIZE		(8ull << 30)
+#define FAKE_VIS_VRAM_SIZE	(256ull << 20)
+#define FAKE_GTT_SIZE		(16ull << 30)
+
+static unsigned sensor_reads;
+
+static void fake_memory_info(struct drm_amdgpu_memory_info *memory)
+{
+	memory->vram.total_heap_size = FAKE_VRAM_SIZE;
+	memory->vram.usable_heap_size = FAKE_VRAM_SIZE;
+	memory->vram.heap_usage = amdgpu_fake_vram_usage;
+	memory->vram.max_allocation = FAKE_VRAM_SIZE * 3 / 4;
+	memory->cpu_accessible_vram.total_heap_size = FAKE_VIS_VRAM_SIZE;
+	memory->cpu_accessible_vram.usable_heap_size = FAKE_VIS_VRAM_SIZE;
+	memory->cpu_accessible_vram.heap_usage =
+		amdgpu_fake_vram_usage < FAKE_VIS_VRAM_SIZE ?
+		amdgpu_fake_vram_usage : FAKE_VIS_VRAM_SIZE;
+	memory->cpu_accessible_vram.max_allocation = FAKE_VIS_VRAM_SIZE * 3 / 4;
+	memory->gtt.total_heap_size = FAKE_GTT_SIZE;
+	memory->gtt.usable_heap_size = FAKE_GTT_SIZE;
+	memory->gtt.heap_usage = amdgpu_fake_gtt_usage;
+	memory->gtt.max_allocation = FAKE_GTT_SIZE * 3 / 4;
+}
+
+static void fake_string(char *buf, __kernel_size_t *len, const char *str)
+{
+	size_t n = strlen(str);
+
+	if (buf)
+		memcpy(buf, str, *len < n ? *len : n);
+	*len = n;
+}
+
+static int fake_info(struct drm_amdgpu_info *info)
+{
+	void *ret = (void *)(uintptr_t)info->return_pointer;
+	struct drm_amdgpu_info_device dev_info = {};
+	struct drm_amdgpu_info_vram_gtt vram_gtt = {};
+	struct drm_amdgpu_memory_info memory = {};
+
+	memset(ret, 0, info->return_size);
+
+	switch (info->query) {
+	case AMDGPU_INFO_ACCEL_WORKING:
+		*(uint32_t *)ret = 1;
+		break;
+	case AMDGPU_INFO_TIMESTAMP:
+		*(uint64_t *)ret = fake_timestamp();
+		break;
+	case AMDGPU_INFO_SENSOR:
+		*(uint32_t *)ret = info->sensor_info.type * 100 +
+				   sensor_reads++ % 50;
+		break;
+	case AMDGPU_INFO_MEMORY:
+		fake_memory_info(&memory);
+		memcpy(ret, &memory, info->return_size < sizeof(memory) ?
+		       info->return_size : sizeof(memory));
+		break;
+	case AMDGPU_INFO_VRAM_GTT:
+		vram_gtt.vram_size = FAKE_VRAM_SIZE;
+		vram_gtt.vram_cpu_accessible_size = FAKE_VIS_VRAM_SIZE;
+		vram_gtt.gtt_size = FAKE_GTT_SIZE;
+		memcpy(ret, &vram_gtt, info->return_size < sizeof(vram_gtt) ?
+		       info->return_size : sizeof(vram_gtt));
+		break;
+	case AMDGPU_INFO_VRAM_USAGE:
+	case AMDGPU_INFO_VIS_VRAM_USAGE:
+	case AMDGPU_INFO_GTT_USAGE:
+		fake_memory_info(&memory);
+		if (info->query == AMDGPU_INFO_VRAM_USAGE)
+			*(uint64_t *)ret = memory.vram.heap_usage;
+		else if (info->query == AMDGPU_INFO_VIS_VRAM_USAGE)
+			*(uint64_t *)ret = memory.cpu_accessible_vram.heap_usage;
+		else
+			*(uint64_t *)ret = memory.gtt.heap_usage;
+		break;
+	case AMDGPU_INFO_DEV_INFO:
+		/* a Vega10, so no tiling registers are read */
+		dev_info.device_id = 0x687f;
+		dev_info.family = AMDGPU_FAMILY_AI;
+		dev_info.virtual_address_offset = 1ull << 20;
+		dev_info.virtual_address_max = 1ull << 47;
+		dev_info.virtual_address_alignment = 4096;
+		dev_info.high_va_offset = 0xffff800000000000ull;
+		dev_info.high_va_max = 0xfffffffffffff000ull;
+		dev_info.pte_fragment_size = amdgpu_fake_pte_fragment_size;
+		dev_info.gpu_counter_freq = FAKE_CLOCK_FREQ;
+		memcpy(ret, &dev_info, info->return_size < sizeof(dev_info) ?
+		       info->return_size : sizeof(dev_info));
+		break;
+	}
+	return 0;
+}
+
+static void fake_dma_buf_release(unsigned i)
+{
+	if (dma_bufs[i].held) {
+		close(dma_bufs[i].fd);
+		dma_bufs[i].held = false;
+		held_dma_bufs--;
+	}
+}
+
+static int fake_prime_ioctl(unsigned long request, void *arg)
+{
+	struct drm_prime_handle *prime = arg;
+	struct stat st;
+	unsigned i;
+
+	if (_IOC_NR(request) == _IOC_NR(DRM_IOCTL_PRIME_HANDLE_TO_FD)) {
+		for (i = 0; held_dma_bufs && i < FAKE_DMA_BUFS; i++) {
+			if (dma_bufs[i].held &&
+			    dma_bufs[i].handle == prime->handle) {
+				prime->fd = fcntl(dma_bufs[i].fd,
+						  prime->flags & DRM_CLOEXEC ?
+						  F_DUPFD_CLOEXEC : F_DUPFD, 0);
+				return prime->fd < 0 ? -1 : 0;
+			}
+		}
+		prime->fd = memfd_create("dma-buf", prime->flags & DRM_CLOEXEC ?
+					 MFD_CLOEXEC : 0);
+		if (prime->fd < 0)
+			return -1;
+		if (ftruncate(prime->fd, FAKE_SHARED_SIZE) ||
+		    fstat(prime->fd, &st)) {
+			close(prime->fd);
+			return -1;
+		}
+		i = next_dma_buf++ % FAKE_DMA_BUFS;
+		fake_dma_buf_release(i);
+		dma_bufs[i].fd = fcntl(prime->fd, F_DUPFD_CLOEXEC, 0);
+		if (dma_bufs[i].fd >= 0) {
+			dma_bufs[i].held = true;
+			held_dma_bufs++;
+		}
+	} else {
+		if (fstat(prime->fd, &st))
+			return -1;
+		amdgpu_fake_stats.prime_imports++;
+		for (i = 0; i < FAKE_DMA_BUFS; i++) {
+			if (dma_bufs[i].ino == st.st_ino)
+				break;
+		}
+		if (i < FAKE_DMA_BUFS) {
+			prime->handle = dma_bufs[i].handle;
+		} else {
+			/* from another device */
+			prime->handle = ++next_handle;
+			i = next_dma_buf++ % FAKE_DMA_BUFS;
+			fake_dma_buf_release(i);
+		}
+		/* the importing handle keeps the dma-buf as well */
+		if (!dma_bufs[i].held) {
+			dma_bufs[i].fd = fcntl(prime->fd, F_DUPFD_CLOEXEC, 0);
+			if (dma_bufs[i].fd >= 0) {
+				dma_bufs[i].held = true;
+				held_dma_bufs++;
+			}
+		}
+	}
+
+	dma_bufs[i].ino = st.st_ino;
+	dma_bufs[i].handle = prime->handle;
+	return 0;
+}
+
+static int fake_mode_ioctl(unsigned long request, void *arg)
+{
+	struct drm_mode_card_res *res;
+	struct drm_mode_crtc *crtc;
+	struct drm_mode_fb_cmd *fb;
+	uint32_t *crtcs;
+
+	switch (_IOC_NR(request)) {
+	case _IOC_NR(DRM_IOCTL_MODE_GETRESOURCES):
+		res = arg;
+		crtcs = (uint32_t *)(uintptr_t)res->crtc_id_ptr;
+		if (crtcs && res->count_crtcs >= 2) {
+			crtcs[0] = FAKE_CRTC_ID - 1;
+			crtcs[1] = FAKE_CRTC_ID;
+		}
+		res->count_fbs = res->count_connectors = res->count_encoders = 0;
+		res->count_crtcs = 2;
+		res->max_width = res->max_height = 16384;
+		return 0;
+	case _IOC_NR(DRM_IOCTL_MODE_GETCRTC):
+		crtc = arg;
+		if (crtc->crtc_id != FAKE_CRTC_ID - 1 &&
+		    crtc->crtc_id != FAKE_CRTC_ID)
+			break;
+		memset(&crtc->fb_id, 0, sizeof(*crtc) -
+		       offsetof(struct drm_mode_crtc, fb_id));
+		if (crtc->crtc_id == FAKE_CRTC_ID && amdgpu_fake_crtc_fb) {
+			crtc->fb_id = amdgpu_fake_crtc_fb;
+			crtc->mode_valid = 1;
+			crtc->mode.hdisplay = amdgpu_fake_mode_width;
+			crtc->mode.vdisplay = amdgpu_fake_mode_width * 9 / 16;
+		}
+		return 0;
+	case _IOC_NR(DRM_IOCTL_MODE_GETFB):
+		fb = arg;
+		if (!fb->fb_id)
+			break;
+		fb->width = amdgpu_fake_mode_width;
+		fb->height = amdgpu_fake_mode_width * 9 / 16;
+		fb->pitch = fb->width * 4;
+		fb->bpp = 32;
+		fb->depth = 24;
+		/* frame buffer ids are the handles of their buffers */
+		fb->handle = fb->fb_id;
+		if (fb->fb_id == amdgpu_fake_crtc_fb && amdgpu_fake_fb_handle)
+			fb->handle = amdgpu_fake_fb_handle;
+		if (fb->handle < FAKE_FB_HANDLES)
+			fb_handle_refs[fb->handle]++;
+		return 0;
+	case _IOC_NR(DRM_IOCTL_WAIT_VBLANK):
+		((union drm_wait_vblank *)arg)->reply.sequence = ++vblank_seq;
+		return 0;
+	case _IOC_NR(DRM_IOCTL_PRIME_HANDLE_TO_FD):
+	case _IOC_NR(DRM_IOCTL_PRIME_FD_TO_HANDLE):
+		return fake_prime_ioctl(request, arg);
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static int fake_ioctl(unsigned long request, void *arg)
+{
+	union drm_amdgpu_gem_create *create;
+	union drm_amdgpu_gem_mmap *mmap;
+	struct drm_amdgpu_gem_userptr *userptr;
+	struct drm_amdgpu_gem_dgma *dgma;
+	struct drm_amdgpu_gem_op *gem_op;
+	union drm_amdgpu_bo_list *list;
+	union drm_amdgpu_ctx *ctx;
+	union drm_amdgpu_cs *cs;
+	union drm_amdgpu_wait_cs *wait;
+	struct drm_amdgpu_cs_chunk *chunk;
+	struct drm_version *version;
+	struct drm_gem_close *gem_close;
+	drm_client_t *client;
+	uint64_t *chunks;
+	uint32_t i;
+
+	switch (_IOC_NR(request)) {
+	case _IOC_NR(DRM_IOCTL_VERSION):
+		version = arg;
+		version->version_major = 3;
+		version->version_minor = 27;
+		version->version_patchlevel = 0;
+		fake_string(version->name, &version->name_len, "amdgpu");
+		fake_string(version->date, &version->date_len, "20150101");
+		fake_string(version->desc, &version->desc_len, "fake");
+		return 0;
+	case _IOC_NR(DRM_IOCTL_GET_CLIENT):
+		client = arg;
+		client->auth = 1;
+		return 0;
+	case _IOC_NR(DRM_IOCTL_GEM_CLOSE):
+		gem_close = arg;
+		if (gem_close->handle < FAKE_FB_HANDLES &&
+		    fb_handle_refs[gem_close->handle]) {
+			fb_handle_refs[gem_close->handle]--;
+			return 0;
+		}
+		for (i = 0; held_dma_bufs && i < FAKE_DMA_BUFS; i++) {
+			if (dma_bufs[i].handle == gem_close->handle)
+				fake_dma_buf_release(i);
+		}
+		fallocate(fake_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			  (off_t)gem_close->handle << FAKE_BO_SHIFT,
+			  1ll << FAKE_BO_SHIFT);
+		amdgpu_fake_stats.bo_closes++;
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_INFO:
+		return fake_info(arg);
+	case DRM_COMMAND_BASE + DRM_AMDGPU_GEM_CREATE:
+		create = arg;
+		memset(&create->out, 0, sizeof(create->out));
+		create->out.handle = ++next_handle;
+		amdgpu_fake_stats.bo_creates++;
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_GEM_USERPTR:
+		userptr = arg;
+		if ((userptr->addr | userptr->size) & (getpagesize() - 1)) {
+			errno = EINVAL;
+			return -1;
+		}
+		/* fault in the pages, as pinning them would */
+		for (i = 0; i < userptr->size / getpagesize(); i++)
+			*(volatile char *)(uintptr_t)(userptr->addr +
+						      i * getpagesize());
+		userptr->handle = ++next_handle;
+		amdgpu_fake_stats.bo_creates++;
+		amdgpu_fake_stats.userptrs++;
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_GEM_DGMA:
+		dgma = arg;
+		if (dgma->op == AMDGPU_GEM_DGMA_QUERY_PHYS_ADDR) {
+			dgma->addr = dgma_addrs[dgma->handle % FAKE_DGMA_SLOTS];
+			amdgpu_fake_stats.dgma_queries++;
+			return 0;
+		}
+		if ((dgma->addr | dgma->size) & 4095) {
+			errno = EINVAL;
+			return -1;
+		}
+		dgma->handle = ++next_handle;
+		dgma_addrs[dgma->handle % FAKE_DGMA_SLOTS] = dgma->addr;
+		amdgpu_fake_stats.bo_creates++;
+		amdgpu_fake_stats.dgma_imports++;
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_GEM_OP:
+		gem_op = arg;
+		if (gem_op->op == AMDGPU_GEM_OP_GET_GEM_CREATE_INFO)
+			((struct drm_amdgpu_gem_create_in *)(uintptr_t)
+			 gem_op->value)->bo_size = FAKE_SHARED_SIZE;
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_GEM_MMAP:
+		mmap = arg;
+		mmap->out.addr_ptr = (uint64_t)mmap->in.handle << FAKE_BO_SHIFT;
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_GEM_VA:
+		amdgpu_fake_stats.va_ops++;
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_GEM_WAIT_IDLE:
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_BO_LIST:
+		list = arg;
+		if (list->in.operation == AMDGPU_BO_LIST_OP_CREATE)
+			list->out.list_handle = ++next_list;
+		amdgpu_fake_stats.bo_lists++;
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_CTX:
+		ctx = arg;
+		if (ctx->in.op == AMDGPU_CTX_OP_ALLOC_CTX) {
+			memset(&ctx->out, 0, sizeof(ctx->out));
+			ctx->out.alloc.ctx_id = ++next_ctx;
+			amdgpu_fake_stats.ctxs++;
+		}
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_CS:
+		if (amdgpu_fake_cs_errno) {
+			errno = amdgpu_fake_cs_errno;
+			return -1;
+		}
+		cs = arg;
+		chunks = (uint64_t *)(uintptr_t)cs->in.chunks;
+		for (i = 0; i < cs->in.num_chunks; i++) {
+			chunk = (void *)(uintptr_t)chunks[i];
+			if (chunk->chunk_id == AMDGPU_CHUNK_ID_IB)
+				amdgpu_fake_stats.ib_chunks++;
+			else if (chunk->chunk_id == AMDGPU_CHUNK_ID_DEPENDENCIES)
+				amdgpu_fake_stats.dep_chunks++;
+		}
+		cs->out.handle = ++next_seq;
+		amdgpu_fake_stats.submits++;
+		return 0;
+	case DRM_COMMAND_BASE + DRM_AMDGPU_WAIT_CS:
+		wait = arg;
+		wait->out.status = wait->in.handle > amdgpu_fake_signaled ||
+				   amdgpu_fake_stalled_rings & (1u << wait->in.ring);
+		amdgpu_fake_stats.fence_waits++;
+		return 0;
+	}
+
+	return fake_mode_ioctl(request, arg);
+}
+
+/* Programs are built with hidden visibility, export the override to libdrm. */
+__attribute__((visibility("default")))
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (!fake_enabled)
+		return syscall(SYS_ioctl, fd, request, arg);
+
+	amdgpu_fake_stats.ioctls++;
+	return fake_ioctl(request, arg);
+}
+
+int amdgpu_fake_open(void)
+{
+	if (fake_fd < 0) {
+		fake_fd = memfd_create("amdgpu_fake", MFD_CLOEXEC);
+		if (fake_fd < 0)
+			return -1;
+		/* sparse, only what is written to takes memory */
+		if (ftruncate(fake_fd, 1ll << 62)) {
+			close(fake_fd);
+			fake_fd = -1;
+			return -1;
+		}
+	}
+
+	fake_enabled = 1;
+	return fcntl(fake_fd, F_DUPFD_CLOEXEC, 0);
+}
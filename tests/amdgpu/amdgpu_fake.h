@@ -0,0 +1,104 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef _AMDGPU_FAKE_H_
+#define _AMDGPU_FAKE_H_
+
+#include <stdint.h>
+
+/*
+ * A stand-in for the amdgpu kernel driver, for programs which run without
+ * the hardware.  It overrides ioctl(); once amdgpu_fake_open() was called,
+ * all ioctls are answered by the fake, before that they go to the kernel.
+ * Buffers are backed by a memfd, so CPU mappings of them behave like the
+ * shared mappings of a real device rather than anonymous memory.  Exported
+ * dma-bufs are memfds of their own, one per buffer while its handle is
+ * open.
+ */
+
+struct amdgpu_fake_stats {
+	/* all of them */
+	unsigned ioctls;
+	unsigned bo_creates;
+	/* also counted as bo_creates */
+	unsigned userptrs;
+	/* also counted as bo_creates */
+	unsigned dgma_imports;
+	unsigned dgma_queries;
+	unsigned prime_imports;
+	unsigned bo_closes;
+	unsigned va_ops;
+	unsigned bo_lists;
+	unsigned ctxs;
+	unsigned submits;
+	unsigned ib_chunks;
+	unsigned dep_chunks;
+	unsigned fence_waits;
+};
+
+extern struct amdgpu_fake_stats amdgpu_fake_stats;
+
+/* Submissions return increasing sequence numbers, those up to this one
+ * are reported as signaled.
+ */
+extern uint64_t amdgpu_fake_signaled;
+
+/* Fences of the rings in this mask never signal. */
+extern uint32_t amdgpu_fake_stalled_rings;
+
+/* Submissions fail with this errno while it is set. */
+extern int amdgpu_fake_cs_errno;
+
+/* Frame buffer the second CRTC scans out, 0 for off.  Frame buffer ids are
+ * the handles of their buffers, the mode's width can be changed.
+ */
+extern uint32_t amdgpu_fake_crtc_fb;
+extern uint16_t amdgpu_fake_mode_width;
+
+/* Handle of the buffer behind amdgpu_fake_crtc_fb instead of its id, as
+ * after the id was reused for another buffer, or 0.
+ */
+extern uint32_t amdgpu_fake_fb_handle;
+
+/* PTE fragment size the device reports, 2 MiB like Vega10 by default */
+extern uint32_t amdgpu_fake_pte_fragment_size;
+
+/* The GPU clock counter nominally runs at 100 MHz, and is off by this many
+ * parts per billion.  Every fourth read of it is delayed by up to 20 us
+ * before or after the counter is taken, like a preempted ioctl.
+ */
+extern int32_t amdgpu_fake_clock_drift_ppb;
+
+/* Returns the GPU clock counter at a CLOCK_MONOTONIC time in ns. */
+uint64_t amdgpu_fake_gpu_clock(uint64_t ns);
+
+/* Heap usage the memory queries report.  Sensors report 100 times their
+ * type plus a value going up with each read and wrapping at 50.
+ */
+extern uint64_t amdgpu_fake_vram_usage;
+extern uint64_t amdgpu_fake_gtt_usage;
+
+/* Returns a file descriptor to pass to amdgpu_device_initialize(). */
+int amdgpu_fake_open(void);
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * dma-buf import benchmark.
+ *
+ * A compositor gets the buffers of its clients as new fds every frame,
+ * while it still holds the buffers it imported from them before.  Such
+ * re-imports are compared with imports of dma-bufs which weren't seen
+ * before.  dma-bufs are memfds in the fake kernel driver, which answers
+ * ioctls without kernel costs, so the ioctls per import are reported too.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+#define MAX_CLIENTS	64
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* a buffer of another device */
+static int foreign_dma_buf(void)
+{
+	int fd = memfd_create("dma-buf", MFD_CLOEXEC);
+
+	assert(fd >= 0);
+	assert(ftruncate(fd, 8 << 20) == 0);
+	return fd;
+}
+
+static void report(const char *name, unsigned n, uint64_t elapsed,
+		   unsigned ioctls)
+{
+	printf("%-10s %9.0f imports/s, %.2f ioctls per import\n", name,
+	       n / (elapsed / 1e9), (double)ioctls / n);
+}
+
+static void bench_first(amdgpu_device_handle dev, unsigned n)
+{
+	struct amdgpu_bo_import_result result;
+	uint64_t begin, elapsed = 0;
+	unsigned ioctls = 0, i;
+	int fd;
+
+	for (i = 0; i < n; i++) {
+		fd = foreign_dma_buf();
+		begin = gettime_ns();
+		ioctls -= amdgpu_fake_stats.ioctls;
+		assert(amdgpu_bo_import(dev, amdgpu_bo_handle_type_dma_buf_fd,
+					fd, &result) == 0);
+		ioctls += amdgpu_fake_stats.ioctls;
+		assert(amdgpu_bo_free(result.buf_handle) == 0);
+		elapsed += gettime_ns() - begin;
+		close(fd);
+	}
+	report("first:", n, elapsed, ioctls);
+}
+
+static void bench_again(amdgpu_device_handle dev, const int *fds,
+			const amdgpu_bo_handle *held, unsigned num_clients,
+			unsigned frames)
+{
+	unsigned ioctls = amdgpu_fake_stats.ioctls, f, i;
+	struct amdgpu_bo_import_result result;
+	uint64_t begin, elapsed = 0;
+	int fd;
+
+	for (f = 0; f < frames; f++) {
+		for (i = 0; i < num_clients; i++) {
+			/* received from the client */
+			fd = dup(fds[i]);
+			assert(fd >= 0);
+			begin = gettime_ns();
+			assert(amdgpu_bo_import(dev,
+						amdgpu_bo_handle_type_dma_buf_fd,
+						fd, &result) == 0);
+			assert(result.buf_handle == held[i]);
+			assert(result.alloc_size == 8 << 20);
+			assert(amdgpu_bo_free(result.buf_handle) == 0);
+			elapsed += gettime_ns() - begin;
+			close(fd);
+		}
+	}
+	report("again:", frames * num_clients, elapsed,
+	       amdgpu_fake_stats.ioctls - ioctls);
+}
+
+/* Exports of the device's own buffers come back as the same buffer, and
+ * freed buffers aren't found anymore.
+ */
+static void check_import(amdgpu_device_handle dev)
+{
+	struct amdgpu_bo_alloc_request req = {};
+	struct amdgpu_bo_import_result result;
+	unsigned imports;
+	amdgpu_bo_handle bo;
+	uint32_t fd, fd2;
+
+	req.alloc_size = 1 << 20;
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	assert(amdgpu_bo_alloc(dev, &req, &bo) == 0);
+	assert(amdgpu_bo_export(bo, amdgpu_bo_handle_type_dma_buf_fd,
+				&fd) == 0);
+	assert(amdgpu_bo_import(dev, amdgpu_bo_handle_type_dma_buf_fd, fd,
+				&result) == 0);
+	assert(result.buf_handle == bo);
+	imports = amdgpu_fake_stats.prime_imports;
+	assert(amdgpu_bo_import(dev, amdgpu_bo_handle_type_dma_buf_fd, fd,
+				&result) == 0);
+	assert(result.buf_handle == bo);
+	assert(amdgpu_fake_stats.prime_imports == imports);
+
+	/* exporting it again gives the same dma-buf */
+	assert(amdgpu_bo_export(bo, amdgpu_bo_handle_type_dma_buf_fd,
+				&fd2) == 0);
+	assert(amdgpu_bo_import(dev, amdgpu_bo_handle_type_dma_buf_fd, fd2,
+				&result) == 0);
+	assert(result.buf_handle == bo);
+	assert(amdgpu_fake_stats.prime_imports == imports);
+	close(fd2);
+
+	assert(amdgpu_bo_free(bo) == 0);
+	assert(amdgpu_bo_free(bo) == 0);
+	assert(amdgpu_bo_free(bo) == 0);
+	assert(amdgpu_bo_free(bo) == 0);
+
+	assert(amdgpu_bo_import(dev, amdgpu_bo_handle_type_dma_buf_fd, fd,
+				&result) == 0);
+	assert(amdgpu_fake_stats.prime_imports == imports + 1);
+	assert(amdgpu_bo_free(result.buf_handle) == 0);
+	close(fd);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-f frames] [-c clients]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned frames = 20000, num_clients = 4, i;
+	struct amdgpu_bo_import_result result;
+	amdgpu_bo_handle held[MAX_CLIENTS];
+	int c, fd, fds[MAX_CLIENTS];
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+
+	while ((c = getopt(argc, argv, "f:c:")) != -1) {
+		switch (c) {
+		case 'f':
+			frames = atoi(optarg);
+			break;
+		case 'c':
+			num_clients = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !frames || !num_clients ||
+	    num_clients > MAX_CLIENTS)
+		usage(argv[0]);
+
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+
+	check_import(dev);
+
+	for (i = 0; i < num_clients; i++) {
+		fds[i] = foreign_dma_buf();
+		assert(amdgpu_bo_import(dev, amdgpu_bo_handle_type_dma_buf_fd,
+					fds[i], &result) == 0);
+		held[i] = result.buf_handle;
+	}
+
+	bench_first(dev, 1000);
+	bench_again(dev, fds, held, num_clients, frames);
+
+	for (i = 0; i < num_clients; i++) {
+		assert(amdgpu_bo_free(held[i]) == 0);
+		close(fds[i]);
+	}
+	assert(amdgpu_device_deinitialize(dev) == 0);
+	return 0;
+}
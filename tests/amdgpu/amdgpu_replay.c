@@ -0,0 +1,661 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Replays a stream written by amdgpu_cs_capture_start().
+ *
+ * Buffers, GPU VA mappings, BO lists and contexts are recreated as they
+ * were captured, IB contents are copied back before each submission, and
+ * buffer handles, contexts and fence sequence numbers are translated.
+ * Other buffer contents aren't captured, so this reproduces the command
+ * submission work, not the rendering.  Syncobj chunks are dropped.
+ *
+ * With -f, the stream is replayed against a fake kernel driver, which
+ * makes the library side of command submission measurable on its own.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_capture.h"
+#include "amdgpu_fake.h"
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+/* submissions remembered to translate dependencies */
+#define SEQ_HISTORY 4096
+
+struct replay_va {
+	uint64_t va;
+	uint64_t size;
+	uint64_t offset;
+	amdgpu_bo_handle bo;
+	void *cpu;
+};
+
+struct replay_seq {
+	uint32_t ctx_id;
+	uint32_t ip_type;
+	uint32_t ip_instance;
+	uint32_t ring;
+	uint64_t captured;
+	uint64_t replayed;
+};
+
+struct replay {
+	amdgpu_device_handle dev;
+
+	amdgpu_bo_handle *bos;		/* by captured handle */
+	uint32_t nr_bos;
+	uint32_t *lists;		/* by captured handle */
+	uint32_t nr_lists;
+	amdgpu_context_handle *ctxs;	/* by captured id */
+	uint32_t nr_ctxs;
+
+	struct replay_va *va;		/* sorted by address */
+	unsigned va_count;
+	unsigned va_size;
+
+	struct replay_seq seqs[SEQ_HISTORY];
+	unsigned nr_seqs;
+
+	unsigned submits;
+	unsigned skipped;
+	unsigned dropped_chunks;
+	uint64_t submit_ns;
+};
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* grow a table indexed by captured handle so that index is valid */
+static void *grow(void *table, uint32_t *count, uint32_t index, size_t size)
+{
+	uint32_t new_count = *count;
+	char *ptr;
+
+	if (index < *count)
+		return table;
+
+	while (new_count <= index)
+		new_count = new_count ? new_count * 2 : 256;
+	ptr = realloc(table, new_count * size);
+	if (!ptr) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(ptr + *count * size, 0, (new_count - *count) * size);
+	*count = new_count;
+	return ptr;
+}
+
+static amdgpu_bo_handle *replay_bo(struct replay *r, uint32_t handle)
+{
+	r->bos = grow(r->bos, &r->nr_bos, handle, sizeof(*r->bos));
+	return &r->bos[handle];
+}
+
+static int replay_va_find(struct replay *r, uint64_t va)
+{
+	int lo = 0, hi = r->va_count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (r->va[mid].va <= va)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+static void replay_va_clear(struct replay *r, uint64_t va, uint64_t size)
+{
+	int i = replay_va_find(r, va);
+
+	if (i < 0 || r->va[i].va + r->va[i].size <= va)
+		i++;
+	while (i < (int)r->va_count && r->va[i].va < va + size) {
+		if (r->va[i].cpu)
+			amdgpu_bo_cpu_unmap(r->va[i].bo);
+		memmove(&r->va[i], &r->va[i + 1],
+			(r->va_count - i - 1) * sizeof(*r->va));
+		r->va_count--;
+	}
+}
+
+static void replay_va_insert(struct replay *r, amdgpu_bo_handle bo,
+			     uint64_t offset, uint64_t va, uint64_t size)
+{
+	int i;
+
+	replay_va_clear(r, va, size);
+	if (r->va_count == r->va_size) {
+		r->va_size = r->va_size ? r->va_size * 2 : 64;
+		r->va = realloc(r->va, r->va_size * sizeof(*r->va));
+		if (!r->va) {
+			fprintf(stderr, "out of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	i = replay_va_find(r, va) + 1;
+	memmove(&r->va[i + 1], &r->va[i], (r->va_count - i) * sizeof(*r->va));
+	r->va_count++;
+	r->va[i].va = va;
+	r->va[i].size = size;
+	r->va[i].offset = offset;
+	r->va[i].bo = bo;
+	r->va[i].cpu = NULL;
+}
+
+static void replay_bo_free(struct replay *r, uint32_t handle)
+{
+	amdgpu_bo_handle *bo = replay_bo(r, handle);
+	unsigned i;
+
+	if (!*bo)
+		return;
+
+	for (i = 0; i < r->va_count;) {
+		if (r->va[i].bo == *bo)
+			replay_va_clear(r, r->va[i].va, r->va[i].size);
+		else
+			i++;
+	}
+	amdgpu_bo_free(*bo);
+	*bo = NULL;
+}
+
+static void replay_bo_alloc(struct replay *r,
+			    const struct amdgpu_capture_bo_alloc *rec)
+{
+	struct amdgpu_bo_alloc_request req = {};
+	amdgpu_bo_handle *bo;
+
+	replay_bo_free(r, rec->handle);
+	bo = replay_bo(r, rec->handle);
+
+	req.alloc_size = rec->size;
+	req.phys_alignment = rec->alignment;
+	req.preferred_heap = rec->heap;
+	req.flags = rec->flags;
+	if (amdgpu_bo_alloc(r->dev, &req, bo))
+		*bo = NULL;
+}
+
+static void replay_va_op(struct replay *r,
+			 const struct amdgpu_capture_va_op *rec)
+{
+	amdgpu_bo_handle bo = NULL;
+
+	if (rec->handle) {
+		struct amdgpu_capture_bo_alloc alloc = {};
+
+		/* a buffer we haven't seen being allocated */
+		if (!*replay_bo(r, rec->handle)) {
+			alloc.handle = rec->handle;
+			alloc.heap = AMDGPU_GEM_DOMAIN_GTT;
+			alloc.size = rec->bo_size;
+			alloc.alignment = 4096;
+			replay_bo_alloc(r, &alloc);
+		}
+		bo = *replay_bo(r, rec->handle);
+		if (!bo)
+			return;
+	}
+
+	if (amdgpu_bo_va_op_raw(r->dev, bo, rec->offset, rec->size, rec->va,
+				rec->flags, rec->op))
+		return;
+
+	switch (rec->op) {
+	case AMDGPU_VA_OP_MAP:
+	case AMDGPU_VA_OP_REPLACE:
+		replay_va_insert(r, bo, rec->offset, rec->va, rec->size);
+		break;
+	case AMDGPU_VA_OP_UNMAP:
+	case AMDGPU_VA_OP_CLEAR:
+		replay_va_clear(r, rec->va, rec->size);
+		break;
+	}
+}
+
+/* translate list entries in place, dropping unknown buffers */
+static uint32_t replay_entries(struct replay *r,
+			       struct drm_amdgpu_bo_list_entry *entries,
+			       const void *src, uint32_t count, uint32_t size)
+{
+	uint32_t i, n = 0;
+
+	for (i = 0; i < count; i++) {
+		const struct drm_amdgpu_bo_list_entry *entry =
+			(const void *)((const char *)src + i * size);
+		amdgpu_bo_handle bo = *replay_bo(r, entry->bo_handle);
+		uint32_t handle;
+
+		if (!bo || amdgpu_bo_export(bo, amdgpu_bo_handle_type_kms,
+					    &handle))
+			continue;
+		entries[n].bo_handle = handle;
+		entries[n].bo_priority = entry->bo_priority;
+		n++;
+	}
+	return n;
+}
+
+static void replay_bo_list(struct replay *r,
+			   const struct amdgpu_capture_bo_list *rec)
+{
+	struct drm_amdgpu_bo_list_entry *entries;
+	uint32_t *list, n;
+
+	r->lists = grow(r->lists, &r->nr_lists, rec->handle, sizeof(*r->lists));
+	list = &r->lists[rec->handle];
+
+	if (*list) {
+		amdgpu_bo_list_destroy_raw(r->dev, *list);
+		*list = 0;
+	}
+	if (rec->op == AMDGPU_BO_LIST_OP_DESTROY)
+		return;
+
+	entries = calloc(rec->count + 1, sizeof(*entries));
+	if (!entries)
+		return;
+	n = replay_entries(r, entries, rec + 1, rec->count, sizeof(*entries));
+	if (n && amdgpu_bo_list_create_raw(r->dev, n, entries, list))
+		*list = 0;
+	free(entries);
+}
+
+static void replay_ctx(struct replay *r, uint32_t type,
+		       const struct amdgpu_capture_ctx *rec)
+{
+	amdgpu_context_handle *ctx;
+
+	r->ctxs = grow(r->ctxs, &r->nr_ctxs, rec->ctx_id, sizeof(*r->ctxs));
+	ctx = &r->ctxs[rec->ctx_id];
+
+	if (*ctx) {
+		amdgpu_cs_ctx_free(*ctx);
+		*ctx = NULL;
+	}
+	if (type == AMDGPU_CAPTURE_CTX_CREATE &&
+	    amdgpu_cs_ctx_create2(r->dev, rec->priority, ctx))
+		*ctx = NULL;
+}
+
+static bool replay_dep(struct replay *r, struct drm_amdgpu_cs_chunk_dep *dep)
+{
+	struct amdgpu_cs_fence fence = {};
+	unsigned i, n = r->nr_seqs < SEQ_HISTORY ? r->nr_seqs : SEQ_HISTORY;
+
+	for (i = 1; i <= n; i++) {
+		struct replay_seq *seq = &r->seqs[(r->nr_seqs - i) % SEQ_HISTORY];
+
+		if (seq->ctx_id != dep->ctx_id || seq->captured != dep->handle ||
+		    seq->ip_type != dep->ip_type ||
+		    seq->ip_instance != dep->ip_instance ||
+		    seq->ring != dep->ring)
+			continue;
+
+		fence.context = r->ctxs[seq->ctx_id];
+		fence.ip_type = seq->ip_type;
+		fence.ip_instance = seq->ip_instance;
+		fence.ring = seq->ring;
+		fence.fence = seq->replayed;
+		amdgpu_cs_chunk_fence_to_dep(&fence, dep);
+		return true;
+	}
+	return false;
+}
+
+static void replay_ib(struct replay *r, const struct amdgpu_capture_ib *ib)
+{
+	struct replay_va *entry;
+	int i = replay_va_find(r, ib->va);
+
+	if (i < 0 || !ib->size)
+		return;
+
+	entry = &r->va[i];
+	if (ib->va + ib->size > entry->va + entry->size)
+		return;
+	if (!entry->cpu && amdgpu_bo_cpu_map(entry->bo, &entry->cpu))
+		entry->cpu = NULL;
+	if (entry->cpu)
+		memcpy((char *)entry->cpu + entry->offset + (ib->va - entry->va),
+		       ib + 1, ib->size);
+}
+
+static void replay_cs(struct replay *r, const struct amdgpu_capture_cs *rec)
+{
+	struct drm_amdgpu_cs_chunk *chunks;
+	struct drm_amdgpu_cs_chunk_ib *first_ib = NULL;
+	struct drm_amdgpu_bo_list_entry *entries = NULL;
+	amdgpu_context_handle ctx;
+	const char *ptr = (const char *)(rec + 1);
+	char *data;
+	uint32_t i, n = 0, list = 0;
+	uint64_t seq_no, start;
+
+	if (rec->result || rec->ctx_id >= r->nr_ctxs ||
+	    !(ctx = r->ctxs[rec->ctx_id])) {
+		r->skipped++;
+		return;
+	}
+	if (rec->bo_list_handle && rec->bo_list_handle < r->nr_lists)
+		list = r->lists[rec->bo_list_handle];
+
+	chunks = calloc(rec->num_chunks, sizeof(*chunks));
+	if (!chunks)
+		return;
+
+	for (i = 0; i < rec->num_chunks; i++) {
+		const struct amdgpu_capture_chunk *chunk = (const void *)ptr;
+		struct drm_amdgpu_bo_list_in *in;
+		struct drm_amdgpu_cs_chunk_fence *fence;
+		struct drm_amdgpu_cs_chunk_dep *deps;
+		amdgpu_bo_handle bo;
+		uint32_t j, nr_deps, count;
+
+		ptr += sizeof(*chunk);
+		data = malloc(chunk->length_dw * 4);
+		if (!data)
+			goto out;
+		memcpy(data, ptr, chunk->length_dw * 4);
+		ptr += ALIGN8(chunk->length_dw * 4);
+
+		switch (chunk->chunk_id) {
+		case AMDGPU_CHUNK_ID_IB:
+			if (!first_ib)
+				first_ib = (void *)data;
+			break;
+		case AMDGPU_CHUNK_ID_FENCE:
+			fence = (void *)data;
+			bo = *replay_bo(r, fence->handle);
+			if (!bo || amdgpu_bo_export(bo, amdgpu_bo_handle_type_kms,
+						    &fence->handle)) {
+				free(data);
+				r->dropped_chunks++;
+				continue;
+			}
+			break;
+		case AMDGPU_CHUNK_ID_DEPENDENCIES:
+		case AMDGPU_CHUNK_ID_SCHEDULED_DEPENDENCIES:
+			deps = (void *)data;
+			nr_deps = chunk->length_dw * 4 / sizeof(*deps);
+			for (j = 0; j < nr_deps; j++) {
+				/* unknown fences have signaled long ago */
+				if (!replay_dep(r, &deps[j]))
+					deps[j].handle = 0;
+			}
+			break;
+		case AMDGPU_CHUNK_ID_BO_HANDLES:
+			in = (void *)data;
+			count = in->bo_number;
+			free(entries);
+			entries = calloc(count + 1, sizeof(*entries));
+			if (!entries) {
+				free(data);
+				goto out;
+			}
+			in->bo_number = replay_entries(r, entries, ptr, count,
+						       in->bo_info_size);
+			ptr += ALIGN8((uint64_t)count * in->bo_info_size);
+			in->bo_info_size = sizeof(*entries);
+			in->bo_info_ptr = (uint64_t)(uintptr_t)entries;
+			break;
+		default:
+			free(data);
+			r->dropped_chunks++;
+			continue;
+		}
+
+		chunks[n].chunk_id = chunk->chunk_id;
+		chunks[n].length_dw = chunk->length_dw;
+		chunks[n].chunk_data = (uint64_t)(uintptr_t)data;
+		n++;
+	}
+
+	for (i = 0; i < rec->num_ibs; i++) {
+		const struct amdgpu_capture_ib *ib = (const void *)ptr;
+
+		replay_ib(r, ib);
+		ptr += sizeof(*ib) + ALIGN8(ib->size);
+	}
+
+	start = get_time_ns();
+	if (amdgpu_cs_submit_raw2(r->dev, ctx, list, n, chunks, &seq_no)) {
+		r->skipped++;
+		goto out;
+	}
+	r->submit_ns += get_time_ns() - start;
+	r->submits++;
+
+	if (first_ib) {
+		struct replay_seq *seq = &r->seqs[r->nr_seqs++ % SEQ_HISTORY];
+
+		seq->ctx_id = rec->ctx_id;
+		seq->ip_type = first_ib->ip_type;
+		seq->ip_instance = first_ib->ip_instance;
+		seq->ring = first_ib->ring;
+		seq->captured = rec->seq_no;
+		seq->replayed = seq_no;
+	}
+
+out:
+	for (i = 0; i < n; i++)
+		free((void *)(uintptr_t)chunks[i].chunk_data);
+	free(chunks);
+	free(entries);
+}
+
+static void replay_fini(struct replay *r)
+{
+	uint32_t i;
+
+	for (i = 0; i < r->nr_bos; i++)
+		replay_bo_free(r, i);
+	for (i = 0; i < r->nr_lists; i++) {
+		if (r->lists[i])
+			amdgpu_bo_list_destroy_raw(r->dev, r->lists[i]);
+	}
+	for (i = 0; i < r->nr_ctxs; i++) {
+		if (r->ctxs[i])
+			amdgpu_cs_ctx_free(r->ctxs[i]);
+	}
+	free(r->bos);
+	free(r->lists);
+	free(r->ctxs);
+	free(r->va);
+	amdgpu_device_deinitialize(r->dev);
+}
+
+static const char *type_names[] = {
+	[AMDGPU_CAPTURE_BO_ALLOC] = "bo_alloc",
+	[AMDGPU_CAPTURE_BO_FREE] = "bo_free",
+	[AMDGPU_CAPTURE_VA_OP] = "va_op",
+	[AMDGPU_CAPTURE_BO_LIST] = "bo_list",
+	[AMDGPU_CAPTURE_CTX_CREATE] = "ctx_create",
+	[AMDGPU_CAPTURE_CTX_FREE] = "ctx_free",
+	[AMDGPU_CAPTURE_CS] = "cs",
+};
+
+static void replay_record(struct replay *r,
+			  const struct amdgpu_capture_record *rec, int list)
+{
+	const void *payload = rec + 1;
+
+	if (list) {
+		printf("%" PRIu64 " %s %u\n", rec->time_ns,
+		       rec->type <= AMDGPU_CAPTURE_CS && type_names[rec->type] ?
+		       type_names[rec->type] : "unknown", rec->size);
+		return;
+	}
+
+	switch (rec->type) {
+	case AMDGPU_CAPTURE_BO_ALLOC:
+		replay_bo_alloc(r, payload);
+		break;
+	case AMDGPU_CAPTURE_BO_FREE:
+		replay_bo_free(r, ((const struct amdgpu_capture_bo_free *)
+				   payload)->handle);
+		break;
+	case AMDGPU_CAPTURE_VA_OP:
+		replay_va_op(r, payload);
+		break;
+	case AMDGPU_CAPTURE_BO_LIST:
+		replay_bo_list(r, payload);
+		break;
+	case AMDGPU_CAPTURE_CTX_CREATE:
+	case AMDGPU_CAPTURE_CTX_FREE:
+		replay_ctx(r, rec->type, payload);
+		break;
+	case AMDGPU_CAPTURE_CS:
+		replay_cs(r, payload);
+		break;
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-f] [-l] [-d device] capture\n"
+		"  -f  replay against a fake kernel driver\n"
+		"  -l  list the records instead of replaying them\n",
+		name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *device = "/dev/dri/renderD128";
+	const struct amdgpu_capture_header *header;
+	const struct amdgpu_capture_trailer *trailer;
+	struct replay r = {};
+	uint64_t offset, end, start;
+	uint32_t major, minor;
+	int fake = 0, list = 0, fd, c;
+	unsigned records = 0;
+	struct stat st;
+	char *map;
+
+	while ((c = getopt(argc, argv, "fld:")) != -1) {
+		switch (c) {
+		case 'f':
+			fake = 1;
+			break;
+		case 'l':
+			list = 1;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	header = (const void *)map;
+	if (map == MAP_FAILED || (size_t)st.st_size < sizeof(*header) ||
+	    header->magic != AMDGPU_CAPTURE_MAGIC ||
+	    header->version != AMDGPU_CAPTURE_VERSION) {
+		fprintf(stderr, "%s: not an amdgpu capture\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	/* without the index, e.g. if the capture wasn't stopped, the records
+	 * run to the end of the file */
+	end = st.st_size;
+	trailer = (const void *)(map + st.st_size - sizeof(*trailer));
+	if ((size_t)st.st_size >= header->header_size + sizeof(*trailer) &&
+	    trailer->magic == AMDGPU_CAPTURE_INDEX_MAGIC &&
+	    trailer->index_offset <= end)
+		end = trailer->index_offset;
+	else
+		fprintf(stderr, "%s: no index, capture is incomplete\n",
+			argv[optind]);
+
+	if (!list) {
+		fd = fake ? amdgpu_fake_open() : open(device, O_RDWR | O_CLOEXEC);
+		if (fd < 0) {
+			perror(device);
+			return EXIT_FAILURE;
+		}
+		if (amdgpu_device_initialize(fd, &major, &minor, &r.dev)) {
+			fprintf(stderr, "%s: failed to initialize\n", device);
+			return EXIT_FAILURE;
+		}
+		close(fd);
+	}
+
+	start = get_time_ns();
+	for (offset = header->header_size; offset + sizeof(struct amdgpu_capture_record) <= end;) {
+		const struct amdgpu_capture_record *rec = (const void *)(map + offset);
+
+		if (rec->size < sizeof(*rec) || offset + rec->size > end)
+			break;
+		replay_record(&r, rec, list);
+		offset += rec->size;
+		records++;
+	}
+
+	if (!list) {
+		printf("%u records, %u submissions in %.3f ms, %.1f us per "
+		       "submission\n", records, r.submits,
+		       (get_time_ns() - start) / 1e6,
+		       r.submits ? r.submit_ns / 1e3 / r.submits : 0.0);
+		if (r.skipped || r.dropped_chunks)
+			printf("%u submissions skipped, %u chunks dropped\n",
+			       r.skipped, r.dropped_chunks);
+		replay_fini(&r);
+	}
+	munmap(map, st.st_size);
+
+	return 0;
+}
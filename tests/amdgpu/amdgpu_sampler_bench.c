@@ -0,0 +1,244 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Telemetry sampler benchmark.
+ *
+ * A monitoring agent's set of clocks, temperature, power, load and heap
+ * usages is polled with the synchronous queries, and with a sampler.  The
+ * ioctls per round of samples and the cost of reading a value are
+ * reported; the fake kernel driver answers ioctls without kernel costs, so
+ * what a query costs on a real device comes on top of the reported one.
+ * The fake only has a single device, so a single one is sampled.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+#define NUM_SENSORS	5
+#define NUM_SOURCES	(NUM_SENSORS + 2)
+
+static const uint32_t sources[NUM_SOURCES] = {
+	AMDGPU_INFO_SENSOR_GFX_SCLK,
+	AMDGPU_INFO_SENSOR_GFX_MCLK,
+	AMDGPU_INFO_SENSOR_GPU_TEMP,
+	AMDGPU_INFO_SENSOR_GPU_LOAD,
+	AMDGPU_INFO_SENSOR_GPU_AVG_POWER,
+	AMDGPU_SAMPLER_VRAM_USAGE,
+	AMDGPU_SAMPLER_GTT_USAGE,
+};
+
+static volatile int budget_calls, budget_over;
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void budget(amdgpu_device_handle dev, uint32_t source, uint64_t value,
+		   bool over, void *data)
+{
+	assert(source == AMDGPU_SAMPLER_VRAM_USAGE);
+	assert(over == (value > *(uint64_t *)data));
+	budget_over = over;
+	budget_calls++;
+}
+
+/* Waits for a number of budget callbacks, for up to a second */
+static void wait_budget(int calls)
+{
+	unsigned i;
+
+	for (i = 0; i < 1000 && budget_calls < calls; i++)
+		usleep(1000);
+	assert(budget_calls == calls);
+}
+
+static void check_sampler(amdgpu_device_handle dev)
+{
+	struct amdgpu_sampler_stats stats;
+	amdgpu_sampler_handle sampler;
+	uint64_t limit = 1ull << 30;
+	uint32_t bad = 0x200;
+	unsigned i;
+
+	/* the first round is long over when the device comes */
+	assert(amdgpu_sampler_create(1000, &sampler) == 0);
+	usleep(1000);
+	assert(amdgpu_sampler_add_device(sampler, dev, sources,
+					 NUM_SOURCES) == 0);
+	assert(amdgpu_sampler_add_device(sampler, dev, sources,
+					 NUM_SOURCES) == -EEXIST);
+	assert(amdgpu_sampler_read(sampler, dev, sources[0],
+				   &stats) == -EAGAIN);
+	assert(amdgpu_sampler_read(sampler, dev, AMDGPU_SAMPLER_VIS_VRAM_USAGE,
+				   &stats) == -EINVAL);
+	assert(amdgpu_sampler_destroy(sampler) == 0);
+
+	assert(amdgpu_sampler_create(1, &sampler) == 0);
+	assert(amdgpu_sampler_add_device(sampler, dev, &bad, 1) == -EINVAL);
+	assert(amdgpu_sampler_add_device(sampler, dev, sources,
+					 NUM_SOURCES) == 0);
+
+	amdgpu_fake_vram_usage = limit / 2;
+	assert(amdgpu_sampler_set_budget(sampler, dev,
+					 AMDGPU_SAMPLER_VRAM_USAGE, limit,
+					 budget, &limit) == 0);
+	amdgpu_fake_vram_usage = limit * 2;
+	wait_budget(1);
+	assert(budget_over);
+	assert(amdgpu_sampler_read(sampler, dev, AMDGPU_SAMPLER_VRAM_USAGE,
+				   &stats) == 0);
+	assert(stats.max == limit * 2 && stats.min <= limit * 2);
+	amdgpu_fake_vram_usage = limit;
+	wait_budget(2);
+	assert(!budget_over);
+
+	for (i = 0; i < NUM_SENSORS; i++) {
+		assert(amdgpu_sampler_read(sampler, dev, sources[i],
+					   &stats) == 0);
+		assert(stats.count > 0);
+		assert(stats.min <= stats.avg && stats.avg <= stats.max);
+		assert(stats.min >= sources[i] * 100);
+		assert(stats.max < sources[i] * 100 + 50);
+	}
+
+	assert(amdgpu_sampler_remove_device(sampler, dev) == 0);
+	assert(amdgpu_sampler_remove_device(sampler, dev) == -EINVAL);
+	assert(amdgpu_sampler_destroy(sampler) == 0);
+	amdgpu_fake_vram_usage = 0;
+}
+
+static void bench_direct(amdgpu_device_handle dev, unsigned rounds)
+{
+	unsigned ioctls = amdgpu_fake_stats.ioctls, r, i;
+	struct amdgpu_heap_info heap;
+	uint64_t begin, elapsed;
+	uint32_t value;
+
+	begin = gettime_ns();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < NUM_SENSORS; i++)
+			assert(amdgpu_query_sensor_info(dev, sources[i],
+							sizeof(value),
+							&value) == 0);
+		assert(amdgpu_query_heap_info(dev, AMDGPU_GEM_DOMAIN_VRAM, 0,
+					      &heap) == 0);
+		assert(amdgpu_query_heap_info(dev, AMDGPU_GEM_DOMAIN_GTT, 0,
+					      &heap) == 0);
+	}
+	elapsed = gettime_ns() - begin;
+
+	printf("queries: %5.2f ioctls per round, %6.0f ns per value read\n",
+	       (double)(amdgpu_fake_stats.ioctls - ioctls) / rounds,
+	       (double)elapsed / rounds / NUM_SOURCES);
+}
+
+static void bench_sampler(amdgpu_device_handle dev, unsigned duration_ms,
+			  unsigned reads)
+{
+	struct amdgpu_sampler_stats stats;
+	amdgpu_sampler_handle sampler;
+	uint64_t begin, elapsed;
+	unsigned ioctls, i, j;
+
+	assert(amdgpu_sampler_create(1, &sampler) == 0);
+	ioctls = amdgpu_fake_stats.ioctls;
+	assert(amdgpu_sampler_add_device(sampler, dev, sources,
+					 NUM_SOURCES) == 0);
+	usleep(duration_ms * 1000);
+
+	/* while the thread keeps sampling */
+	begin = gettime_ns();
+	for (i = 0; i < reads; i++) {
+		for (j = 0; j < NUM_SOURCES; j++)
+			assert(amdgpu_sampler_read(sampler, dev, sources[j],
+						   &stats) == 0);
+	}
+	elapsed = gettime_ns() - begin;
+
+	assert(amdgpu_sampler_read(sampler, dev, sources[0], &stats) == 0);
+	assert(amdgpu_sampler_remove_device(sampler, dev) == 0);
+	ioctls = amdgpu_fake_stats.ioctls - ioctls;
+	assert(amdgpu_sampler_destroy(sampler) == 0);
+
+	/* a round may have been in progress */
+	printf("sampler: %5.2f ioctls per round, %6.0f ns per value read, "
+	       "%llu rounds\n", (double)ioctls / stats.count,
+	       (double)elapsed / reads / NUM_SOURCES,
+	       (unsigned long long)stats.count);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d duration ms] [-r reads]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned duration_ms = 200, reads = 100000;
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "d:r:")) != -1) {
+		switch (c) {
+		case 'd':
+			duration_ms = atoi(optarg);
+			break;
+		case 'r':
+			reads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !duration_ms || !reads)
+		usage(argv[0]);
+
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+
+	check_sampler(dev);
+	bench_direct(dev, reads);
+	bench_sampler(dev, duration_ms, reads);
+
+	assert(amdgpu_device_deinitialize(dev) == 0);
+	return 0;
+}
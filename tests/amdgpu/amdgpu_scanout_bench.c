@@ -0,0 +1,260 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Scanout capture benchmark, comparing amdgpu_get_fb_id() plus
+ * amdgpu_get_bo_from_fb_id() per frame with a capture session.
+ *
+ * A compositor, which is a second client of the fake kernel driver, flips
+ * between a few frame buffers of its own buffers, and every frame the
+ * buffer it scans out is looked up.  The ioctls per frame are reported
+ * next to the frame rate, as the fake answers them without kernel costs.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+#define MAX_FBS		8
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char *name, unsigned frames, uint64_t begin,
+		   unsigned ioctls)
+{
+	uint64_t elapsed = gettime_ns() - begin;
+
+	printf("%-19s %9.0f frames/s, %.2f ioctls per frame\n", name,
+	       frames / (elapsed / 1e9),
+	       (double)(amdgpu_fake_stats.ioctls - ioctls) / frames);
+}
+
+static void bench_fb_id(amdgpu_device_handle dev, const uint32_t *fbs,
+			unsigned num_fbs, unsigned frames)
+{
+	unsigned ioctls = amdgpu_fake_stats.ioctls, f, fb_id;
+	struct amdgpu_bo_import_result result;
+	uint64_t begin = gettime_ns();
+
+	for (f = 0; f < frames; f++) {
+		amdgpu_fake_crtc_fb = fbs[f % num_fbs];
+		assert(amdgpu_get_fb_id(dev, &fb_id) == 0);
+		assert(fb_id == amdgpu_fake_crtc_fb);
+		assert(amdgpu_get_bo_from_fb_id(dev, fb_id, &result) == 0);
+		assert(amdgpu_bo_free(result.buf_handle) == 0);
+	}
+	report("fb id per frame:", frames, begin, ioctls);
+}
+
+static void bench_session(amdgpu_device_handle dev, const uint32_t *fbs,
+			  unsigned num_fbs, unsigned frames, int flips)
+{
+	unsigned ioctls = amdgpu_fake_stats.ioctls, f;
+	struct amdgpu_scanout_frame frame;
+	amdgpu_scanout_handle scanout;
+	uint32_t sequence, handle;
+	uint64_t begin;
+
+	amdgpu_fake_crtc_fb = fbs[0];
+	begin = gettime_ns();
+	assert(amdgpu_scanout_create(dev, 0, &scanout) == 0);
+	for (f = 0; f < frames; f++) {
+		amdgpu_fake_crtc_fb = fbs[f % num_fbs];
+		if (flips) {
+			assert(amdgpu_scanout_flipped(scanout,
+						      amdgpu_fake_crtc_fb) == 0);
+		} else {
+			assert(amdgpu_scanout_wait_vblank(scanout,
+							  &sequence) == 0);
+		}
+		assert(amdgpu_scanout_get_frame(scanout, &frame) == 0);
+		assert(frame.fb_id == amdgpu_fake_crtc_fb);
+		assert(frame.new_fb == (num_fbs > 1 || !f));
+		assert(amdgpu_bo_export(frame.bo, amdgpu_bo_handle_type_kms,
+					&handle) == 0);
+		assert(handle == frame.fb_id);
+	}
+	report(flips ? "session, flips:" : "session, vblanks:", frames, begin,
+	       ioctls);
+	assert(amdgpu_scanout_destroy(scanout) == 0);
+}
+
+static void show_fb(amdgpu_scanout_handle scanout, uint32_t fb_id, int flips)
+{
+	amdgpu_fake_crtc_fb = fb_id;
+	if (flips)
+		assert(amdgpu_scanout_flipped(scanout, fb_id) == 0);
+}
+
+/* A kept buffer is only used while its frame buffer shows it. */
+static void check_fb_reused(amdgpu_scanout_handle scanout, const uint32_t *fbs,
+			    int flips)
+{
+	struct amdgpu_scanout_frame frame;
+	uint32_t handle;
+
+	show_fb(scanout, fbs[0], flips);
+	assert(amdgpu_scanout_get_frame(scanout, &frame) == 0);
+
+	/* the frame buffer was removed and its id given to another one */
+	show_fb(scanout, fbs[1], flips);
+	assert(amdgpu_scanout_get_frame(scanout, &frame) == 0);
+	amdgpu_fake_fb_handle = fbs[1];
+	show_fb(scanout, fbs[0], flips);
+	assert(amdgpu_scanout_get_frame(scanout, &frame) == 0);
+	assert(frame.fb_id == fbs[0] && frame.new_fb);
+	assert(amdgpu_bo_export(frame.bo, amdgpu_bo_handle_type_kms,
+				&handle) == 0);
+	assert(handle == fbs[1]);
+	assert(amdgpu_scanout_get_frame(scanout, &frame) == 0);
+	assert(!frame.new_fb);
+
+	/* and once more, on a flip or a switch back to the id */
+	amdgpu_fake_fb_handle = 0;
+	if (!flips) {
+		show_fb(scanout, fbs[1], flips);
+		assert(amdgpu_scanout_get_frame(scanout, &frame) == 0);
+	}
+	show_fb(scanout, fbs[0], flips);
+	assert(amdgpu_scanout_get_frame(scanout, &frame) == 0);
+	assert(frame.new_fb);
+	assert(amdgpu_bo_export(frame.bo, amdgpu_bo_handle_type_kms,
+				&handle) == 0);
+	assert(handle == fbs[0]);
+}
+
+/* Kept buffers are checked without importing them again, even across mode
+ * sets, reused frame buffer ids are noticed and an off CRTC is reported.
+ */
+static void check_session(amdgpu_device_handle dev, const uint32_t *fbs)
+{
+	struct amdgpu_scanout_frame frame, frame2;
+	amdgpu_scanout_handle scanout;
+	unsigned ioctls, imports;
+
+	amdgpu_fake_crtc_fb = 0;
+	assert(amdgpu_scanout_create(dev, 0, &scanout) == -ENOENT);
+	amdgpu_fake_crtc_fb = fbs[0];
+	assert(amdgpu_scanout_create(dev, 12345, &scanout) == -EINVAL);
+	assert(amdgpu_scanout_create(dev, 0, &scanout) == 0);
+
+	assert(amdgpu_scanout_get_frame(scanout, &frame) == 0);
+	ioctls = amdgpu_fake_stats.ioctls;
+	assert(amdgpu_scanout_get_frame(scanout, &frame2) == 0);
+	assert(frame2.bo == frame.bo && !frame2.new_fb);
+	/* only GETCRTC, the frame buffer didn't change */
+	assert(amdgpu_fake_stats.ioctls == ioctls + 1);
+
+	imports = amdgpu_fake_stats.prime_imports;
+	amdgpu_fake_mode_width = 1280;
+	assert(amdgpu_scanout_get_frame(scanout, &frame2) == 0);
+	assert(frame2.bo == frame.bo && !frame2.new_fb);
+	assert(amdgpu_fake_stats.prime_imports == imports);
+	amdgpu_fake_mode_width = 1920;
+
+	check_fb_reused(scanout, fbs, 0);
+	amdgpu_fake_crtc_fb = 0;
+	assert(amdgpu_scanout_get_frame(scanout, &frame) == -ENOENT);
+	assert(amdgpu_scanout_destroy(scanout) == 0);
+
+	assert(amdgpu_scanout_create(dev, 0, &scanout) == -ENOENT);
+	amdgpu_fake_crtc_fb = fbs[0];
+	assert(amdgpu_scanout_create(dev, 0, &scanout) == 0);
+	check_fb_reused(scanout, fbs, 1);
+	assert(amdgpu_scanout_destroy(scanout) == 0);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-f frames] [-b frame buffers]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned frames = 100000, num_fbs = 3, i;
+	union drm_amdgpu_gem_create create;
+	uint32_t fbs[MAX_FBS], major, minor;
+	amdgpu_device_handle dev;
+	int c, fd, compositor;
+
+	while ((c = getopt(argc, argv, "f:b:")) != -1) {
+		switch (c) {
+		case 'f':
+			frames = atoi(optarg);
+			break;
+		case 'b':
+			num_fbs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !frames || !num_fbs || num_fbs > MAX_FBS)
+		usage(argv[0]);
+
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+
+	/* the compositor's buffers, unknown to the device handle, at least two
+	 * for check_fb_reused()
+	 */
+	compositor = amdgpu_fake_open();
+	assert(compositor >= 0);
+	for (i = 0; i < num_fbs || i < 2; i++) {
+		memset(&create, 0, sizeof(create));
+		create.in.bo_size = 8 << 20;
+		create.in.domains = AMDGPU_GEM_DOMAIN_VRAM;
+		assert(drmCommandWriteRead(compositor, DRM_AMDGPU_GEM_CREATE,
+					   &create, sizeof(create)) == 0);
+		fbs[i] = create.out.handle;
+	}
+
+	check_session(dev, fbs);
+	bench_fb_id(dev, fbs, num_fbs, frames);
+	bench_session(dev, fbs, num_fbs, frames, 0);
+	bench_session(dev, fbs, num_fbs, frames, 1);
+
+	close(compositor);
+	assert(amdgpu_device_deinitialize(dev) == 0);
+	return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Small buffer allocation benchmark, comparing a buffer per allocation
+ * with the slab allocator.
+ *
+ * Reports allocations per second and how many buffers a BO list needs to
+ * reference, then runs frames which allocate buffers and free them with
+ * the fence of the frame, while the GPU lags a few frames behind.  Also
+ * checks that entries freed on a stalled ring don't hold up the others.
+ *
+ * Runs against the fake kernel driver, so kernel costs are left out and
+ * the numbers are the library's side only.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+struct single_bo {
+	amdgpu_bo_handle bo;
+	amdgpu_va_handle va_handle;
+	uint64_t va;
+	uint64_t size;
+};
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* mostly constant and descriptor sized, some up to 4 KiB */
+static uint64_t random_size(void)
+{
+	if (rand() % 4)
+		return 16 + rand() % 496;
+	return 512 + rand() % 3584;
+}
+
+static int compare_ptr(const void *a, const void *b)
+{
+	uintptr_t pa = (uintptr_t)*(void * const *)a;
+	uintptr_t pb = (uintptr_t)*(void * const *)b;
+
+	return pa < pb ? -1 : pa > pb;
+}
+
+/* number of distinct buffers, i.e. the length of a BO list for all of them */
+static unsigned count_buffers(amdgpu_bo_handle *bos, unsigned n)
+{
+	unsigned i, count = 0;
+
+	qsort(bos, n, sizeof(*bos), compare_ptr);
+	for (i = 0; i < n; i++)
+		count += !i || bos[i] != bos[i - 1];
+	return count;
+}
+
+static void bench_single(amdgpu_device_handle dev, unsigned n)
+{
+	struct single_bo *bos = calloc(n, sizeof(*bos));
+	struct amdgpu_bo_alloc_request req = {};
+	uint64_t start, elapsed;
+	void *cpu;
+	unsigned i;
+
+	assert(bos);
+	req.phys_alignment = 256;
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+
+	start = gettime_ns();
+	for (i = 0; i < n; i++) {
+		req.alloc_size = bos[i].size = random_size();
+		assert(amdgpu_bo_alloc(dev, &req, &bos[i].bo) == 0);
+		assert(amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general,
+					     req.alloc_size, 0, 0, &bos[i].va,
+					     &bos[i].va_handle, 0) == 0);
+		assert(amdgpu_bo_va_op(bos[i].bo, 0, req.alloc_size, bos[i].va,
+				       0, AMDGPU_VA_OP_MAP) == 0);
+		assert(amdgpu_bo_cpu_map(bos[i].bo, &cpu) == 0);
+	}
+	elapsed = gettime_ns() - start;
+	printf("bo per allocation: %10.0f allocations/s, %u buffers in the BO list\n",
+	       n / (elapsed / 1e9), n);
+
+	for (i = 0; i < n; i++) {
+		assert(amdgpu_bo_cpu_unmap(bos[i].bo) == 0);
+		assert(amdgpu_bo_va_op(bos[i].bo, 0, bos[i].size, bos[i].va, 0,
+				       AMDGPU_VA_OP_UNMAP) == 0);
+		assert(amdgpu_va_range_free(bos[i].va_handle) == 0);
+		assert(amdgpu_bo_free(bos[i].bo) == 0);
+	}
+	free(bos);
+}
+
+static void bench_slab(amdgpu_device_handle dev, unsigned n)
+{
+	amdgpu_bo_slab_entry_handle *entries = calloc(n, sizeof(*entries));
+	amdgpu_bo_handle *bos = calloc(n, sizeof(*bos));
+	struct amdgpu_bo_alloc_request req = {};
+	struct amdgpu_bo_slab_entry_info info;
+	amdgpu_bo_slab_handle slab;
+	uint64_t start, elapsed;
+	unsigned i;
+
+	assert(entries && bos);
+	assert(amdgpu_bo_slab_create(dev, 0, &slab) == 0);
+	req.phys_alignment = 256;
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+
+	start = gettime_ns();
+	for (i = 0; i < n; i++) {
+		req.alloc_size = random_size();
+		assert(amdgpu_bo_slab_alloc(slab, &req, &entries[i], &info) == 0);
+		assert(info.size >= req.alloc_size && info.cpu);
+		assert(info.va % 256 == 0 && info.offset % 256 == 0);
+		bos[i] = info.bo;
+	}
+	elapsed = gettime_ns() - start;
+	printf("slab:              %10.0f allocations/s, %u buffers in the BO list\n",
+	       n / (elapsed / 1e9), count_buffers(bos, n));
+
+	for (i = 0; i < n; i++)
+		assert(amdgpu_bo_slab_free(entries[i], NULL) == 0);
+
+	/* too large or cleared, these get buffers of their own */
+	req.alloc_size = 64 * 1024;
+	assert(amdgpu_bo_slab_alloc(slab, &req, &entries[0], &info) == 0);
+	assert(info.offset == 0 && info.size == req.alloc_size && info.cpu);
+	assert(amdgpu_bo_slab_free(entries[0], NULL) == 0);
+	req.alloc_size = 256;
+	req.flags = AMDGPU_GEM_CREATE_VRAM_CLEARED;
+	assert(amdgpu_bo_slab_alloc(slab, &req, &entries[0], &info) == 0);
+	assert(info.offset == 0 && info.size == req.alloc_size);
+	/* released with the allocator */
+	assert(amdgpu_bo_slab_destroy(slab) == 0);
+	free(entries);
+	free(bos);
+}
+
+static void bench_frames(amdgpu_device_handle dev, unsigned frames,
+			 unsigned per_frame, unsigned lag)
+{
+	amdgpu_bo_slab_entry_handle *entries = calloc(per_frame, sizeof(*entries));
+	struct amdgpu_bo_alloc_request req = {};
+	struct amdgpu_bo_slab_entry_info info;
+	struct amdgpu_cs_fence fence = {};
+	amdgpu_context_handle ctx;
+	amdgpu_bo_slab_handle slab;
+	unsigned i, f, bo_creates, fence_waits;
+	uint64_t start, elapsed;
+
+	assert(entries);
+	assert(amdgpu_cs_ctx_create(dev, &ctx) == 0);
+	assert(amdgpu_bo_slab_create(dev, 0, &slab) == 0);
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	fence.context = ctx;
+	fence.ip_type = AMDGPU_HW_IP_GFX;
+
+	bo_creates = amdgpu_fake_stats.bo_creates;
+	fence_waits = amdgpu_fake_stats.fence_waits;
+	start = gettime_ns();
+	for (f = 1; f <= frames; f++) {
+		for (i = 0; i < per_frame; i++) {
+			req.alloc_size = random_size();
+			assert(amdgpu_bo_slab_alloc(slab, &req, &entries[i],
+						    &info) == 0);
+		}
+		fence.fence = f;
+		for (i = 0; i < per_frame; i++)
+			assert(amdgpu_bo_slab_free(entries[i], &fence) == 0);
+		amdgpu_fake_signaled = f > lag ? f - lag : 0;
+	}
+	elapsed = gettime_ns() - start;
+	printf("frames:            %10.0f allocations/s, %u slabs, "
+	       "%.2f fence queries per frame\n",
+	       (double)frames * per_frame / (elapsed / 1e9),
+	       amdgpu_fake_stats.bo_creates - bo_creates,
+	       (double)(amdgpu_fake_stats.fence_waits - fence_waits) / frames);
+
+	assert(amdgpu_bo_slab_destroy(slab) == 0);
+	assert(amdgpu_cs_ctx_free(ctx) == 0);
+	free(entries);
+}
+
+static void check_stalled_ring(amdgpu_device_handle dev)
+{
+	amdgpu_bo_slab_entry_handle entries[256];
+	struct amdgpu_bo_alloc_request req = {};
+	struct amdgpu_bo_slab_entry_info info;
+	struct amdgpu_cs_fence fence = {};
+	amdgpu_context_handle ctx;
+	amdgpu_bo_slab_handle slab;
+	unsigned i, bo_creates, fence_waits;
+
+	assert(amdgpu_cs_ctx_create(dev, &ctx) == 0);
+	assert(amdgpu_bo_slab_create(dev, 0, &slab) == 0);
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	req.alloc_size = 256;
+
+	/* one slab, the first half freed on a stalled ring */
+	bo_creates = amdgpu_fake_stats.bo_creates;
+	for (i = 0; i < 256; i++)
+		assert(amdgpu_bo_slab_alloc(slab, &req, &entries[i], &info) == 0);
+	assert(amdgpu_fake_stats.bo_creates == bo_creates + 1);
+
+	amdgpu_fake_stalled_rings = 1 << 1;
+	amdgpu_fake_signaled = 1;
+	fence.context = ctx;
+	fence.ip_type = AMDGPU_HW_IP_GFX;
+	fence.fence = 1;
+	for (i = 0; i < 256; i++) {
+		fence.ring = i < 128 ? 1 : 0;
+		assert(amdgpu_bo_slab_free(entries[i], &fence) == 0);
+	}
+
+	/* a query per ring */
+	fence_waits = amdgpu_fake_stats.fence_waits;
+	for (i = 0; i < 128; i++)
+		assert(amdgpu_bo_slab_alloc(slab, &req, &entries[i], &info) == 0);
+	assert(amdgpu_fake_stats.bo_creates == bo_creates + 1);
+	assert(amdgpu_fake_stats.fence_waits == fence_waits + 2);
+	amdgpu_fake_stalled_rings = 0;
+
+	assert(amdgpu_bo_slab_destroy(slab) == 0);
+	assert(amdgpu_cs_ctx_free(ctx) == 0);
+	printf("stalled ring:      ok\n");
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n allocations] [-f frames] "
+		"[-k allocations per frame]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned n = 50000, frames = 1000, per_frame = 512;
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "n:f:k:")) != -1) {
+		switch (c) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'f':
+			frames = atoi(optarg);
+			break;
+		case 'k':
+			per_frame = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !n)
+		usage(argv[0]);
+
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+
+	srand(1);
+	bench_single(dev, n);
+	srand(1);
+	bench_slab(dev, n);
+	bench_frames(dev, frames, per_frame, 2);
+	check_stalled_ring(dev);
+	assert(amdgpu_fake_stats.bo_creates == amdgpu_fake_stats.bo_closes);
+
+	assert(amdgpu_device_deinitialize(dev) == 0);
+	return 0;
+}
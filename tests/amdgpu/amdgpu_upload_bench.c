@@ -0,0 +1,297 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Streaming upload benchmark, comparing a buffer per upload with the
+ * upload ring.
+ *
+ * Frames fill allocations with a pattern and attach the frame's fence,
+ * while the GPU lags a few frames behind.  The patterns of the frames the
+ * GPU didn't finish yet are checked when their fence signals, so space
+ * which is reused too early is caught.  The frames are run from one and
+ * from several threads, and once more with a GPU which falls far behind,
+ * so that the ring has to grow.  Fences of a second producer are checked
+ * to be rejected.
+ *
+ * Runs against the fake kernel driver, so kernel costs are left out and
+ * the numbers are the library's side only.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+#define MAX_THREADS	16
+
+struct upload {
+	uint8_t *cpu;
+	uint32_t size;
+	uint8_t pattern;
+};
+
+struct frames {
+	amdgpu_upload_ring_handle ring;
+	unsigned frames;
+	unsigned per_thread;
+	unsigned num_threads;
+	unsigned lag;
+	pthread_barrier_t start;
+	pthread_barrier_t done;
+	/* uploads of the last lag + 1 frames, by frame and thread */
+	struct upload *uploads;
+};
+
+struct thread {
+	struct frames *frames;
+	unsigned index;
+};
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* mostly constants and small vertex streams */
+static uint32_t random_size(unsigned *seed)
+{
+	if (rand_r(seed) % 8)
+		return 16 + rand_r(seed) % 1008;
+	return 1024 + rand_r(seed) % 15360;
+}
+
+static struct upload *get_uploads(struct frames *f, unsigned frame,
+				  unsigned thread)
+{
+	unsigned slot = frame % (f->lag + 1);
+
+	return &f->uploads[(slot * f->num_threads + thread) * f->per_thread];
+}
+
+static void check_uploads(struct frames *f, unsigned frame)
+{
+	struct upload *u = get_uploads(f, frame, 0);
+	unsigned i, j;
+
+	for (i = 0; i < f->per_thread * f->num_threads; i++)
+		for (j = 0; j < u[i].size; j++)
+			assert(u[i].cpu[j] == u[i].pattern);
+}
+
+static void *thread_func(void *data)
+{
+	struct thread *t = data;
+	struct frames *f = t->frames;
+	struct amdgpu_upload_info info;
+	unsigned seed = t->index + 1, frame, i;
+	struct upload *u;
+
+	for (frame = 1; frame <= f->frames; frame++) {
+		pthread_barrier_wait(&f->start);
+		u = get_uploads(f, frame, t->index);
+		for (i = 0; i < f->per_thread; i++) {
+			u[i].size = random_size(&seed);
+			u[i].pattern = frame * 31 + t->index * 7 + i;
+			assert(amdgpu_upload_ring_alloc(f->ring, u[i].size, 256,
+							&info) == 0);
+			assert(info.va % 256 == 0 && info.bo && info.cpu);
+			u[i].cpu = info.cpu;
+			memset(u[i].cpu, u[i].pattern, u[i].size);
+		}
+		pthread_barrier_wait(&f->done);
+	}
+	return NULL;
+}
+
+static void bench_single(amdgpu_device_handle dev, unsigned n)
+{
+	struct amdgpu_bo_alloc_request req = {};
+	amdgpu_va_handle va_handle;
+	unsigned i, seed = 1;
+	uint64_t start, elapsed, va;
+	amdgpu_bo_handle bo;
+	void *cpu;
+
+	req.phys_alignment = 256;
+	req.preferred_heap = AMDGPU_GEM_DOMAIN_GTT;
+	req.flags = AMDGPU_GEM_CREATE_CPU_GTT_USWC;
+
+	start = gettime_ns();
+	for (i = 0; i < n; i++) {
+		req.alloc_size = random_size(&seed);
+		assert(amdgpu_bo_alloc(dev, &req, &bo) == 0);
+		assert(amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general,
+					     req.alloc_size, 0, 0, &va,
+					     &va_handle, 0) == 0);
+		assert(amdgpu_bo_va_op(bo, 0, req.alloc_size, va, 0,
+				       AMDGPU_VA_OP_MAP) == 0);
+		assert(amdgpu_bo_cpu_map(bo, &cpu) == 0);
+		memset(cpu, i, req.alloc_size);
+		assert(amdgpu_bo_cpu_unmap(bo) == 0);
+		assert(amdgpu_bo_va_op(bo, 0, req.alloc_size, va, 0,
+				       AMDGPU_VA_OP_UNMAP) == 0);
+		assert(amdgpu_va_range_free(va_handle) == 0);
+		assert(amdgpu_bo_free(bo) == 0);
+	}
+	elapsed = gettime_ns() - start;
+	printf("bo per upload:        %10.0f uploads/s\n", n / (elapsed / 1e9));
+}
+
+static void bench_frames(amdgpu_device_handle dev, const char *name,
+			 unsigned frames, unsigned per_frame,
+			 unsigned num_threads, unsigned lag)
+{
+	struct thread threads[MAX_THREADS];
+	pthread_t tids[MAX_THREADS];
+	struct amdgpu_cs_fence fence = {};
+	amdgpu_context_handle ctx;
+	unsigned i, frame, bo_creates, fence_waits;
+	uint64_t start, elapsed;
+	struct frames f;
+
+	f.frames = frames;
+	f.per_thread = per_frame / num_threads;
+	f.num_threads = num_threads;
+	f.lag = lag;
+	f.uploads = calloc((lag + 1) * num_threads * f.per_thread,
+			   sizeof(*f.uploads));
+	assert(f.uploads);
+	pthread_barrier_init(&f.start, NULL, num_threads + 1);
+	pthread_barrier_init(&f.done, NULL, num_threads + 1);
+
+	assert(amdgpu_cs_ctx_create(dev, &ctx) == 0);
+	assert(amdgpu_upload_ring_create(dev, 256 * 1024, AMDGPU_GEM_DOMAIN_GTT,
+					 AMDGPU_GEM_CREATE_CPU_GTT_USWC,
+					 &f.ring) == 0);
+	fence.context = ctx;
+	fence.ip_type = AMDGPU_HW_IP_GFX;
+	amdgpu_fake_signaled = 0;
+
+	for (i = 0; i < num_threads; i++) {
+		threads[i].frames = &f;
+		threads[i].index = i;
+		assert(pthread_create(&tids[i], NULL, thread_func,
+				      &threads[i]) == 0);
+	}
+
+	bo_creates = amdgpu_fake_stats.bo_creates;
+	fence_waits = amdgpu_fake_stats.fence_waits;
+	start = gettime_ns();
+	for (frame = 1; frame <= frames; frame++) {
+		pthread_barrier_wait(&f.start);
+		pthread_barrier_wait(&f.done);
+		fence.fence = frame;
+		assert(amdgpu_upload_ring_fence(f.ring, &fence) == 0);
+		if (frame == 1) {
+			/* another producer, on another ring or behind */
+			fence.ring = 1;
+			assert(amdgpu_upload_ring_fence(f.ring, &fence) == -EINVAL);
+			fence.ring = 0;
+			fence.fence = 0;
+			assert(amdgpu_upload_ring_fence(f.ring, &fence) == -EINVAL);
+		}
+		/* the GPU finishes the frame submitted lag frames ago */
+		if (frame > lag) {
+			check_uploads(&f, frame - lag);
+			amdgpu_fake_signaled = frame - lag;
+		}
+	}
+	elapsed = gettime_ns() - start;
+	printf("%-21s %10.0f uploads/s, %u buffers, "
+	       "%.2f fence queries per frame\n", name,
+	       (double)frames * f.per_thread * num_threads / (elapsed / 1e9),
+	       amdgpu_fake_stats.bo_creates - bo_creates,
+	       (double)(amdgpu_fake_stats.fence_waits - fence_waits) / frames);
+
+	for (i = 0; i < num_threads; i++)
+		pthread_join(tids[i], NULL);
+	assert(amdgpu_upload_ring_destroy(f.ring) == 0);
+	assert(amdgpu_cs_ctx_free(ctx) == 0);
+	pthread_barrier_destroy(&f.start);
+	pthread_barrier_destroy(&f.done);
+	free(f.uploads);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n uploads] [-f frames] "
+		"[-k uploads per frame] [-t threads]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned n = 20000, frames = 1000, per_frame = 256, num_threads = 4;
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "n:f:k:t:")) != -1) {
+		switch (c) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'f':
+			frames = atoi(optarg);
+			break;
+		case 'k':
+			per_frame = atoi(optarg);
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !n || !num_threads || num_threads > MAX_THREADS ||
+	    per_frame < num_threads)
+		usage(argv[0]);
+
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+
+	bench_single(dev, n);
+	bench_frames(dev, "ring:", frames, per_frame, 1, 2);
+	bench_frames(dev, "ring, threads:", frames, per_frame, num_threads, 2);
+	bench_frames(dev, "ring, GPU behind:", frames, per_frame, 1, 16);
+	assert(amdgpu_fake_stats.bo_creates == amdgpu_fake_stats.bo_closes);
+
+	assert(amdgpu_device_deinitialize(dev) == 0);
+	return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Ingest benchmark for the userptr cache.
+ *
+ * Every frame wraps part of one of a few host buffers for the GPU, either
+ * with a registration of its own or through the cache, and reports frames
+ * per second and how many registrations the kernel had to pin.  The fake
+ * kernel driver faults in the pages of a registration, the real one also
+ * pins and validates them, so the difference is larger on hardware.
+ *
+ * munmap() and mremap() are hooked to invalidate the cache, which is
+ * checked by unmapping and remapping buffers the cache holds.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+#define MAX_BUFFERS	64
+
+/* Programs are built with hidden visibility, export the hooks to libc's
+ * callers.
+ */
+__attribute__((visibility("default")))
+int munmap(void *addr, size_t length)
+{
+	amdgpu_userptr_cache_invalidate(addr, length);
+	return syscall(SYS_munmap, addr, length);
+}
+
+__attribute__((visibility("default")))
+void *mremap(void *old_address, size_t old_size, size_t new_size,
+	     int flags, ...)
+{
+	void *new_address = NULL;
+	va_list ap;
+
+	if (flags & MREMAP_FIXED) {
+		va_start(ap, flags);
+		new_address = va_arg(ap, void *);
+		va_end(ap);
+	}
+
+	amdgpu_userptr_cache_invalidate(old_address, old_size);
+	return (void *)syscall(SYS_mremap, old_address, old_size, new_size,
+			       flags, new_address);
+}
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void *map_buffer(uint64_t size)
+{
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	assert(ptr != MAP_FAILED);
+	memset(ptr, 1, size);
+	return ptr;
+}
+
+/* a quarter to all of some buffer at some offset */
+static char *random_range(char **buffers, unsigned num_buffers,
+			  uint64_t buffer_size, uint64_t *size)
+{
+	char *buffer = buffers[rand() % num_buffers];
+
+	*size = buffer_size / 4 + rand() % (buffer_size * 3 / 4);
+	return buffer + rand() % (buffer_size - *size + 1);
+}
+
+static void bench_direct(amdgpu_device_handle dev, char **buffers,
+			 unsigned num_buffers, uint64_t buffer_size,
+			 unsigned frames)
+{
+	uintptr_t page_mask = getpagesize() - 1, start, end;
+	unsigned f, userptrs = amdgpu_fake_stats.userptrs;
+	uint64_t size, begin, elapsed, va;
+	amdgpu_va_handle va_handle;
+	amdgpu_bo_handle bo;
+
+	begin = gettime_ns();
+	for (f = 0; f < frames; f++) {
+		start = (uintptr_t)random_range(buffers, num_buffers,
+						buffer_size, &size);
+		end = (start + size + page_mask) & ~page_mask;
+		start &= ~page_mask;
+
+		assert(amdgpu_create_bo_from_user_mem(dev, (void *)start,
+						      end - start, &bo) == 0);
+		assert(amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general,
+					     end - start, 0, 0, &va, &va_handle,
+					     0) == 0);
+		assert(amdgpu_bo_va_op(bo, 0, end - start, va, 0,
+				       AMDGPU_VA_OP_MAP) == 0);
+
+		assert(amdgpu_bo_va_op(bo, 0, end - start, va, 0,
+				       AMDGPU_VA_OP_UNMAP) == 0);
+		assert(amdgpu_va_range_free(va_handle) == 0);
+		assert(amdgpu_bo_free(bo) == 0);
+	}
+	elapsed = gettime_ns() - begin;
+	printf("registration per frame: %9.0f frames/s, %u registrations\n",
+	       frames / (elapsed / 1e9), amdgpu_fake_stats.userptrs - userptrs);
+}
+
+static void bench_cached(amdgpu_device_handle dev, const char *name,
+			 uint64_t max_pinned, char **buffers,
+			 unsigned num_buffers, uint64_t buffer_size,
+			 unsigned frames)
+{
+	unsigned f, userptrs = amdgpu_fake_stats.userptrs;
+	uint64_t size, begin, elapsed;
+	char *cpu;
+	amdgpu_userptr_cache_handle cache;
+	amdgpu_userptr_entry_handle entry;
+	struct amdgpu_userptr_info info;
+
+	assert(amdgpu_userptr_cache_create(dev, max_pinned, &cache) == 0);
+
+	begin = gettime_ns();
+	for (f = 0; f < frames; f++) {
+		cpu = random_range(buffers, num_buffers, buffer_size, &size);
+		assert(amdgpu_userptr_cache_get(cache, cpu, size, &entry,
+						&info) == 0);
+		assert(info.va % getpagesize() ==
+		       (uintptr_t)cpu % getpagesize());
+		assert(amdgpu_userptr_cache_put(entry) == 0);
+	}
+	elapsed = gettime_ns() - begin;
+	printf("%-22s  %9.0f frames/s, %u registrations\n", name,
+	       frames / (elapsed / 1e9), amdgpu_fake_stats.userptrs - userptrs);
+
+	assert(amdgpu_userptr_cache_destroy(cache) == 0);
+}
+
+/* Unmaps and remaps memory the cache holds, which must drop it. */
+static void check_invalidate(amdgpu_device_handle dev)
+{
+	uint64_t size = 1024 * 1024, page = getpagesize();
+	amdgpu_userptr_entry_handle entry, entry2;
+	struct amdgpu_userptr_info info, info2;
+	amdgpu_userptr_cache_handle cache;
+	unsigned userptrs, closes;
+	char *ptr;
+
+	assert(amdgpu_userptr_cache_create(dev, 0, &cache) == 0);
+	ptr = map_buffer(size);
+
+	/* contained ranges reuse the registration of a larger one */
+	userptrs = amdgpu_fake_stats.userptrs;
+	assert(amdgpu_userptr_cache_get(cache, ptr, size, &entry, &info) == 0);
+	assert(amdgpu_userptr_cache_get(cache, ptr + 100, 5000, &entry2,
+					&info2) == 0);
+	assert(info2.bo == info.bo && info2.offset == 100 &&
+	       info2.va == info.va + 100);
+	assert(amdgpu_userptr_cache_put(entry2) == 0);
+	assert(amdgpu_userptr_cache_put(entry) == 0);
+	assert(amdgpu_fake_stats.userptrs == userptrs + 1);
+
+	/* an unmapped range is dropped right away, or once it is unused */
+	closes = amdgpu_fake_stats.bo_closes;
+	assert(munmap(ptr, size) == 0);
+	assert(amdgpu_fake_stats.bo_closes == closes + 1);
+
+	ptr = map_buffer(size);
+	assert(amdgpu_userptr_cache_get(cache, ptr, size, &entry, &info) == 0);
+	assert(amdgpu_fake_stats.userptrs == userptrs + 2);
+	closes = amdgpu_fake_stats.bo_closes;
+	ptr = mremap(ptr, size, 2 * size, MREMAP_MAYMOVE);
+	assert(ptr != MAP_FAILED);
+	assert(amdgpu_fake_stats.bo_closes == closes);
+	assert(amdgpu_userptr_cache_put(entry) == 0);
+	assert(amdgpu_fake_stats.bo_closes == closes + 1);
+
+	/* overlapping ranges are merged into one registration */
+	assert(amdgpu_userptr_cache_get(cache, ptr, size, &entry, &info) == 0);
+	assert(amdgpu_userptr_cache_put(entry) == 0);
+	assert(amdgpu_userptr_cache_get(cache, ptr + size - page, size,
+					&entry, &info) == 0);
+	assert(amdgpu_userptr_cache_put(entry) == 0);
+	userptrs = amdgpu_fake_stats.userptrs;
+	assert(amdgpu_userptr_cache_get(cache, ptr, 2 * size - page, &entry,
+					&info) == 0);
+	assert(info.offset == 0);
+	assert(amdgpu_userptr_cache_put(entry) == 0);
+	assert(amdgpu_fake_stats.userptrs == userptrs);
+
+	assert(munmap(ptr, 2 * size) == 0);
+
+	/* an entry dropped while in use outlives the cache */
+	ptr = map_buffer(size);
+	assert(amdgpu_userptr_cache_get(cache, ptr, size, &entry, &info) == 0);
+	assert(munmap(ptr, size) == 0);
+	closes = amdgpu_fake_stats.bo_closes;
+	assert(amdgpu_userptr_cache_destroy(cache) == 0);
+	assert(amdgpu_fake_stats.bo_closes == closes);
+	assert(amdgpu_userptr_cache_put(entry) == 0);
+	assert(amdgpu_fake_stats.bo_closes == closes + 1);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-f frames] [-b buffers] "
+		"[-s buffer size in MiB]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned frames = 2000, num_buffers = 4, i;
+	uint64_t buffer_size = 8ull << 20;
+	char *buffers[MAX_BUFFERS];
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "f:b:s:")) != -1) {
+		switch (c) {
+		case 'f':
+			frames = atoi(optarg);
+			break;
+		case 'b':
+			num_buffers = atoi(optarg);
+			break;
+		case 's':
+			buffer_size = (uint64_t)atoi(optarg) << 20;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !frames || !num_buffers ||
+	    num_buffers > MAX_BUFFERS || !buffer_size)
+		usage(argv[0]);
+
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+
+	check_invalidate(dev);
+
+	for (i = 0; i < num_buffers; i++)
+		buffers[i] = map_buffer(buffer_size);
+	printf("%u buffers of %u MiB\n", num_buffers,
+	       (unsigned)(buffer_size >> 20));
+
+	srand(1);
+	bench_direct(dev, buffers, num_buffers, buffer_size, frames);
+	srand(1);
+	bench_cached(dev, "cache:", 0, buffers, num_buffers, buffer_size,
+		     frames);
+	srand(1);
+	bench_cached(dev, "cache, half the limit:",
+		     num_buffers * buffer_size / 2, buffers, num_buffers,
+		     buffer_size, frames);
+
+	for (i = 0; i < num_buffers; i++)
+		assert(munmap(buffers[i], buffer_size) == 0);
+	assert(amdgpu_fake_stats.bo_creates == amdgpu_fake_stats.bo_closes);
+	assert(amdgpu_device_deinitialize(dev) == 0);
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Virtual address placement benchmark.
+ *
+ * Replays a synthetic trace of mostly small and some large allocations,
+ * freed in random order, in the 32 bit range so that the address space
+ * actually fills up.  The same trace runs on a device reporting no PTE
+ * fragment size, which gives the placement without fragment alignment, and
+ * on one reporting 2 MiB.  For the large allocations, the share placed on
+ * a fragment boundary and the share of their whole fragments which can be
+ * mapped as such are reported, next to the state of the free space.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "amdgpu.h"
+#include "amdgpu_drm.h"
+#include "amdgpu_fake.h"
+
+#define FRAGMENT	(2ull << 20)
+#define MAX_LIVE	4096
+
+struct range {
+	amdgpu_va_handle handle;
+	uint64_t va;
+	uint64_t size;
+};
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static amdgpu_device_handle open_device(uint32_t fragment_size)
+{
+	amdgpu_device_handle dev;
+	uint32_t major, minor;
+	int fd;
+
+	amdgpu_fake_pte_fragment_size = fragment_size;
+	fd = amdgpu_fake_open();
+	assert(fd >= 0);
+	assert(amdgpu_device_initialize(fd, &major, &minor, &dev) == 0);
+	close(fd);
+	return dev;
+}
+
+static int alloc_range(amdgpu_device_handle dev, uint64_t size,
+		       struct range *r)
+{
+	r->size = size;
+	return amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general, size,
+				     0, 0, &r->va, &r->handle,
+				     AMDGPU_VA_RANGE_32_BIT);
+}
+
+static void get_stats(amdgpu_device_handle dev,
+		      struct amdgpu_va_range_stats *stats)
+{
+	assert(amdgpu_va_range_query_stats(dev, amdgpu_gpu_va_range_general,
+					   AMDGPU_VA_RANGE_32_BIT, stats) == 0);
+}
+
+/* 4 KiB to 256 KiB mostly, and 1 MiB to 32 MiB for every 8th */
+static uint64_t random_size(void)
+{
+	if (rand() % 8)
+		return (1 + rand() % 64) * 4096;
+	return (256 + rand() % 7937) * 4096;
+}
+
+static void check_placement(void)
+{
+	amdgpu_device_handle dev = open_device(FRAGMENT);
+	struct amdgpu_va_range_stats before, stats;
+	struct range small, large, fixed;
+
+	get_stats(dev, &before);
+	assert(before.fragment_size == FRAGMENT && before.free_blocks == 1);
+
+	assert(alloc_range(dev, 4096, &small) == 0);
+	assert(alloc_range(dev, 3 << 20, &large) == 0);
+	assert(large.va % FRAGMENT == 0);
+	/* the two arenas grow from opposite ends */
+	assert(small.va < large.va);
+
+	/* a required base is still honoured */
+	fixed.size = FRAGMENT;
+	assert(amdgpu_va_range_alloc(dev, amdgpu_gpu_va_range_general,
+				     fixed.size, 0, small.va + 4096 * 16,
+				     &fixed.va, &fixed.handle,
+				     AMDGPU_VA_RANGE_32_BIT) == 0);
+	assert(fixed.va == small.va + 4096 * 16);
+
+	get_stats(dev, &stats);
+	assert(stats.large_allocs == 2 && stats.large_aligned == 1);
+	assert(stats.free == before.free - small.size - large.size -
+	       fixed.size);
+
+	assert(amdgpu_va_range_free(fixed.handle) == 0);
+	assert(amdgpu_va_range_free(large.handle) == 0);
+	assert(amdgpu_va_range_free(small.handle) == 0);
+	get_stats(dev, &stats);
+	assert(stats.free == before.free && stats.free_blocks == 1);
+
+	assert(amdgpu_device_deinitialize(dev) == 0);
+}
+
+static void replay(const char *name, uint32_t fragment_size, unsigned steps,
+		   unsigned max_live)
+{
+	uint64_t begin, elapsed = 0, start, end, whole = 0, mapped = 0;
+	unsigned live = 0, large = 0, aligned = 0, failed = 0, i, j;
+	amdgpu_device_handle dev = open_device(fragment_size);
+	static struct range ranges[MAX_LIVE];
+	struct amdgpu_va_range_stats before, stats;
+	struct range *r;
+
+	get_stats(dev, &before);
+	srand(1);
+	for (i = 0; i < steps; i++) {
+		if (live == max_live || (live && rand() % 3 == 0)) {
+			j = rand() % live;
+			begin = gettime_ns();
+			assert(amdgpu_va_range_free(ranges[j].handle) == 0);
+			elapsed += gettime_ns() - begin;
+			ranges[j] = ranges[--live];
+			continue;
+		}
+
+		r = &ranges[live];
+		begin = gettime_ns();
+		if (alloc_range(dev, random_size(), r)) {
+			elapsed += gettime_ns() - begin;
+			failed++;
+			continue;
+		}
+		elapsed += gettime_ns() - begin;
+		assert(r->va + r->size <= 1ull << 32);
+		live++;
+
+		if (r->size < FRAGMENT)
+			continue;
+		large++;
+		if (r->va % FRAGMENT == 0)
+			aligned++;
+		start = (r->va + FRAGMENT - 1) & ~(FRAGMENT - 1);
+		end = (r->va + r->size) & ~(FRAGMENT - 1);
+		whole += r->size & ~(FRAGMENT - 1);
+		if (end > start)
+			mapped += end - start;
+	}
+
+	get_stats(dev, &stats);
+	printf("%-10s %8.0f ops/s, %5.1f%% large aligned, %5.1f%% fragments "
+	       "mapped, %u failed\n", name, steps / (elapsed / 1e9),
+	       100.0 * aligned / large, 100.0 * mapped / whole, failed);
+	printf("%-10s %u free blocks, largest %.1f%% of free space", "",
+	       stats.free_blocks, 100.0 * stats.largest_free / stats.free);
+	if (stats.fragment_size)
+		printf(", %.1f%% in whole fragments",
+		       100.0 * stats.fragment_free / stats.free);
+	printf("\n");
+
+	while (live)
+		assert(amdgpu_va_range_free(ranges[--live].handle) == 0);
+	get_stats(dev, &stats);
+	assert(stats.free == before.free && stats.free_blocks == 1);
+	assert(amdgpu_device_deinitialize(dev) == 0);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n steps] [-l live ranges]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned steps = 200000, max_live = 1024;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:l:")) != -1) {
+		switch (c) {
+		case 'n':
+			steps = atoi(optarg);
+			break;
+		case 'l':
+			max_live = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !steps || !max_live || max_live > MAX_LIVE)
+		usage(argv[0]);
+
+	check_placement();
+	replay("unaware:", 0, steps, max_live);
+	replay("fragment:", FRAGMENT, steps, max_live);
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright © 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the restart policy and accounting of drmIoctl(): interrupted
+ * calls are restarted, backed off, given up by deadline or callback, and
+ * counted per ioctl number.
+ *
+ * The kernel is stubbed out by overriding ioctl(), failing calls with
+ * EINTR or EAGAIN as many times as asked.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "xf86drm.h"
+
+/* failures left before the stub succeeds, and the errno it fails with */
+static unsigned fail_count;
+static int fail_errno;
+static unsigned nr_ioctls;
+
+/* Tests are built with hidden visibility, export the stub to libdrm. */
+__attribute__((visibility("default")))
+int ioctl(int fd, unsigned long request, ...)
+{
+	nr_ioctls++;
+	if (fail_count) {
+		if (fail_count != ~0u)
+			fail_count--;
+		errno = fail_errno;
+		return -1;
+	}
+	return 0;
+}
+
+static int call(unsigned long request, unsigned failures, int err)
+{
+	struct drm_gem_close arg;
+
+	memset(&arg, 0, sizeof(arg));
+	fail_count = failures;
+	fail_errno = err;
+	nr_ioctls = 0;
+	return drmIoctl(-1, request, &arg);
+}
+
+static int get_stats(unsigned long request, drmIoctlRetryStats *stats)
+{
+	drmIoctlRetryStats all[4];
+	int i, count;
+
+	count = drmGetIoctlRetryStats(all, 4);
+	assert(count <= 4);
+	for (i = 0; i < count; i++) {
+		if (all[i].nr == DRM_IOCTL_NR(request)) {
+			*stats = all[i];
+			return count;
+		}
+	}
+	memset(stats, 0, sizeof(*stats));
+	return count;
+}
+
+static int abort_after(int fd, unsigned long request, int err,
+		       unsigned int retries, void *data)
+{
+	assert(err == EAGAIN);
+	return retries >= *(unsigned *)data;
+}
+
+int main(int argc, char *argv[])
+{
+	drmIoctlRetryPolicy policy;
+	drmIoctlRetryStats stats;
+	unsigned limit = 10;
+
+	printf("testing restarts ... ");
+	assert(call(DRM_IOCTL_GEM_CLOSE, 0, 0) == 0);
+	assert(nr_ioctls == 1);
+	/* calls which went through at once are not accounted */
+	assert(get_stats(DRM_IOCTL_GEM_CLOSE, &stats) == 0);
+
+	assert(call(DRM_IOCTL_GEM_CLOSE, 3, EINTR) == 0);
+	assert(nr_ioctls == 4);
+	assert(call(DRM_IOCTL_GEM_CLOSE, 5, EAGAIN) == 0);
+	assert(nr_ioctls == 6);
+	assert(get_stats(DRM_IOCTL_GEM_CLOSE, &stats) == 1);
+	assert(stats.calls == 2 && stats.retries == 3 + 5);
+	assert(stats.max_retries == 5 && stats.aborts == 0);
+	assert(stats.max_retry_ns > 0 && stats.max_retry_ns <= stats.retry_ns);
+
+	/* other errors are not restarted */
+	assert(call(DRM_IOCTL_GEM_FLINK, 1, EINVAL) == -1 && errno == EINVAL);
+	assert(nr_ioctls == 1);
+	assert(get_stats(DRM_IOCTL_GEM_FLINK, &stats) == 1);
+	assert(stats.calls == 0);
+	printf("ok\n");
+
+	printf("testing backoff ... ");
+	drmGetIoctlRetryPolicy(&policy);
+	policy.spins = 2;
+	policy.backoff_min_us = 100;
+	policy.backoff_max_us = 400;
+	drmSetIoctlRetryPolicy(&policy);
+	drmResetIoctlRetryStats();
+	/* 2 immediate restarts, then 100, 200, 400 and 400 us */
+	assert(call(DRM_IOCTL_GEM_OPEN, 6, EINTR) == 0);
+	assert(get_stats(DRM_IOCTL_GEM_OPEN, &stats) == 1);
+	assert(stats.calls == 1 && stats.retries == 6);
+	assert(stats.retry_ns >= 1100000);
+	assert(stats.max_retry_ns == stats.retry_ns);
+	printf("ok, %llu us retrying\n",
+	       (unsigned long long)stats.retry_ns / 1000);
+
+	printf("testing deadline ... ");
+	policy.deadline_ns = 5000000;
+	drmSetIoctlRetryPolicy(&policy);
+	assert(call(DRM_IOCTL_GEM_OPEN, ~0u, EAGAIN) == -1 && errno == EAGAIN);
+	assert(get_stats(DRM_IOCTL_GEM_OPEN, &stats) == 1);
+	assert(stats.calls == 2 && stats.aborts == 1);
+	assert(stats.max_retry_ns >= policy.deadline_ns);
+	printf("ok\n");
+
+	printf("testing callback ... ");
+	policy.deadline_ns = 0;
+	policy.callback = abort_after;
+	policy.callback_data = &limit;
+	drmSetIoctlRetryPolicy(&policy);
+	assert(call(DRM_IOCTL_GEM_CLOSE, ~0u, EAGAIN) == -1 && errno == EAGAIN);
+	assert(nr_ioctls == limit + 1);
+	assert(get_stats(DRM_IOCTL_GEM_CLOSE, &stats) == 2);
+	assert(stats.calls == 1 && stats.retries == limit && stats.aborts == 1);
+	printf("ok\n");
+
+	drmSetIoctlRetryPolicy(NULL);
+	drmResetIoctlRetryStats();
+	assert(get_stats(DRM_IOCTL_GEM_CLOSE, &stats) == 0);
+	return 0;
+}
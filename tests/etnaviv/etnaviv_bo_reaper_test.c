@@ -0,0 +1,152 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Checks that the background reaper keeps the bo cache within its byte
+ * budget and age limit, and that the cache statistics add up.
+ *
+ * The kernel is stubbed out by overriding ioctl(), so this runs without
+ * etnaviv hardware.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "xf86drm.h"
+#include "etnaviv_drmif.h"
+#include "etnaviv_drm.h"
+
+#define NR_BOS 64
+#define BO_SIZE 4096
+
+static uint32_t next_handle = 1;
+static uint32_t nr_closed;
+
+/* Tests are built with hidden visibility, export the stub to libdrm. */
+__attribute__((visibility("default")))
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct drm_etnaviv_gem_new *gem_new;
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	switch (request) {
+	case DRM_IOCTL_ETNAVIV_GEM_NEW:
+		gem_new = arg;
+		gem_new->handle = __sync_fetch_and_add(&next_handle, 1);
+		return 0;
+	case DRM_IOCTL_GEM_CLOSE:
+		__sync_fetch_and_add(&nr_closed, 1);
+		return 0;
+	case DRM_IOCTL_ETNAVIV_GEM_CPU_PREP:
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+/* wait up to @timeout seconds for the reaper to shrink the cache */
+static void wait_for_size(struct etna_device *dev, uint64_t size,
+			  unsigned timeout)
+{
+	struct etna_bo_cache_stats stats;
+	unsigned i;
+
+	for (i = 0; i < timeout * 100; i++) {
+		etna_device_get_cache_stats(dev, &stats);
+		if (stats.size <= size)
+			return;
+		usleep(10000);
+	}
+	fprintf(stderr, "cache still holds %llu bytes, expected %llu\n",
+		(unsigned long long)stats.size, (unsigned long long)size);
+	assert(0);
+}
+
+int main(int argc, char *argv[])
+{
+	struct etna_device *dev;
+	struct etna_bo *bos[NR_BOS];
+	struct etna_bo_cache_stats stats;
+	unsigned i;
+
+	dev = etna_device_new(-1);
+	assert(dev);
+
+	/* keep at most 16 bo's around, but don't expire them by age yet */
+	assert(etna_device_enable_cache_reaper(dev, 16 * BO_SIZE, 3600) == 0);
+
+	printf("testing byte budget ... ");
+	for (i = 0; i < NR_BOS; i++) {
+		bos[i] = etna_bo_new(dev, BO_SIZE, ETNA_BO_WC);
+		assert(bos[i]);
+	}
+	for (i = 0; i < NR_BOS; i++)
+		etna_bo_del(bos[i]);
+
+	wait_for_size(dev, 16 * BO_SIZE, 5);
+	etna_device_get_cache_stats(dev, &stats);
+	assert(stats.count == 16);
+	assert(stats.misses == NR_BOS && stats.hits == 0);
+	assert(stats.evictions == NR_BOS - 16);
+	assert(nr_closed == stats.evictions);
+	printf("ok\n");
+
+	printf("testing cache hits ... ");
+	for (i = 0; i < 16; i++) {
+		bos[i] = etna_bo_new(dev, BO_SIZE, ETNA_BO_WC);
+		assert(bos[i]);
+	}
+	etna_device_get_cache_stats(dev, &stats);
+	assert(stats.hits == 16 && stats.count == 0 && stats.size == 0);
+	for (i = 0; i < 16; i++)
+		etna_bo_del(bos[i]);
+	printf("ok\n");
+
+	printf("testing age limit ... ");
+	assert(etna_device_enable_cache_reaper(dev, 0, 1) == 0);
+	etna_device_get_cache_stats(dev, &stats);
+	assert(stats.count == 16);
+	wait_for_size(dev, 0, 5);
+	etna_device_get_cache_stats(dev, &stats);
+	assert(stats.count == 0);
+	assert(stats.evictions == NR_BOS);
+	assert(nr_closed == NR_BOS);
+	printf("ok\n");
+
+	etna_device_del(dev);
+
+	return 0;
+}
@@ -0,0 +1,252 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Multi-threaded relocation benchmark: every thread builds command streams
+ * of its own, referencing private bo's and bo's shared by all threads.
+ *
+ * The kernel is stubbed out by overriding ioctl(), so this runs without
+ * etnaviv hardware.  Each submit is checked for duplicated bo's.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "xf86drm.h"
+#include "etnaviv_drmif.h"
+#include "etnaviv_drm.h"
+
+#define MAX_HANDLES 65536
+
+static uint32_t next_handle = 1;
+
+static void check_submit(struct drm_etnaviv_gem_submit *req)
+{
+	struct drm_etnaviv_gem_submit_bo *bos = (void *)(uintptr_t)req->bos;
+	struct drm_etnaviv_gem_submit_reloc *relocs =
+		(void *)(uintptr_t)req->relocs;
+	static __thread uint8_t seen[MAX_HANDLES];
+	uint32_t i;
+
+	for (i = 0; i < req->nr_bos; i++) {
+		assert(bos[i].handle < MAX_HANDLES);
+		assert(!seen[bos[i].handle]);
+		seen[bos[i].handle] = 1;
+	}
+	for (i = 0; i < req->nr_bos; i++)
+		seen[bos[i].handle] = 0;
+	for (i = 0; i < req->nr_relocs; i++)
+		assert(relocs[i].reloc_idx < req->nr_bos);
+}
+
+/* Tests are built with hidden visibility, export the stub to libdrm. */
+__attribute__((visibility("default")))
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct drm_etnaviv_param *param;
+	struct drm_etnaviv_gem_new *gem_new;
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	switch (request) {
+	case DRM_IOCTL_ETNAVIV_GET_PARAM:
+		param = arg;
+		param->value = 1;
+		return 0;
+	case DRM_IOCTL_ETNAVIV_GEM_NEW:
+		gem_new = arg;
+		gem_new->handle = __sync_fetch_and_add(&next_handle, 1);
+		return 0;
+	case DRM_IOCTL_ETNAVIV_GEM_SUBMIT:
+		check_submit(arg);
+		return 0;
+	case DRM_IOCTL_ETNAVIV_WAIT_FENCE:
+	case DRM_IOCTL_GEM_CLOSE:
+		return 0;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+struct thread_data {
+	pthread_t thread;
+	struct etna_pipe *pipe;
+	struct etna_bo **shared_bos;
+	struct etna_bo **bos;
+	unsigned nr_shared, nr_bos, nr_relocs;
+};
+
+static unsigned nr_threads = 4, nr_shared = 64, nr_private = 256;
+static unsigned nr_relocs = 1000000, stream_size = 4096;
+
+static void *thread_func(void *arg)
+{
+	struct thread_data *t = arg;
+	struct etna_cmd_stream *stream;
+	struct etna_reloc r = { .flags = ETNA_RELOC_READ };
+	unsigned i, seed = (uintptr_t)t;
+
+	stream = etna_cmd_stream_new(t->pipe, stream_size, NULL, NULL);
+	assert(stream);
+
+	for (i = 0; i < t->nr_relocs; i++) {
+		/* one in four relocs is to a shared bo */
+		if (rand_r(&seed) % 4)
+			r.bo = t->bos[rand_r(&seed) % t->nr_bos];
+		else
+			r.bo = t->shared_bos[rand_r(&seed) % t->nr_shared];
+
+		etna_cmd_stream_reserve(stream, 1);
+		etna_cmd_stream_reloc(stream, &r);
+	}
+	etna_cmd_stream_flush(stream);
+	etna_cmd_stream_del(stream);
+
+	return NULL;
+}
+
+static uint64_t get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-t threads] [-s shared bos] [-p private bos]"
+		" [-r relocs per thread] [-z stream size]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	struct etna_device *dev;
+	struct etna_gpu *gpu;
+	struct etna_pipe *pipe;
+	struct etna_bo **shared_bos;
+	struct thread_data *threads;
+	uint64_t start, elapsed;
+	unsigned i, j;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:s:p:r:z:")) != -1) {
+		switch (c) {
+		case 't':
+			nr_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			nr_shared = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			nr_private = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			nr_relocs = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			stream_size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!nr_threads || !nr_shared || !nr_private || stream_size < 2 ||
+	    nr_shared + nr_threads * nr_private >= MAX_HANDLES)
+		usage(argv[0]);
+
+	dev = etna_device_new(-1);
+	assert(dev);
+	gpu = etna_gpu_new(dev, 0);
+	assert(gpu);
+	pipe = etna_pipe_new(gpu, ETNA_PIPE_3D);
+	assert(pipe);
+
+	shared_bos = calloc(nr_shared, sizeof(*shared_bos));
+	threads = calloc(nr_threads, sizeof(*threads));
+	assert(shared_bos && threads);
+	for (i = 0; i < nr_shared; i++) {
+		shared_bos[i] = etna_bo_new(dev, 4096, ETNA_BO_WC);
+		assert(shared_bos[i]);
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		struct thread_data *t = &threads[i];
+
+		t->pipe = pipe;
+		t->shared_bos = shared_bos;
+		t->nr_shared = nr_shared;
+		t->nr_bos = nr_private;
+		t->nr_relocs = nr_relocs;
+		t->bos = calloc(nr_private, sizeof(*t->bos));
+		assert(t->bos);
+		for (j = 0; j < nr_private; j++) {
+			t->bos[j] = etna_bo_new(dev, 4096, ETNA_BO_WC);
+			assert(t->bos[j]);
+		}
+	}
+
+	start = get_time_ns();
+	for (i = 0; i < nr_threads; i++)
+		assert(!pthread_create(&threads[i].thread, NULL, thread_func,
+				       &threads[i]));
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i].thread, NULL);
+	elapsed = get_time_ns() - start;
+
+	printf("%u threads, %u relocs each: %.1f ns per reloc and thread, "
+	       "%.2f Mrelocs/s\n", nr_threads, nr_relocs,
+	       (double)elapsed / nr_relocs,
+	       (double)nr_threads * nr_relocs * 1000.0 / elapsed);
+
+	for (i = 0; i < nr_threads; i++) {
+		for (j = 0; j < nr_private; j++)
+			etna_bo_del(threads[i].bos[j]);
+		free(threads[i].bos);
+	}
+	for (i = 0; i < nr_shared; i++)
+		etna_bo_del(shared_bos[i]);
+	free(threads);
+	free(shared_bos);
+	etna_pipe_del(pipe);
+	etna_gpu_del(gpu);
+	etna_device_del(dev);
+
+	return 0;
+}
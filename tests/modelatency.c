@@ -0,0 +1,172 @@
+/*
+ * Copyright © 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Checks how the latency instrumentation matches completion events to
+ * submissions: a vblank wait completes on its first event, an atomic
+ * commit once on every CRTC, and enough vblank waits don't push page
+ * flips out of the table of pending submissions.
+ *
+ * The kernel is stubbed out by overriding ioctl(), and the events are
+ * written to a pipe which drmHandleEvent() reads in place of the fd.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#define CRTC_A	40
+#define CRTC_B	41
+
+static uint32_t vblank_seq;
+static int event_fd;
+
+/* Tests are built with hidden visibility, export the stub to libdrm. */
+__attribute__((visibility("default")))
+int ioctl(int fd, unsigned long request, ...)
+{
+	union drm_wait_vblank *vbl;
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (request == DRM_IOCTL_WAIT_VBLANK) {
+		vbl = arg;
+		vbl->reply.sequence = vblank_seq + 1;
+	}
+	return 0;
+}
+
+static void send_event(int fd, uint32_t type, uint32_t crtc_id,
+		       uint64_t user_data)
+{
+	drmEventContext evctx;
+	struct drm_event_vblank e;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	memset(&e, 0, sizeof(e));
+	e.base.type = type;
+	e.base.length = sizeof(e);
+	e.user_data = user_data;
+	e.tv_sec = ts.tv_sec;
+	e.tv_usec = ts.tv_nsec / 1000;
+	e.sequence = ++vblank_seq;
+	e.crtc_id = crtc_id;
+	assert(write(event_fd, &e, sizeof(e)) == sizeof(e));
+
+	memset(&evctx, 0, sizeof(evctx));
+	evctx.version = 2;
+	assert(drmHandleEvent(fd, &evctx) == 0);
+}
+
+static void wait_vblank(int fd, unsigned long user_data)
+{
+	drmVBlank vbl;
+
+	memset(&vbl, 0, sizeof(vbl));
+	vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+	vbl.request.sequence = 1;
+	vbl.request.signal = user_data;
+	assert(drmWaitVBlank(fd, &vbl) == 0);
+}
+
+/* Returns the completions of a CRTC. */
+static uint64_t completions(int fd, uint32_t crtc_id)
+{
+	drmModeCrtcLatency stats[4];
+	int i, count;
+
+	count = drmModeLatencyGetStats(fd, stats, 4);
+	assert(count >= 0 && count <= 4);
+	for (i = 0; i < count; i++) {
+		if (stats[i].crtc_id == crtc_id)
+			return stats[i].completions;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	drmModeAtomicReqPtr req;
+	int fds[2], fd, i;
+
+	assert(pipe(fds) == 0);
+	fd = fds[0];
+	event_fd = fds[1];
+	assert(drmModeLatencyEnable(fd) == 0);
+
+	printf("testing vblank waits ... ");
+	wait_vblank(fd, 7);
+	send_event(fd, DRM_EVENT_VBLANK, CRTC_A, 7);
+	/* the wait is done, another CRTC's event doesn't match it */
+	send_event(fd, DRM_EVENT_VBLANK, CRTC_B, 7);
+	assert(completions(fd, CRTC_A) == 1);
+	assert(completions(fd, CRTC_B) == 0);
+	printf("ok\n");
+
+	printf("testing atomic commits ... ");
+	req = drmModeAtomicAlloc();
+	assert(req);
+	assert(drmModeAtomicAddProperty(req, 30, 1, 2) >= 0);
+	assert(drmModeAtomicCommit(fd, req, DRM_MODE_PAGE_FLIP_EVENT,
+				   (void *)8) == 0);
+	drmModeAtomicFree(req);
+	send_event(fd, DRM_EVENT_FLIP_COMPLETE, CRTC_A, 8);
+	send_event(fd, DRM_EVENT_FLIP_COMPLETE, CRTC_B, 8);
+	send_event(fd, DRM_EVENT_FLIP_COMPLETE, CRTC_A, 8);
+	assert(completions(fd, CRTC_A) == 2);
+	assert(completions(fd, CRTC_B) == 1);
+	printf("ok\n");
+
+	printf("testing pending submissions ... ");
+	drmModeLatencyReset(fd);
+	assert(drmModePageFlip(fd, CRTC_B, 1, DRM_MODE_PAGE_FLIP_EVENT,
+			       (void *)9) == 0);
+	/* completed waits make room for later submissions */
+	for (i = 0; i < 256; i++) {
+		wait_vblank(fd, 100 + i);
+		send_event(fd, DRM_EVENT_VBLANK, CRTC_A, 100 + i);
+	}
+	send_event(fd, DRM_EVENT_FLIP_COMPLETE, CRTC_B, 9);
+	assert(completions(fd, CRTC_A) == 256);
+	assert(completions(fd, CRTC_B) == 1);
+	printf("ok\n");
+
+	drmModeLatencyDisable(fd);
+	close(fds[0]);
+	close(fds[1]);
+	return 0;
+}
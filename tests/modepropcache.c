@@ -0,0 +1,209 @@
+/*
+ * Copyright © 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Counts the ioctls of resolving every property of a plane by name, the
+ * way atomic clients do before each commit, with and without the property
+ * cache, and checks that the cache is kept per fd and is dropped by
+ * drmModePropertyCacheInvalidate() and drmModePropertyCacheDisable().
+ *
+ * The kernel is stubbed out by overriding ioctl(), so this runs without
+ * KMS hardware.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#define PLANE_ID	40
+#define PROP_ID(i)	(1000 + (i))
+
+static const char *const names[] = {
+	"type", "FB_ID", "IN_FENCE_FD", "CRTC_ID", "CRTC_X", "CRTC_Y",
+	"CRTC_W", "CRTC_H", "SRC_X", "SRC_Y", "SRC_W", "SRC_H", "IN_FORMATS",
+	"rotation", "zpos", "alpha",
+};
+
+#define NUM_PROPS	(sizeof(names) / sizeof(names[0]))
+
+static unsigned nr_ioctls;
+
+static int stub_get_property(struct drm_mode_get_property *prop)
+{
+	struct drm_mode_property_enum *enums;
+	uint64_t *values;
+	uint32_t i = prop->prop_id - PROP_ID(0);
+
+	if (i >= NUM_PROPS)
+		return -ENOENT;
+
+	strcpy(prop->name, names[i]);
+	if (i == 0) {
+		/* the plane type enum */
+		enums = (struct drm_mode_property_enum *)(uintptr_t)prop->enum_blob_ptr;
+		values = (uint64_t *)(uintptr_t)prop->values_ptr;
+		if (prop->count_enum_blobs >= 3 && prop->count_values >= 3) {
+			strcpy(enums[0].name, "Overlay");
+			strcpy(enums[1].name, "Primary");
+			strcpy(enums[2].name, "Cursor");
+			for (i = 0; i < 3; i++)
+				enums[i].value = values[i] = i;
+		}
+		prop->flags = DRM_MODE_PROP_ENUM | DRM_MODE_PROP_IMMUTABLE;
+		prop->count_enum_blobs = 3;
+		prop->count_values = 3;
+	} else {
+		values = (uint64_t *)(uintptr_t)prop->values_ptr;
+		if (prop->count_values >= 2) {
+			values[0] = 0;
+			values[1] = UINT32_MAX;
+		}
+		prop->flags = DRM_MODE_PROP_RANGE;
+		prop->count_values = 2;
+	}
+	return 0;
+}
+
+static int stub_ioctl(unsigned long request, void *arg)
+{
+	struct drm_mode_obj_get_properties *props;
+	uint32_t *ids;
+	uint64_t *values;
+	uint32_t i;
+
+	switch (request) {
+	case DRM_IOCTL_MODE_OBJ_GETPROPERTIES:
+		props = arg;
+		if (props->obj_id != PLANE_ID ||
+		    props->obj_type != DRM_MODE_OBJECT_PLANE)
+			return -ENOENT;
+		ids = (uint32_t *)(uintptr_t)props->props_ptr;
+		values = (uint64_t *)(uintptr_t)props->prop_values_ptr;
+		for (i = 0; i < props->count_props && i < NUM_PROPS; i++) {
+			ids[i] = PROP_ID(i);
+			values[i] = i;
+		}
+		props->count_props = NUM_PROPS;
+		return 0;
+	case DRM_IOCTL_MODE_GETPROPERTY:
+		return stub_get_property(arg);
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Tests are built with hidden visibility, export the stub to libdrm. */
+__attribute__((visibility("default")))
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+	int ret;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	nr_ioctls++;
+	ret = stub_ioctl(request, arg);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+	return 0;
+}
+
+/* Resolves every plane property by name, returns the ioctls it took. */
+static unsigned resolve_all(int fd)
+{
+	unsigned before = nr_ioctls, i;
+	drmModePropertyPtr prop;
+
+	for (i = 0; i < NUM_PROPS; i++) {
+		prop = drmModeObjectGetPropertyByName(fd, PLANE_ID,
+						      DRM_MODE_OBJECT_PLANE,
+						      names[i]);
+		assert(prop);
+		assert(prop->prop_id == PROP_ID(i));
+		assert(!strcmp(prop->name, names[i]));
+		drmModeFreeProperty(prop);
+	}
+
+	return nr_ioctls - before;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned uncached, first, cached;
+	drmModePropertyPtr prop;
+
+	/* any fd numbers, the stub doesn't look at them */
+	const int fd = 100, other_fd = 101;
+
+	printf("testing lookups without the cache ... ");
+	uncached = resolve_all(fd);
+	/* the object's properties, then the definitions up to the match */
+	assert(uncached == NUM_PROPS * 2 + NUM_PROPS * (NUM_PROPS + 1));
+	printf("ok, %u ioctls\n", uncached);
+
+	printf("testing lookups with the cache ... ");
+	assert(drmModePropertyCacheEnable(fd) == 0);
+	first = resolve_all(fd);
+	assert(first == 2 + NUM_PROPS * 2);
+	cached = resolve_all(fd);
+	assert(cached == 0);
+	printf("ok, %u ioctls filling it, %u after\n", first, cached);
+
+	printf("testing cached definitions ... ");
+	prop = drmModeGetProperty(fd, PROP_ID(0));
+	assert(prop && prop->count_enums == 3 && prop->count_values == 3);
+	assert(!strcmp(prop->enums[1].name, "Primary"));
+	drmModeFreeProperty(prop);
+	prop = drmModeGetProperty(fd, PROP_ID(0));
+	assert(prop && !strcmp(prop->enums[2].name, "Cursor"));
+	drmModeFreeProperty(prop);
+	assert(!drmModeObjectGetPropertyByName(fd, PLANE_ID,
+					       DRM_MODE_OBJECT_PLANE,
+					       "COLOR_ENCODING"));
+	assert(nr_ioctls == uncached + first);
+	printf("ok\n");
+
+	printf("testing caches per fd ... ");
+	assert(resolve_all(other_fd) == uncached);
+	drmModePropertyCacheInvalidate(fd);
+	assert(resolve_all(fd) == first);
+	/* as before closing the fd, its number may come back */
+	drmModePropertyCacheDisable(fd);
+	assert(resolve_all(fd) == uncached);
+	printf("ok\n");
+
+	return 0;
+}
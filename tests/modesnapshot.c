@@ -0,0 +1,317 @@
+/*
+ * Copyright © 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the KMS state snapshots: a snapshot taken with the previous one
+ * costs a single ioctl per unchanged object, changes are reported by
+ * drmModeStateSnapshotDiff(), and DRM_MODE_SNAPSHOT_NO_PROPERTIES leaves
+ * the property arrays zeroed.
+ *
+ * The kernel is stubbed out by overriding ioctl(), with arrays larger than
+ * the snapshot's first guesses, so this runs without KMS hardware.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "xf86drm.h"
+#include "xf86drmMode.h"
+
+#define NUM_FBS		20
+#define NUM_CRTCS	2
+#define NUM_CONNECTORS	2
+#define NUM_ENCODERS	3
+#define NUM_PLANES	3
+#define NUM_PROPS	24
+#define NUM_MODES	40
+#define NUM_FORMATS	48
+
+#define FB_ID(i)	(100 + (i))
+#define CRTC_ID(i)	(10 + (i))
+#define CONNECTOR_ID(i)	(20 + (i))
+#define ENCODER_ID(i)	(30 + (i))
+#define PLANE_ID(i)	(40 + (i))
+
+static unsigned nr_ioctls, nr_probes;
+static uint32_t crtc_fb[NUM_CRTCS];
+
+/* Copies the ids, as the kernel does, when there is room for all of them. */
+static void put_ids(uint64_t ptr, uint32_t room, uint32_t count,
+		    uint32_t first)
+{
+	uint32_t *ids = (uint32_t *)(uintptr_t)ptr;
+	uint32_t i;
+
+	if (room < count)
+		return;
+	for (i = 0; i < count; i++)
+		ids[i] = first + i;
+}
+
+static void put_props(uint64_t props_ptr, uint64_t values_ptr, uint32_t room,
+		      uint32_t obj_id)
+{
+	uint64_t *values = (uint64_t *)(uintptr_t)values_ptr;
+	uint32_t i;
+
+	put_ids(props_ptr, room, NUM_PROPS, 1000);
+	if (room < NUM_PROPS)
+		return;
+	for (i = 0; i < NUM_PROPS; i++)
+		values[i] = obj_id * 100 + i;
+}
+
+static int stub_get_connector(struct drm_mode_get_connector *conn)
+{
+	struct drm_mode_modeinfo *modes;
+	uint32_t i;
+
+	if (conn->connector_id < CONNECTOR_ID(0) ||
+	    conn->connector_id >= CONNECTOR_ID(NUM_CONNECTORS))
+		return -ENOENT;
+
+	if (!conn->count_modes)
+		nr_probes++;
+
+	modes = (struct drm_mode_modeinfo *)(uintptr_t)conn->modes_ptr;
+	if (conn->count_modes >= NUM_MODES) {
+		for (i = 0; i < NUM_MODES; i++) {
+			memset(&modes[i], 0, sizeof(modes[i]));
+			modes[i].hdisplay = 640 + i * 16;
+			modes[i].vdisplay = 480 + i * 9;
+		}
+	}
+	put_ids(conn->encoders_ptr, conn->count_encoders, 2,
+		ENCODER_ID(conn->connector_id - CONNECTOR_ID(0)));
+	put_props(conn->props_ptr, conn->prop_values_ptr, conn->count_props,
+		  conn->connector_id);
+
+	conn->count_modes = NUM_MODES;
+	conn->count_encoders = 2;
+	conn->count_props = NUM_PROPS;
+	conn->encoder_id = ENCODER_ID(conn->connector_id - CONNECTOR_ID(0));
+	conn->connection = DRM_MODE_CONNECTED;
+	conn->connector_type = DRM_MODE_CONNECTOR_HDMIA;
+	return 0;
+}
+
+static int stub_ioctl(unsigned long request, void *arg)
+{
+	struct drm_mode_card_res *res;
+	struct drm_mode_get_plane_res *plane_res;
+	struct drm_mode_crtc *crtc;
+	struct drm_mode_get_encoder *enc;
+	struct drm_mode_get_plane *plane;
+	struct drm_mode_obj_get_properties *props;
+
+	switch (request) {
+	case DRM_IOCTL_MODE_GETRESOURCES:
+		res = arg;
+		put_ids(res->fb_id_ptr, res->count_fbs, NUM_FBS, FB_ID(0));
+		put_ids(res->crtc_id_ptr, res->count_crtcs, NUM_CRTCS,
+			CRTC_ID(0));
+		put_ids(res->connector_id_ptr, res->count_connectors,
+			NUM_CONNECTORS, CONNECTOR_ID(0));
+		put_ids(res->encoder_id_ptr, res->count_encoders,
+			NUM_ENCODERS, ENCODER_ID(0));
+		res->count_fbs = NUM_FBS;
+		res->count_crtcs = NUM_CRTCS;
+		res->count_connectors = NUM_CONNECTORS;
+		res->count_encoders = NUM_ENCODERS;
+		res->max_width = res->max_height = 8192;
+		return 0;
+	case DRM_IOCTL_MODE_GETPLANERESOURCES:
+		plane_res = arg;
+		put_ids(plane_res->plane_id_ptr, plane_res->count_planes,
+			NUM_PLANES, PLANE_ID(0));
+		plane_res->count_planes = NUM_PLANES;
+		return 0;
+	case DRM_IOCTL_MODE_GETCRTC:
+		crtc = arg;
+		if (crtc->crtc_id < CRTC_ID(0) ||
+		    crtc->crtc_id >= CRTC_ID(NUM_CRTCS))
+			return -ENOENT;
+		crtc->fb_id = crtc_fb[crtc->crtc_id - CRTC_ID(0)];
+		crtc->mode_valid = !!crtc->fb_id;
+		crtc->gamma_size = 256;
+		return 0;
+	case DRM_IOCTL_MODE_GETCONNECTOR:
+		return stub_get_connector(arg);
+	case DRM_IOCTL_MODE_GETENCODER:
+		enc = arg;
+		if (enc->encoder_id < ENCODER_ID(0) ||
+		    enc->encoder_id >= ENCODER_ID(NUM_ENCODERS))
+			return -ENOENT;
+		enc->encoder_type = DRM_MODE_ENCODER_TMDS;
+		enc->possible_crtcs = (1 << NUM_CRTCS) - 1;
+		return 0;
+	case DRM_IOCTL_MODE_GETPLANE:
+		plane = arg;
+		if (plane->plane_id < PLANE_ID(0) ||
+		    plane->plane_id >= PLANE_ID(NUM_PLANES))
+			return -ENOENT;
+		put_ids(plane->format_type_ptr, plane->count_format_types,
+			NUM_FORMATS, 0x34325258);
+		plane->count_format_types = NUM_FORMATS;
+		plane->possible_crtcs = (1 << NUM_CRTCS) - 1;
+		return 0;
+	case DRM_IOCTL_MODE_OBJ_GETPROPERTIES:
+		props = arg;
+		put_props(props->props_ptr, props->prop_values_ptr,
+			  props->count_props, props->obj_id);
+		props->count_props = NUM_PROPS;
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Tests are built with hidden visibility, export the stub to libdrm. */
+__attribute__((visibility("default")))
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+	int ret;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	nr_ioctls++;
+	ret = stub_ioctl(request, arg);
+	if (ret) {
+		errno = -ret;
+		return -1;
+	}
+	return 0;
+}
+
+static void check_props(drmModeObjectPropertiesPtr props, int count,
+			int expected)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		assert(props[i].count_props == (uint32_t)expected);
+		assert(!expected == !props[i].props);
+		assert(!expected == !props[i].prop_values);
+	}
+}
+
+static void check_snapshot(drmModeStateSnapshotPtr s, int props)
+{
+	unsigned i;
+
+	assert(s->count_fbs == NUM_FBS);
+	assert(s->fbs[NUM_FBS - 1] == FB_ID(NUM_FBS - 1));
+	assert(s->count_crtcs == NUM_CRTCS);
+	assert(s->count_connectors == NUM_CONNECTORS);
+	assert(s->count_encoders == NUM_ENCODERS);
+	assert(s->count_planes == NUM_PLANES);
+
+	for (i = 0; i < NUM_CONNECTORS; i++) {
+		assert(s->connectors[i].connector_id == CONNECTOR_ID(i));
+		assert(s->connectors[i].count_modes == NUM_MODES);
+		assert(s->connectors[i].modes[NUM_MODES - 1].hdisplay ==
+		       640 + (NUM_MODES - 1) * 16);
+		assert(s->connectors[i].count_encoders == 2);
+	}
+	for (i = 0; i < NUM_PLANES; i++)
+		assert(s->planes[i].count_formats == NUM_FORMATS);
+
+	check_props(s->crtc_props, NUM_CRTCS, props ? NUM_PROPS : 0);
+	check_props(s->connector_props, NUM_CONNECTORS, props ? NUM_PROPS : 0);
+	check_props(s->plane_props, NUM_PLANES, props ? NUM_PROPS : 0);
+	if (props)
+		assert(s->plane_props[1].prop_values[3] == PLANE_ID(1) * 100 + 3);
+}
+
+int main(int argc, char *argv[])
+{
+	/* resources, plane resources, and one query per object */
+	unsigned objects = 2 + NUM_CRTCS + NUM_CONNECTORS + NUM_ENCODERS +
+			   NUM_PLANES;
+	drmModeStateSnapshotPtr first, second, third;
+	uint32_t ids[4];
+	unsigned before;
+
+	printf("testing snapshot ... ");
+	before = nr_ioctls;
+	first = drmModeGetStateSnapshot(-1, NULL, 0);
+	assert(first);
+	assert(first->count_ioctls == nr_ioctls - before);
+	check_snapshot(first, 1);
+	/* the arrays outgrow the first guesses */
+	assert(first->count_ioctls > objects + NUM_CRTCS + NUM_PLANES);
+	assert(nr_probes == 0);
+	printf("ok, %u ioctls\n", first->count_ioctls);
+
+	printf("testing snapshot with the previous one ... ");
+	before = nr_ioctls;
+	second = drmModeGetStateSnapshot(-1, first, 0);
+	assert(second);
+	/* CRTCs and planes have their properties queried separately */
+	assert(second->count_ioctls == objects + NUM_CRTCS + NUM_PLANES);
+	assert(nr_ioctls - before == second->count_ioctls);
+	check_snapshot(second, 1);
+	assert(drmModeStateSnapshotDiff(first, second, ids, 4) == 0);
+	printf("ok, %u ioctls\n", second->count_ioctls);
+
+	printf("testing snapshot without properties ... ");
+	crtc_fb[1] = FB_ID(3);
+	third = drmModeGetStateSnapshot(-1, second,
+					DRM_MODE_SNAPSHOT_NO_PROPERTIES);
+	assert(third);
+	assert(third->count_ioctls == objects);
+	check_snapshot(third, 0);
+	assert(third->crtcs[1].buffer_id == FB_ID(3));
+	printf("ok, %u ioctls\n", third->count_ioctls);
+
+	printf("testing snapshot diff ... ");
+	drmModeFreeStateSnapshot(first);
+	first = drmModeGetStateSnapshot(-1, third, 0);
+	assert(first);
+	assert(drmModeStateSnapshotDiff(second, first, ids, 4) == 1);
+	assert(ids[0] == CRTC_ID(1));
+	printf("ok\n");
+
+	printf("testing snapshot with probing ... ");
+	assert(nr_probes == 0);
+	drmModeFreeStateSnapshot(third);
+	third = drmModeGetStateSnapshot(-1, first, DRM_MODE_SNAPSHOT_PROBE);
+	assert(third);
+	assert(nr_probes == NUM_CONNECTORS);
+	printf("ok\n");
+
+	drmModeFreeStateSnapshot(first);
+	drmModeFreeStateSnapshot(second);
+	drmModeFreeStateSnapshot(third);
+	return 0;
+}
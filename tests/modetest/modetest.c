@@ -1512,6 +1512,8 @@ static void test_page_flip(struct device *dev, struct pipe_arg *pipes, unsigned
 	unsigned int i;
 	int ret;
 
+	drmModeLatencyEnable(dev->fd);
+
 	other_bo = bo_create(dev->fd, pipes[0].fourcc, dev->mode.width,
 			     dev->mode.height, handles, pitches, offsets,
 			     UTIL_PATTERN_PLAIN);
@@ -1588,10 +1590,13 @@ static void test_page_flip(struct device *dev, struct pipe_arg *pipes, unsigned
 		drmHandleEvent(dev->fd, &evctx);
 	}
 
+	util_print_latency(dev->fd);
+
 err_rmfb:
 	drmModeRmFB(dev->fd, other_fb_id);
 err:
 	bo_destroy(other_bo);
+	drmModeLatencyDisable(dev->fd);
 }
 
 #define min(a, b)	((a) < (b) ? (a) : (b))
@@ -1948,23 +1953,33 @@ int main(int argc, char **argv)
 
 	dev.use_atomic = use_atomic;
 
+	/* Properties are looked up repeatedly, keep their definitions around. */
+	drmModePropertyCacheEnable(dev.fd);
+
 	if (test_vsync && !page_flipping_supported()) {
 		fprintf(stderr, "page flipping not supported by drm.\n");
+		drmModePropertyCacheDisable(dev.fd);
+		drmClose(dev.fd);
 		return -1;
 	}
 
 	if (test_vsync && !count) {
 		fprintf(stderr, "page flipping requires at least one -s option.\n");
+		drmModePropertyCacheDisable(dev.fd);
+		drmClose(dev.fd);
 		return -1;
 	}
 
 	if (test_cursor && !cursor_supported()) {
 		fprintf(stderr, "hw cursor not supported by drm.\n");
+		drmModePropertyCacheDisable(dev.fd);
+		drmClose(dev.fd);
 		return -1;
 	}
 
 	dev.resources = get_resources(&dev);
 	if (!dev.resources) {
+		drmModePropertyCacheDisable(dev.fd);
 		drmClose(dev.fd);
 		return 1;
 	}
@@ -1972,6 +1987,7 @@ int main(int argc, char **argv)
 	for (i = 0; i < count; i++) {
 		if (pipe_resolve_connectors(&dev, &pipe_args[i]) < 0) {
 			free_resources(dev.resources);
+			drmModePropertyCacheDisable(dev.fd);
 			drmClose(dev.fd);
 			return 1;
 		}
@@ -2096,6 +2112,7 @@ int main(int argc, char **argv)
 	}
 
 	free_resources(dev.resources);
+	drmModePropertyCacheDisable(dev.fd);
 
 	return 0;
 }
@@ -0,0 +1,185 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Relocation emission benchmark for the radeon GEM command stream.
+ *
+ * The kernel is stubbed out by overriding ioctl(), so this runs without
+ * radeon hardware: GEM objects are plain handles and submission is a no-op.
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "xf86drm.h"
+#include "radeon_drm.h"
+#include "radeon_bo.h"
+#include "radeon_bo_gem.h"
+#include "radeon_cs.h"
+#include "radeon_cs_gem.h"
+
+static uint32_t next_handle = 1;
+
+/* Tests are built with hidden visibility, export the stub to libdrm. */
+__attribute__((visibility("default")))
+int ioctl(int fd, unsigned long request, ...)
+{
+    struct drm_radeon_gem_create *create;
+    va_list ap;
+    void *arg;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    switch (request) {
+    case DRM_IOCTL_RADEON_GEM_CREATE:
+        create = arg;
+        create->handle = next_handle++;
+        return 0;
+    case DRM_IOCTL_RADEON_INFO:
+    case DRM_IOCTL_RADEON_CS:
+    case DRM_IOCTL_GEM_CLOSE:
+        return 0;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+static uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-b bos] [-r relocs] [-n rounds]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    struct radeon_bo_manager *bom;
+    struct radeon_cs_manager *csm;
+    struct radeon_bo **bos;
+    struct radeon_cs *cs;
+    uint32_t *first_idx;
+    unsigned nbos = 4096, nrelocs = 16384, nrounds = 20;
+    unsigned i, j, k, unique = 0;
+    uint64_t start, elapsed;
+    int c;
+
+    while ((c = getopt(argc, argv, "b:r:n:")) != -1) {
+        switch (c) {
+        case 'b':
+            nbos = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            nrelocs = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            nrounds = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (!nbos || !nrelocs)
+        usage(argv[0]);
+
+    bom = radeon_bo_manager_gem_ctor(-1);
+    csm = radeon_cs_manager_gem_ctor(-1);
+    assert(bom && csm);
+
+    bos = calloc(nbos, sizeof(*bos));
+    first_idx = calloc(nbos, sizeof(*first_idx));
+    assert(bos && first_idx);
+    for (i = 0; i < nbos; i++) {
+        bos[i] = radeon_bo_open(bom, 0, 4096, 0, RADEON_GEM_DOMAIN_GTT, 0);
+        assert(bos[i]);
+    }
+
+    cs = radeon_cs_create(csm, 1024);
+    assert(cs);
+    radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_GTT, INT32_MAX);
+    radeon_cs_set_limit(cs, RADEON_GEM_DOMAIN_VRAM, INT32_MAX);
+
+    start = get_time_ns();
+    for (i = 0; i < nrounds; i++) {
+        memset(first_idx, 0xff, nbos * sizeof(*first_idx));
+        unique = 0;
+
+        assert(radeon_cs_begin(cs, 2 * nrelocs, __FILE__, __func__,
+                               __LINE__) == 0);
+        for (j = 0; j < nrelocs; j++) {
+            /* walk the BOs with a stride so that most are referenced
+             * several times, like textures and vertex buffers would be */
+            k = (j * 2654435761u + i) % nbos;
+
+            assert(radeon_cs_space_check_with_bo(cs, bos[k],
+                                                 RADEON_GEM_DOMAIN_GTT,
+                                                 0) == 0);
+            assert(radeon_cs_write_reloc(cs, bos[k], RADEON_GEM_DOMAIN_GTT,
+                                         0, 0) == 0);
+
+            /* a BO must always map to the same relocation */
+            if (first_idx[k] == ~0u) {
+                first_idx[k] = cs->packets[cs->cdw - 1];
+                unique++;
+            }
+            assert(cs->packets[cs->cdw - 1] == first_idx[k]);
+        }
+        assert(radeon_cs_end(cs, __FILE__, __func__, __LINE__) == 0);
+
+        assert(radeon_cs_emit(cs) == 0);
+        radeon_cs_erase(cs);
+    }
+    elapsed = get_time_ns() - start;
+
+    printf("%u rounds of %u relocs over %u bos (%u unique per round)\n",
+           nrounds, nrelocs, nbos, unique);
+    printf("%.1f ns per reloc\n",
+           (double)elapsed / ((uint64_t)nrounds * nrelocs));
+
+    radeon_cs_destroy(cs);
+    for (i = 0; i < nbos; i++)
+        radeon_bo_unref(bos[i]);
+    free(first_idx);
+    free(bos);
+    radeon_cs_manager_gem_dtor(csm);
+    radeon_bo_manager_gem_dtor(bom);
+
+    return 0;
+}
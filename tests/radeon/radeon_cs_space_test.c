@@ -0,0 +1,435 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Differential test of the CS space accounting.
+ *
+ * Random sequences of space checks, relocations and flushes on two CSes
+ * sharing bos are run both through libdrm_radeon and through a reference
+ * model which recomputes the totals over all persistent bos on every check,
+ * the way radeon_cs_space originally did. Return codes, flushes, the
+ * accounted domains of every bo and the totals of the CS manager must all
+ * match.
+ *
+ * The kernel is stubbed out by overriding ioctl().
+ */
+
+#undef NDEBUG
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "xf86drm.h"
+#include "radeon_drm.h"
+#include "radeon_bo.h"
+#include "radeon_bo_gem.h"
+#include "radeon_cs.h"
+#include "radeon_cs_gem.h"
+#include "radeon_bo_int.h"
+#include "radeon_cs_int.h"
+
+#define NBOS        64
+#define NSEEDS      200
+#define NOPS        2000
+#define NCS         2
+
+static uint32_t next_handle = 1;
+
+/* Tests are built with hidden visibility, export the stub to libdrm. */
+__attribute__((visibility("default")))
+int ioctl(int fd, unsigned long request, ...)
+{
+    struct drm_radeon_gem_create *create;
+    va_list ap;
+    void *arg;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    switch (request) {
+    case DRM_IOCTL_RADEON_GEM_CREATE:
+        create = arg;
+        create->handle = next_handle++;
+        return 0;
+    case DRM_IOCTL_RADEON_INFO:
+    case DRM_IOCTL_RADEON_CS:
+    case DRM_IOCTL_GEM_CLOSE:
+        return 0;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+struct model_check {
+    int bo;
+    uint32_t read_domains;
+    uint32_t write_domain;
+    uint32_t new_accounted;
+};
+
+struct model_cs {
+    int in_cs[NBOS];
+    struct model_check bos[MAX_SPACE_BOS];
+    int bo_count;
+};
+
+/* the bos and the totals of the CS manager are shared by the CSes */
+struct model {
+    uint32_t size[NBOS];
+    uint32_t accounted[NBOS];
+    struct model_cs cs[NCS];
+    int32_t vram_limit, gart_limit;
+    int32_t vram_write_used, gart_write_used, read_used;
+    unsigned flushes;
+};
+
+struct harness;
+
+struct harness_cs {
+    struct harness *h;
+    struct radeon_cs *cs;
+};
+
+struct harness {
+    struct harness_cs cs[NCS];
+    struct radeon_bo *bos[NBOS];
+    unsigned flushes;
+};
+
+static void model_flush(struct model *m, struct model_cs *mcs)
+{
+    int i;
+
+    for (i = 0; i < NBOS; i++) {
+        if (mcs->in_cs[i])
+            m->accounted[i] = 0;
+        mcs->in_cs[i] = 0;
+    }
+    m->vram_write_used = m->gart_write_used = m->read_used = 0;
+    m->flushes++;
+}
+
+/* radeon_cs_setup_bo() as it was, without the legacy static bo path */
+static int model_setup_bo(struct model *m, struct model_check *sc,
+                          int32_t *op_read, int32_t *op_gart_write,
+                          int32_t *op_vram_write)
+{
+    uint32_t accounted = m->accounted[sc->bo];
+    uint32_t size = m->size[sc->bo];
+    uint16_t old_read, old_write;
+
+    sc->new_accounted = 0;
+    if (sc->write_domain && sc->write_domain == accounted) {
+        sc->new_accounted = accounted;
+        return 0;
+    }
+    if (sc->read_domains && (sc->read_domains << 16) == accounted) {
+        sc->new_accounted = accounted;
+        return 0;
+    }
+
+    if (accounted == 0) {
+        if (sc->write_domain) {
+            if (sc->write_domain == RADEON_GEM_DOMAIN_VRAM)
+                *op_vram_write += size;
+            else if (sc->write_domain == RADEON_GEM_DOMAIN_GTT)
+                *op_gart_write += size;
+            sc->new_accounted = sc->write_domain;
+        } else {
+            *op_read += size;
+            sc->new_accounted = sc->read_domains << 16;
+        }
+        return 0;
+    }
+
+    old_read = accounted >> 16;
+    old_write = accounted & 0xffff;
+    if (sc->write_domain && (old_read & sc->write_domain)) {
+        sc->new_accounted = sc->write_domain;
+        if (sc->write_domain == RADEON_GEM_DOMAIN_VRAM) {
+            *op_read -= size;
+            *op_vram_write += size;
+        } else if (sc->write_domain == RADEON_GEM_DOMAIN_GTT) {
+            *op_read -= size;
+            *op_gart_write += size;
+        }
+    } else if (sc->read_domains & old_write) {
+        sc->new_accounted = accounted & 0xffff;
+    } else {
+        return RADEON_CS_SPACE_FLUSH;
+    }
+    return 0;
+}
+
+static int model_do_check(struct model *m, struct model_cs *mcs,
+                          struct model_check *tmp)
+{
+    int32_t op_read = 0, op_gart_write = 0, op_vram_write = 0;
+    int i, ret;
+
+    if (mcs->bo_count == 0 && !tmp)
+        return 0;
+
+    for (i = 0; i < mcs->bo_count; i++) {
+        ret = model_setup_bo(m, &mcs->bos[i], &op_read, &op_gart_write,
+                             &op_vram_write);
+        if (ret)
+            return ret;
+    }
+    if (tmp) {
+        ret = model_setup_bo(m, tmp, &op_read, &op_gart_write,
+                             &op_vram_write);
+        if (ret)
+            return ret;
+    }
+
+    if (op_read < 0)
+        op_read = 0;
+
+    if ((op_read + op_gart_write > m->gart_limit) ||
+        (op_vram_write > m->vram_limit))
+        return RADEON_CS_SPACE_OP_TO_BIG;
+
+    if ((m->vram_write_used + op_vram_write > m->vram_limit) ||
+        (m->read_used + m->gart_write_used + op_gart_write + op_read >
+         m->gart_limit))
+        return RADEON_CS_SPACE_FLUSH;
+
+    m->gart_write_used += op_gart_write;
+    m->vram_write_used += op_vram_write;
+    m->read_used += op_read;
+    for (i = 0; i < mcs->bo_count; i++)
+        m->accounted[mcs->bos[i].bo] = mcs->bos[i].new_accounted;
+    if (tmp)
+        m->accounted[tmp->bo] = tmp->new_accounted;
+
+    return RADEON_CS_SPACE_OK;
+}
+
+static int model_check(struct model *m, struct model_cs *mcs,
+                       struct model_check *tmp)
+{
+    int flushed = 0, ret;
+
+again:
+    ret = model_do_check(m, mcs, tmp);
+    if (ret == RADEON_CS_SPACE_OP_TO_BIG)
+        return -1;
+    if (ret == RADEON_CS_SPACE_FLUSH) {
+        model_flush(m, mcs);
+        if (flushed)
+            return -1;
+        flushed = 1;
+        goto again;
+    }
+    return 0;
+}
+
+static void model_add_persistent(struct model_cs *mcs, int bo,
+                                 uint32_t read_domains, uint32_t write_domain)
+{
+    int i;
+
+    for (i = 0; i < mcs->bo_count; i++) {
+        if (mcs->bos[i].bo == bo &&
+            mcs->bos[i].read_domains == read_domains &&
+            mcs->bos[i].write_domain == write_domain)
+            return;
+    }
+    mcs->bos[mcs->bo_count].bo = bo;
+    mcs->bos[mcs->bo_count].read_domains = read_domains;
+    mcs->bos[mcs->bo_count].write_domain = write_domain;
+    mcs->bo_count++;
+}
+
+static void harness_flush(void *data)
+{
+    struct harness_cs *hcs = data;
+
+    radeon_cs_emit(hcs->cs);
+    radeon_cs_erase(hcs->cs);
+    hcs->h->flushes++;
+}
+
+static void random_domains(uint32_t *read_domains, uint32_t *write_domain)
+{
+    static const uint32_t reads[] = {
+        RADEON_GEM_DOMAIN_GTT,
+        RADEON_GEM_DOMAIN_VRAM,
+        RADEON_GEM_DOMAIN_GTT | RADEON_GEM_DOMAIN_VRAM,
+    };
+
+    if (rand() % 3) {
+        *read_domains = reads[rand() % 3];
+        *write_domain = 0;
+    } else {
+        *read_domains = 0;
+        *write_domain = rand() % 2 ? RADEON_GEM_DOMAIN_GTT :
+                                     RADEON_GEM_DOMAIN_VRAM;
+    }
+}
+
+static void compare(struct model *m, struct harness *h)
+{
+    struct radeon_cs_int *csi = (struct radeon_cs_int *)h->cs[0].cs;
+    int i;
+
+    assert(m->flushes == h->flushes);
+    assert(m->read_used == csi->csm->read_used);
+    assert(m->gart_write_used == csi->csm->gart_write_used);
+    assert(m->vram_write_used == csi->csm->vram_write_used);
+    for (i = 0; i < NBOS; i++)
+        assert(m->accounted[i] ==
+               ((struct radeon_bo_int *)h->bos[i])->space_accounted);
+}
+
+static void run(struct radeon_bo_manager *bom, struct radeon_cs_manager *csm,
+                unsigned seed)
+{
+    struct model m;
+    struct harness h;
+    struct model_check tmp;
+    struct model_cs *mcs;
+    struct radeon_cs *cs;
+    uint32_t read_domains, write_domain;
+    int i, op, bo, k, ret;
+    /* odd seeds use a single CS, which never shares its persistent bos */
+    int ncs = seed % 2 ? 1 : NCS;
+
+    srand(seed);
+    memset(&m, 0, sizeof(m));
+    memset(&h, 0, sizeof(h));
+
+    for (i = 0; i < NBOS; i++) {
+        m.size[i] = 4096 << (rand() % 9);
+        h.bos[i] = radeon_bo_open(bom, 0, m.size[i], 0,
+                                  RADEON_GEM_DOMAIN_GTT, 0);
+        assert(h.bos[i]);
+    }
+
+    m.vram_limit = (1 + rand() % 8) << 20;
+    m.gart_limit = (1 + rand() % 8) << 20;
+    for (k = 0; k < ncs; k++) {
+        h.cs[k].h = &h;
+        h.cs[k].cs = radeon_cs_create(csm, 1024);
+        assert(h.cs[k].cs);
+        radeon_cs_set_limit(h.cs[k].cs, RADEON_GEM_DOMAIN_VRAM, m.vram_limit);
+        radeon_cs_set_limit(h.cs[k].cs, RADEON_GEM_DOMAIN_GTT, m.gart_limit);
+        radeon_cs_space_set_flush(h.cs[k].cs, harness_flush, &h.cs[k]);
+    }
+
+    for (op = 0; op < NOPS; op++) {
+        k = rand() % ncs;
+        mcs = &m.cs[k];
+        cs = h.cs[k].cs;
+        bo = rand() % NBOS;
+        random_domains(&read_domains, &write_domain);
+
+        switch (rand() % 8) {
+        case 0:
+        case 1:
+            if (mcs->bo_count >= MAX_SPACE_BOS - 1)
+                break;
+            model_add_persistent(mcs, bo, read_domains, write_domain);
+            radeon_cs_space_add_persistent_bo(cs, h.bos[bo],
+                                              read_domains, write_domain);
+            break;
+        case 2:
+            ret = radeon_cs_space_check(cs);
+            assert(ret == model_check(&m, mcs, NULL));
+            break;
+        case 3:
+        case 4:
+            tmp.bo = bo;
+            tmp.read_domains = read_domains;
+            tmp.write_domain = write_domain;
+            ret = radeon_cs_space_check_with_bo(cs, h.bos[bo],
+                                                read_domains, write_domain);
+            assert(ret == model_check(&m, mcs, &tmp));
+            if (ret || mcs->in_cs[bo])
+                break;
+            /* reference it in the domain it was accounted in */
+            if (m.accounted[bo] & 0xffff)
+                ret = radeon_cs_write_reloc(cs, h.bos[bo], 0,
+                                            m.accounted[bo] & 0xffff, 0);
+            else
+                ret = radeon_cs_write_reloc(cs, h.bos[bo],
+                                            m.accounted[bo] >> 16, 0, 0);
+            assert(ret == 0);
+            mcs->in_cs[bo] = 1;
+            break;
+        case 5:
+            harness_flush(&h.cs[k]);
+            model_flush(&m, mcs);
+            break;
+        case 6:
+            if (rand() % 8)
+                break;
+            radeon_cs_space_reset_bos(cs);
+            mcs->bo_count = 0;
+            break;
+        default:
+            break;
+        }
+
+        compare(&m, &h);
+    }
+
+    for (k = 0; k < ncs; k++) {
+        radeon_cs_space_reset_bos(h.cs[k].cs);
+        harness_flush(&h.cs[k]);
+        radeon_cs_destroy(h.cs[k].cs);
+    }
+    for (i = 0; i < NBOS; i++)
+        radeon_bo_unref(h.bos[i]);
+}
+
+int main(void)
+{
+    struct radeon_bo_manager *bom;
+    struct radeon_cs_manager *csm;
+    unsigned seed;
+
+    /* domain conflicts are part of the sequences, silence their reports */
+    if (!freopen("/dev/null", "w", stderr))
+        return 1;
+
+    bom = radeon_bo_manager_gem_ctor(-1);
+    csm = radeon_cs_manager_gem_ctor(-1);
+    assert(bom && csm);
+
+    for (seed = 1; seed <= NSEEDS; seed++)
+        run(bom, csm, seed);
+
+    radeon_cs_manager_gem_dtor(csm);
+    radeon_bo_manager_gem_dtor(bom);
+
+    printf("%u random sequences of %u operations match\n", NSEEDS, NOPS);
+    return 0;
+}
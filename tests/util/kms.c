@@ -38,6 +38,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -47,6 +48,7 @@
 #include "xf86drmMode.h"
 
 #include "common.h"
+#include "kms.h"
 
 struct type_name {
 	unsigned int type;
@@ -183,3 +185,42 @@ int util_open(const char *device, const char *module)
 
 	return fd;
 }
+
+static void util_print_histogram(const char *name,
+				 const drmModeLatencyHistogram *h)
+{
+	unsigned int i;
+
+	if (!h->count)
+		return;
+
+	printf("  %s: %" PRIu64 " samples, min %.3fms avg %.3fms max %.3fms\n",
+	       name, h->count, h->min_ns / 1e6,
+	       h->total_ns / 1e6 / h->count, h->max_ns / 1e6);
+
+	for (i = 0; i < DRM_MODE_LATENCY_BUCKETS; i++) {
+		if (!h->buckets[i])
+			continue;
+		printf("    %8uus-%uus: %" PRIu64 "\n", i ? 1u << i : 0,
+		       1u << (i + 1), h->buckets[i]);
+	}
+}
+
+void util_print_latency(int fd)
+{
+	drmModeCrtcLatency stats[16];
+	int count, i;
+
+	count = drmModeLatencyGetStats(fd, stats, ARRAY_SIZE(stats));
+	if (count < 0)
+		return;
+
+	for (i = 0; i < count && i < (int)ARRAY_SIZE(stats); i++) {
+		printf("crtc %u: %" PRIu64 " completions, %" PRIu64 " missed vblanks\n",
+		       stats[i].crtc_id, stats[i].completions,
+		       stats[i].missed_vblanks);
+		util_print_histogram("submit to event", &stats[i].submit_to_event);
+		util_print_histogram("interval", &stats[i].interval);
+		util_print_histogram("jitter", &stats[i].jitter);
+	}
+}
@@ -32,4 +32,6 @@ const char *util_lookup_connector_type_name(unsigned int type);
 
 int util_open(const char *device, const char *module);
 
+void util_print_latency(int fd);
+
 #endif /* UTIL_KMS_H */
@@ -28,6 +28,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
@@ -45,7 +46,7 @@
 
 extern char *optarg;
 extern int optind, opterr, optopt;
-static char optstr[] = "D:M:s";
+static char optstr[] = "bD:M:s";
 
 int secondary = 0;
 
@@ -82,11 +83,27 @@ static void vblank_handler(int fd, unsigned int frame, unsigned int sec,
 	}
 }
 
+static void vblank_batch_handler(int fd, drmEventInfoPtr events, int count,
+				 void *data)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (events[i].type != DRM_EVENT_VBLANK)
+			continue;
+		vblank_handler(fd, events[i].sequence,
+			       events[i].time_ns / 1000000000,
+			       events[i].time_ns / 1000 % 1000000,
+			       (void *)(unsigned long)events[i].user_data);
+	}
+}
+
 static void usage(char *name)
 {
-	fprintf(stderr, "usage: %s [-DMs]\n", name);
+	fprintf(stderr, "usage: %s [-bDMs]\n", name);
 	fprintf(stderr, "\n");
 	fprintf(stderr, "options:\n");
+	fprintf(stderr, "  -b         use the batched event reader\n");
 	fprintf(stderr, "  -D DEVICE  open the given device\n");
 	fprintf(stderr, "  -M MODULE  open the given module\n");
 	fprintf(stderr, "  -s         use secondary pipe\n");
@@ -96,14 +113,19 @@ static void usage(char *name)
 int main(int argc, char **argv)
 {
 	const char *device = NULL, *module = NULL;
-	int c, fd, ret;
+	int c, fd, ret, batched = 0;
 	drmVBlank vbl;
 	drmEventContext evctx;
+	drmEventBatchPtr batch = NULL;
+	drmEventBatchStats stats;
 	struct vbl_info handler_info;
 
 	opterr = 0;
 	while ((c = getopt(argc, argv, optstr)) != -1) {
 		switch (c) {
+		case 'b':
+			batched = 1;
+			break;
 		case 'D':
 			device = optarg;
 			break;
@@ -136,6 +158,8 @@ int main(int argc, char **argv)
 
 	printf("starting count: %d\n", vbl.request.sequence);
 
+	drmModeLatencyEnable(fd);
+
 	handler_info.vbl_count = 0;
 	gettimeofday(&handler_info.start, NULL);
 
@@ -157,6 +181,14 @@ int main(int argc, char **argv)
 	evctx.vblank_handler = vblank_handler;
 	evctx.page_flip_handler = NULL;
 
+	if (batched) {
+		batch = drmEventBatchCreate(NULL, 0, vblank_batch_handler, NULL);
+		if (!batch) {
+			printf("drmEventBatchCreate failed\n");
+			return -1;
+		}
+	}
+
 	/* Poll for events */
 	while (1) {
 		struct timeval timeout = { .tv_sec = 3, .tv_usec = 0 };
@@ -175,6 +207,15 @@ int main(int argc, char **argv)
 			break;
 		}
 
+		if (batch) {
+			ret = drmHandleEventBatch(fd, batch);
+			if (ret < 0) {
+				printf("drmHandleEventBatch failed: %i\n", ret);
+				return -1;
+			}
+			continue;
+		}
+
 		ret = drmHandleEvent(fd, &evctx);
 		if (ret != 0) {
 			printf("drmHandleEvent failed: %i\n", ret);
@@ -182,5 +223,15 @@ int main(int argc, char **argv)
 		}
 	}
 
+	util_print_latency(fd);
+	drmModeLatencyDisable(fd);
+
+	if (batch) {
+		drmEventBatchGetStats(batch, &stats);
+		printf("reads: %" PRIu64 ", events: %" PRIu64 ", batches: %" PRIu64 "\n",
+		       stats.reads, stats.events, stats.batches);
+		drmEventBatchDestroy(batch);
+	}
+
 	return 0;
 }
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+*/
+
+#ifndef _UTIL_BUCKET_H_
+#define _UTIL_BUCKET_H_
+
+#include <stdint.h>
+
+/*
+ * Size classes of the intel, freedreno and etnaviv bo caches.
+ *
+ * The caches have buckets of 4, 8 and 12 KiB, followed by four buckets per
+ * power of two from 16 KiB on: 16, 20, 24, 28, 32, 40, 48, 56, 64 KiB...
+ * The coarse variant (freedreno's ring cache) only has the powers of two
+ * from 4 KiB on.  These return the index of the smallest bucket that can
+ * hold @size, which callers must check against their number of buckets.
+ */
+
+static inline unsigned util_bucket_index(uint64_t size)
+{
+	unsigned log2;
+
+	if (size <= 4 * 4096)
+		return size ? (size - 1) >> 12 : 0;
+
+	/* 1 << log2 < size <= 2 << log2, in steps of (1 << log2) / 4 */
+	log2 = 63 - __builtin_clzll(size - 1);
+	return 4 * (log2 - 14) + 4 +
+		((size - 1 - (1ull << log2)) >> (log2 - 2));
+}
+
+static inline unsigned util_bucket_index_coarse(uint64_t size)
+{
+	if (size <= 4096)
+		return 0;
+
+	/* ceil(log2(size)) - 12 */
+	return 52 - __builtin_clzll(size - 1);
+}
+
+#endif /*_UTIL_BUCKET_H_*/
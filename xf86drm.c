@@ -45,6 +45,7 @@
 #include <limits.h>
 #include <signal.h>
 #include <time.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #define stat_t struct stat
@@ -67,6 +68,7 @@
 #endif
 
 #include "xf86drm.h"
+#include "xf86drmPriv.h"
 #include "libdrm_macros.h"
 
 #include "util_math.h"
@@ -178,17 +180,148 @@ drm_public void drmFree(void *pt)
     free(pt);
 }
 
+#define DRM_IOCTL_RETRY_SPINS          64
+#define DRM_IOCTL_RETRY_BACKOFF_MIN_US 1
+#define DRM_IOCTL_RETRY_BACKOFF_MAX_US 1000
+
+static pthread_mutex_t ioctl_retry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static drmIoctlRetryPolicy ioctl_retry_policy = {
+    .spins = DRM_IOCTL_RETRY_SPINS,
+    .backoff_min_us = DRM_IOCTL_RETRY_BACKOFF_MIN_US,
+    .backoff_max_us = DRM_IOCTL_RETRY_BACKOFF_MAX_US,
+};
+/* DRM ioctl numbers fit in 8 bits, see DRM_IOCTL_NR(). */
+static drmIoctlRetryStats ioctl_retry_stats[256];
+
+drm_public void drmSetIoctlRetryPolicy(const drmIoctlRetryPolicy *policy)
+{
+    pthread_mutex_lock(&ioctl_retry_mutex);
+    if (policy) {
+        ioctl_retry_policy = *policy;
+    } else {
+        memclear(ioctl_retry_policy);
+        ioctl_retry_policy.spins = DRM_IOCTL_RETRY_SPINS;
+        ioctl_retry_policy.backoff_min_us = DRM_IOCTL_RETRY_BACKOFF_MIN_US;
+        ioctl_retry_policy.backoff_max_us = DRM_IOCTL_RETRY_BACKOFF_MAX_US;
+    }
+    if (!ioctl_retry_policy.backoff_min_us)
+        ioctl_retry_policy.backoff_min_us = 1;
+    ioctl_retry_policy.backoff_max_us = MAX2(ioctl_retry_policy.backoff_max_us,
+                                             ioctl_retry_policy.backoff_min_us);
+    pthread_mutex_unlock(&ioctl_retry_mutex);
+}
+
+drm_public void drmGetIoctlRetryPolicy(drmIoctlRetryPolicy *policy)
+{
+    pthread_mutex_lock(&ioctl_retry_mutex);
+    *policy = ioctl_retry_policy;
+    pthread_mutex_unlock(&ioctl_retry_mutex);
+}
+
+drm_public int drmGetIoctlRetryStats(drmIoctlRetryStats *stats, int max_stats)
+{
+    unsigned int i;
+    int count = 0;
+
+    pthread_mutex_lock(&ioctl_retry_mutex);
+    for (i = 0; i < ARRAY_SIZE(ioctl_retry_stats); i++) {
+        if (!ioctl_retry_stats[i].calls)
+            continue;
+        if (count < max_stats) {
+            stats[count] = ioctl_retry_stats[i];
+            stats[count].nr = i;
+        }
+        count++;
+    }
+    pthread_mutex_unlock(&ioctl_retry_mutex);
+
+    return count;
+}
+
+drm_public void drmResetIoctlRetryStats(void)
+{
+    pthread_mutex_lock(&ioctl_retry_mutex);
+    memset(ioctl_retry_stats, 0, sizeof(ioctl_retry_stats));
+    pthread_mutex_unlock(&ioctl_retry_mutex);
+}
+
+static uint64_t drmIoctlRetryClock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * Slow path of drmIoctl(), entered after the first attempt failed with
+ * EINTR or EAGAIN.
+ */
+static int drmIoctlRetry(int fd, unsigned long request, void *arg)
+{
+    drmIoctlRetryPolicy policy;
+    drmIoctlRetryStats *stats;
+    unsigned int retries = 0, backoff_us = 0;
+    uint64_t start = drmIoctlRetryClock(), elapsed;
+    int ret, err, aborted = 0;
+
+    drmGetIoctlRetryPolicy(&policy);
+
+    do {
+        err = errno;
+        if (retries >= policy.spins) {
+            if (policy.deadline_ns &&
+                drmIoctlRetryClock() - start >= policy.deadline_ns) {
+                aborted = 1;
+                break;
+            }
+            if (policy.callback &&
+                policy.callback(fd, request, err, retries, policy.callback_data)) {
+                aborted = 1;
+                break;
+            }
+
+            backoff_us = backoff_us ? MIN2(backoff_us * 2, policy.backoff_max_us)
+                                    : policy.backoff_min_us;
+            usleep(backoff_us);
+        }
+        retries++;
+        ret = ioctl(fd, request, arg);
+    } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+
+    elapsed = drmIoctlRetryClock() - start;
+
+    pthread_mutex_lock(&ioctl_retry_mutex);
+    stats = &ioctl_retry_stats[DRM_IOCTL_NR(request)];
+    stats->calls++;
+    stats->retries += retries;
+    stats->retry_ns += elapsed;
+    stats->max_retries = MAX2(stats->max_retries, retries);
+    stats->max_retry_ns = MAX2(stats->max_retry_ns, elapsed);
+    stats->aborts += aborted;
+    pthread_mutex_unlock(&ioctl_retry_mutex);
+
+    if (aborted) {
+        errno = err;
+        return -1;
+    }
+    return ret;
+}
+
 /**
  * Call ioctl, restarting if it is interrupted
+ *
+ * Restarts are throttled and accounted as set up with
+ * drmSetIoctlRetryPolicy().
  */
 drm_public int
 drmIoctl(int fd, unsigned long request, void *arg)
 {
     int ret;
 
-    do {
-        ret = ioctl(fd, request, arg);
-    } while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+    ret = ioctl(fd, request, arg);
+    if (ret == -1 && (errno == EINTR || errno == EAGAIN))
+        ret = drmIoctlRetry(fd, request, arg);
     return ret;
 }
 
@@ -1721,6 +1854,7 @@ drm_public int drmCrtcQueueSequence(int fd, uint32_t crtcId, uint32_t flags,
                                     uint64_t user_data)
 {
     struct drm_crtc_queue_sequence queue_seq;
+    uint64_t submit_ns = drmLatencyClock(fd);
     int ret;
 
     memclear(queue_seq);
@@ -1732,6 +1866,10 @@ drm_public int drmCrtcQueueSequence(int fd, uint32_t crtcId, uint32_t flags,
     ret = drmIoctl(fd, DRM_IOCTL_CRTC_QUEUE_SEQUENCE, &queue_seq);
     if (ret == 0 && sequence_queued)
         *sequence_queued = queue_seq.sequence;
+    if (ret == 0)
+        drmLatencySubmit(fd, submit_ns, DRM_EVENT_CRTC_SEQUENCE, crtcId,
+                         user_data, DRM_LATENCY_TARGET_ABSOLUTE,
+                         queue_seq.sequence);
 
     return ret;
 }
@@ -2152,6 +2290,10 @@ drm_public int drmScatterGatherFree(int fd, drm_handle_t handle)
 drm_public int drmWaitVBlank(int fd, drmVBlankPtr vbl)
 {
     struct timespec timeout, cur;
+    uint64_t submit_ns = drmLatencyClock(fd);
+    /* request and reply share the storage */
+    int event = vbl->request.type & DRM_VBLANK_EVENT;
+    unsigned long user_data = vbl->request.signal;
     int ret;
 
     ret = clock_gettime(CLOCK_MONOTONIC, &timeout);
@@ -2177,6 +2319,11 @@ drm_public int drmWaitVBlank(int fd, drmVBlankPtr vbl)
        }
     } while (ret && errno == EINTR);
 
+    /* The reply holds the absolute sequence the event was queued for. */
+    if (ret == 0 && event)
+        drmLatencySubmit(fd, submit_ns, DRM_EVENT_VBLANK, 0, user_data,
+                         DRM_LATENCY_TARGET_ABSOLUTE, vbl->reply.sequence);
+
 out:
     return ret;
 }
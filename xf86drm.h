@@ -119,6 +119,45 @@ typedef struct drmHashEntry {
 } drmHashEntry;
 
 extern int drmIoctl(int fd, unsigned long request, void *arg);
+
+/**
+ * Retry policy of drmIoctl() for ioctls failing with EINTR or EAGAIN.
+ *
+ * The ioctl is restarted immediately \c spins times, then with an
+ * exponential backoff from \c backoff_min_us up to \c backoff_max_us
+ * between attempts.  A non-zero \c deadline_ns bounds the total time spent
+ * retrying one call, after which drmIoctl() fails with the last errno.  The
+ * optional \c callback is invoked before each backoff and aborts the call
+ * the same way when it returns non-zero.
+ */
+typedef struct _drmIoctlRetryPolicy {
+    unsigned int spins;
+    unsigned int backoff_min_us;
+    unsigned int backoff_max_us;
+    uint64_t     deadline_ns;
+    int          (*callback)(int fd, unsigned long request, int err,
+                             unsigned int retries, void *data);
+    void         *callback_data;
+} drmIoctlRetryPolicy, *drmIoctlRetryPolicyPtr;
+
+/**
+ * Retry accounting of the ioctls which had to be restarted, indexed by
+ * ioctl number.
+ */
+typedef struct _drmIoctlRetryStats {
+    unsigned int nr;            /**< ioctl number, DRM_IOCTL_NR(request) */
+    uint64_t     calls;         /**< calls needing at least one retry */
+    uint64_t     retries;       /**< total retries */
+    uint64_t     retry_ns;      /**< total time spent retrying */
+    unsigned int max_retries;   /**< most retries of a single call */
+    uint64_t     max_retry_ns;  /**< longest time spent retrying a single call */
+    uint64_t     aborts;        /**< calls given up by deadline or callback */
+} drmIoctlRetryStats, *drmIoctlRetryStatsPtr;
+
+extern void drmSetIoctlRetryPolicy(const drmIoctlRetryPolicy *policy);
+extern void drmGetIoctlRetryPolicy(drmIoctlRetryPolicy *policy);
+extern int drmGetIoctlRetryStats(drmIoctlRetryStats *stats, int max_stats);
+extern void drmResetIoctlRetryStats(void);
 extern void *drmGetHashTable(void);
 extern drmHashEntry *drmGetEntry(int fd);
 
@@ -726,6 +765,20 @@ extern int  drmSLLookupNeighbors(void *l, unsigned long key,
 				 unsigned long *prev_key, void **prev_value,
 				 unsigned long *next_key, void **next_value);
 
+/* Background reaper routines
+ *
+ * A single thread per process runs the registered callbacks every
+ * \c interval_ms milliseconds, or as soon as possible after a kick.
+ * Callbacks must not block on locks which are held while calling
+ * drmReaperUnregister(), as that waits for a running callback to finish.
+ */
+typedef void (*drmReaperFunc)(void *data);
+
+extern void *drmReaperRegister(drmReaperFunc func, void *data,
+                               unsigned int interval_ms);
+extern void drmReaperUnregister(void *handle);
+extern void drmReaperKick(void *handle);
+
 extern int drmOpenOnce(void *unused, const char *BusID, int *newlyopened);
 extern int drmOpenOnceWithType(const char *BusID, int *newlyopened, int type);
 extern void drmCloseOnce(int fd);
@@ -770,6 +823,41 @@ typedef struct _drmEventContext {
 
 extern int drmHandleEvent(int fd, drmEventContextPtr evctx);
 
+/*
+ * Batched event handling. drmHandleEventBatch() keeps reading from the fd
+ * until the kernel event queue is drained, and hands the events over to
+ * the handler in arrays rather than one callback per event.
+ */
+
+typedef struct _drmEventInfo {
+	uint32_t type;		/* DRM_EVENT_* */
+	uint32_t crtc_id;	/* 0 when the event does not carry it */
+	uint64_t sequence;
+	uint64_t time_ns;	/* kernel timestamp, CLOCK_MONOTONIC */
+	uint64_t user_data;
+} drmEventInfo, *drmEventInfoPtr;
+
+typedef struct _drmEventBatchStats {
+	uint64_t reads;		/* read() calls */
+	uint64_t events;	/* events delivered */
+	uint64_t batches;	/* handler invocations */
+} drmEventBatchStats, *drmEventBatchStatsPtr;
+
+typedef struct _drmEventBatch drmEventBatch, *drmEventBatchPtr;
+
+typedef void (*drmEventBatchHandler)(int fd, drmEventInfoPtr events,
+				     int count, void *data);
+
+/* buffer may be NULL, in which case a buffer of size bytes (or a default
+ * size if 0) is allocated and owned by the batch. */
+extern drmEventBatchPtr drmEventBatchCreate(void *buffer, size_t size,
+					    drmEventBatchHandler handler,
+					    void *data);
+extern void drmEventBatchDestroy(drmEventBatchPtr batch);
+extern int drmHandleEventBatch(int fd, drmEventBatchPtr batch);
+extern void drmEventBatchGetStats(drmEventBatchPtr batch,
+				  drmEventBatchStatsPtr stats);
+
 extern char *drmGetDeviceNameFromFd(int fd);
 
 /* Improved version of drmGetDeviceNameFromFd which attributes for any type of
@@ -39,6 +39,7 @@
  */
 
 #include <limits.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <sys/ioctl.h>
@@ -47,15 +48,20 @@
 #endif
 #include <stdio.h>
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "libdrm_macros.h"
+#include "util_math.h"
 #include "xf86drmMode.h"
 #include "xf86drm.h"
+#include "xf86drmPriv.h"
 #include <drm.h>
 #include <string.h>
 #include <dirent.h>
 #include <unistd.h>
 #include <errno.h>
+#include <poll.h>
 
 #define memclear(s) memset(&s, 0, sizeof(s))
 
@@ -622,7 +628,7 @@ drm_public int drmModeDetachMode(int fd, uint32_t connector_id, drmModeModeInfoP
 	return DRM_IOCTL(fd, DRM_IOCTL_MODE_DETACHMODE, &res);
 }
 
-drm_public drmModePropertyPtr drmModeGetProperty(int fd, uint32_t property_id)
+static drmModePropertyPtr drmModeFetchProperty(int fd, uint32_t property_id)
 {
 	struct drm_mode_get_property prop;
 	drmModePropertyPtr r;
@@ -686,6 +692,313 @@ drm_public void drmModeFreeProperty(drmModePropertyPtr ptr)
 	drmFree(ptr);
 }
 
+/*
+ * Property definition cache
+ *
+ * Property definitions do not change for the lifetime of a device, so once
+ * enabled for an fd they are kept in a hash table keyed by property ID.
+ * The list of properties attached to an object is cached as well, sorted
+ * by name to answer drmModeObjectGetPropertyByName(). Only the property
+ * values need a trip to the kernel then.
+ *
+ * Caches are looked up by fd number, libdrm does not see the fd being
+ * closed, so clients disable the cache before closing it.
+ */
+
+struct prop_cache_name {
+	char name[DRM_PROP_NAME_LEN];
+	uint32_t prop_id;
+};
+
+struct prop_cache_object {
+	uint32_t type;
+	uint32_t count;
+	struct prop_cache_name names[];
+};
+
+struct prop_cache {
+	int fd;
+	struct prop_cache *next;
+	void *props;	/* property ID -> drmModePropertyPtr */
+	void *objects;	/* object ID -> struct prop_cache_object */
+};
+
+static pthread_mutex_t prop_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct prop_cache *prop_cache_list;
+static int prop_cache_count;
+
+static struct prop_cache *prop_cache_lookup(int fd)
+{
+	struct prop_cache *cache;
+
+	for (cache = prop_cache_list; cache; cache = cache->next)
+		if (cache->fd == fd)
+			return cache;
+
+	return NULL;
+}
+
+static void prop_cache_clear(struct prop_cache *cache)
+{
+	unsigned long key;
+	void *value;
+
+	if (drmHashFirst(cache->props, &key, &value) == 1) {
+		do {
+			drmModeFreeProperty(value);
+		} while (drmHashNext(cache->props, &key, &value) == 1);
+	}
+	drmHashDestroy(cache->props);
+
+	if (drmHashFirst(cache->objects, &key, &value) == 1) {
+		do {
+			drmFree(value);
+		} while (drmHashNext(cache->objects, &key, &value) == 1);
+	}
+	drmHashDestroy(cache->objects);
+
+	cache->props = drmHashCreate();
+	cache->objects = drmHashCreate();
+}
+
+static drmModePropertyPtr drmModeCopyProperty(drmModePropertyPtr prop)
+{
+	drmModePropertyPtr r;
+
+	if (!(r = drmMalloc(sizeof(*r))))
+		return NULL;
+
+	*r = *prop;
+	r->values = drmAllocCpy((char *)prop->values, prop->count_values,
+				sizeof(uint64_t));
+	r->enums = drmAllocCpy((char *)prop->enums, prop->count_enums,
+			       sizeof(struct drm_mode_property_enum));
+	r->blob_ids = NULL;
+	r->count_blobs = 0;
+
+	if ((r->count_values && !r->values) ||
+	    (r->count_enums && !r->enums)) {
+		drmModeFreeProperty(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+/* Blob properties of old kernels list the blob IDs, which do change. */
+static int prop_cacheable(drmModePropertyPtr prop)
+{
+	return !((prop->flags & DRM_MODE_PROP_BLOB) && prop->count_blobs);
+}
+
+drm_public int drmModePropertyCacheEnable(int fd)
+{
+	struct prop_cache *cache;
+	int ret = 0;
+
+	pthread_mutex_lock(&prop_cache_mutex);
+	if (!prop_cache_lookup(fd)) {
+		cache = drmMalloc(sizeof(*cache));
+		if (cache) {
+			cache->fd = fd;
+			cache->props = drmHashCreate();
+			cache->objects = drmHashCreate();
+		}
+		if (!cache || !cache->props || !cache->objects) {
+			if (cache) {
+				drmHashDestroy(cache->props);
+				drmHashDestroy(cache->objects);
+			}
+			drmFree(cache);
+			ret = -ENOMEM;
+		} else {
+			cache->next = prop_cache_list;
+			prop_cache_list = cache;
+			prop_cache_count++;
+		}
+	}
+	pthread_mutex_unlock(&prop_cache_mutex);
+
+	return ret;
+}
+
+drm_public void drmModePropertyCacheDisable(int fd)
+{
+	struct prop_cache **p, *cache;
+
+	pthread_mutex_lock(&prop_cache_mutex);
+	for (p = &prop_cache_list; (cache = *p); p = &cache->next) {
+		if (cache->fd == fd) {
+			*p = cache->next;
+			prop_cache_count--;
+			prop_cache_clear(cache);
+			drmHashDestroy(cache->props);
+			drmHashDestroy(cache->objects);
+			drmFree(cache);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&prop_cache_mutex);
+}
+
+drm_public void drmModePropertyCacheInvalidate(int fd)
+{
+	struct prop_cache *cache;
+
+	pthread_mutex_lock(&prop_cache_mutex);
+	cache = prop_cache_lookup(fd);
+	if (cache)
+		prop_cache_clear(cache);
+	pthread_mutex_unlock(&prop_cache_mutex);
+}
+
+drm_public drmModePropertyPtr drmModeGetProperty(int fd, uint32_t property_id)
+{
+	struct prop_cache *cache;
+	drmModePropertyPtr prop, r;
+	void *value;
+
+	if (!prop_cache_count)
+		return drmModeFetchProperty(fd, property_id);
+
+	pthread_mutex_lock(&prop_cache_mutex);
+	cache = prop_cache_lookup(fd);
+	if (cache && !drmHashLookup(cache->props, property_id, &value)) {
+		r = drmModeCopyProperty(value);
+		pthread_mutex_unlock(&prop_cache_mutex);
+		return r;
+	}
+	pthread_mutex_unlock(&prop_cache_mutex);
+
+	r = drmModeFetchProperty(fd, property_id);
+	if (!cache || !r || !prop_cacheable(r))
+		return r;
+
+	prop = drmModeCopyProperty(r);
+	if (!prop)
+		return r;
+
+	pthread_mutex_lock(&prop_cache_mutex);
+	/* The cache may have been disabled or refilled meanwhile. */
+	cache = prop_cache_lookup(fd);
+	if (!cache || drmHashInsert(cache->props, property_id, prop))
+		drmModeFreeProperty(prop);
+	pthread_mutex_unlock(&prop_cache_mutex);
+
+	return r;
+}
+
+static int prop_cache_name_cmp(const void *a, const void *b)
+{
+	const struct prop_cache_name *na = a, *nb = b;
+
+	return strcmp(na->name, nb->name);
+}
+
+static int prop_cache_name_find(const void *key, const void *elem)
+{
+	const struct prop_cache_name *n = elem;
+
+	return strcmp(key, n->name);
+}
+
+/* Called with the cache lock held, which is dropped around the ioctls. */
+static struct prop_cache_object *
+prop_cache_get_object(int fd, uint32_t object_id, uint32_t object_type)
+{
+	drmModeObjectPropertiesPtr props;
+	struct prop_cache_object *obj = NULL;
+	struct prop_cache *cache;
+	drmModePropertyPtr prop;
+	uint32_t i, count = 0;
+	void *value;
+
+	cache = prop_cache_lookup(fd);
+	if (!drmHashLookup(cache->objects, object_id, &value)) {
+		obj = value;
+		return obj->type == object_type ? obj : NULL;
+	}
+
+	pthread_mutex_unlock(&prop_cache_mutex);
+	props = drmModeObjectGetProperties(fd, object_id, object_type);
+	if (props)
+		obj = drmMalloc(sizeof(*obj) +
+				props->count_props * sizeof(obj->names[0]));
+	for (i = 0; obj && i < props->count_props; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+		strncpy(obj->names[count].name, prop->name, DRM_PROP_NAME_LEN);
+		obj->names[count].name[DRM_PROP_NAME_LEN - 1] = '\0';
+		obj->names[count].prop_id = prop->prop_id;
+		count++;
+		drmModeFreeProperty(prop);
+	}
+	drmModeFreeObjectProperties(props);
+	pthread_mutex_lock(&prop_cache_mutex);
+
+	if (!obj)
+		return NULL;
+
+	obj->type = object_type;
+	obj->count = count;
+	qsort(obj->names, count, sizeof(obj->names[0]), prop_cache_name_cmp);
+
+	cache = prop_cache_lookup(fd);
+	if (!cache || drmHashInsert(cache->objects, object_id, obj)) {
+		drmFree(obj);
+		if (!cache || drmHashLookup(cache->objects, object_id, &value))
+			return NULL;
+		obj = value;
+	}
+
+	return obj;
+}
+
+drm_public drmModePropertyPtr
+drmModeObjectGetPropertyByName(int fd, uint32_t object_id,
+			       uint32_t object_type, const char *name)
+{
+	drmModeObjectPropertiesPtr props;
+	struct prop_cache_object *obj;
+	struct prop_cache_name *found;
+	drmModePropertyPtr prop = NULL;
+	uint32_t prop_id = 0, i;
+
+	pthread_mutex_lock(&prop_cache_mutex);
+	if (prop_cache_lookup(fd)) {
+		obj = prop_cache_get_object(fd, object_id, object_type);
+		if (obj) {
+			found = bsearch(name, obj->names, obj->count,
+					sizeof(obj->names[0]),
+					prop_cache_name_find);
+			if (found)
+				prop_id = found->prop_id;
+		}
+		pthread_mutex_unlock(&prop_cache_mutex);
+
+		if (obj)
+			return prop_id ? drmModeGetProperty(fd, prop_id) : NULL;
+	} else {
+		pthread_mutex_unlock(&prop_cache_mutex);
+	}
+
+	props = drmModeObjectGetProperties(fd, object_id, object_type);
+	if (!props)
+		return NULL;
+
+	for (i = 0; i < props->count_props && !prop; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (prop && strcmp(prop->name, name)) {
+			drmModeFreeProperty(prop);
+			prop = NULL;
+		}
+	}
+	drmModeFreeObjectProperties(props);
+
+	return prop;
+}
+
 drm_public drmModePropertyBlobPtr drmModeGetPropertyBlob(int fd,
 														 uint32_t blob_id)
 {
@@ -910,10 +1223,15 @@ drm_public int drmHandleEvent(int fd, drmEventContextPtr evctx)
 		e = (struct drm_event *)(buffer + i);
 		switch (e->type) {
 		case DRM_EVENT_VBLANK:
+			vblank = (struct drm_event_vblank *) e;
+			drmLatencyComplete(fd, e->type, vblank->crtc_id,
+					   vblank->sequence,
+					   vblank->tv_sec * 1000000000ull +
+					   vblank->tv_usec * 1000ull,
+					   vblank->user_data);
 			if (evctx->version < 1 ||
 			    evctx->vblank_handler == NULL)
 				break;
-			vblank = (struct drm_event_vblank *) e;
 			evctx->vblank_handler(fd,
 					      vblank->sequence,
 					      vblank->tv_sec,
@@ -923,6 +1241,11 @@ drm_public int drmHandleEvent(int fd, drmEventContextPtr evctx)
 		case DRM_EVENT_FLIP_COMPLETE:
 			vblank = (struct drm_event_vblank *) e;
 			user_data = U642VOID (vblank->user_data);
+			drmLatencyComplete(fd, e->type, vblank->crtc_id,
+					   vblank->sequence,
+					   vblank->tv_sec * 1000000000ull +
+					   vblank->tv_usec * 1000ull,
+					   vblank->user_data);
 
 			if (evctx->version >= 3 && evctx->page_flip_handler2)
 				evctx->page_flip_handler2(fd,
@@ -940,6 +1263,8 @@ drm_public int drmHandleEvent(int fd, drmEventContextPtr evctx)
 			break;
 		case DRM_EVENT_CRTC_SEQUENCE:
 			seq = (struct drm_event_crtc_sequence *) e;
+			drmLatencyComplete(fd, e->type, 0, seq->sequence,
+					   seq->time_ns, seq->user_data);
 			if (evctx->version >= 4 && evctx->sequence_handler)
 				evctx->sequence_handler(fd,
 							seq->sequence,
@@ -955,10 +1280,179 @@ drm_public int drmHandleEvent(int fd, drmEventContextPtr evctx)
 	return 0;
 }
 
+#define DRM_EVENT_BATCH_DEFAULT_SIZE	(16 * 1024)
+#define DRM_EVENT_BATCH_MIN_SIZE	1024
+#define DRM_EVENT_BATCH_MAX_EVENTS	64
+
+struct _drmEventBatch {
+	char *buffer;
+	size_t size;
+	int owns_buffer;
+
+	drmEventBatchHandler handler;
+	void *data;
+
+	int count;
+	drmEventInfo events[DRM_EVENT_BATCH_MAX_EVENTS];
+
+	drmEventBatchStats stats;
+};
+
+drm_public drmEventBatchPtr drmEventBatchCreate(void *buffer, size_t size,
+						drmEventBatchHandler handler,
+						void *data)
+{
+	drmEventBatchPtr batch;
+
+	if (!handler)
+		return NULL;
+
+	if (!size)
+		size = DRM_EVENT_BATCH_DEFAULT_SIZE;
+	if (size < DRM_EVENT_BATCH_MIN_SIZE)
+		return NULL;
+
+	batch = drmMalloc(sizeof(*batch));
+	if (!batch)
+		return NULL;
+
+	if (buffer) {
+		batch->buffer = buffer;
+	} else {
+		batch->buffer = malloc(size);
+		if (!batch->buffer) {
+			drmFree(batch);
+			return NULL;
+		}
+		batch->owns_buffer = 1;
+	}
+	batch->size = size;
+	batch->handler = handler;
+	batch->data = data;
+
+	return batch;
+}
+
+drm_public void drmEventBatchDestroy(drmEventBatchPtr batch)
+{
+	if (!batch)
+		return;
+
+	if (batch->owns_buffer)
+		free(batch->buffer);
+	drmFree(batch);
+}
+
+drm_public void drmEventBatchGetStats(drmEventBatchPtr batch,
+				      drmEventBatchStatsPtr stats)
+{
+	*stats = batch->stats;
+}
+
+static void drmEventBatchFlush(int fd, drmEventBatchPtr batch)
+{
+	if (!batch->count)
+		return;
+
+	batch->handler(fd, batch->events, batch->count, batch->data);
+	batch->stats.events += batch->count;
+	batch->stats.batches++;
+	batch->count = 0;
+}
+
+static void drmEventBatchParse(int fd, drmEventBatchPtr batch, int len)
+{
+	struct drm_event_vblank *vblank;
+	struct drm_event_crtc_sequence *seq;
+	struct drm_event *e;
+	drmEventInfoPtr info;
+	int i = 0;
+
+	while (i < len) {
+		e = (struct drm_event *)(batch->buffer + i);
+		i += e->length;
+
+		info = &batch->events[batch->count];
+		memset(info, 0, sizeof(*info));
+		info->type = e->type;
+
+		switch (e->type) {
+		case DRM_EVENT_VBLANK:
+		case DRM_EVENT_FLIP_COMPLETE:
+			vblank = (struct drm_event_vblank *) e;
+			info->crtc_id = vblank->crtc_id;
+			info->sequence = vblank->sequence;
+			info->time_ns = vblank->tv_sec * 1000000000ull +
+					vblank->tv_usec * 1000ull;
+			info->user_data = vblank->user_data;
+			break;
+		case DRM_EVENT_CRTC_SEQUENCE:
+			seq = (struct drm_event_crtc_sequence *) e;
+			info->sequence = seq->sequence;
+			info->time_ns = seq->time_ns;
+			info->user_data = seq->user_data;
+			break;
+		default:
+			break;
+		}
+
+		if (info->type == DRM_EVENT_VBLANK ||
+		    info->type == DRM_EVENT_FLIP_COMPLETE ||
+		    info->type == DRM_EVENT_CRTC_SEQUENCE)
+			drmLatencyComplete(fd, info->type, info->crtc_id,
+					   info->sequence, info->time_ns,
+					   info->user_data);
+
+		if (++batch->count == DRM_EVENT_BATCH_MAX_EVENTS)
+			drmEventBatchFlush(fd, batch);
+	}
+}
+
+drm_public int drmHandleEventBatch(int fd, drmEventBatchPtr batch)
+{
+	struct pollfd pfd;
+	uint64_t events = batch->stats.events;
+	ssize_t len;
+
+	for (;;) {
+		len = read(fd, batch->buffer, batch->size);
+		batch->stats.reads++;
+		if (len < 0) {
+			/* Whatever was read before is still delivered. */
+			if (errno == EAGAIN || errno == EINTR)
+				break;
+			drmEventBatchFlush(fd, batch);
+			return -1;
+		}
+		if (len < (ssize_t)sizeof(struct drm_event))
+			break;
+
+		drmEventBatchParse(fd, batch, len);
+
+		/* The kernel only stops copying events early when the next
+		 * one does not fit. With room to spare the queue is empty,
+		 * otherwise check for more without blocking. */
+		if (batch->size - len >= DRM_EVENT_BATCH_MIN_SIZE)
+			break;
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN))
+			break;
+	}
+
+	drmEventBatchFlush(fd, batch);
+
+	return batch->stats.events - events;
+}
+
 drm_public int drmModePageFlip(int fd, uint32_t crtc_id, uint32_t fb_id,
 		    uint32_t flags, void *user_data)
 {
 	struct drm_mode_crtc_page_flip flip;
+	uint64_t submit_ns = drmLatencyClock(fd);
+	int ret;
 
 	memclear(flip);
 	flip.fb_id = fb_id;
@@ -966,7 +1460,12 @@ drm_public int drmModePageFlip(int fd, uint32_t crtc_id, uint32_t fb_id,
 	flip.user_data = VOID2U64(user_data);
 	flip.flags = flags;
 
-	return DRM_IOCTL(fd, DRM_IOCTL_MODE_PAGE_FLIP, &flip);
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_PAGE_FLIP, &flip);
+	if (ret == 0 && (flags & DRM_MODE_PAGE_FLIP_EVENT))
+		drmLatencySubmit(fd, submit_ns, DRM_EVENT_FLIP_COMPLETE, crtc_id,
+				 flip.user_data, DRM_LATENCY_TARGET_NEXT, 0);
+
+	return ret;
 }
 
 drm_public int drmModePageFlipTarget(int fd, uint32_t crtc_id, uint32_t fb_id,
@@ -974,6 +1473,9 @@ drm_public int drmModePageFlipTarget(int fd, uint32_t crtc_id, uint32_t fb_id,
 			  uint32_t target_vblank)
 {
 	struct drm_mode_crtc_page_flip_target flip_target;
+	uint64_t submit_ns = drmLatencyClock(fd);
+	int target_mode = DRM_LATENCY_TARGET_NEXT;
+	int ret;
 
 	memclear(flip_target);
 	flip_target.fb_id = fb_id;
@@ -982,7 +1484,18 @@ drm_public int drmModePageFlipTarget(int fd, uint32_t crtc_id, uint32_t fb_id,
 	flip_target.flags = flags;
 	flip_target.sequence = target_vblank;
 
-	return DRM_IOCTL(fd, DRM_IOCTL_MODE_PAGE_FLIP, &flip_target);
+	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_PAGE_FLIP, &flip_target);
+	if (ret == 0 && (flags & DRM_MODE_PAGE_FLIP_EVENT)) {
+		if (flags & DRM_MODE_PAGE_FLIP_TARGET_ABSOLUTE)
+			target_mode = DRM_LATENCY_TARGET_ABSOLUTE;
+		else if (flags & DRM_MODE_PAGE_FLIP_TARGET_RELATIVE)
+			target_mode = DRM_LATENCY_TARGET_RELATIVE;
+		drmLatencySubmit(fd, submit_ns, DRM_EVENT_FLIP_COMPLETE, crtc_id,
+				 flip_target.user_data, target_mode,
+				 target_vblank);
+	}
+
+	return ret;
 }
 
 drm_public int drmModeSetPlane(int fd, uint32_t plane_id, uint32_t crtc_id,
@@ -1375,6 +1888,7 @@ drm_public int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
 	uint32_t *props_ptr = NULL;
 	uint64_t *prop_values_ptr = NULL;
 	uint32_t last_obj_id = 0;
+	uint64_t submit_ns;
 	uint32_t i;
 	int obj_idx = -1;
 	int ret = -1;
@@ -1458,7 +1972,12 @@ drm_public int drmModeAtomicCommit(int fd, drmModeAtomicReqPtr req,
 	atomic.prop_values_ptr = VOID2U64(prop_values_ptr);
 	atomic.user_data = VOID2U64(user_data);
 
+	submit_ns = drmLatencyClock(fd);
 	ret = DRM_IOCTL(fd, DRM_IOCTL_MODE_ATOMIC, &atomic);
+	if (ret == 0 && (flags & DRM_MODE_PAGE_FLIP_EVENT) &&
+	    !(flags & DRM_MODE_ATOMIC_TEST_ONLY))
+		drmLatencySubmit(fd, submit_ns, DRM_EVENT_FLIP_COMPLETE, 0,
+				 atomic.user_data, DRM_LATENCY_TARGET_NEXT, 0);
 
 out:
 	drmFree(objs_ptr);
@@ -1594,3 +2113,1089 @@ drmModeRevokeLease(int fd, uint32_t lessee_id)
 		return 0;
 	return -errno;
 }
+
+/*
+ * State snapshots
+ *
+ * Everything is first gathered into a growable scratch buffer, with the
+ * array pointers of the objects holding offsets into it, and then moved
+ * into a single allocation once the total size is known. The array sizes
+ * recorded in a previous snapshot are used as a first guess for the kernel
+ * queries, falling back to the defaults below for new objects.
+ */
+
+#define SNAPSHOT_DEFAULT_IDS		16
+#define SNAPSHOT_DEFAULT_PROPS		16
+#define SNAPSHOT_DEFAULT_MODES		16
+#define SNAPSHOT_DEFAULT_ENCODERS	4
+#define SNAPSHOT_DEFAULT_FORMATS	32
+
+#define SNAPSHOT_ALIGN(x) (((x) + 7) & ~(size_t)7)
+#define OFF2PTR(x) ((void *)(uintptr_t)(x))
+#define PTR2OFF(x) ((size_t)(uintptr_t)(x))
+
+struct snapshot_builder {
+	int fd;
+	uint32_t flags;
+	drmModeStateSnapshotPtr prev;
+	uint32_t count_ioctls;
+
+	char *data;
+	size_t used;
+	size_t size;
+};
+
+static int snapshot_ioctl(struct snapshot_builder *b, unsigned long request,
+			  void *arg)
+{
+	b->count_ioctls++;
+	return drmIoctl(b->fd, request, arg);
+}
+
+/* Returns the offset of the reserved range, or (size_t)-1 on failure. The
+ * scratch buffer may move, so pointers into it must be recomputed with
+ * snapshot_ptr() after each reservation. */
+static size_t snapshot_reserve(struct snapshot_builder *b, size_t bytes)
+{
+	size_t offset = SNAPSHOT_ALIGN(b->used);
+
+	if (offset + bytes > b->size) {
+		size_t size = b->size ? b->size : 4096;
+		char *data;
+
+		while (size < offset + bytes)
+			size *= 2;
+		data = realloc(b->data, size);
+		if (!data)
+			return (size_t)-1;
+		b->data = data;
+		b->size = size;
+	}
+
+	b->used = offset + bytes;
+	return offset;
+}
+
+static void *snapshot_ptr(struct snapshot_builder *b, size_t offset)
+{
+	return b->data + offset;
+}
+
+static int snapshot_reserve_ids(struct snapshot_builder *b, uint32_t count,
+				size_t *offset)
+{
+	*offset = snapshot_reserve(b, count * sizeof(uint32_t));
+	return *offset == (size_t)-1 ? -ENOMEM : 0;
+}
+
+static int snapshot_get_resources(struct snapshot_builder *b,
+				  drmModeStateSnapshotPtr s,
+				  size_t *crtcs, size_t *connectors,
+				  size_t *encoders)
+{
+	struct drm_mode_card_res res;
+	drmModeStateSnapshotPtr prev = b->prev;
+	uint32_t count_fbs = prev ? prev->count_fbs : SNAPSHOT_DEFAULT_IDS;
+	uint32_t count_crtcs = prev ? prev->count_crtcs : SNAPSHOT_DEFAULT_IDS;
+	uint32_t count_connectors = prev ? prev->count_connectors : SNAPSHOT_DEFAULT_IDS;
+	uint32_t count_encoders = prev ? prev->count_encoders : SNAPSHOT_DEFAULT_IDS;
+	size_t mark = b->used, fbs;
+
+	for (;;) {
+		b->used = mark;
+		if (snapshot_reserve_ids(b, count_fbs, &fbs) ||
+		    snapshot_reserve_ids(b, count_crtcs, crtcs) ||
+		    snapshot_reserve_ids(b, count_connectors, connectors) ||
+		    snapshot_reserve_ids(b, count_encoders, encoders))
+			return -ENOMEM;
+
+		memclear(res);
+		res.count_fbs = count_fbs;
+		res.fb_id_ptr = VOID2U64(snapshot_ptr(b, fbs));
+		res.count_crtcs = count_crtcs;
+		res.crtc_id_ptr = VOID2U64(snapshot_ptr(b, *crtcs));
+		res.count_connectors = count_connectors;
+		res.connector_id_ptr = VOID2U64(snapshot_ptr(b, *connectors));
+		res.count_encoders = count_encoders;
+		res.encoder_id_ptr = VOID2U64(snapshot_ptr(b, *encoders));
+
+		if (snapshot_ioctl(b, DRM_IOCTL_MODE_GETRESOURCES, &res))
+			return -errno;
+
+		if (res.count_fbs <= count_fbs &&
+		    res.count_crtcs <= count_crtcs &&
+		    res.count_connectors <= count_connectors &&
+		    res.count_encoders <= count_encoders)
+			break;
+
+		count_fbs = res.count_fbs;
+		count_crtcs = res.count_crtcs;
+		count_connectors = res.count_connectors;
+		count_encoders = res.count_encoders;
+	}
+
+	s->min_width = res.min_width;
+	s->max_width = res.max_width;
+	s->min_height = res.min_height;
+	s->max_height = res.max_height;
+	s->count_fbs = res.count_fbs;
+	s->fbs = OFF2PTR(fbs);
+	s->count_crtcs = res.count_crtcs;
+	s->count_connectors = res.count_connectors;
+	s->count_encoders = res.count_encoders;
+
+	return 0;
+}
+
+static int snapshot_get_plane_resources(struct snapshot_builder *b,
+					drmModeStateSnapshotPtr s,
+					size_t *planes)
+{
+	struct drm_mode_get_plane_res res;
+	uint32_t count = b->prev ? b->prev->count_planes : SNAPSHOT_DEFAULT_IDS;
+	size_t mark = b->used;
+
+	for (;;) {
+		b->used = mark;
+		if (snapshot_reserve_ids(b, count, planes))
+			return -ENOMEM;
+
+		memclear(res);
+		res.count_planes = count;
+		res.plane_id_ptr = VOID2U64(snapshot_ptr(b, *planes));
+
+		/* Planes are optional, kernels without them report none. */
+		if (snapshot_ioctl(b, DRM_IOCTL_MODE_GETPLANERESOURCES, &res)) {
+			res.count_planes = 0;
+			break;
+		}
+
+		if (res.count_planes <= count)
+			break;
+
+		count = res.count_planes;
+	}
+
+	s->count_planes = res.count_planes;
+
+	return 0;
+}
+
+#define SNAPSHOT_OBJ_ID(objs, obj_size, id_offset, i) \
+	(*(const uint32_t *)((const char *)(objs) + (i) * (obj_size) + (id_offset)))
+
+/* Returns the index of the object with the given ID, or -1. */
+static int snapshot_find_obj(const void *objs, size_t obj_size,
+			     size_t id_offset, int count, int hint, uint32_t id)
+{
+	int i;
+
+	/* IDs are stable, so the object is usually at the same index. */
+	if (hint < count && SNAPSHOT_OBJ_ID(objs, obj_size, id_offset, hint) == id)
+		return hint;
+
+	for (i = 0; i < count; i++)
+		if (SNAPSHOT_OBJ_ID(objs, obj_size, id_offset, i) == id)
+			return i;
+
+	return -1;
+}
+
+static int snapshot_get_props(struct snapshot_builder *b, uint32_t obj_id,
+			      uint32_t obj_type,
+			      drmModeObjectPropertiesPtr prev,
+			      drmModeObjectPropertiesPtr r)
+{
+	struct drm_mode_obj_get_properties properties;
+	uint32_t count = prev ? prev->count_props : SNAPSHOT_DEFAULT_PROPS;
+	size_t mark = b->used, props, values;
+
+	for (;;) {
+		b->used = mark;
+		props = snapshot_reserve(b, count * sizeof(uint32_t));
+		values = snapshot_reserve(b, count * sizeof(uint64_t));
+		if (props == (size_t)-1 || values == (size_t)-1)
+			return -ENOMEM;
+
+		memclear(properties);
+		properties.obj_id = obj_id;
+		properties.obj_type = obj_type;
+		properties.count_props = count;
+		properties.props_ptr = VOID2U64(snapshot_ptr(b, props));
+		properties.prop_values_ptr = VOID2U64(snapshot_ptr(b, values));
+
+		if (snapshot_ioctl(b, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &properties))
+			return -errno;
+
+		if (properties.count_props <= count)
+			break;
+
+		count = properties.count_props;
+	}
+
+	r->count_props = properties.count_props;
+	r->props = OFF2PTR(props);
+	r->prop_values = OFF2PTR(values);
+
+	return 0;
+}
+
+static int snapshot_get_crtc(struct snapshot_builder *b, uint32_t crtc_id,
+			     drmModeCrtcPtr r)
+{
+	struct drm_mode_crtc crtc;
+
+	memclear(crtc);
+	crtc.crtc_id = crtc_id;
+
+	if (snapshot_ioctl(b, DRM_IOCTL_MODE_GETCRTC, &crtc))
+		return -errno;
+
+	r->crtc_id = crtc.crtc_id;
+	r->x = crtc.x;
+	r->y = crtc.y;
+	r->mode_valid = crtc.mode_valid;
+	if (r->mode_valid) {
+		memcpy(&r->mode, &crtc.mode, sizeof(struct drm_mode_modeinfo));
+		r->width = crtc.mode.hdisplay;
+		r->height = crtc.mode.vdisplay;
+	}
+	r->buffer_id = crtc.fb_id;
+	r->gamma_size = crtc.gamma_size;
+
+	return 0;
+}
+
+static int snapshot_get_encoder(struct snapshot_builder *b,
+				uint32_t encoder_id, drmModeEncoderPtr r)
+{
+	struct drm_mode_get_encoder enc;
+
+	memclear(enc);
+	enc.encoder_id = encoder_id;
+
+	if (snapshot_ioctl(b, DRM_IOCTL_MODE_GETENCODER, &enc))
+		return -errno;
+
+	r->encoder_id = enc.encoder_id;
+	r->crtc_id = enc.crtc_id;
+	r->encoder_type = enc.encoder_type;
+	r->possible_crtcs = enc.possible_crtcs;
+	r->possible_clones = enc.possible_clones;
+
+	return 0;
+}
+
+static int snapshot_get_connector(struct snapshot_builder *b,
+				  uint32_t connector_id,
+				  drmModeConnectorPtr prev,
+				  drmModeConnectorPtr r)
+{
+	struct drm_mode_get_connector conn;
+	uint32_t count_props = prev ? prev->count_props : SNAPSHOT_DEFAULT_PROPS;
+	uint32_t count_modes = prev ? prev->count_modes : SNAPSHOT_DEFAULT_MODES;
+	uint32_t count_encoders = prev ? prev->count_encoders : SNAPSHOT_DEFAULT_ENCODERS;
+	size_t mark = b->used, props, values, modes, encoders;
+
+	if (b->flags & DRM_MODE_SNAPSHOT_PROBE) {
+		/* Only a query without a mode array makes the kernel probe. */
+		memclear(conn);
+		conn.connector_id = connector_id;
+		if (snapshot_ioctl(b, DRM_IOCTL_MODE_GETCONNECTOR, &conn))
+			return -errno;
+
+		count_props = conn.count_props;
+		count_modes = conn.count_modes;
+		count_encoders = conn.count_encoders;
+	}
+
+	for (;;) {
+		/* Always pass at least one mode, to avoid a probe. */
+		count_modes = MAX2(count_modes, 1);
+
+		b->used = mark;
+		props = snapshot_reserve(b, count_props * sizeof(uint32_t));
+		values = snapshot_reserve(b, count_props * sizeof(uint64_t));
+		modes = snapshot_reserve(b, count_modes * sizeof(struct drm_mode_modeinfo));
+		encoders = snapshot_reserve(b, count_encoders * sizeof(uint32_t));
+		if (props == (size_t)-1 || values == (size_t)-1 ||
+		    modes == (size_t)-1 || encoders == (size_t)-1)
+			return -ENOMEM;
+
+		memclear(conn);
+		conn.connector_id = connector_id;
+		conn.count_props = count_props;
+		conn.props_ptr = VOID2U64(snapshot_ptr(b, props));
+		conn.prop_values_ptr = VOID2U64(snapshot_ptr(b, values));
+		conn.count_modes = count_modes;
+		conn.modes_ptr = VOID2U64(snapshot_ptr(b, modes));
+		conn.count_encoders = count_encoders;
+		conn.encoders_ptr = VOID2U64(snapshot_ptr(b, encoders));
+
+		if (snapshot_ioctl(b, DRM_IOCTL_MODE_GETCONNECTOR, &conn))
+			return -errno;
+
+		if (conn.count_props <= count_props &&
+		    conn.count_modes <= count_modes &&
+		    conn.count_encoders <= count_encoders)
+			break;
+
+		count_props = conn.count_props;
+		count_modes = conn.count_modes;
+		count_encoders = conn.count_encoders;
+	}
+
+	r->connector_id = conn.connector_id;
+	r->encoder_id = conn.encoder_id;
+	r->connection = conn.connection;
+	r->mmWidth = conn.mm_width;
+	r->mmHeight = conn.mm_height;
+	/* convert subpixel from kernel to userspace */
+	r->subpixel = conn.subpixel + 1;
+	r->count_modes = conn.count_modes;
+	r->modes = OFF2PTR(modes);
+	r->count_props = conn.count_props;
+	r->props = OFF2PTR(props);
+	r->prop_values = OFF2PTR(values);
+	r->count_encoders = conn.count_encoders;
+	r->encoders = OFF2PTR(encoders);
+	r->connector_type = conn.connector_type;
+	r->connector_type_id = conn.connector_type_id;
+
+	return 0;
+}
+
+static int snapshot_get_plane(struct snapshot_builder *b, uint32_t plane_id,
+			      drmModePlanePtr prev, drmModePlanePtr r)
+{
+	struct drm_mode_get_plane ovr;
+	uint32_t count = prev ? prev->count_formats : SNAPSHOT_DEFAULT_FORMATS;
+	size_t mark = b->used, formats;
+
+	for (;;) {
+		b->used = mark;
+		formats = snapshot_reserve(b, count * sizeof(uint32_t));
+		if (formats == (size_t)-1)
+			return -ENOMEM;
+
+		memclear(ovr);
+		ovr.plane_id = plane_id;
+		ovr.count_format_types = count;
+		ovr.format_type_ptr = VOID2U64(snapshot_ptr(b, formats));
+
+		if (snapshot_ioctl(b, DRM_IOCTL_MODE_GETPLANE, &ovr))
+			return -errno;
+
+		if (ovr.count_format_types <= count)
+			break;
+
+		count = ovr.count_format_types;
+	}
+
+	r->count_formats = ovr.count_format_types;
+	r->formats = OFF2PTR(formats);
+	r->plane_id = ovr.plane_id;
+	r->crtc_id = ovr.crtc_id;
+	r->fb_id = ovr.fb_id;
+	r->possible_crtcs = ovr.possible_crtcs;
+	r->gamma_size = ovr.gamma_size;
+
+	return 0;
+}
+
+static void snapshot_rebase_props(drmModeObjectPropertiesPtr props,
+				  char *base)
+{
+	if (props->count_props) {
+		props->props = (uint32_t *)(base + PTR2OFF(props->props));
+		props->prop_values = (uint64_t *)(base + PTR2OFF(props->prop_values));
+	} else {
+		props->props = NULL;
+		props->prop_values = NULL;
+	}
+}
+
+/* Move the objects and the scratch data into the final allocation and turn
+ * the recorded offsets back into pointers. */
+static drmModeStateSnapshotPtr
+snapshot_finish(struct snapshot_builder *b, drmModeStateSnapshotPtr s)
+{
+	size_t crtcs_size = s->count_crtcs * sizeof(drmModeCrtc);
+	size_t connectors_size = s->count_connectors * sizeof(drmModeConnector);
+	size_t encoders_size = s->count_encoders * sizeof(drmModeEncoder);
+	size_t planes_size = s->count_planes * sizeof(drmModePlane);
+	size_t props_size = (s->count_crtcs + s->count_connectors + s->count_planes) *
+			    sizeof(drmModeObjectProperties);
+	size_t size;
+	drmModeStateSnapshotPtr r;
+	char *p, *base;
+	int i;
+
+	size = SNAPSHOT_ALIGN(sizeof(*s)) + SNAPSHOT_ALIGN(crtcs_size) +
+	       SNAPSHOT_ALIGN(connectors_size) + SNAPSHOT_ALIGN(encoders_size) +
+	       SNAPSHOT_ALIGN(planes_size) + SNAPSHOT_ALIGN(props_size) +
+	       b->used;
+
+	r = malloc(size);
+	if (!r)
+		return NULL;
+
+	*r = *s;
+	r->size = size;
+	r->count_ioctls = b->count_ioctls;
+
+	p = (char *)r + SNAPSHOT_ALIGN(sizeof(*s));
+	r->crtcs = memcpy(p, s->crtcs, crtcs_size);
+	p += SNAPSHOT_ALIGN(crtcs_size);
+	r->connectors = memcpy(p, s->connectors, connectors_size);
+	p += SNAPSHOT_ALIGN(connectors_size);
+	r->encoders = memcpy(p, s->encoders, encoders_size);
+	p += SNAPSHOT_ALIGN(encoders_size);
+	r->planes = memcpy(p, s->planes, planes_size);
+	p += SNAPSHOT_ALIGN(planes_size);
+	r->crtc_props = memcpy(p, s->crtc_props,
+			       s->count_crtcs * sizeof(drmModeObjectProperties));
+	r->connector_props = memcpy(r->crtc_props + s->count_crtcs,
+				    s->connector_props,
+				    s->count_connectors * sizeof(drmModeObjectProperties));
+	r->plane_props = memcpy(r->connector_props + s->count_connectors,
+				s->plane_props,
+				s->count_planes * sizeof(drmModeObjectProperties));
+	p += SNAPSHOT_ALIGN(props_size);
+	base = memcpy(p, b->data, b->used);
+
+	r->fbs = r->count_fbs ? (uint32_t *)(base + PTR2OFF(s->fbs)) : NULL;
+
+	for (i = 0; i < r->count_crtcs; i++)
+		snapshot_rebase_props(&r->crtc_props[i], base);
+
+	for (i = 0; i < r->count_connectors; i++) {
+		drmModeConnectorPtr c = &r->connectors[i];
+
+		c->modes = c->count_modes ?
+			(drmModeModeInfoPtr)(base + PTR2OFF(c->modes)) : NULL;
+		c->props = c->count_props ?
+			(uint32_t *)(base + PTR2OFF(c->props)) : NULL;
+		c->prop_values = c->count_props ?
+			(uint64_t *)(base + PTR2OFF(c->prop_values)) : NULL;
+		c->encoders = c->count_encoders ?
+			(uint32_t *)(base + PTR2OFF(c->encoders)) : NULL;
+		snapshot_rebase_props(&r->connector_props[i], base);
+	}
+
+	for (i = 0; i < r->count_planes; i++) {
+		drmModePlanePtr pl = &r->planes[i];
+
+		pl->formats = pl->count_formats ?
+			(uint32_t *)(base + PTR2OFF(pl->formats)) : NULL;
+		snapshot_rebase_props(&r->plane_props[i], base);
+	}
+
+	return r;
+}
+
+drm_public drmModeStateSnapshotPtr
+drmModeGetStateSnapshot(int fd, drmModeStateSnapshotPtr prev, uint32_t flags)
+{
+	struct snapshot_builder b;
+	drmModeStateSnapshot s;
+	drmModeStateSnapshotPtr r = NULL;
+	size_t crtcs, connectors, encoders, planes;
+	int props = !(flags & DRM_MODE_SNAPSHOT_NO_PROPERTIES);
+	int i, j, ret;
+
+	memclear(b);
+	memclear(s);
+	b.fd = fd;
+	b.flags = flags;
+	b.prev = prev;
+
+	ret = snapshot_get_resources(&b, &s, &crtcs, &connectors, &encoders);
+	if (!ret)
+		ret = snapshot_get_plane_resources(&b, &s, &planes);
+	if (ret)
+		goto out;
+
+	s.crtcs = drmMalloc(s.count_crtcs * sizeof(*s.crtcs) + 1);
+	s.crtc_props = drmMalloc(s.count_crtcs * sizeof(*s.crtc_props) + 1);
+	s.connectors = drmMalloc(s.count_connectors * sizeof(*s.connectors) + 1);
+	s.connector_props = drmMalloc(s.count_connectors * sizeof(*s.connector_props) + 1);
+	s.encoders = drmMalloc(s.count_encoders * sizeof(*s.encoders) + 1);
+	s.planes = drmMalloc(s.count_planes * sizeof(*s.planes) + 1);
+	s.plane_props = drmMalloc(s.count_planes * sizeof(*s.plane_props) + 1);
+	if (!s.crtcs || !s.crtc_props || !s.connectors || !s.connector_props ||
+	    !s.encoders || !s.planes || !s.plane_props)
+		goto out;
+
+	/* The ID lists live in the scratch buffer, which may move while the
+	 * objects are gathered, so index them through their offsets. */
+#define SNAPSHOT_ID(off, i) (((uint32_t *)snapshot_ptr(&b, (off)))[i])
+
+	for (i = 0; i < s.count_crtcs; i++) {
+		uint32_t id = SNAPSHOT_ID(crtcs, i);
+
+		j = prev ? snapshot_find_obj(prev->crtcs, sizeof(drmModeCrtc),
+					     offsetof(drmModeCrtc, crtc_id),
+					     prev->count_crtcs, i, id) : -1;
+
+		ret = snapshot_get_crtc(&b, id, &s.crtcs[i]);
+		if (!ret && props)
+			ret = snapshot_get_props(&b, id, DRM_MODE_OBJECT_CRTC,
+						 j < 0 ? NULL : &prev->crtc_props[j],
+						 &s.crtc_props[i]);
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < s.count_connectors; i++) {
+		uint32_t id = SNAPSHOT_ID(connectors, i);
+
+		j = prev ? snapshot_find_obj(prev->connectors,
+					     sizeof(drmModeConnector),
+					     offsetof(drmModeConnector, connector_id),
+					     prev->count_connectors, i, id) : -1;
+
+		ret = snapshot_get_connector(&b, id,
+					     j < 0 ? NULL : &prev->connectors[j],
+					     &s.connectors[i]);
+		if (ret)
+			goto out;
+
+		/* The connector query returns its properties as well. */
+		if (props) {
+			s.connector_props[i].count_props = s.connectors[i].count_props;
+			s.connector_props[i].props = s.connectors[i].props;
+			s.connector_props[i].prop_values = s.connectors[i].prop_values;
+		}
+	}
+
+	for (i = 0; i < s.count_encoders; i++) {
+		ret = snapshot_get_encoder(&b, SNAPSHOT_ID(encoders, i),
+					   &s.encoders[i]);
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < s.count_planes; i++) {
+		uint32_t id = SNAPSHOT_ID(planes, i);
+
+		j = prev ? snapshot_find_obj(prev->planes, sizeof(drmModePlane),
+					     offsetof(drmModePlane, plane_id),
+					     prev->count_planes, i, id) : -1;
+
+		ret = snapshot_get_plane(&b, id, j < 0 ? NULL : &prev->planes[j],
+					 &s.planes[i]);
+		if (!ret && props)
+			ret = snapshot_get_props(&b, id, DRM_MODE_OBJECT_PLANE,
+						 j < 0 ? NULL : &prev->plane_props[j],
+						 &s.plane_props[i]);
+		if (ret)
+			goto out;
+	}
+
+#undef SNAPSHOT_ID
+
+	r = snapshot_finish(&b, &s);
+
+out:
+	drmFree(s.crtcs);
+	drmFree(s.crtc_props);
+	drmFree(s.connectors);
+	drmFree(s.connector_props);
+	drmFree(s.encoders);
+	drmFree(s.planes);
+	drmFree(s.plane_props);
+	free(b.data);
+
+	return r;
+}
+
+drm_public void drmModeFreeStateSnapshot(drmModeStateSnapshotPtr ptr)
+{
+	free(ptr);
+}
+
+static int snapshot_props_equal(drmModeObjectPropertiesPtr a,
+				drmModeObjectPropertiesPtr b)
+{
+	return a->count_props == b->count_props &&
+	       !memcmp(a->props, b->props, a->count_props * sizeof(uint32_t)) &&
+	       !memcmp(a->prop_values, b->prop_values,
+		       a->count_props * sizeof(uint64_t));
+}
+
+static int snapshot_crtc_equal(const void *pa, const void *pb)
+{
+	const drmModeCrtc *a = pa, *b = pb;
+
+	return a->buffer_id == b->buffer_id &&
+	       a->x == b->x && a->y == b->y &&
+	       a->width == b->width && a->height == b->height &&
+	       a->mode_valid == b->mode_valid &&
+	       !memcmp(&a->mode, &b->mode, sizeof(a->mode)) &&
+	       a->gamma_size == b->gamma_size;
+}
+
+static int snapshot_connector_equal(const void *pa, const void *pb)
+{
+	const drmModeConnector *a = pa, *b = pb;
+
+	return a->encoder_id == b->encoder_id &&
+	       a->connection == b->connection &&
+	       a->mmWidth == b->mmWidth && a->mmHeight == b->mmHeight &&
+	       a->subpixel == b->subpixel &&
+	       a->count_modes == b->count_modes &&
+	       !memcmp(a->modes, b->modes, a->count_modes * sizeof(*a->modes)) &&
+	       a->count_encoders == b->count_encoders &&
+	       !memcmp(a->encoders, b->encoders,
+		       a->count_encoders * sizeof(uint32_t)) &&
+	       a->count_props == b->count_props &&
+	       !memcmp(a->props, b->props, a->count_props * sizeof(uint32_t)) &&
+	       !memcmp(a->prop_values, b->prop_values,
+		       a->count_props * sizeof(uint64_t));
+}
+
+static int snapshot_encoder_equal(const void *pa, const void *pb)
+{
+	const drmModeEncoder *a = pa, *b = pb;
+
+	return a->encoder_type == b->encoder_type &&
+	       a->crtc_id == b->crtc_id &&
+	       a->possible_crtcs == b->possible_crtcs &&
+	       a->possible_clones == b->possible_clones;
+}
+
+static int snapshot_plane_equal(const void *pa, const void *pb)
+{
+	const drmModePlane *a = pa, *b = pb;
+
+	return a->crtc_id == b->crtc_id && a->fb_id == b->fb_id &&
+	       a->possible_crtcs == b->possible_crtcs &&
+	       a->gamma_size == b->gamma_size &&
+	       a->count_formats == b->count_formats &&
+	       !memcmp(a->formats, b->formats,
+		       a->count_formats * sizeof(uint32_t));
+}
+
+struct snapshot_diff {
+	uint32_t *ids;
+	int max_ids;
+	int count;
+};
+
+static void snapshot_diff_add(struct snapshot_diff *d, uint32_t id)
+{
+	if (d->count < d->max_ids)
+		d->ids[d->count] = id;
+	d->count++;
+}
+
+static void snapshot_diff_objects(struct snapshot_diff *d, size_t obj_size,
+				  size_t id_offset,
+				  int (*equal)(const void *, const void *),
+				  const void *old_objs, int old_count,
+				  drmModeObjectPropertiesPtr old_props,
+				  const void *cur_objs, int cur_count,
+				  drmModeObjectPropertiesPtr cur_props)
+{
+	int i, j;
+
+	for (i = 0; i < cur_count; i++) {
+		uint32_t id = SNAPSHOT_OBJ_ID(cur_objs, obj_size, id_offset, i);
+
+		j = snapshot_find_obj(old_objs, obj_size, id_offset,
+				      old_count, i, id);
+		if (j < 0 ||
+		    !equal((const char *)old_objs + j * obj_size,
+			   (const char *)cur_objs + i * obj_size) ||
+		    (old_props && !snapshot_props_equal(&old_props[j],
+							&cur_props[i])))
+			snapshot_diff_add(d, id);
+	}
+
+	for (j = 0; j < old_count; j++) {
+		uint32_t id = SNAPSHOT_OBJ_ID(old_objs, obj_size, id_offset, j);
+
+		if (snapshot_find_obj(cur_objs, obj_size, id_offset,
+				      cur_count, j, id) < 0)
+			snapshot_diff_add(d, id);
+	}
+}
+
+drm_public int drmModeStateSnapshotDiff(drmModeStateSnapshotPtr old,
+					drmModeStateSnapshotPtr cur,
+					uint32_t *ids, int max_ids)
+{
+	struct snapshot_diff d;
+
+	if (!old || !cur)
+		return -EINVAL;
+
+	d.ids = ids;
+	d.max_ids = max_ids;
+	d.count = 0;
+
+	snapshot_diff_objects(&d, sizeof(drmModeCrtc),
+			      offsetof(drmModeCrtc, crtc_id),
+			      snapshot_crtc_equal,
+			      old->crtcs, old->count_crtcs, old->crtc_props,
+			      cur->crtcs, cur->count_crtcs, cur->crtc_props);
+	snapshot_diff_objects(&d, sizeof(drmModeConnector),
+			      offsetof(drmModeConnector, connector_id),
+			      snapshot_connector_equal,
+			      old->connectors, old->count_connectors, NULL,
+			      cur->connectors, cur->count_connectors, NULL);
+	snapshot_diff_objects(&d, sizeof(drmModeEncoder),
+			      offsetof(drmModeEncoder, encoder_id),
+			      snapshot_encoder_equal,
+			      old->encoders, old->count_encoders, NULL,
+			      cur->encoders, cur->count_encoders, NULL);
+	snapshot_diff_objects(&d, sizeof(drmModePlane),
+			      offsetof(drmModePlane, plane_id),
+			      snapshot_plane_equal,
+			      old->planes, old->count_planes, old->plane_props,
+			      cur->planes, cur->count_planes, cur->plane_props);
+
+	return d.count;
+}
+
+/*
+ * Latency instrumentation
+ */
+
+#define LATENCY_MAX_PENDING	64
+#define LATENCY_MAX_CRTCS	16
+#define LATENCY_MAX_AGE_NS	1000000000ull
+
+struct latency_pending {
+	int in_use;
+	uint32_t event_type;
+	uint32_t crtc_id;
+	int target_mode;
+	uint64_t target;
+	uint64_t user_data;
+	uint64_t submit_ns;
+	uint32_t done_crtcs; /* mask of latency_state::crtcs indices */
+};
+
+struct latency_crtc {
+	drmModeCrtcLatency stats;
+	int in_use;
+	uint64_t last_sequence;
+	uint64_t last_ns;
+	uint64_t last_interval_ns;
+	uint64_t period_ns;
+};
+
+struct latency_state {
+	int fd;
+	struct latency_state *next;
+	struct latency_pending pending[LATENCY_MAX_PENDING];
+	struct latency_crtc crtcs[LATENCY_MAX_CRTCS];
+};
+
+static pthread_mutex_t latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct latency_state *latency_list;
+
+static struct latency_state *latency_lookup(int fd)
+{
+	struct latency_state *state;
+
+	for (state = latency_list; state; state = state->next)
+		if (state->fd == fd)
+			return state;
+
+	return NULL;
+}
+
+drm_public int drmModeLatencyEnable(int fd)
+{
+	struct latency_state *state;
+	int ret = 0;
+
+	pthread_mutex_lock(&latency_mutex);
+	if (!latency_lookup(fd)) {
+		state = drmMalloc(sizeof(*state));
+		if (state) {
+			state->fd = fd;
+			state->next = latency_list;
+			latency_list = state;
+		} else {
+			ret = -ENOMEM;
+		}
+	}
+	pthread_mutex_unlock(&latency_mutex);
+
+	return ret;
+}
+
+drm_public void drmModeLatencyDisable(int fd)
+{
+	struct latency_state **p, *state;
+
+	pthread_mutex_lock(&latency_mutex);
+	for (p = &latency_list; (state = *p); p = &state->next) {
+		if (state->fd == fd) {
+			*p = state->next;
+			drmFree(state);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&latency_mutex);
+}
+
+drm_public void drmModeLatencyReset(int fd)
+{
+	struct latency_state *state;
+	struct latency_state *next;
+
+	pthread_mutex_lock(&latency_mutex);
+	state = latency_lookup(fd);
+	if (state) {
+		next = state->next;
+		memset(state, 0, sizeof(*state));
+		state->fd = fd;
+		state->next = next;
+	}
+	pthread_mutex_unlock(&latency_mutex);
+}
+
+drm_public int drmModeLatencyGetStats(int fd, drmModeCrtcLatencyPtr stats,
+				      int max_crtcs)
+{
+	struct latency_state *state;
+	int i, count = 0;
+
+	pthread_mutex_lock(&latency_mutex);
+	state = latency_lookup(fd);
+	if (!state) {
+		pthread_mutex_unlock(&latency_mutex);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < LATENCY_MAX_CRTCS; i++) {
+		if (!state->crtcs[i].in_use)
+			continue;
+		if (count < max_crtcs)
+			stats[count] = state->crtcs[i].stats;
+		count++;
+	}
+	pthread_mutex_unlock(&latency_mutex);
+
+	return count;
+}
+
+drm_private uint64_t drmLatencyClock(int fd)
+{
+	struct timespec ts;
+	int instrumented;
+
+	pthread_mutex_lock(&latency_mutex);
+	instrumented = latency_lookup(fd) != NULL;
+	pthread_mutex_unlock(&latency_mutex);
+	if (!instrumented)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+drm_private void drmLatencySubmit(int fd, uint64_t submit_ns,
+				  uint32_t event_type, uint32_t crtc_id,
+				  uint64_t user_data, int target_mode,
+				  uint64_t target)
+{
+	struct latency_state *state;
+	struct latency_pending *p = NULL;
+	int i;
+
+	if (!submit_ns)
+		return;
+
+	pthread_mutex_lock(&latency_mutex);
+	state = latency_lookup(fd);
+	if (state) {
+		/* The oldest submission is dropped when the table is full,
+		 * which also ages out atomic commits spanning several CRTCs. */
+		for (i = 0; i < LATENCY_MAX_PENDING; i++) {
+			if (!state->pending[i].in_use) {
+				p = &state->pending[i];
+				break;
+			}
+			if (!p || state->pending[i].submit_ns < p->submit_ns)
+				p = &state->pending[i];
+		}
+		p->in_use = 1;
+		p->event_type = event_type;
+		p->crtc_id = crtc_id;
+		p->target_mode = target_mode;
+		p->target = target;
+		p->user_data = user_data;
+		p->submit_ns = submit_ns;
+		p->done_crtcs = 0;
+	}
+	pthread_mutex_unlock(&latency_mutex);
+}
+
+static void latency_histogram_add(drmModeLatencyHistogramPtr h, uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int bucket = 0;
+
+	while (us > 1 && bucket < DRM_MODE_LATENCY_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+
+	if (!h->count || ns < h->min_ns)
+		h->min_ns = ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+	h->total_ns += ns;
+	h->count++;
+	h->buckets[bucket]++;
+}
+
+static struct latency_crtc *latency_get_crtc(struct latency_state *state,
+					     uint32_t crtc_id)
+{
+	int i;
+
+	for (i = 0; i < LATENCY_MAX_CRTCS; i++)
+		if (state->crtcs[i].in_use &&
+		    state->crtcs[i].stats.crtc_id == crtc_id)
+			return &state->crtcs[i];
+
+	for (i = 0; i < LATENCY_MAX_CRTCS; i++) {
+		if (!state->crtcs[i].in_use) {
+			state->crtcs[i].in_use = 1;
+			state->crtcs[i].stats.crtc_id = crtc_id;
+			return &state->crtcs[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Returns the oldest submission matching the event. Atomic commits and
+ * vblank waits are recorded without a CRTC; commits match once on each
+ * CRTC. */
+static struct latency_pending *
+latency_find_pending(struct latency_state *state, uint32_t event_type,
+		     uint32_t crtc_id, uint32_t crtc_mask, uint64_t user_data,
+		     uint64_t time_ns)
+{
+	struct latency_pending *p, *found = NULL;
+	int i;
+
+	for (i = 0; i < LATENCY_MAX_PENDING; i++) {
+		p = &state->pending[i];
+		if (!p->in_use)
+			continue;
+
+		/* Stale entries, e.g. atomic commits not touching every CRTC,
+		 * must not match events of later submissions. */
+		if (time_ns > p->submit_ns + LATENCY_MAX_AGE_NS) {
+			p->in_use = 0;
+			continue;
+		}
+
+		if (p->event_type != event_type || p->user_data != user_data ||
+		    (p->crtc_id && crtc_id && p->crtc_id != crtc_id) ||
+		    (p->done_crtcs & crtc_mask))
+			continue;
+
+		if (!found || p->submit_ns < found->submit_ns)
+			found = p;
+	}
+
+	return found;
+}
+
+/* The sequence the submission was expected to complete at, estimated from
+ * the previous completion and the refresh period when it was not given. */
+static int latency_expected(struct latency_crtc *crtc,
+			    struct latency_pending *p, uint64_t *expected)
+{
+	uint64_t base;
+
+	if (p->target_mode == DRM_LATENCY_TARGET_ABSOLUTE) {
+		*expected = p->target;
+		return 1;
+	}
+
+	if (!crtc->period_ns || !crtc->last_ns)
+		return 0;
+
+	base = crtc->last_sequence;
+	if (p->submit_ns > crtc->last_ns)
+		base += (p->submit_ns - crtc->last_ns) / crtc->period_ns;
+
+	if (p->target_mode == DRM_LATENCY_TARGET_RELATIVE)
+		*expected = base + p->target;
+	else
+		*expected = base + 1;
+
+	return 1;
+}
+
+drm_private void drmLatencyComplete(int fd, uint32_t event_type,
+				    uint32_t crtc_id, uint64_t sequence,
+				    uint64_t time_ns, uint64_t user_data)
+{
+	struct latency_state *state;
+	struct latency_pending *p;
+	struct latency_crtc *crtc;
+	uint64_t expected, interval;
+
+	pthread_mutex_lock(&latency_mutex);
+	state = latency_lookup(fd);
+	if (!state)
+		goto out;
+
+	crtc = crtc_id ? latency_get_crtc(state, crtc_id) : NULL;
+	p = latency_find_pending(state, event_type, crtc_id,
+				 crtc ? 1u << (crtc - state->crtcs) : 0,
+				 user_data, time_ns);
+	if (!p)
+		goto out;
+
+	/* CRTC sequence events do not carry the CRTC, the request does. */
+	if (!crtc)
+		crtc = latency_get_crtc(state, p->crtc_id);
+	if (!crtc)
+		goto out;
+
+	crtc->stats.completions++;
+	if (time_ns > p->submit_ns)
+		latency_histogram_add(&crtc->stats.submit_to_event,
+				      time_ns - p->submit_ns);
+
+	if (latency_expected(crtc, p, &expected) && sequence > expected)
+		crtc->stats.missed_vblanks += sequence - expected;
+
+	if (crtc->last_ns && time_ns > crtc->last_ns &&
+	    sequence > crtc->last_sequence) {
+		interval = time_ns - crtc->last_ns;
+		latency_histogram_add(&crtc->stats.interval, interval);
+		if (crtc->last_interval_ns)
+			latency_histogram_add(&crtc->stats.jitter,
+					      interval > crtc->last_interval_ns ?
+					      interval - crtc->last_interval_ns :
+					      crtc->last_interval_ns - interval);
+		crtc->last_interval_ns = interval;
+		crtc->period_ns = interval / (sequence - crtc->last_sequence);
+	}
+	crtc->last_sequence = sequence;
+	crtc->last_ns = time_ns;
+
+	/* An atomic commit sends one event per CRTC, keep it around until
+	 * it ages out. A vblank wait sends a single one. */
+	if (p->crtc_id || !crtc_id || p->event_type != DRM_EVENT_FLIP_COMPLETE)
+		p->in_use = 0;
+	else
+		p->done_crtcs |= 1u << (crtc - state->crtcs);
+
+out:
+	pthread_mutex_unlock(&latency_mutex);
+}
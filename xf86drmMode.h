@@ -465,6 +465,27 @@ extern int drmModeDetachMode(int fd, uint32_t connectorId, drmModeModeInfoPtr mo
 extern drmModePropertyPtr drmModeGetProperty(int fd, uint32_t propertyId);
 extern void drmModeFreeProperty(drmModePropertyPtr ptr);
 
+/*
+ * Property definition cache
+ *
+ * Once enabled for an fd, drmModeGetProperty() answers repeated lookups of a
+ * property definition from memory and drmModeObjectGetPropertyByName() looks
+ * up properties by name without walking every property of the object.
+ * libdrm does not listen for uevents, so clients should call
+ * drmModePropertyCacheInvalidate() from their hotplug handler.
+ *
+ * The cache is keyed by the fd number, not by the device. It must be
+ * disabled with drmModePropertyCacheDisable() before the fd is closed,
+ * otherwise a later fd reusing the number sees this device's properties.
+ */
+extern int drmModePropertyCacheEnable(int fd);
+extern void drmModePropertyCacheDisable(int fd);
+extern void drmModePropertyCacheInvalidate(int fd);
+extern drmModePropertyPtr drmModeObjectGetPropertyByName(int fd,
+						uint32_t object_id,
+						uint32_t object_type,
+						const char *name);
+
 extern drmModePropertyBlobPtr drmModeGetPropertyBlob(int fd, uint32_t blob_id);
 extern void drmModeFreePropertyBlob(drmModePropertyBlobPtr ptr);
 extern int drmModeConnectorSetProperty(int fd, uint32_t connector_id, uint32_t property_id,
@@ -544,6 +565,105 @@ extern drmModeObjectListPtr drmModeGetLease(int fd);
 
 extern int drmModeRevokeLease(int fd, uint32_t lessee_id);
 
+/*
+ * KMS state snapshots. A snapshot holds every CRTC, connector, encoder and
+ * plane of a device, plus their properties, in a single allocation which is
+ * released with one drmModeFreeStateSnapshot() call.
+ */
+
+/* Force a probe of the connectors, like drmModeGetConnector() does. */
+#define DRM_MODE_SNAPSHOT_PROBE		(1 << 0)
+/* Do not gather the object properties. */
+#define DRM_MODE_SNAPSHOT_NO_PROPERTIES	(1 << 1)
+
+typedef struct _drmModeStateSnapshot {
+	uint32_t min_width, max_width;
+	uint32_t min_height, max_height;
+
+	int count_fbs;
+	uint32_t *fbs;
+
+	int count_crtcs;
+	drmModeCrtcPtr crtcs;
+	drmModeObjectPropertiesPtr crtc_props; /**< count_crtcs entries */
+
+	int count_connectors;
+	drmModeConnectorPtr connectors;
+	drmModeObjectPropertiesPtr connector_props; /**< count_connectors entries */
+
+	int count_encoders;
+	drmModeEncoderPtr encoders;
+
+	int count_planes;
+	drmModePlanePtr planes;
+	drmModeObjectPropertiesPtr plane_props; /**< count_planes entries */
+
+	uint32_t count_ioctls; /**< ioctls issued to build the snapshot */
+	size_t size; /**< size in bytes of the snapshot allocation */
+} drmModeStateSnapshot, *drmModeStateSnapshotPtr;
+
+/**
+ * Gather the complete modesetting state of the device in one go.
+ *
+ * If \p prev is a previous snapshot of the same device, the array sizes it
+ * recorded are used to size the kernel queries, so that an unchanged object
+ * costs a single ioctl. The property arrays are only filled in when
+ * DRM_MODE_SNAPSHOT_NO_PROPERTIES is not set, and are zeroed otherwise.
+ */
+extern drmModeStateSnapshotPtr drmModeGetStateSnapshot(int fd,
+						       drmModeStateSnapshotPtr prev,
+						       uint32_t flags);
+extern void drmModeFreeStateSnapshot(drmModeStateSnapshotPtr ptr);
+
+/**
+ * Compare two snapshots of the same device and store the IDs of the objects
+ * which were added, removed or changed in \p ids, up to \p max_ids entries.
+ *
+ * Returns the total number of such objects, which may exceed \p max_ids.
+ */
+extern int drmModeStateSnapshotDiff(drmModeStateSnapshotPtr old,
+				    drmModeStateSnapshotPtr cur,
+				    uint32_t *ids, int max_ids);
+
+/*
+ * Display latency instrumentation. Once enabled for an fd, page flips,
+ * atomic commits, vblank waits and CRTC sequence requests asking for an
+ * event are timestamped, and matched against their completion event in
+ * drmHandleEvent() or drmHandleEventBatch().
+ */
+
+#define DRM_MODE_LATENCY_BUCKETS 32
+
+typedef struct _drmModeLatencyHistogram {
+	uint64_t count;
+	uint64_t min_ns, max_ns, total_ns;
+	/* Bucket n counts the samples in [2^n, 2^(n+1)) microseconds, with
+	 * bucket 0 also holding anything below 1us. */
+	uint64_t buckets[DRM_MODE_LATENCY_BUCKETS];
+} drmModeLatencyHistogram, *drmModeLatencyHistogramPtr;
+
+typedef struct _drmModeCrtcLatency {
+	uint32_t crtc_id; /**< 0 for events from kernels not reporting it */
+	uint64_t completions;
+	uint64_t missed_vblanks;
+	drmModeLatencyHistogram submit_to_event; /**< submission to completion */
+	drmModeLatencyHistogram interval; /**< between two completions */
+	drmModeLatencyHistogram jitter; /**< change of the interval */
+} drmModeCrtcLatency, *drmModeCrtcLatencyPtr;
+
+extern int drmModeLatencyEnable(int fd);
+extern void drmModeLatencyDisable(int fd);
+extern void drmModeLatencyReset(int fd);
+
+/**
+ * Copy the statistics of up to \p max_crtcs CRTCs to \p stats.
+ *
+ * Returns the number of CRTCs with statistics, which may exceed
+ * \p max_crtcs, or a negative error code if \p fd is not instrumented.
+ */
+extern int drmModeLatencyGetStats(int fd, drmModeCrtcLatencyPtr stats,
+				  int max_crtcs);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,56 @@
+/*
+ * Copyright © 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER(S) OR AUTHOR(S) BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Functions shared between the libdrm translation units, not exported. */
+
+#ifndef _XF86DRMPRIV_H_
+#define _XF86DRMPRIV_H_
+
+#include <stdint.h>
+
+#include "libdrm_macros.h"
+
+/*
+ * Latency instrumentation, see drmModeLatencyEnable().
+ */
+
+/* How the target sequence of a submission is expressed. */
+#define DRM_LATENCY_TARGET_NEXT		0	/* next vblank */
+#define DRM_LATENCY_TARGET_ABSOLUTE	1
+#define DRM_LATENCY_TARGET_RELATIVE	2
+
+/* Returns the submission timestamp to pass to drmLatencySubmit(), or 0
+ * when the fd is not instrumented. */
+drm_private uint64_t drmLatencyClock(int fd);
+
+/* Record a submission which will complete with an event of the given
+ * type. crtc_id may be 0 when unknown at submission time. */
+drm_private void drmLatencySubmit(int fd, uint64_t submit_ns,
+				  uint32_t event_type, uint32_t crtc_id,
+				  uint64_t user_data, int target_mode,
+				  uint64_t target);
+
+drm_private void drmLatencyComplete(int fd, uint32_t event_type,
+				    uint32_t crtc_id, uint64_t sequence,
+				    uint64_t time_ns, uint64_t user_data);
+
+#endif
@@ -0,0 +1,209 @@
+/* xf86drmReaper.c -- Shared background thread for cache maintenance
+ *
+ * Copyright 2019 Advanced Micro Devices, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * DESCRIPTION
+ *
+ * The buffer object caches of the driver libraries free expired buffers
+ * from whichever thread happens to release a buffer, which makes that
+ * release as slow as a batch of GEM_CLOSE ioctls and munmaps.  The reaper
+ * lets them move this work to one thread shared by the whole process.
+ *
+ * Callbacks are run one at a time, each on its own schedule.  The thread
+ * is started by the first registration and exits once the last callback
+ * is unregistered.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "libdrm_macros.h"
+#include "xf86drm.h"
+
+typedef struct _drmReaperEntry {
+    struct _drmReaperEntry *next;
+    drmReaperFunc          func;
+    void                   *data;
+    uint64_t               interval_ns;
+    uint64_t               due_ns;
+} drmReaperEntry;
+
+static pthread_once_t  reaper_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t reaper_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  reaper_wake;    /* entry added or kicked */
+static pthread_cond_t  reaper_idle;    /* callback finished */
+static drmReaperEntry  *reaper_entries;
+static drmReaperEntry  *reaper_current;
+static pthread_t       reaper_thread;
+static int             reaper_running;
+
+static uint64_t drmReaperNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void drmReaperInit(void)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&reaper_wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&reaper_idle, NULL);
+}
+
+static void *drmReaperThread(void *arg)
+{
+    pthread_mutex_lock(&reaper_mutex);
+    while (reaper_entries) {
+        drmReaperEntry *entry, *next = reaper_entries;
+        uint64_t now = drmReaperNow();
+
+        for (entry = reaper_entries->next; entry; entry = entry->next)
+            if (entry->due_ns < next->due_ns)
+                next = entry;
+
+        if (next->due_ns > now) {
+            struct timespec ts;
+
+            ts.tv_sec = next->due_ns / 1000000000ull;
+            ts.tv_nsec = next->due_ns % 1000000000ull;
+            pthread_cond_timedwait(&reaper_wake, &reaper_mutex, &ts);
+            continue;
+        }
+
+        next->due_ns = now + next->interval_ns;
+        reaper_current = next;
+        pthread_mutex_unlock(&reaper_mutex);
+
+        next->func(next->data);
+
+        pthread_mutex_lock(&reaper_mutex);
+        reaper_current = NULL;
+        pthread_cond_broadcast(&reaper_idle);
+    }
+    reaper_running = 0;
+    pthread_mutex_unlock(&reaper_mutex);
+
+    return NULL;
+}
+
+/**
+ * Run \p func(\p data) in the background every \p interval_ms milliseconds.
+ *
+ * \return an opaque handle for drmReaperKick() and drmReaperUnregister(),
+ * or NULL on failure.
+ */
+drm_public void *drmReaperRegister(drmReaperFunc func, void *data,
+                                   unsigned int interval_ms)
+{
+    drmReaperEntry *entry;
+
+    if (!func || !interval_ms)
+        return NULL;
+
+    pthread_once(&reaper_once, drmReaperInit);
+
+    entry = drmMalloc(sizeof(*entry));
+    if (!entry)
+        return NULL;
+
+    entry->func = func;
+    entry->data = data;
+    entry->interval_ns = interval_ms * 1000000ull;
+    entry->due_ns = drmReaperNow() + entry->interval_ns;
+
+    pthread_mutex_lock(&reaper_mutex);
+    if (!reaper_running) {
+        pthread_attr_t attr;
+        int ret;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        ret = pthread_create(&reaper_thread, &attr, drmReaperThread, NULL);
+        pthread_attr_destroy(&attr);
+        if (ret) {
+            pthread_mutex_unlock(&reaper_mutex);
+            drmFree(entry);
+            return NULL;
+        }
+        reaper_running = 1;
+    }
+    entry->next = reaper_entries;
+    reaper_entries = entry;
+    pthread_cond_signal(&reaper_wake);
+    pthread_mutex_unlock(&reaper_mutex);
+
+    return entry;
+}
+
+/**
+ * Stop running a callback.  If it is running at the time, wait for it to
+ * return, unless called from the callback itself.
+ */
+drm_public void drmReaperUnregister(void *handle)
+{
+    drmReaperEntry *entry = handle, **prev;
+
+    if (!entry)
+        return;
+
+    pthread_mutex_lock(&reaper_mutex);
+    for (prev = &reaper_entries; *prev; prev = &(*prev)->next) {
+        if (*prev == entry) {
+            *prev = entry->next;
+            break;
+        }
+    }
+    if (!pthread_equal(pthread_self(), reaper_thread))
+        while (reaper_current == entry)
+            pthread_cond_wait(&reaper_idle, &reaper_mutex);
+    pthread_cond_signal(&reaper_wake);
+    pthread_mutex_unlock(&reaper_mutex);
+
+    drmFree(entry);
+}
+
+/**
+ * Run a callback as soon as possible, e.g. when a cache went over budget.
+ */
+drm_public void drmReaperKick(void *handle)
+{
+    drmReaperEntry *entry = handle;
+
+    if (!entry)
+        return;
+
+    pthread_mutex_lock(&reaper_mutex);
+    if (entry->due_ns) {
+        entry->due_ns = 0;
+        pthread_cond_signal(&reaper_wake);
+    }
+    pthread_mutex_unlock(&reaper_mutex);
+}